@@ -0,0 +1,1242 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "oj.h"
+#include "dump.h"
+#include "parse.h"
+#include "encode.h"
+#include "err.h"
+#include "rails.h"
+#include "stats.h"
+
+// MessagePack and CBOR output and input that follow the same mode rules as
+// Oj.dump() and Oj.load(). Values with the same form in every mode (nil,
+// booleans, Integers, finite Floats, Strings, Symbols, and plain Arrays and
+// Hashes with String or Symbol keys) are written directly. Anything else is
+// dumped as JSON with the mode and options given, read back in strict mode,
+// and the result written so as_json, to_hash, the Code tables, and the Rails
+// optimizations give the same values they would in JSON. Loading runs the
+// mode callbacks just as the JSON parsers do.
+
+#define MAX_DEPTH	1000
+
+typedef enum {
+    MsgPackFmt	= 'm',
+    CborFmt	= 'c',
+} BinFmt;
+
+typedef struct _binDump {
+    struct _out	out;
+    Options	copts;
+    BinFmt	fmt;
+    int		argc;
+    VALUE	*argv;
+    bool	core_ok;  // mode writes core types as JSON would
+    bool	hash_ok;
+    bool	array_ok;
+} *BinDump;
+
+typedef struct _binLevel {
+    int64_t	remaining; // -1 for an indefinite length CBOR container
+    bool	hash;
+    char	*kbuf;     // text of a non-String key, does not move when levels grow
+} *BinLevel;
+
+typedef struct _binLoad {
+    struct _parseInfo	pi;
+    BinFmt		fmt;
+    const uint8_t	*start;
+    const uint8_t	*cur;
+    const uint8_t	*end;
+    BinLevel		levels;
+    size_t		depth;
+    size_t		lcap;
+    bool		done;
+} *BinLoad;
+
+static void	dump_val(BinDump b, VALUE obj, int depth, bool core);
+
+///// dump
+
+inline static void
+put_be(Out out, uint64_t v, int n) {
+    for (n--; 0 <= n; n--) {
+	*out->cur++ = (char)(uint8_t)(v >> (n * 8));
+    }
+}
+
+// Writes a CBOR head or the MessagePack head for a str, array, or map.
+static void
+put_head(BinDump b, int major, uint64_t len) {
+    Out	out = &b->out;
+
+    assure_size(out, 9);
+    if (CborFmt == b->fmt) {
+	uint8_t	m = (uint8_t)(major << 5);
+
+	if (len < 24) {
+	    *out->cur++ = (char)(m | len);
+	} else if (len <= 0xFF) {
+	    *out->cur++ = (char)(m | 24);
+	    put_be(out, len, 1);
+	} else if (len <= 0xFFFF) {
+	    *out->cur++ = (char)(m | 25);
+	    put_be(out, len, 2);
+	} else if (len <= 0xFFFFFFFFULL) {
+	    *out->cur++ = (char)(m | 26);
+	    put_be(out, len, 4);
+	} else {
+	    *out->cur++ = (char)(m | 27);
+	    put_be(out, len, 8);
+	}
+	return;
+    }
+    switch (major) {
+    case 3: // str
+	if (len < 32) {
+	    *out->cur++ = (char)(0xA0 | len);
+	} else if (len <= 0xFF) {
+	    *out->cur++ = (char)0xD9;
+	    put_be(out, len, 1);
+	} else if (len <= 0xFFFF) {
+	    *out->cur++ = (char)0xDA;
+	    put_be(out, len, 2);
+	} else {
+	    *out->cur++ = (char)0xDB;
+	    put_be(out, len, 4);
+	}
+	break;
+    case 4: // array
+	if (len < 16) {
+	    *out->cur++ = (char)(0x90 | len);
+	} else if (len <= 0xFFFF) {
+	    *out->cur++ = (char)0xDC;
+	    put_be(out, len, 2);
+	} else {
+	    *out->cur++ = (char)0xDD;
+	    put_be(out, len, 4);
+	}
+	break;
+    case 5: // map
+    default:
+	if (len < 16) {
+	    *out->cur++ = (char)(0x80 | len);
+	} else if (len <= 0xFFFF) {
+	    *out->cur++ = (char)0xDE;
+	    put_be(out, len, 2);
+	} else {
+	    *out->cur++ = (char)0xDF;
+	    put_be(out, len, 4);
+	}
+	break;
+    }
+}
+
+inline static void
+put_byte(BinDump b, uint8_t c) {
+    assure_size(&b->out, 1);
+    *b->out.cur++ = (char)c;
+}
+
+static void
+put_uint(BinDump b, uint64_t u) {
+    Out	out = &b->out;
+
+    if (CborFmt == b->fmt) {
+	put_head(b, 0, u);
+	return;
+    }
+    assure_size(out, 9);
+    if (u < 0x80) {
+	*out->cur++ = (char)u;
+    } else if (u <= 0xFF) {
+	*out->cur++ = (char)0xCC;
+	put_be(out, u, 1);
+    } else if (u <= 0xFFFF) {
+	*out->cur++ = (char)0xCD;
+	put_be(out, u, 2);
+    } else if (u <= 0xFFFFFFFFULL) {
+	*out->cur++ = (char)0xCE;
+	put_be(out, u, 4);
+    } else {
+	*out->cur++ = (char)0xCF;
+	put_be(out, u, 8);
+    }
+}
+
+// Writes the negative number -mag.
+static void
+put_neg(BinDump b, uint64_t mag) {
+    Out	out = &b->out;
+
+    if (CborFmt == b->fmt) {
+	put_head(b, 1, mag - 1);
+	return;
+    }
+    assure_size(out, 9);
+    if (mag <= 32) {
+	*out->cur++ = (char)(uint8_t)(0x100 - mag);
+    } else if (mag <= 0x80) {
+	*out->cur++ = (char)0xD0;
+	put_be(out, (uint64_t)(0 - mag), 1);
+    } else if (mag <= 0x8000) {
+	*out->cur++ = (char)0xD1;
+	put_be(out, (uint64_t)(0 - mag), 2);
+    } else if (mag <= 0x80000000ULL) {
+	*out->cur++ = (char)0xD2;
+	put_be(out, (uint64_t)(0 - mag), 4);
+    } else {
+	*out->cur++ = (char)0xD3;
+	put_be(out, (uint64_t)(0 - mag), 8);
+    }
+}
+
+// Floats that a float32 holds exactly are written as one.
+static void
+put_float(BinDump b, double d) {
+    Out		out = &b->out;
+    float	f = (float)d;
+
+    assure_size(out, 9);
+    if ((double)f == d || isnan(d)) {
+	uint32_t	bits;
+
+	memcpy(&bits, &f, sizeof(bits));
+	*out->cur++ = (char)((CborFmt == b->fmt) ? 0xFA : 0xCA);
+	put_be(out, bits, 4);
+    } else {
+	uint64_t	bits;
+
+	memcpy(&bits, &d, sizeof(bits));
+	*out->cur++ = (char)((CborFmt == b->fmt) ? 0xFB : 0xCB);
+	put_be(out, bits, 8);
+    }
+}
+
+static void
+put_str(BinDump b, const char *str, size_t len) {
+    put_head(b, 3, len);
+    assure_size(&b->out, len);
+    memcpy(b->out.cur, str, len);
+    b->out.cur += len;
+}
+
+static void
+put_rstr(BinDump b, VALUE rstr) {
+    rb_encoding	*enc = rb_enc_get(rstr);
+
+    if (rb_utf8_encoding() != enc && rb_usascii_encoding() != enc && rb_ascii8bit_encoding() != enc) {
+	rstr = rb_str_conv_enc(rstr, enc, rb_utf8_encoding());
+    }
+    put_str(b, RSTRING_PTR(rstr), RSTRING_LEN(rstr));
+}
+
+static bool
+int_in_range(BinDump b, int64_t n) {
+    return (0 == b->copts->int_range_max && 0 == b->copts->int_range_min) ||
+	(b->copts->int_range_min <= n && n <= b->copts->int_range_max);
+}
+
+// Integers too large for 64 bits are bignums in CBOR and decimal Strings in
+// MessagePack which has no larger type.
+static void
+put_bignum(BinDump b, VALUE obj) {
+    uint64_t		u;
+    int			sign = rb_integer_pack(obj, &u, 1, sizeof(u), 0, INTEGER_PACK_LSWORD_FIRST | INTEGER_PACK_NATIVE_BYTE_ORDER);
+    volatile VALUE	v;
+    size_t		size;
+
+    switch (sign) {
+    case 0:
+	put_uint(b, 0);
+	return;
+    case 1:
+	put_uint(b, u);
+	return;
+    case -1:
+	if (CborFmt == b->fmt || u <= 0x8000000000000000ULL) {
+	    put_neg(b, u);
+	    return;
+	}
+	break;
+    default:
+	break;
+    }
+    if (MsgPackFmt == b->fmt) {
+	v = rb_big2str(obj, 10);
+	put_str(b, RSTRING_PTR(v), RSTRING_LEN(v));
+	return;
+    }
+    if (0 < sign) {
+	v = obj;
+	put_head(b, 6, 2);
+    } else {
+	// A CBOR negative bignum holds -1 - n.
+	v = rb_funcall(rb_funcall(obj, rb_intern("-@"), 0), rb_intern("-"), 1, INT2FIX(1));
+	put_head(b, 6, 3);
+    }
+    size = rb_absint_size(v, NULL);
+    put_head(b, 2, size);
+    assure_size(&b->out, size);
+    rb_integer_pack(v, b->out.cur, size, 1, 0, INTEGER_PACK_BIG_ENDIAN);
+    b->out.cur += size;
+}
+
+typedef struct _hashCheck {
+    BinDump	b;
+    long	cnt;
+    bool	ok;
+} *HashCheck;
+
+static int
+hash_check_cb(VALUE key, VALUE value, VALUE x) {
+    HashCheck	hc = (HashCheck)x;
+
+    switch (rb_type(key)) {
+    case T_STRING:
+	if (WabMode == hc->b->copts->mode) {
+	    hc->ok = false;
+	    return ST_STOP;
+	}
+	break;
+    case T_SYMBOL:
+	break;
+    default:
+	hc->ok = false;
+	return ST_STOP;
+    }
+    if (Qnil != value || !hc->b->copts->dump_opts.omit_nil) {
+	hc->cnt++;
+    }
+    return ST_CONTINUE;
+}
+
+typedef struct _hashDump {
+    BinDump	b;
+    int		depth;
+    bool	core;
+} *HashDump;
+
+static int
+hash_dump_cb(VALUE key, VALUE value, VALUE x) {
+    HashDump	hd = (HashDump)x;
+
+    if (Qnil == value && hd->b->copts->dump_opts.omit_nil) {
+	return ST_CONTINUE;
+    }
+    if (T_SYMBOL == rb_type(key)) {
+	key = rb_sym2str(key);
+    }
+    put_rstr(hd->b, key);
+    dump_val(hd->b, value, hd->depth, hd->core);
+
+    return ST_CONTINUE;
+}
+
+// Returns the value the mode gives obj in JSON as loaded in strict mode.
+static VALUE
+json_value(BinDump b, VALUE obj) {
+    char		buf[4096];
+    struct _out		out;
+    struct _parseInfo	pi;
+    volatile VALUE	json;
+    VALUE		args[1];
+
+    out.buf = buf;
+    out.end = buf + sizeof(buf) - 10;
+    out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
+    out.omit_nil = b->copts->dump_opts.omit_nil;
+    out.caller = CALLER_DUMP;
+    json = oj_dump_to_str(obj, b->copts, &out, b->argc, b->argv);
+
+    parse_info_init(&pi);
+    pi.options = oj_default_options;
+    pi.options.mode = StrictMode;
+    pi.options.allow_nan = Yes;
+    pi.options.nilnil = Yes;
+    pi.options.empty_string = Yes;
+    pi.options.quirks_mode = Yes;
+    pi.options.sym_key = No;
+    pi.options.bigdec_load = FloatDec;
+    pi.options.hash_class = Qnil;
+    pi.options.array_class = Qnil;
+    pi.options.only = Qnil;
+    pi.options.raw = Qnil;
+    pi.options.release_gvl = 0;
+    pi.handler = Qnil;
+    pi.err_class = Qnil;
+    oj_set_strict_bulk_callbacks(&pi);
+    *args = json;
+
+    return oj_pi_parse(1, args, &pi, 0, 0, 0);
+}
+
+// Writes obj. When core is true obj is the result of json_value() and is
+// written as is.
+static void
+dump_val(BinDump b, VALUE obj, int depth, bool core) {
+    if (MAX_DEPTH < depth) {
+	rb_raise(rb_eNoMemError, "Too deeply nested.\n");
+    }
+    switch (rb_type(obj)) {
+    case T_NIL:
+	put_byte(b, (CborFmt == b->fmt) ? 0xF6 : 0xC0);
+	return;
+    case T_TRUE:
+	put_byte(b, (CborFmt == b->fmt) ? 0xF5 : 0xC3);
+	return;
+    case T_FALSE:
+	put_byte(b, (CborFmt == b->fmt) ? 0xF4 : 0xC2);
+	return;
+    case T_FIXNUM:
+	if (core || (b->core_ok && int_in_range(b, NUM2LL(obj)))) {
+	    int64_t	n = NUM2LL(obj);
+
+	    if (0 <= n) {
+		put_uint(b, (uint64_t)n);
+	    } else {
+		put_neg(b, (uint64_t)0 - (uint64_t)n);
+	    }
+	    return;
+	}
+	break;
+    case T_BIGNUM:
+	if (core || (b->core_ok && 0 == b->copts->int_range_max && 0 == b->copts->int_range_min)) {
+	    put_bignum(b, obj);
+	    return;
+	}
+	break;
+    case T_FLOAT:
+	if (core || (b->core_ok && isfinite(rb_num2dbl(obj)))) {
+	    put_float(b, rb_num2dbl(obj));
+	    return;
+	}
+	break;
+    case T_STRING:
+	if (core || (b->core_ok && rb_cString == rb_obj_class(obj))) {
+	    put_rstr(b, obj);
+	    return;
+	}
+	break;
+    case T_SYMBOL:
+	if (core || b->core_ok) {
+	    put_rstr(b, rb_sym2str(obj));
+	    return;
+	}
+	break;
+    case T_ARRAY:
+	if (core || (b->array_ok && rb_cArray == rb_obj_class(obj))) {
+	    long	cnt = RARRAY_LEN(obj);
+	    long	i;
+
+	    put_head(b, 4, cnt);
+	    for (i = 0; i < cnt; i++) {
+		dump_val(b, RARRAY_AREF(obj, i), depth + 1, core);
+	    }
+	    return;
+	}
+	break;
+    case T_HASH:
+	if (core || (b->hash_ok && rb_cHash == rb_obj_class(obj))) {
+	    struct _hashCheck	hc = { b, 0, true };
+
+	    rb_hash_foreach(obj, hash_check_cb, (VALUE)&hc);
+	    if (hc.ok) {
+		struct _hashDump	hd = { b, depth + 1, core };
+
+		put_head(b, 5, hc.cnt);
+		rb_hash_foreach(obj, hash_dump_cb, (VALUE)&hd);
+		return;
+	    }
+	}
+	break;
+    default:
+	break;
+    }
+    if (core) {
+	rb_raise(rb_eTypeError, "Failed to dump %s Object to %s.", rb_class2name(rb_obj_class(obj)),
+		 (CborFmt == b->fmt) ? "CBOR" : "MessagePack");
+    }
+    dump_val(b, json_value(b, obj), depth, true);
+}
+
+static VALUE
+bin_dump(int argc, VALUE *argv, BinFmt fmt) {
+    struct _binDump	b;
+    struct _options	copts;
+    volatile VALUE	rstr;
+    VALUE		args[2];
+
+    if (1 > argc) {
+	rb_raise(rb_eArgError, "wrong number of arguments (0 for 1).");
+    }
+    if (2 == argc && oj_options_class == rb_obj_class(argv[1])) {
+	copts = *oj_options_dump(argv[1], args + 1);
+	args[0] = *argv;
+	argv = args;
+    } else {
+	oj_dump_options((2 == argc) ? argv[1] : Qnil, &copts);
+    }
+    b.copts = &copts;
+    b.fmt = fmt;
+    b.argc = argc - 1;
+    b.argv = argv + 1;
+    b.core_ok = (ObjectMode != copts.mode && !(CompatMode == copts.mode && Yes == copts.to_json));
+    b.hash_ok = b.core_ok && (RailsMode != copts.mode || oj_rails_hash_opt);
+    b.array_ok = b.core_ok && (RailsMode != copts.mode || oj_rails_array_opt);
+
+    // The output is written directly into the String which is grown as
+    // needed so nothing is left to free if a dump raises.
+    rstr = rb_str_buf_new(4096);
+    b.out.str = rstr;
+    b.out.buf = RSTRING_PTR(rstr);
+    b.out.end = b.out.buf + rb_str_capacity(rstr) - BUFFER_EXTRA;
+    b.out.cur = b.out.buf;
+    b.out.allocated = false;
+    b.out.flush = NULL;
+    dump_val(&b, *argv, 0, false);
+    rb_str_set_len(rstr, b.out.cur - b.out.buf);
+    oj_stats.dumps++;
+    oj_stats.bytes_dumped += b.out.cur - b.out.buf;
+
+    return rstr;
+}
+
+VALUE
+oj_msgpack_dump(int argc, VALUE *argv, VALUE self) {
+    return bin_dump(argc, argv, MsgPackFmt);
+}
+
+VALUE
+oj_cbor_dump(int argc, VALUE *argv, VALUE self) {
+    return bin_dump(argc, argv, CborFmt);
+}
+
+///// load
+
+static void
+load_error(BinLoad bl, const char *msg) {
+    if (!err_has(&bl->pi.err)) {
+	oj_err_set(&bl->pi.err, oj_parse_error_class, "%s at offset %ld", msg, (long)(bl->cur - bl->start));
+    }
+}
+
+static bool
+take(BinLoad bl, size_t n, uint64_t *vp) {
+    uint64_t	v = 0;
+
+    if ((size_t)(bl->end - bl->cur) < n) {
+	load_error(bl, "unexpected end of input");
+	return false;
+    }
+    for (; 0 < n; n--) {
+	v = (v << 8) | *bl->cur++;
+    }
+    *vp = v;
+
+    return true;
+}
+
+static const char*
+take_bytes(BinLoad bl, uint64_t len) {
+    const char	*s = (const char*)bl->cur;
+
+    if ((uint64_t)(bl->end - bl->cur) < len) {
+	load_error(bl, "unexpected end of input");
+	return NULL;
+    }
+    bl->cur += len;
+
+    return s;
+}
+
+static void
+add_value(BinLoad bl, VALUE rval) {
+    ParseInfo	pi = &bl->pi;
+    Val		parent = stack_peek(&pi->stack);
+
+    if (0 == parent) {
+	pi->add_value(pi, rval);
+    } else if (NEXT_HASH_VALUE == parent->next) {
+	pi->hash_set_value(pi, parent, rval);
+	parent->next = NEXT_HASH_COMMA;
+    } else {
+	pi->array_append_value(pi, rval);
+	parent->next = NEXT_ARRAY_COMMA;
+    }
+}
+
+static void
+add_cstr(BinLoad bl, const char *str, size_t len) {
+    ParseInfo	pi = &bl->pi;
+    Val		parent = stack_peek(&pi->stack);
+
+    if (0 == parent) {
+	pi->add_cstr(pi, str, len, str);
+    } else if (NEXT_HASH_VALUE == parent->next) {
+	pi->hash_set_cstr(pi, parent, str, len, str);
+	parent->next = NEXT_HASH_COMMA;
+    } else {
+	pi->array_append_cstr(pi, str, len, str);
+	parent->next = NEXT_ARRAY_COMMA;
+    }
+}
+
+static void
+add_uint(BinLoad bl, uint64_t u, bool neg) {
+    char	buf[32];
+
+    if (neg) {
+	// The CBOR value is -1 - u.
+	if (UINT64_MAX == u) {
+	    strcpy(buf, "-18446744073709551616");
+	} else {
+	    snprintf(buf, sizeof(buf), "-%llu", (unsigned long long)(u + 1));
+	}
+    } else {
+	snprintf(buf, sizeof(buf), "%llu", (unsigned long long)u);
+    }
+    oj_pi_add_num_str(&bl->pi, buf);
+}
+
+static void
+add_int(BinLoad bl, int64_t i) {
+    char	buf[32];
+
+    snprintf(buf, sizeof(buf), "%lld", (long long)i);
+    oj_pi_add_num_str(&bl->pi, buf);
+}
+
+static void
+add_float(BinLoad bl, double d) {
+    char	buf[40];
+
+    if (isnan(d) || isinf(d)) {
+	if (No == bl->pi.options.allow_nan) {
+	    load_error(bl, "not a number or other value");
+	    return;
+	}
+	strcpy(buf, isnan(d) ? "NaN" : ((d < 0.0) ? "-Infinity" : "Infinity"));
+    } else {
+	oj_dump_float_shortest(d, buf);
+    }
+    oj_pi_add_num_str(&bl->pi, buf);
+}
+
+static void
+value_done(BinLoad bl) {
+    if (0 == bl->depth) {
+	bl->done = true;
+    } else if (0 < bl->levels[bl->depth - 1].remaining) {
+	bl->levels[bl->depth - 1].remaining--;
+    }
+}
+
+static void
+open_container(BinLoad bl, bool hash, int64_t cnt) {
+    ParseInfo		pi = &bl->pi;
+    volatile VALUE	v;
+    BinLevel		lv;
+
+    if (bl->lcap <= bl->depth) {
+	size_t	old = bl->lcap;
+
+	bl->lcap = (0 == bl->lcap) ? 16 : bl->lcap * 2;
+	REALLOC_N(bl->levels, struct _binLevel, bl->lcap);
+	memset(bl->levels + old, 0, sizeof(struct _binLevel) * (bl->lcap - old));
+    }
+    lv = bl->levels + bl->depth++;
+    if (NULL == lv->kbuf) {
+	lv->kbuf = ALLOC_N(char, 40);
+    }
+    lv->remaining = cnt;
+    lv->hash = hash;
+    if (hash) {
+	v = pi->start_hash(pi);
+	if (!stack_push(&pi->stack, v, NEXT_HASH_NEW)) {
+	    oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	}
+    } else {
+	v = pi->start_array(pi);
+	if (!stack_push(&pi->stack, v, NEXT_ARRAY_NEW)) {
+	    oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	}
+    }
+}
+
+static void
+close_container(BinLoad bl) {
+    ParseInfo	pi = &bl->pi;
+
+    if (bl->levels[--bl->depth].hash) {
+	Val	hash = stack_peek(&pi->stack);
+
+	pi->end_hash(pi);
+	stack_pop(&pi->stack);
+	add_value(bl, hash->val);
+    } else {
+	Val	array = stack_pop(&pi->stack);
+
+	pi->end_array(pi);
+	add_value(bl, array->val);
+    }
+    value_done(bl);
+}
+
+static void
+set_key(BinLoad bl, const char *key, size_t klen) {
+    ParseInfo	pi = &bl->pi;
+    Val		parent = stack_peek(&pi->stack);
+
+    if (Qundef == (parent->key_val = pi->hash_key(pi, key, klen))) {
+	parent->key = key;
+	parent->klen = klen;
+    } else {
+	parent->key = "";
+	parent->klen = 0;
+    }
+    parent->k1 = (0 < klen) ? *key : '\0';
+    parent->next = NEXT_HASH_VALUE;
+}
+
+// Reads one item and gives it to the callbacks or, when key is true, sets it
+// as the key of the Hash being read. Keys must be strings or scalars and the
+// text of a scalar key is used. A container is only opened, its members are
+// read by the caller.
+static void
+read_msgpack(BinLoad bl, bool key) {
+    uint8_t	c;
+    uint64_t	v = 0;
+    const char	*s;
+    double	d;
+    char	*kbuf = key ? bl->levels[bl->depth - 1].kbuf : NULL;
+
+    if (bl->end <= bl->cur) {
+	load_error(bl, "unexpected end of input");
+	return;
+    }
+    c = *bl->cur++;
+    if (c <= 0x7F) {
+	v = c;
+	goto UINT;
+    }
+    if (0xE0 <= c) {
+	if (key) {
+	    snprintf(kbuf, 40, "%d", (int)(int8_t)c);
+	    set_key(bl, kbuf, strlen(kbuf));
+	} else {
+	    add_int(bl, (int8_t)c);
+	    value_done(bl);
+	}
+	return;
+    }
+    if (0xA0 <= c && c <= 0xBF) {
+	v = c & 0x1F;
+	goto STR;
+    }
+    if (0x90 <= c && c <= 0x9F) {
+	v = c & 0x0F;
+	goto ARRAY;
+    }
+    if (0x80 <= c && c <= 0x8F) {
+	v = c & 0x0F;
+	goto MAP;
+    }
+    switch (c) {
+    case 0xC0:
+	s = "null";
+	goto WORD;
+    case 0xC2:
+	s = "false";
+	goto WORD;
+    case 0xC3:
+	s = "true";
+	goto WORD;
+    case 0xC4:
+    case 0xD9:
+	if (!take(bl, 1, &v)) {
+	    return;
+	}
+	goto STR;
+    case 0xC5:
+    case 0xDA:
+	if (!take(bl, 2, &v)) {
+	    return;
+	}
+	goto STR;
+    case 0xC6:
+    case 0xDB:
+	if (!take(bl, 4, &v)) {
+	    return;
+	}
+	goto STR;
+    case 0xCA: {
+	float	f;
+	uint32_t	bits;
+
+	if (!take(bl, 4, &v)) {
+	    return;
+	}
+	bits = (uint32_t)v;
+	memcpy(&f, &bits, sizeof(f));
+	d = f;
+	goto FLOAT;
+    }
+    case 0xCB:
+	if (!take(bl, 8, &v)) {
+	    return;
+	}
+	memcpy(&d, &v, sizeof(d));
+	goto FLOAT;
+    case 0xCC:
+    case 0xCD:
+    case 0xCE:
+    case 0xCF:
+	if (!take(bl, (size_t)1 << (c - 0xCC), &v)) {
+	    return;
+	}
+	goto UINT;
+    case 0xD0:
+    case 0xD1:
+    case 0xD2:
+    case 0xD3: {
+	size_t	n = (size_t)1 << (c - 0xD0);
+	int64_t	i;
+
+	if (!take(bl, n, &v)) {
+	    return;
+	}
+	// sign extend
+	i = (8 == n) ? (int64_t)v : (int64_t)(v << (64 - n * 8)) >> (64 - n * 8);
+	if (key) {
+	    snprintf(kbuf, 40, "%lld", (long long)i);
+	    set_key(bl, kbuf, strlen(kbuf));
+	} else {
+	    add_int(bl, i);
+	    value_done(bl);
+	}
+	return;
+    }
+    case 0xDC:
+	if (!take(bl, 2, &v)) {
+	    return;
+	}
+	goto ARRAY;
+    case 0xDD:
+	if (!take(bl, 4, &v)) {
+	    return;
+	}
+	goto ARRAY;
+    case 0xDE:
+	if (!take(bl, 2, &v)) {
+	    return;
+	}
+	goto MAP;
+    case 0xDF:
+	if (!take(bl, 4, &v)) {
+	    return;
+	}
+	goto MAP;
+    default:
+	load_error(bl, "unsupported MessagePack type");
+	return;
+    }
+UINT:
+    if (key) {
+	snprintf(kbuf, 40, "%llu", (unsigned long long)v);
+	set_key(bl, kbuf, strlen(kbuf));
+    } else {
+	add_uint(bl, v, false);
+	value_done(bl);
+    }
+    return;
+FLOAT:
+    if (key) {
+	oj_dump_float_shortest(d, kbuf);
+	set_key(bl, kbuf, strlen(kbuf));
+    } else {
+	add_float(bl, d);
+	value_done(bl);
+    }
+    return;
+STR:
+    if (NULL == (s = take_bytes(bl, v))) {
+	return;
+    }
+    if (key) {
+	set_key(bl, s, (size_t)v);
+    } else {
+	add_cstr(bl, s, (size_t)v);
+	value_done(bl);
+    }
+    return;
+WORD:
+    if (key) {
+	set_key(bl, s, strlen(s));
+    } else {
+	add_value(bl, ('n' == *s) ? Qnil : (('t' == *s) ? Qtrue : Qfalse));
+	value_done(bl);
+    }
+    return;
+ARRAY:
+MAP:
+    if (key) {
+	load_error(bl, "map keys must be strings or scalars");
+	return;
+    }
+    if ((uint64_t)(bl->end - bl->cur) < v) {
+	load_error(bl, "container length longer than the input");
+	return;
+    }
+    open_container(bl, (0x80 <= c && c <= 0x8F) || 0xDE == c || 0xDF == c, (int64_t)v);
+}
+
+static void
+read_cbor(BinLoad bl, bool key) {
+    uint8_t	c;
+    int		major;
+    int		info;
+    uint64_t	v = 0;
+    const char	*s;
+    double	d;
+    char	*kbuf = key ? bl->levels[bl->depth - 1].kbuf : NULL;
+
+TAGGED:
+    if (bl->end <= bl->cur) {
+	load_error(bl, "unexpected end of input");
+	return;
+    }
+    c = *bl->cur++;
+    major = c >> 5;
+    info = c & 0x1F;
+    if (info < 24) {
+	v = info;
+    } else if (info <= 27) {
+	if (!take(bl, (size_t)1 << (info - 24), &v)) {
+	    return;
+	}
+    } else if (31 != info || major < 2 || 5 < major) {
+	load_error(bl, "invalid CBOR item");
+	return;
+    }
+    switch (major) {
+    case 0:
+    case 1:
+	if (key) {
+	    if (1 == major) {
+		if (UINT64_MAX == v) {
+		    strcpy(kbuf, "-18446744073709551616");
+		} else {
+		    snprintf(kbuf, 40, "-%llu", (unsigned long long)(v + 1));
+		}
+	    } else {
+		snprintf(kbuf, 40, "%llu", (unsigned long long)v);
+	    }
+	    set_key(bl, kbuf, strlen(kbuf));
+	} else {
+	    add_uint(bl, v, 1 == major);
+	    value_done(bl);
+	}
+	return;
+    case 2:
+    case 3:
+	if (31 == info) {
+	    load_error(bl, "indefinite length strings are not supported");
+	    return;
+	}
+	if (NULL == (s = take_bytes(bl, v))) {
+	    return;
+	}
+	if (key) {
+	    set_key(bl, s, (size_t)v);
+	} else {
+	    add_cstr(bl, s, (size_t)v);
+	    value_done(bl);
+	}
+	return;
+    case 4:
+    case 5:
+	if (key) {
+	    load_error(bl, "map keys must be strings or scalars");
+	    return;
+	}
+	if (31 != info && (uint64_t)(bl->end - bl->cur) < v) {
+	    load_error(bl, "container length longer than the input");
+	    return;
+	}
+	open_container(bl, 5 == major, (31 == info) ? -1 : (int64_t)v);
+	return;
+    case 6:
+	if ((2 == v || 3 == v) && bl->cur < bl->end && 0x40 == (*bl->cur & 0xE0)) {
+	    // bignum
+	    volatile VALUE	num;
+	    uint64_t		len;
+
+	    c = *bl->cur++;
+	    if (24 > (c & 0x1F)) {
+		len = c & 0x1F;
+	    } else if (27 < (c & 0x1F) || !take(bl, (size_t)1 << ((c & 0x1F) - 24), &len)) {
+		load_error(bl, "invalid CBOR bignum");
+		return;
+	    }
+	    if (NULL == (s = take_bytes(bl, len))) {
+		return;
+	    }
+	    num = rb_integer_unpack(s, (size_t)len, 1, 0, INTEGER_PACK_BIG_ENDIAN);
+	    if (3 == v) {
+		num = rb_funcall(rb_funcall(num, rb_intern("+"), 1, INT2FIX(1)), rb_intern("-@"), 0);
+	    }
+	    if (key) {
+		load_error(bl, "map keys must be strings or scalars");
+		return;
+	    }
+	    add_value(bl, num);
+	    value_done(bl);
+	    return;
+	}
+	// The self-described CBOR tag only marks the data as CBOR. Other tags
+	// change the meaning of the item so loading it untagged would be wrong.
+	if (55799 == v) {
+	    goto TAGGED;
+	}
+	if (2 == v || 3 == v) {
+	    load_error(bl, "invalid CBOR bignum");
+	} else {
+	    load_error(bl, "unsupported CBOR tag");
+	}
+	return;
+    case 7:
+    default:
+	switch (info) {
+	case 20:
+	    s = "false";
+	    break;
+	case 21:
+	    s = "true";
+	    break;
+	case 22:
+	case 23:
+	    s = "null";
+	    break;
+	case 25: {
+	    // half float
+	    int	e = (int)((v >> 10) & 0x1F);
+	    int	m = (int)(v & 0x3FF);
+
+	    if (0 == e) {
+		d = ldexp(m, -24);
+	    } else if (31 == e) {
+		d = (0 == m) ? INFINITY : NAN;
+	    } else {
+		d = ldexp(m + 1024, e - 25);
+	    }
+	    if (v & 0x8000) {
+		d = -d;
+	    }
+	    goto FLOAT;
+	}
+	case 26: {
+	    float	f;
+	    uint32_t	bits = (uint32_t)v;
+
+	    memcpy(&f, &bits, sizeof(f));
+	    d = f;
+	    goto FLOAT;
+	}
+	case 27:
+	    memcpy(&d, &v, sizeof(d));
+	    goto FLOAT;
+	default:
+	    load_error(bl, "unsupported CBOR simple value");
+	    return;
+	}
+	if (key) {
+	    set_key(bl, s, strlen(s));
+	} else {
+	    add_value(bl, ('n' == *s) ? Qnil : (('t' == *s) ? Qtrue : Qfalse));
+	    value_done(bl);
+	}
+	return;
+    }
+FLOAT:
+    if (key) {
+	if (isnan(d) || isinf(d)) {
+	    strcpy(kbuf, isnan(d) ? "NaN" : ((d < 0.0) ? "-Infinity" : "Infinity"));
+	} else {
+	    oj_dump_float_shortest(d, kbuf);
+	}
+	set_key(bl, kbuf, strlen(kbuf));
+    } else {
+	add_float(bl, d);
+	value_done(bl);
+    }
+}
+
+static VALUE
+protect_load(VALUE x) {
+    BinLoad	bl = (BinLoad)x;
+    ParseInfo	pi = &bl->pi;
+
+    while (!bl->done && !err_has(&pi->err)) {
+	if (0 < bl->depth) {
+	    BinLevel	lv = bl->levels + bl->depth - 1;
+	    Val		parent = stack_peek(&pi->stack);
+
+	    if (0 == lv->remaining) {
+		close_container(bl);
+		continue;
+	    }
+	    if (0 > lv->remaining && bl->cur < bl->end && 0xFF == *bl->cur) {
+		if (lv->hash && NEXT_HASH_VALUE == parent->next) {
+		    load_error(bl, "map ended before a value");
+		    break;
+		}
+		bl->cur++;
+		close_container(bl);
+		continue;
+	    }
+	    if (lv->hash && NEXT_HASH_VALUE != parent->next) {
+		if (CborFmt == bl->fmt) {
+		    read_cbor(bl, true);
+		} else {
+		    read_msgpack(bl, true);
+		}
+		continue;
+	    }
+	    if (!lv->hash) {
+		// as if a comma was read
+		parent->next = NEXT_ARRAY_ELEMENT;
+	    }
+	}
+	if (CborFmt == bl->fmt) {
+	    read_cbor(bl, false);
+	} else {
+	    read_msgpack(bl, false);
+	}
+    }
+    if (!err_has(&pi->err) && bl->cur < bl->end) {
+	load_error(bl, "unexpected data after the document");
+    }
+    return Qnil;
+}
+
+static void
+set_callbacks(ParseInfo pi) {
+    switch (pi->options.mode) {
+    case StrictMode:
+    case NullMode:
+	oj_set_strict_bulk_callbacks(pi);
+	break;
+    case CustomMode:
+	oj_set_custom_callbacks(pi);
+	break;
+    case CompatMode:
+    case RailsMode:
+	oj_set_compat_callbacks(pi);
+	break;
+    case WabMode:
+	oj_set_wab_callbacks(pi);
+	break;
+    case ObjectMode:
+    default:
+	oj_set_object_callbacks(pi);
+	break;
+    }
+}
+
+static VALUE
+bin_load(int argc, VALUE *argv, BinFmt fmt) {
+    struct _binLoad	bl;
+    ParseInfo		pi = &bl.pi;
+    volatile VALUE	input;
+    volatile VALUE	wrapped_stack;
+    volatile VALUE	result;
+    int			line = 0;
+
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to load.");
+    }
+    input = *argv;
+    if (T_STRING != rb_type(input)) {
+	if (rb_respond_to(input, oj_read_id)) {
+	    input = rb_funcall2(input, oj_read_id, 0, 0);
+	}
+	Check_Type(input, T_STRING);
+    }
+    parse_info_init(pi);
+    pi->options = oj_default_options;
+    pi->handler = Qnil;
+    pi->err_class = Qnil;
+    pi->proc = Qundef;
+    pi->max_depth = 0;
+    if (2 == argc && oj_options_class == rb_obj_class(argv[1])) {
+	pi->options = *oj_options_load(argv[1]);
+	set_callbacks(pi);
+    } else {
+	VALUE	ropts = (2 == argc) ? argv[1] : Qnil;
+
+	if (Qnil != ropts) {
+	    Check_Type(ropts, T_HASH);
+	}
+	oj_set_mode_callbacks(pi, ropts);
+	if (Qnil != ropts) {
+	    oj_parse_options(ropts, &pi->options);
+	}
+    }
+    // The :only filter works on JSON text and is not used here.
+    pi->options.only = Qnil;
+    pi->options.raw = Qnil;
+    memset(((char*)&bl) + sizeof(bl.pi), 0, sizeof(bl) - sizeof(bl.pi));
+    bl.fmt = fmt;
+    bl.start = (const uint8_t*)RSTRING_PTR(input);
+    bl.cur = bl.start;
+    bl.end = bl.start + RSTRING_LEN(input);
+    pi->json = (const char*)bl.start;
+    pi->cur = pi->json;
+    pi->end = (const char*)bl.end;
+    err_init(&pi->err);
+    if (Yes == pi->options.circular) {
+	pi->circ_array = oj_circ_array_new();
+    }
+    wrapped_stack = oj_stack_init(&pi->stack);
+    rb_protect(protect_load, (VALUE)&bl, &line);
+    result = stack_head_val(&pi->stack);
+    DATA_PTR(wrapped_stack) = 0;
+    oj_stats.loads++;
+    oj_stats.bytes_parsed += RSTRING_LEN(input);
+    if (0 != pi->circ_array) {
+	oj_circ_array_free(pi->circ_array);
+    }
+    for (size_t i = 0; i < bl.lcap; i++) {
+	xfree(bl.levels[i].kbuf);
+    }
+    xfree(bl.levels);
+    stack_cleanup(&pi->stack);
+    if (pi->str_rx.head != oj_default_options.str_rx.head) {
+	oj_rxclass_cleanup(&pi->str_rx);
+    }
+    if (0 != line) {
+	rb_jump_tag(line);
+    }
+    if (err_has(&pi->err)) {
+	oj_err_raise(&pi->err);
+    }
+    RB_GC_GUARD(input);
+
+    return result;
+}
+
+VALUE
+oj_msgpack_load(int argc, VALUE *argv, VALUE self) {
+    return bin_load(argc, argv, MsgPackFmt);
+}
+
+VALUE
+oj_cbor_load(int argc, VALUE *argv, VALUE self) {
+    return bin_load(argc, argv, CborFmt);
+}
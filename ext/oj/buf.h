@@ -3,12 +3,18 @@
 #ifndef OJ_BUF_H
 #define OJ_BUF_H
 
+#include <stdbool.h>
+
 #include "ruby.h"
 
+// The buffer does not use the Ruby allocators as it is used by the tape
+// recorder which runs without the GVL.
+
 typedef struct _buf {
     char	*head;
     char	*end;
     char	*tail;
+    bool	no_mem;	// set if growing failed, appends are then dropped
     char	base[1024];
 } *Buf;
 
@@ -17,12 +23,13 @@ buf_init(Buf buf) {
     buf->head = buf->base;
     buf->end = buf->base + sizeof(buf->base) - 1;
     buf->tail = buf->head;
+    buf->no_mem = false;
 }
 
 inline static void
 buf_cleanup(Buf buf) {
     if (buf->base != buf->head) {
-        xfree(buf->head);
+        free(buf->head);
     }
 }
 
@@ -31,21 +38,36 @@ buf_len(Buf buf) {
     return buf->tail - buf->head;
 }
 
-inline static void
-buf_append_string(Buf buf, const char *s, size_t slen) {
-    if (buf->end <= buf->tail + slen) {
-	size_t	len = buf->end - buf->head;
-	size_t	toff = buf->tail - buf->head;
-	size_t	new_len = len + slen + len / 2;
+// Makes room for slen more bytes. On failure the current contents are kept,
+// no_mem is set, and false is returned.
+inline static bool
+buf_grow(Buf buf, size_t slen) {
+    size_t	len = buf->end - buf->head;
+    size_t	toff = buf->tail - buf->head;
+    size_t	new_len = len + slen + len / 2;
+    char	*h;
 
-	if (buf->base == buf->head) {
-	    buf->head = ALLOC_N(char, new_len);
-	    memcpy(buf->head, buf->base, len);
-	} else {
-	    REALLOC_N(buf->head, char, new_len);
+    if (buf->base == buf->head) {
+	if (NULL == (h = malloc(new_len))) {
+	    buf->no_mem = true;
+	    return false;
 	}
-	buf->tail = buf->head + toff;
-	buf->end = buf->head + new_len - 1;
+	memcpy(h, buf->base, len);
+    } else if (NULL == (h = realloc(buf->head, new_len))) {
+	buf->no_mem = true;
+	return false;
+    }
+    buf->head = h;
+    buf->tail = buf->head + toff;
+    buf->end = buf->head + new_len - 1;
+
+    return true;
+}
+
+inline static void
+buf_append_string(Buf buf, const char *s, size_t slen) {
+    if (buf->end <= buf->tail + slen && !buf_grow(buf, slen)) {
+	return;
     }
     memcpy(buf->tail, s, slen);
     buf->tail += slen;
@@ -53,19 +75,8 @@ buf_append_string(Buf buf, const char *s, size_t slen) {
 
 inline static void
 buf_append(Buf buf, char c) {
-    if (buf->end <= buf->tail) {
-	size_t	len = buf->end - buf->head;
-	size_t	toff = buf->tail - buf->head;
-	size_t	new_len = len + len / 2;
-
-	if (buf->base == buf->head) {
-	    buf->head = ALLOC_N(char, new_len);
-	    memcpy(buf->head, buf->base, len);
-	} else {
-	    REALLOC_N(buf->head, char, new_len);
-	}
-	buf->tail = buf->head + toff;
-	buf->end = buf->head + new_len - 1;
+    if (buf->end <= buf->tail && !buf_grow(buf, 1)) {
+	return;
     }
     *buf->tail = c;
     buf->tail++;
@@ -1,7 +1,11 @@
 // Copyright (c) 2017 Peter Ohler. All rights reserved.
 
+#include <stdint.h>
+#include <string.h>
+
 #include "code.h"
 #include "dump.h"
+#include "local.h"
 
 inline static VALUE
 resolve_classname(VALUE mod, const char *classname) {
@@ -45,45 +49,71 @@ path2class(const char *name) {
     return resolve_classname(clas, class_name);
 }
 
-bool
-oj_code_dump(Code codes, VALUE obj, int depth, Out out) {
-    VALUE	clas = rb_obj_class(obj);
-    Code	c = codes;
+// Lookups go through a small direct mapped cache keyed by the table and the
+// class. Misses, including classes with no entry, are remembered so each
+// class pays for a table scan only once per generation. The cache is kept
+// per Ractor while the generation is only changed from the main Ractor.
+static uint32_t		code_gen = 1;
 
-    for (; NULL != c->name; c++) {
-	if (Qundef == c->clas) { // indicates not defined
-	    continue;
-	}
+static Code
+code_find(Code codes, VALUE clas) {
+    uint64_t	h = ((uint64_t)clas ^ ((uint64_t)(uintptr_t)codes >> 4)) * 0x9E3779B97F4A7C15ULL;
+    CodeSlot	slot = oj_local()->code_cache + (h >> (64 - CODE_CACHE_BITS));
+    Code	c;
+
+    if (code_gen == slot->gen && clas == slot->clas && codes == slot->codes) {
+	return slot->code;
+    }
+    // Names are resolved before anything is cached so a miss can not hide a
+    // class that had not been looked up yet. Qundef marks a class that is
+    // not defined. Every Ractor resolves a name to the same class so one
+    // setting it while another reads it only repeats the lookup.
+    for (c = codes; NULL != c->name; c++) {
 	if (Qnil == c->clas) {
 	    c->clas = path2class(c->name);
 	}
-	if (clas == c->clas && c->active) {
-	    c->encode(obj, depth, out);
-	    return true;
+    }
+    for (c = codes; NULL != c->name; c++) {
+	if (clas == c->clas) {
+	    break;
 	}
     }
+    slot->codes = codes;
+    slot->clas = clas;
+    slot->code = (NULL == c->name) ? NULL : c;
+    slot->gen = code_gen;
+
+    return slot->code;
+}
+
+void
+oj_code_cache_clear() {
+    code_gen++;
+    if (0 == code_gen) {
+	memset(oj_local()->code_cache, 0, sizeof(oj_local()->code_cache));
+	code_gen = 1;
+    }
+}
+
+bool
+oj_code_dump(Code codes, VALUE obj, int depth, Out out) {
+    Code	c = code_find(codes, rb_obj_class(obj));
+
+    if (NULL != c && c->active) {
+	c->encode(obj, depth, out);
+	return true;
+    }
     return false;
 }
 
 VALUE
 oj_code_load(Code codes, VALUE clas, VALUE args) {
-    Code	c = codes;
+    Code	c = code_find(codes, clas);
 
-    for (; NULL != c->name; c++) {
-	if (Qundef == c->clas) { // indicates not defined
-	    continue;
-	}
-	if (Qnil == c->clas) {
-	    c->clas = path2class(c->name);
-	}
-	if (clas == c->clas) {
-	    if (NULL == c->decode) {
-		break;
-	    }
-	    return c->decode(clas, args);
-	}
+    if (NULL == c || NULL == c->decode) {
+	return Qnil;
     }
-    return Qnil;
+    return c->decode(clas, args);
 }
 
 void
@@ -104,28 +134,20 @@ oj_code_set_active(Code codes, VALUE clas, bool active) {
 	    }
 	}
     }
+    oj_code_cache_clear();
 }
 
 bool
 oj_code_has(Code codes, VALUE clas, bool encode) {
-    Code	c = codes;
+    Code	c = code_find(codes, clas);
 
-    for (; NULL != c->name; c++) {
-	if (Qundef == c->clas) { // indicates not defined
-	    continue;
-	}
-	if (Qnil == c->clas) {
-	    c->clas = path2class(c->name);
-	}
-	if (clas == c->clas) {
-	    if (encode) {
-		return c->active && NULL != c->encode;
-	    } else {
-		return c->active && NULL != c->decode;
-	    }
-	}
+    if (NULL == c || !c->active) {
+	return false;
     }
-    return false;
+    if (encode) {
+	return NULL != c->encode;
+    }
+    return NULL != c->decode;
 }
 
 void
@@ -18,6 +18,15 @@ typedef struct _code {
     bool	active; // For compat mode.
 } *Code;
 
+#define CODE_CACHE_BITS	7
+
+typedef struct _codeSlot {
+    Code	codes;
+    VALUE	clas;
+    Code	code; // NULL if clas has no entry in codes
+    uint32_t	gen;
+} *CodeSlot;
+
 // Used by encode functions.
 typedef struct _attr {
     const char	*name;
@@ -31,6 +40,7 @@ extern bool	oj_code_dump(Code codes, VALUE obj, int depth, Out out);
 extern VALUE	oj_code_load(Code codes, VALUE clas, VALUE args);
 extern void	oj_code_set_active(Code codes, VALUE clas, bool active);
 extern bool	oj_code_has(Code codes, VALUE clas, bool encode);
+extern void	oj_code_cache_clear(void);
 
 extern void	oj_code_attrs(VALUE obj, Attr attrs, int depth, Out out, bool with_class);
 
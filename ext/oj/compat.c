@@ -23,20 +23,14 @@ hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *o
 	*pi->options.create_id == *key &&
 	(int)pi->options.create_id_len == klen &&
 	0 == strncmp(pi->options.create_id, key, klen)) {
+	ValCold	cold = stack_cold(&pi->stack, parent);
 
-	parent->classname = oj_strndup(str, len);
-	parent->clen = len;
+	cold->classname = oj_strndup(str, len);
+	cold->clen = len;
     } else {
-	volatile VALUE	rstr = rb_str_new(str, len);
-
-	if (Qundef == rkey) {
-	    rkey = rb_str_new(key, klen);
-	    rstr = oj_encode(rstr);
-	    rkey = oj_encode(rkey);
-	    if (Yes == pi->options.sym_key) {
-		rkey = rb_str_intern(rkey);
-	    }
-	}
+	volatile VALUE	rstr = oj_cstr_to_value(pi, str, len);
+
+	rkey = oj_calc_hash_key(pi, kval);
 	if (Yes == pi->options.create_ok && NULL != pi->options.str_rx.head) {
 	    VALUE	clas = oj_rxclass_match(&pi->options.str_rx, str, (int)len);
 
@@ -76,12 +70,13 @@ start_hash(ParseInfo pi) {
 
 static void
 end_hash(struct _parseInfo *pi) {
-    Val	parent = stack_peek(&pi->stack);
+    Val		parent = stack_peek(&pi->stack);
+    ValCold	cold = stack_cold_peek(&pi->stack, parent);
 
-    if (0 != parent->classname) {
+    if (NULL != cold && 0 != cold->classname) {
 	volatile VALUE	clas;
 
-	clas = oj_name2class(pi, parent->classname, parent->clen, 0, rb_eArgError);
+	clas = oj_name2class(pi, cold->classname, cold->clen, 0, rb_eArgError);
 	if (Qundef != clas) { // else an error
 	    ID	creatable = rb_intern("json_creatable?");
 
@@ -89,9 +84,9 @@ end_hash(struct _parseInfo *pi) {
 		parent->val = rb_funcall(clas, oj_json_create_id, 1, parent->val);
 	    }
 	}
-	if (0 != parent->classname) {
-	    xfree((char*)parent->classname);
-	    parent->classname = 0;
+	if (0 != cold->classname) {
+	    xfree((char*)cold->classname);
+	    cold->classname = 0;
 	}
     }
     if (Yes == pi->options.trace) {
@@ -99,25 +94,10 @@ end_hash(struct _parseInfo *pi) {
     }
 }
 
-static VALUE
-calc_hash_key(ParseInfo pi, Val parent) {
-    volatile VALUE	rkey = parent->key_val;
-
-    if (Qundef == rkey) {
-	rkey = rb_str_new(parent->key, parent->klen);
-    }
-    rkey = oj_encode(rkey);
-    if (Yes == pi->options.sym_key) {
-	rkey = rb_str_intern(rkey);
-    }
-    return rkey;
-}
-
 static void
 add_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
+    volatile VALUE	rstr = oj_cstr_to_value(pi, str, len);
 
-    rstr = oj_encode(rstr);
     if (Yes == pi->options.create_ok && NULL != pi->options.str_rx.head) {
 	VALUE	clas = oj_rxclass_match(&pi->options.str_rx, str, (int)len);
 
@@ -149,9 +129,9 @@ hash_set_num(struct _parseInfo *pi, Val parent, NumInfo ni) {
 	// json gem require the less efficient []= method be called to set
 	// values. Even using the store method to set the values will fail
 	// the unit tests.
-	rb_funcall(stack_peek(&pi->stack)->val, rb_intern("[]="), 2, calc_hash_key(pi, parent), rval);
+	rb_funcall(stack_peek(&pi->stack)->val, rb_intern("[]="), 2, oj_calc_hash_key(pi, parent), rval);
     } else {
-	rb_hash_aset(stack_peek(&pi->stack)->val, calc_hash_key(pi, parent), rval);
+	rb_hash_aset(stack_peek(&pi->stack)->val, oj_calc_hash_key(pi, parent), rval);
     }
     if (Yes == pi->options.trace) {
 	oj_trace_parse_call("set_number", pi, __FILE__, __LINE__, rval);
@@ -165,9 +145,9 @@ hash_set_value(ParseInfo pi, Val parent, VALUE value) {
 	// json gem require the less efficient []= method be called to set
 	// values. Even using the store method to set the values will fail
 	// the unit tests.
-	rb_funcall(stack_peek(&pi->stack)->val, rb_intern("[]="), 2, calc_hash_key(pi, parent), value);
+	rb_funcall(stack_peek(&pi->stack)->val, rb_intern("[]="), 2, oj_calc_hash_key(pi, parent), value);
     } else {
-	rb_hash_aset(stack_peek(&pi->stack)->val, calc_hash_key(pi, parent), value);
+	rb_hash_aset(stack_peek(&pi->stack)->val, oj_calc_hash_key(pi, parent), value);
     }
     if (Yes == pi->options.trace) {
 	oj_trace_parse_call("set_value", pi, __FILE__, __LINE__, value);
@@ -205,9 +185,8 @@ array_append_num(ParseInfo pi, NumInfo ni) {
 
 static void
 array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
+    volatile VALUE	rstr = oj_cstr_to_value(pi, str, len);
 
-    rstr = oj_encode(rstr);
     if (Yes == pi->options.create_ok && NULL != pi->options.str_rx.head) {
 	VALUE	clas = oj_rxclass_match(&pi->options.str_rx, str, (int)len);
 
@@ -0,0 +1,125 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <errno.h>
+#include <string.h>
+
+#include "oj.h"
+#include "dump.h"
+#include "compress.h"
+
+static VALUE	compression_sym = Qundef;
+static VALUE	gzip_sym = Qundef;
+
+void
+oj_compress_init() {
+    compression_sym = ID2SYM(rb_intern("compression"));	rb_gc_register_address(&compression_sym);
+    gzip_sym = ID2SYM(rb_intern("gzip"));		rb_gc_register_address(&gzip_sym);
+}
+
+// Returns the :compression option in ropts. Only gzip is supported and only
+// when Oj was built with zlib.
+Compression
+oj_compression(VALUE ropts) {
+    volatile VALUE	v;
+
+    if (T_HASH != rb_type(ropts)) {
+	return NO_COMPRESS;
+    }
+    v = rb_hash_lookup(ropts, compression_sym);
+    if (Qnil == v || Qfalse == v) {
+	return NO_COMPRESS;
+    }
+    if (gzip_sym != v) {
+	rb_raise(rb_eArgError, ":compression must be :gzip or nil.");
+    }
+#ifndef OJ_ZLIB
+    rb_raise(rb_eNotImpError, "gzip compression is not available, Oj was built without zlib.");
+#endif
+    return GZIP_COMPRESS;
+}
+
+int
+oj_deflate_to_fd(void *ctx, const char *buf, size_t len) {
+    return oj_write_all((int)(intptr_t)ctx, buf, len);
+}
+
+int
+oj_deflate_to_io(void *ctx, const char *buf, size_t len) {
+    rb_funcall((VALUE)ctx, oj_write_id, 1, rb_str_new(buf, len));
+
+    return 0;
+}
+
+#ifdef OJ_ZLIB
+
+void
+oj_deflater_init(Deflater d, Compression c, DeflateWrite write, void *ctx) {
+    memset(&d->zs, 0, sizeof(d->zs));
+    d->write = write;
+    d->ctx = ctx;
+    // A window of 15 bits plus 16 asks for a gzip header and trailer.
+    if (Z_OK != deflateInit2(&d->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)) {
+	rb_raise(rb_eNoMemError, "failed to initialize gzip compression.");
+    }
+}
+
+// Compresses len bytes of buf and writes out whatever zlib produces. The
+// input is not copied so nothing is held beyond the deflater itself.
+int
+oj_deflate(Deflater d, const char *buf, size_t len, DeflateMode mode) {
+    int	flush = Z_NO_FLUSH;
+    int	rc;
+    int	err;
+
+    switch (mode) {
+    case DEFLATE_SYNC:	 flush = Z_SYNC_FLUSH;	break;
+    case DEFLATE_FINISH: flush = Z_FINISH;	break;
+    default:					break;
+    }
+    if (Z_FINISH == flush && 0 == len && 0 == d->zs.total_in) {
+	// Nothing since the last member ended so there is nothing to finish.
+	return 0;
+    }
+    d->zs.next_in = (Bytef*)buf;
+    d->zs.avail_in = (uInt)len;
+    do {
+	d->zs.next_out = (Bytef*)d->buf;
+	d->zs.avail_out = sizeof(d->buf);
+	rc = deflate(&d->zs, flush);
+	if (Z_STREAM_ERROR == rc) {
+	    return EIO;
+	}
+	if (d->zs.avail_out < sizeof(d->buf) &&
+	    0 != (err = d->write(d->ctx, d->buf, sizeof(d->buf) - d->zs.avail_out))) {
+	    return err;
+	}
+    } while (0 == d->zs.avail_out || (Z_FINISH == flush && Z_STREAM_END != rc));
+
+    if (Z_FINISH == flush) {
+	deflateReset(&d->zs);
+    }
+    return 0;
+}
+
+void
+oj_deflater_cleanup(Deflater d) {
+    deflateEnd(&d->zs);
+}
+
+#else
+
+void
+oj_deflater_init(Deflater d, Compression c, DeflateWrite write, void *ctx) {
+    rb_raise(rb_eNotImpError, "gzip compression is not available, Oj was built without zlib.");
+}
+
+int
+oj_deflate(Deflater d, const char *buf, size_t len, DeflateMode mode) {
+    return ENOSYS;
+}
+
+void
+oj_deflater_cleanup(Deflater d) {
+}
+
+#endif
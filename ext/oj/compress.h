@@ -0,0 +1,49 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_COMPRESS_H
+#define OJ_COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ruby.h"
+
+#ifdef OJ_ZLIB
+#include <zlib.h>
+#endif
+
+typedef enum {
+    NO_COMPRESS		= 0,
+    GZIP_COMPRESS	= 'g',
+} Compression;
+
+typedef enum {
+    DEFLATE_MORE	= 0, // more input follows, write only full blocks
+    DEFLATE_SYNC	= 1, // write everything so far, the stream stays open
+    DEFLATE_FINISH	= 2, // end the gzip member, later input starts a new one
+} DeflateMode;
+
+// Writes compressed bytes. Returns 0 or an errno. Must not call Ruby when
+// the deflater is used on a writer thread.
+typedef int	(*DeflateWrite)(void *ctx, const char *buf, size_t len);
+
+typedef struct _deflater {
+#ifdef OJ_ZLIB
+    z_stream		zs;
+#endif
+    DeflateWrite	write;
+    void		*ctx;
+    char		buf[0x00004000];
+} *Deflater;
+
+extern void		oj_compress_init(void);
+extern Compression	oj_compression(VALUE ropts);
+
+extern void	oj_deflater_init(Deflater d, Compression c, DeflateWrite write, void *ctx);
+extern int	oj_deflate(Deflater d, const char *buf, size_t len, DeflateMode mode);
+extern void	oj_deflater_cleanup(Deflater d);
+
+extern int	oj_deflate_to_fd(void *ctx, const char *buf, size_t len);
+extern int	oj_deflate_to_io(void *ctx, const char *buf, size_t len);
+
+#endif /* OJ_COMPRESS_H */
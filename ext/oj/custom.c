@@ -12,10 +12,11 @@
 #include "oj.h"
 #include "parse.h"
 #include "resolve.h"
+#include "stats.h"
 #include "trace.h"
 #include "util.h"
 
-extern void	oj_set_obj_ivar(Val parent, Val kval, VALUE value);
+extern void	oj_set_obj_ivar(ParseInfo pi, Val parent, Val kval, VALUE value);
 extern VALUE	oj_parse_xml_time(const char *str, int len); // from object.c
 
 static void
@@ -110,6 +111,32 @@ time_dump(VALUE obj, int depth, Out out) {
     }
 }
 
+static ID	jd_id = 0;
+static ID	start_id = 0;
+
+// Date.jd of 1970-01-01.
+#define EPOCH_JD	2440588
+
+// Finds the UTC seconds at the start of a Date from its jd, which is what
+// to_time, utc_offset, utc, and + give with four calls. Returns false if the
+// Date uses the Julian calendar as a Time does not.
+static bool
+date_secs(VALUE obj, int64_t *secp) {
+    volatile VALUE	jd;
+
+    if (0 == jd_id) {
+	jd_id = rb_intern("jd");
+	start_id = rb_intern("start");
+    }
+    jd = rb_funcall(obj, jd_id, 0);
+    if (!FIXNUM_P(jd) || (double)FIX2LONG(jd) < NUM2DBL(rb_funcall(obj, start_id, 0))) {
+	return false;
+    }
+    *secp = ((int64_t)FIX2LONG(jd) - EPOCH_JD) * 86400;
+
+    return true;
+}
+
 static void
 date_dump(VALUE obj, int depth, Out out) {
     if (Yes == out->opts->create_ok) {
@@ -123,6 +150,7 @@ date_dump(VALUE obj, int depth, Out out) {
     } else {
 	volatile VALUE	v;
 	volatile VALUE	ov;
+	int64_t		secs;
 
 	switch (out->opts->time_format) {
 	case RubyTime:
@@ -131,23 +159,34 @@ date_dump(VALUE obj, int depth, Out out) {
 	    oj_dump_cstr(rb_string_value_ptr((VALUE*)&v), (int)RSTRING_LEN(v), 0, 0, out);
 	    break;
 	case UnixZTime:
-	    v = rb_funcall(obj, rb_intern("to_time"), 0);
 	    if (oj_date_class == rb_obj_class(obj)) {
+		if (date_secs(obj, &secs)) {
+		    oj_dump_epoch(secs, 0, false, 0, out);
+		    break;
+		}
+		v = rb_funcall(obj, rb_intern("to_time"), 0);
 		ov = rb_funcall(v, rb_intern("utc_offset"), 0);
 		v = rb_funcall(v, rb_intern("utc"), 0);
 		v = rb_funcall(v, rb_intern("+"), 1, ov);
 		oj_dump_time(v, out, false);
 	    } else {
+		v = rb_funcall(obj, rb_intern("to_time"), 0);
 		oj_dump_time(v, out, true);
 	    }
 	    break;
 	case UnixTime:
 	default:
-	    v = rb_funcall(obj, rb_intern("to_time"), 0);
 	    if (oj_date_class == rb_obj_class(obj)) {
+		if (date_secs(obj, &secs)) {
+		    oj_dump_epoch(secs, 0, false, 0, out);
+		    break;
+		}
+		v = rb_funcall(obj, rb_intern("to_time"), 0);
 		ov = rb_funcall(v, rb_intern("utc_offset"), 0);
 		v = rb_funcall(v, rb_intern("utc"), 0);
 		v = rb_funcall(v, rb_intern("+"), 1, ov);
+	    } else {
+		v = rb_funcall(obj, rb_intern("to_time"), 0);
 	    }
 	    oj_dump_time(v, out, false);
 	    break;
@@ -155,11 +194,19 @@ date_dump(VALUE obj, int depth, Out out) {
     }
 }
 
+// The iso8601 strings written by date_dump are read directly and anything
+// else, including out of range dates, is left to Date.parse and
+// DateTime.parse.
 static VALUE
 date_load(VALUE clas, VALUE args) {
     volatile VALUE	v;
 
     if (Qnil != (v = rb_hash_aref(args, rb_str_new2("s")))) {
+	struct _isoTime	it;
+
+	if (T_STRING == rb_type(v) && oj_parse_iso8601(RSTRING_PTR(v), RSTRING_LEN(v), &it) && it.exact && !it.has_time) {
+	    return rb_funcall(oj_date_class, oj_new_id, 3, INT2FIX(it.year), INT2FIX(it.mon), INT2FIX(it.day));
+	}
 	return rb_funcall(oj_date_class, rb_intern("parse"), 1, v);
     }
     return Qnil;
@@ -170,6 +217,18 @@ datetime_load(VALUE clas, VALUE args) {
     volatile VALUE	v;
 
     if (Qnil != (v = rb_hash_aref(args, rb_str_new2("s")))) {
+	struct _isoTime	it;
+
+	// Before the Gregorian reform a DateTime uses the Julian calendar
+	// while a Time does not so older dates are parsed.
+	if (T_STRING == rb_type(v) && oj_parse_iso8601(RSTRING_PTR(v), RSTRING_LEN(v), &it) && it.exact && it.has_time && 1583 <= it.year) {
+	    struct timespec	ts;
+
+	    ts.tv_sec = (time_t)it.secs;
+	    ts.tv_nsec = it.nsecs;
+
+	    return rb_funcall(rb_time_timespec_new(&ts, it.offset), rb_intern("to_datetime"), 0);
+	}
 	return rb_funcall(oj_datetime_class, rb_intern("parse"), 1, v);
     }
     return Qnil;
@@ -324,10 +383,8 @@ hash_cb(VALUE key, VALUE value, VALUE ov) {
     }
     switch (rb_type(key)) {
     case T_STRING:
-	oj_dump_str(key, 0, out, false);
-	break;
     case T_SYMBOL:
-	oj_dump_sym(key, 0, out, false);
+	oj_dump_key(key, out);
 	break;
     default:
 	oj_dump_str(rb_funcall(key, oj_to_s_id, 0), 0, out, false);
@@ -400,12 +457,12 @@ dump_hash(VALUE obj, int depth, Out out, bool as_ok) {
 
 static void
 dump_odd(VALUE obj, Odd odd, VALUE clas, int depth, Out out) {
-    ID			*idp;
-    AttrGetFunc		*fp;
     volatile VALUE	v;
     const char		*name;
+    size_t		nlen;
     size_t		size;
     int			d2 = depth + 1;
+    int			i;
 
     assure_size(out, 2);
     *out->cur++ = '{';
@@ -460,44 +517,11 @@ dump_odd(VALUE obj, Odd odd, VALUE clas, int depth, Out out) {
 	}
     } else {
 	size = d2 * out->indent + 1;
-	for (idp = odd->attrs, fp = odd->attrFuncs; 0 != *idp; idp++, fp++) {
-	    size_t	nlen;
-
+	for (i = 0; i < odd->attr_cnt; i++) {
 	    assure_size(out, size);
-	    name = rb_id2name(*idp);
-	    nlen = strlen(name);
-	    if (0 != *fp) {
-		v = (*fp)(obj);
-	    } else if (0 == strchr(name, '.')) {
-		v = rb_funcall(obj, *idp, 0);
-	    } else {
-		char	nbuf[256];
-		char	*n2 = nbuf;
-		char	*n;
-		char	*end;
-		ID	i;
-
-		if (sizeof(nbuf) <= nlen) {
-		    if (NULL == (n2 = strdup(name))) {
-			rb_raise(rb_eNoMemError, "for attribute name.");
-		    }
-		} else {
-		    strcpy(n2, name);
-		}
-		n = n2;
-		v = obj;
-		while (0 != (end = strchr(n, '.'))) {
-		    *end = '\0';
-		    i = rb_intern(n);
-		    v = rb_funcall(v, i, 0);
-		    n = end + 1;
-		}
-		i = rb_intern(n);
-		v = rb_funcall(v, i, 0);
-		if (nbuf != n2) {
-		    free(n2);
-		}
-	    }
+	    name = odd->attr_names[i];
+	    nlen = odd->attr_lens[i];
+	    v = oj_odd_get_attr(odd, i, obj);
 	    fill_indent(out, d2);
 	    oj_dump_cstr(name, nlen, 0, 0, out);
 	    *out->cur++ = ':';
@@ -525,6 +549,7 @@ dump_common(VALUE obj, int depth, Out out) {
 	if (Yes == out->opts->trace) {
 	    oj_trace("to_json", obj, __FILE__, __LINE__, depth + 1, TraceRubyIn);
 	}
+	oj_stats.to_json_calls++;
 	if (0 == rb_obj_method_arity(obj, oj_to_json_id)) {
 	    rs = rb_funcall(obj, oj_to_json_id, 0);
 	} else {
@@ -546,6 +571,7 @@ dump_common(VALUE obj, int depth, Out out) {
 	if (Yes == out->opts->trace) {
 	    oj_trace("as_json", obj, __FILE__, __LINE__, depth + 1, TraceRubyIn);
 	}
+	oj_stats.as_json_calls++;
 	// Some classes elect to not take an options argument so check the arity
 	// of as_json.
 	if (0 == rb_obj_method_arity(obj, oj_as_json_id)) {
@@ -560,6 +586,7 @@ dump_common(VALUE obj, int depth, Out out) {
 	if (aj == obj) {
 	    volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
+	    oj_stats.to_s_calls++;
 	    oj_dump_cstr(rb_string_value_ptr((VALUE*)&rstr), (int)RSTRING_LEN(rstr), false, false, out);
 	} else {
 	    oj_dump_custom_val(aj, depth, out, true);
@@ -720,9 +747,14 @@ dump_obj_attrs(VALUE obj, VALUE clas, slot_t id, int depth, Out out) {
 
 static void
 dump_obj(VALUE obj, int depth, Out out, bool as_ok) {
-    long	id = oj_check_circular(obj, out);
+    long	id;
     VALUE	clas;
 
+    if (oj_raw_json_class == rb_obj_class(obj)) {
+	oj_dump_raw_json(obj, depth, out);
+	return;
+    }
+    id = oj_check_circular(obj, out);
     if (0 > id) {
 	oj_dump_nil(Qnil, depth, out, false);
     } else if (Qnil != (clas = dump_common(obj, depth, out))) {
@@ -776,7 +808,11 @@ dump_array(VALUE a, int depth, Out out, bool as_ok) {
 		*out->cur++ = ',';
 	    }
 	}
-	size = depth * out->indent + 1;
+	if (out->opts->dump_opts.use) {
+	    size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.array_size + 1;
+	} else {
+	    size = depth * out->indent + 1;
+	}
 	assure_size(out, size);
 	if (out->opts->dump_opts.use) {
 	    if (0 < out->opts->dump_opts.array_size) {
@@ -965,6 +1001,14 @@ oj_dump_custom_val(VALUE obj, int depth, Out out, bool as_ok) {
 
 ///// load functions /////
 
+// Returns the class named by the create_id member of the Hash or Qundef.
+inline static VALUE
+create_class(ParseInfo pi, Val parent) {
+    ValCold	cold = stack_cold_peek(&pi->stack, parent);
+
+    return (NULL == cold) ? Qundef : cold->clas;
+}
+
 static void
 hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *orig) {
     const char		*key = kval->key;
@@ -978,26 +1022,20 @@ hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *o
 	*pi->options.create_id == *key &&
 	(int)pi->options.create_id_len == klen &&
 	0 == strncmp(pi->options.create_id, key, klen)) {
+	ValCold	cold = stack_cold(&pi->stack, parent);
 
-	parent->clas = oj_name2class(pi, str, len, false, rb_eArgError);
+	cold->clas = oj_name2class(pi, str, len, false, rb_eArgError);
 	if (2 == klen && '^' == *key && 'o' == key[1]) {
-	    if (Qundef != parent->clas) {
-		if (!oj_code_has(codes, parent->clas, false)) {
-		    parent->val = rb_obj_alloc(parent->clas);
+	    if (Qundef != cold->clas) {
+		if (!oj_code_has(codes, cold->clas, false)) {
+		    parent->val = rb_obj_alloc(cold->clas);
 		}
 	    }
 	}
     } else {
-	volatile VALUE	rstr = rb_str_new(str, len);
-
-	if (Qundef == rkey) {
-	    rkey = rb_str_new(key, klen);
-	    rstr = oj_encode(rstr);
-	    rkey = oj_encode(rkey);
-	    if (Yes == pi->options.sym_key) {
-		rkey = rb_str_intern(rkey);
-	    }
-	}
+	volatile VALUE	rstr = oj_cstr_to_value(pi, str, len);
+
+	rkey = oj_calc_hash_key(pi, kval);
 	if (Yes == pi->options.create_ok && NULL != pi->options.str_rx.head) {
 	    VALUE	clas = oj_rxclass_match(&pi->options.str_rx, str, (int)len);
 
@@ -1007,10 +1045,10 @@ hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *o
 	}
 	switch (rb_type(parent->val)) {
 	case T_OBJECT:
-	    oj_set_obj_ivar(parent, kval, rstr);
+	    oj_set_obj_ivar(pi, parent, kval, rstr);
 	    break;
 	case T_HASH:
-	    if (4 == parent->klen && NULL != parent->key && rb_cTime == parent->clas && 0 == strncmp("time", parent->key, 4)) {
+	    if (4 == parent->klen && NULL != parent->key && rb_cTime == create_class(pi, parent) && 0 == strncmp("time", parent->key, 4)) {
 		if (Qnil == (parent->val = oj_parse_xml_time(str, (int)len))) {
 		    parent->val = rb_funcall(rb_cTime, rb_intern("parse"), 1, rb_str_new(str, len));
 		}
@@ -1029,37 +1067,24 @@ hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *o
 
 static void
 end_hash(struct _parseInfo *pi) {
-    Val	parent = stack_peek(&pi->stack);
+    Val		parent = stack_peek(&pi->stack);
+    ValCold	cold = stack_cold_peek(&pi->stack, parent);
 
-    if (Qundef != parent->clas && parent->clas != rb_obj_class(parent->val)) {
-	volatile VALUE	obj = oj_code_load(codes, parent->clas, parent->val);
+    if (NULL != cold && Qundef != cold->clas && cold->clas != rb_obj_class(parent->val)) {
+	volatile VALUE	obj = oj_code_load(codes, cold->clas, parent->val);
 
 	if (Qnil != obj) {
 	    parent->val = obj;
 	} else {
-	    parent->val = rb_funcall(parent->clas, oj_json_create_id, 1, parent->val);
+	    parent->val = rb_funcall(cold->clas, oj_json_create_id, 1, parent->val);
 	}
-	parent->clas = Qundef;
+	cold->clas = Qundef;
     }
     if (Yes == pi->options.trace) {
 	oj_trace_parse_hash_end(pi, __FILE__, __LINE__);
     }
 }
 
-static VALUE
-calc_hash_key(ParseInfo pi, Val parent) {
-    volatile VALUE	rkey = parent->key_val;
-
-    if (Qundef == rkey) {
-	rkey = rb_str_new(parent->key, parent->klen);
-    }
-    rkey = oj_encode(rkey);
-    if (Yes == pi->options.sym_key) {
-	rkey = rb_str_intern(rkey);
-    }
-    return rkey;
-}
-
 static void
 hash_set_num(struct _parseInfo *pi, Val kval, NumInfo ni) {
     Val			parent = stack_peek(&pi->stack);
@@ -1067,10 +1092,10 @@ hash_set_num(struct _parseInfo *pi, Val kval, NumInfo ni) {
 
     switch (rb_type(parent->val)) {
     case T_OBJECT:
-	oj_set_obj_ivar(parent, kval, rval);
+	oj_set_obj_ivar(pi, parent, kval, rval);
 	break;
     case T_HASH:
-	if (4 == parent->klen && NULL != parent->key && rb_cTime == parent->clas && 0 != ni->div && 0 == strncmp("time", parent->key, 4)) {
+	if (4 == parent->klen && NULL != parent->key && rb_cTime == create_class(pi, parent) && 0 != ni->div && 0 == strncmp("time", parent->key, 4)) {
 	    int64_t	nsec = ni->num * 1000000000LL / ni->div;
 
 	    if (ni->neg) {
@@ -1106,7 +1131,7 @@ hash_set_num(struct _parseInfo *pi, Val kval, NumInfo ni) {
 	    }
 	    rval = parent->val;
 	} else {
-	    rb_hash_aset(parent->val, calc_hash_key(pi, kval), rval);
+	    rb_hash_aset(parent->val, oj_calc_hash_key(pi, kval), rval);
 	}
 	break;
     default:
@@ -1123,10 +1148,10 @@ hash_set_value(ParseInfo pi, Val kval, VALUE value) {
 
     switch (rb_type(parent->val)) {
     case T_OBJECT:
-	oj_set_obj_ivar(parent, kval, value);
+	oj_set_obj_ivar(pi, parent, kval, value);
 	break;
     case T_HASH:
-	rb_hash_aset(parent->val, calc_hash_key(pi, kval), value);
+	rb_hash_aset(parent->val, oj_calc_hash_key(pi, kval), value);
 	break;
     default:
 	break;
@@ -1149,9 +1174,8 @@ array_append_num(ParseInfo pi, NumInfo ni) {
 
 static void
 array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
+    volatile VALUE	rstr = oj_cstr_to_value(pi, str, len);
 
-    rstr = oj_encode(rstr);
     if (Yes == pi->options.create_ok && NULL != pi->options.str_rx.head) {
 	VALUE	clas = oj_rxclass_match(&pi->options.str_rx, str, (int)len);
 
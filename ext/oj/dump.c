@@ -2,6 +2,9 @@
 
 #include <errno.h>
 #include <math.h>
+#if !IS_WINDOWS
+#include <poll.h>
+#endif
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,11 +12,15 @@
 #include <unistd.h>
 
 #include "oj.h"
-#include "cache8.h"
 #include "dump.h"
+#include "encode.h"
+#include "local.h"
 #include "odd.h"
+#include "probes.h"
+#include "stats.h"
 #include "trace.h"
 #include "util.h"
+#include "simd.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
 #define OJ_INFINITY (1.0/0.0)
@@ -26,10 +33,6 @@ static const char	nan_val[] = NAN_VAL;
 
 typedef unsigned long	ulong;
 
-static size_t	hibit_friendly_size(const uint8_t *str, size_t len);
-static size_t	xss_friendly_size(const uint8_t *str, size_t len);
-static size_t	ascii_friendly_size(const uint8_t *str, size_t len);
-
 static const char	hex_chars[17] = "0123456789abcdef";
 
 // JSON standard except newlines are no escaped
@@ -115,92 +118,6 @@ raise_strict(VALUE obj) {
     rb_raise(rb_eTypeError, "Failed to dump %s Object to JSON in strict mode.", rb_class2name(rb_obj_class(obj)));
 }
 
-inline static size_t
-newline_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-    size_t	i = len;
-
-    for (; 0 < i; str++, i--) {
-	size += newline_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
-
-inline static size_t
-hibit_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-    size_t	i = len;
-
-    for (; 0 < i; str++, i--) {
-	size += hibit_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
-
-inline static size_t
-ascii_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-    size_t	i = len;
-
-    for (; 0 < i; str++, i--) {
-	size += ascii_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
-
-inline static size_t
-xss_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-    size_t	i = len;
-
-    for (; 0 < i; str++, i--) {
-	size += xss_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
-
-inline static size_t
-hixss_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-    size_t	i = len;
-    bool	check = false;
-
-    for (; 0 < i; str++, i--) {
-	size += hixss_friendly_chars[*str];
-	if (0 != (0x80 & *str)) {
-	    check = true;
-	}
-    }
-    return size - len * (size_t)'0' + check;
-}
-
-inline static long
-rails_xss_friendly_size(const uint8_t *str, size_t len) {
-    long	size = 0;
-    size_t	i = len;
-    uint8_t	hi = 0;
-
-    for (; 0 < i; str++, i--) {
-	size += rails_xss_friendly_chars[*str];
-	hi |= *str & 0x80;
-    }
-    if (0 == hi) {
-	return size - len * (size_t)'0';
-    }
-    return -(size - len * (size_t)'0');
-}
-
-inline static size_t
-rails_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-    size_t	i = len;
-
-    for (; 0 < i; str++, i--) {
-	size += rails_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
-
 const char*
 oj_nan_str(VALUE obj, int opt, int mode, bool plus, int *lenp) {
     const char	*str = NULL;
@@ -356,20 +273,83 @@ check_unicode(const char *str, const char *end, const char *orig) {
     return str;
 }
 
+#define CIRC_MIN_SLOTS	64
+
+// An open addressing set of the objects already dumped. The slots are
+// allocated on the first check and VALUE 0 (false) marks an empty slot
+// since only containers and objects are checked.
+typedef struct _circSlot {
+    VALUE	obj;
+    slot_t	id;
+} *CircSlot;
+
+inline static CircSlot
+circ_find(CircSlot slots, uint32_t mask, VALUE obj) {
+    uint32_t	i = (uint32_t)((((uint64_t)obj >> 3) * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+    while (0 != slots[i].obj && obj != slots[i].obj) {
+	i = (i + 1) & mask;
+    }
+    return slots + i;
+}
+
+static void
+circ_grow(Out out) {
+    uint32_t	size = (NULL == out->circ_slots) ? CIRC_MIN_SLOTS : (out->circ_mask + 1) * 2;
+    CircSlot	slots = ALLOC_N(struct _circSlot, size);
+
+    memset(slots, 0, sizeof(struct _circSlot) * size);
+    if (NULL != out->circ_slots) {
+	CircSlot	s = out->circ_slots;
+	CircSlot	end = s + out->circ_mask + 1;
+
+	for (; s < end; s++) {
+	    if (0 != s->obj) {
+		*circ_find(slots, size - 1, s->obj) = *s;
+	    }
+	}
+	xfree(out->circ_slots);
+    }
+    out->circ_slots = slots;
+    out->circ_mask = size - 1;
+}
+
+void
+oj_circ_cleanup(Out out) {
+    if (NULL != out->circ_slots) {
+	xfree(out->circ_slots);
+	out->circ_slots = NULL;
+    }
+    out->circ_mask = 0;
+    out->circ_cnt = 0;
+}
+
 // Returns 0 if not using circular references, -1 if no further writing is
 // needed (duplicate), and a positive value if the object was added to the
 // cache.
 long
 oj_check_circular(VALUE obj, Out out) {
     slot_t	id = 0;
-    slot_t	*slot;
+    CircSlot	slot;
 
     if (Yes == out->opts->circular) {
-	if (0 == (id = oj_cache8_get(out->circ_cache, obj, &slot))) {
+	if (NULL == out->circ_slots) {
+	    circ_grow(out);
+	}
+	slot = circ_find(out->circ_slots, out->circ_mask, obj);
+	if (0 == slot->obj) {
+	    // Keep the set at most half full.
+	    if (out->circ_mask + 1 < (out->circ_cnt + 1) * 2) {
+		circ_grow(out);
+		slot = circ_find(out->circ_slots, out->circ_mask, obj);
+	    }
 	    out->circ_cnt++;
+	    oj_stats.circ_inserts++;
 	    id = out->circ_cnt;
-	    *slot = id;
+	    slot->obj = obj;
+	    slot->id = id;
 	} else {
+	    id = slot->id;
 	    if (ObjectMode == out->opts->mode) {
 		assure_size(out, 18);
 		*out->cur++ = '"';
@@ -384,14 +364,86 @@ oj_check_circular(VALUE obj, Out out) {
     return (long)id;
 }
 
+const char	oj_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+inline static char*
+two_digits(char *b, int n) {
+    *b++ = oj_digit_pairs[n * 2];
+    *b++ = oj_digit_pairs[n * 2 + 1];
+
+    return b;
+}
+
+// Writes an RFC 3339 time such as 2012-01-05T23:58:07.123456789+09:00 to
+// buf and returns the length. The sec must already include the tzsecs
+// offset and nsec must already be reduced to prec digits.
+int
+oj_xml_time_str(char *buf, int64_t sec, long nsec, int prec, long tzsecs, bool zulu) {
+    OjLocal	local = oj_local();
+    int64_t	day = sec / 86400;
+    int		tod;
+    char	*b = buf;
+
+    if (sec < day * 86400) {
+	day--;
+    }
+    tod = (int)(sec - day * 86400);
+    // Times being dumped are usually close together so most only need the
+    // time of day added to the date of the last one.
+    if (day != local->date_day) {
+	struct _timeInfo	ti;
+
+	sec_as_time(day * 86400, &ti);
+	local->date_len = sprintf(local->date_str, "%04d-%02d-%02dT", ti.year, ti.mon, ti.day);
+	local->date_day = day;
+    }
+    memcpy(b, local->date_str, local->date_len);
+    b += local->date_len;
+    b = two_digits(b, tod / 3600);
+    *b++ = ':';
+    b = two_digits(b, tod / 60 % 60);
+    *b++ = ':';
+    b = two_digits(b, tod % 60);
+    if (0 < prec) {
+	int	i;
+
+	*b++ = '.';
+	for (i = prec - 1; 0 <= i; i--) {
+	    b[i] = '0' + (char)(nsec % 10);
+	    nsec /= 10;
+	}
+	b += prec;
+    }
+    if (zulu) {
+	*b++ = 'Z';
+    } else {
+	if (0 > tzsecs) {
+	    *b++ = '-';
+	    tzsecs = -tzsecs;
+	} else {
+	    *b++ = '+';
+	}
+	b = two_digits(b, (int)(tzsecs / 3600));
+	*b++ = ':';
+	b = two_digits(b, (int)(tzsecs / 60 % 60));
+    }
+    *b = '\0';
+
+    return (int)(b - buf);
+}
+
 void
 oj_dump_time(VALUE obj, Out out, int withZone) {
-    char	buf[64];
-    char	*b = buf + sizeof(buf) - 1;
-    long	size;
-    char	*dot;
-    int		neg = 0;
-    long	one = 1000000000;
     long long	sec;
     long long	nsec;
 
@@ -413,14 +465,33 @@ oj_dump_time(VALUE obj, Out out, int withZone) {
     nsec = rb_num2ll(rb_funcall2(obj, oj_tv_nsec_id, 0, 0));
 #endif
 
-    *b-- = '\0';
     if (withZone) {
 	long	tzsecs = NUM2LONG(rb_funcall2(obj, oj_utc_offset_id, 0, 0));
-	int	zneg = (0 > tzsecs);
 
 	if (0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0)) {
 	    tzsecs = 86400;
 	}
+	oj_dump_epoch(sec, nsec, true, tzsecs, out);
+    } else {
+	oj_dump_epoch(sec, nsec, false, 0, out);
+    }
+}
+
+// Dumps seconds since the epoch with a fraction of sec_prec digits and, if
+// with_zone, the tzsecs as an exponent. A tzsecs of 86400 indicates UTC.
+void
+oj_dump_epoch(int64_t sec, long long nsec, bool with_zone, long tzsecs, Out out) {
+    char	buf[64];
+    char	*b = buf + sizeof(buf) - 1;
+    long	size;
+    char	*dot;
+    int		neg = 0;
+    long	one = 1000000000;
+
+    *b-- = '\0';
+    if (with_zone) {
+	int	zneg = (0 > tzsecs);
+
 	if (zneg) {
 	    tzsecs = -tzsecs;
 	}
@@ -464,13 +535,7 @@ oj_dump_time(VALUE obj, Out out, int withZone) {
 	}
 	*b-- = '.';
     }
-    if (0 == sec) {
-	*b-- = '0';
-    } else {
-	for (; 0 < sec; b--, sec /= 10) {
-	    *b = '0' + (sec % 10);
-	}
-    }
+    b = oj_ulong_digits((uint64_t)sec, b + 1) - 1;
     if (neg) {
 	*b-- = '-';
     }
@@ -492,13 +557,12 @@ oj_dump_ruby_time(VALUE obj, Out out) {
 void
 oj_dump_xml_time(VALUE obj, Out out) {
     char		buf[64];
-    struct _timeInfo	ti;
     long		one = 1000000000;
     int64_t		sec;
     long long		nsec;
     long		tzsecs = NUM2LONG(rb_funcall2(obj, oj_utc_offset_id, 0, 0));
-    int			tzhour, tzmin;
-    char		tzsign = '+';
+    int			prec = 9;
+    int			len;
 
 #ifdef HAVE_RB_TIME_TIMESPEC
     if (16 <= sizeof(struct timespec)) {
@@ -537,47 +601,14 @@ oj_dump_xml_time(VALUE obj, Out out) {
 	}
     }
     // 2012-01-05T23:58:07.123456000+09:00
-    //tm = localtime(&sec);
-    sec += tzsecs;
-    sec_as_time((int64_t)sec, &ti);
-    if (0 > tzsecs) {
-        tzsign = '-';
-        tzhour = (int)(tzsecs / -3600);
-        tzmin = (int)(tzsecs / -60) - (tzhour * 60);
-    } else {
-        tzhour = (int)(tzsecs / 3600);
-        tzmin = (int)(tzsecs / 60) - (tzhour * 60);
-    }
     if ((0 == nsec && !out->opts->sec_prec_set) || 0 == out->opts->sec_prec) {
-	if (0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0)) {
-	    sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02dZ", ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec);
-	    oj_dump_cstr(buf, 20, 0, 0, out);
-	} else {
-	    sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02d%c%02d:%02d", ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec,
-		    tzsign, tzhour, tzmin);
-	    oj_dump_cstr(buf, 25, 0, 0, out);
-	}
-    } else if (0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0)) {
-	char	format[64] = "%04d-%02d-%02dT%02d:%02d:%02d.%09ldZ";
-	int	len = 30;
-
-	if (9 > out->opts->sec_prec) {
-	    format[32] = '0' + out->opts->sec_prec;
-	    len -= 9 - out->opts->sec_prec;
-	}
-	sprintf(buf, format, ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec, (long)nsec);
-	oj_dump_cstr(buf, len, 0, 0, out);
-    } else {
-	char	format[64] = "%04d-%02d-%02dT%02d:%02d:%02d.%09ld%c%02d:%02d";
-	int	len = 35;
-
-	if (9 > out->opts->sec_prec) {
-	    format[32] = '0' + out->opts->sec_prec;
-	    len -= 9 - out->opts->sec_prec;
-	}
-	sprintf(buf, format, ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec, (long)nsec, tzsign, tzhour, tzmin);
-	oj_dump_cstr(buf, len, 0, 0, out);
+	prec = 0;
+    } else if (9 > out->opts->sec_prec) {
+	prec = out->opts->sec_prec;
     }
+    len = oj_xml_time_str(buf, sec + tzsecs, (long)nsec, prec, tzsecs,
+			  0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0));
+    oj_dump_cstr(buf, len, 0, 0, out);
 }
 
 void
@@ -587,6 +618,7 @@ oj_dump_obj_to_json(VALUE obj, Options copts, Out out) {
 
 void
 oj_dump_obj_to_json_using_params(VALUE obj, Options copts, Out out, int argc, VALUE *argv) {
+    OJ_PROBE1(dump__start, (int)copts->mode);
     if (0 == out->buf) {
 	out->buf = ALLOC_N(char, 4096);
 	out->end = out->buf + 4095 - BUFFER_EXTRA; // 1 less than end plus extra for possible errors
@@ -600,9 +632,11 @@ oj_dump_obj_to_json_using_params(VALUE obj, Options copts, Out out, int argc, VA
     out->argc = argc;
     out->argv = argv;
     out->ropts = NULL;
-    if (Yes == copts->circular) {
-	oj_cache8_new(&out->circ_cache);
-    }
+    out->circ_slots = NULL;
+    out->circ_mask = 0;
+    out->key_used = 0;
+    out->ropt_used = 0;
+    out->tj_used = 0;
     switch (copts->mode) {
     case StrictMode:	oj_dump_strict_val(obj, 0, out);			break;
     case NullMode:	oj_dump_null_val(obj, 0, out);				break;
@@ -624,83 +658,295 @@ oj_dump_obj_to_json_using_params(VALUE obj, Options copts, Out out, int argc, VA
 	}
     }
     *out->cur = '\0';
-    if (Yes == copts->circular) {
-	oj_cache8_delete(out->circ_cache);
+    oj_circ_cleanup(out);
+    oj_stats.dumps++;
+    oj_stats.bytes_dumped += out->cur - out->buf;
+    OJ_PROBE2(dump__done, (size_t)(out->cur - out->buf), (int)copts->mode);
+}
+
+// The buffer grown by the last Oj.dump is kept for the next one unless it
+// is larger than DUMP_BUF_KEEP_MAX. Each Ractor keeps its own. Only one Out
+// can use it at a time so a dump made while another is in progress, from a
+// to_json or another thread, uses its own buffer.
+#define DUMP_BUF_KEEP_MAX	(4 * 1024 * 1024)
+
+typedef struct _dumpStr {
+    VALUE	obj;
+    Options	copts;
+    Out		out;
+    OjLocal	local;
+    int		argc;
+    VALUE	*argv;
+} *DumpStr;
+
+static VALUE
+dump_str_body(VALUE x) {
+    DumpStr		ds = (DumpStr)x;
+    Out			out = ds->out;
+    volatile VALUE	rstr;
+
+    oj_dump_obj_to_json_using_params(ds->obj, ds->copts, out, ds->argc, ds->argv);
+    if (0 == out->buf) {
+	rb_raise(rb_eNoMemError, "Not enough memory.");
+    }
+    if (Qnil != out->str) {
+	rstr = out->str;
+	rb_str_set_len(rstr, out->cur - out->buf);
+	// Gives back the unused capacity if it is large.
+	rb_str_resize(rstr, out->cur - out->buf);
+    } else {
+	rstr = rb_str_new(out->buf, out->cur - out->buf);
     }
+    return oj_encode(rstr);
 }
 
-void
-oj_write_obj_to_file(VALUE obj, const char *path, Options copts) {
-    char	buf[4096];
-    struct _out out;
-    size_t	size;
-    FILE	*f;
-    int		ok;
+static VALUE
+dump_str_ensure(VALUE x) {
+    Out		out = ((DumpStr)x)->out;
+    OjLocal	local = ((DumpStr)x)->local;
+
+    if (local->dump_buf_owner == out) {
+	local->dump_buf_owner = NULL;
+	if (out->allocated) {
+	    if ((size_t)(out->end - out->buf) <= DUMP_BUF_KEEP_MAX) {
+		local->dump_buf = out->buf;
+		local->dump_buf_size = out->end - out->buf;
+	    } else {
+		xfree(out->buf);
+	    }
+	}
+    } else if (out->allocated) {
+	xfree(out->buf);
+    }
+    out->buf = NULL;
+    out->allocated = false;
+
+    return Qnil;
+}
+
+// Dumps to a new String. The Out must have been set up with a stack buffer
+// which is replaced by the Ruby String itself if the :string_buffer option
+// is true or by the reused dump buffer if it is free. The buffer is released
+// even if the dump raises.
+VALUE
+oj_dump_to_str(VALUE obj, Options copts, Out out, int argc, VALUE *argv) {
+    struct _dumpStr	ds;
+    volatile VALUE	rstr = Qnil;
+    OjLocal		local = oj_local();
+
+    if (Yes == copts->string_buf) {
+	rstr = rb_str_buf_new(4096);
+	out->str = rstr;
+	out->buf = RSTRING_PTR(rstr);
+	out->end = out->buf + rb_str_capacity(rstr) - BUFFER_EXTRA;
+	out->allocated = false;
+    } else if (NULL == local->dump_buf_owner) {
+	local->dump_buf_owner = out;
+	if (NULL != local->dump_buf) {
+	    out->buf = local->dump_buf;
+	    out->end = local->dump_buf + local->dump_buf_size;
+	    out->allocated = true;
+	    local->dump_buf = NULL;
+	}
+    }
+    ds.obj = obj;
+    ds.copts = copts;
+    ds.out = out;
+    ds.local = local;
+    ds.argc = argc;
+    ds.argv = argv;
+    rstr = rb_ensure(dump_str_body, (VALUE)&ds, dump_str_ensure, (VALUE)&ds);
+    out->str = Qnil;
+
+    return rstr;
+}
+
+// Writes all of buf to the fd, continuing after partial writes and waiting
+// for a non-blocking fd to take more. Returns 0 or the errno of the failure.
+int
+oj_write_all(int fd, const char *buf, size_t len) {
+    while (0 < len) {
+	ssize_t	cnt = write(fd, buf, len);
+
+	if (0 > cnt) {
+	    if (EINTR == errno) {
+		continue;
+	    }
+#if !IS_WINDOWS
+	    if (EAGAIN == errno || EWOULDBLOCK == errno) {
+		struct pollfd	pfd = { .fd = fd, .events = POLLOUT };
+
+		poll(&pfd, 1, -1);
+		continue;
+	    }
+#endif
+	    return errno;
+	}
+	buf += cnt;
+	len -= cnt;
+    }
+    return 0;
+}
+
+static void
+file_flush(Out out, const char *buf, size_t len) {
+    if (len != fwrite(buf, 1, len, (FILE*)out->flush_ctx)) {
+	rb_raise(rb_eIOError, "Write failed. [%d:%s]", errno, strerror(errno));
+    }
+}
+
+static void
+fd_flush(Out out, const char *buf, size_t len) {
+    int	err = oj_write_all(*(int*)out->flush_ctx, buf, len);
+
+    if (0 != err) {
+	rb_raise(rb_eIOError, "Write failed. [%d:%s]", err, strerror(err));
+    }
+}
+
+static void
+io_flush(Out out, const char *buf, size_t len) {
+    rb_funcall((VALUE)out->flush_ctx, oj_write_id, 1, rb_str_new(buf, len));
+}
+
+static void
+deflate_flush(Out out, const char *buf, size_t len) {
+    int	err = oj_deflate((Deflater)out->flush_ctx, buf, len, DEFLATE_MORE);
+
+    if (0 != err) {
+	rb_raise(rb_eIOError, "Write failed. [%d:%s]", err, strerror(err));
+    }
+}
+
+static int
+deflate_to_file(void *ctx, const char *buf, size_t len) {
+    return (len == fwrite(buf, 1, len, (FILE*)ctx)) ? 0 : errno;
+}
+
+typedef struct _dumpFlush {
+    VALUE	obj;
+    Options	copts;
+    Out		out;
+} *DumpFlush;
+
+static VALUE
+dump_flush_body(VALUE x) {
+    DumpFlush	df = (DumpFlush)x;
+    Out		out = df->out;
+
+    oj_dump_obj_to_json(df->obj, df->copts, out);
+    if (out->buf < out->cur) {
+	out->flush(out, out->buf, out->cur - out->buf);
+    }
+    if (deflate_flush == out->flush) {
+	int	err = oj_deflate((Deflater)out->flush_ctx, NULL, 0, DEFLATE_FINISH);
+
+	if (0 != err) {
+	    rb_raise(rb_eIOError, "Write failed. [%d:%s]", err, strerror(err));
+	}
+    }
+    return Qnil;
+}
+
+// Dumps to the flush function which is called each time the buffer reaches
+// OUT_FLUSH_LIMIT and once at the end so the memory used does not depend on
+// the size of the output. The buffer is freed even if the dump or a write
+// raises. Returns the rb_protect state.
+static int
+dump_to_flush(VALUE obj, Options copts, OutFlush flush, void *ctx) {
+    char		buf[4096];
+    struct _out		out;
+    struct _dumpFlush	df;
+    int			state = 0;
 
     out.buf = buf;
     out.end = buf + sizeof(buf) - BUFFER_EXTRA;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = flush;
+    out.flush_ctx = ctx;
+    out.flush_limit = OUT_FLUSH_LIMIT;
     out.omit_nil = copts->dump_opts.omit_nil;
-    oj_dump_obj_to_json(obj, copts, &out);
-    size = out.cur - out.buf;
-    if (0 == (f = fopen(path, "w"))) {
-	if (out.allocated) {
-	    xfree(out.buf);
-	}
-	rb_raise(rb_eIOError, "%s", strerror(errno));
-    }
-    ok = (size == fwrite(out.buf, 1, size, f));
+    df.obj = obj;
+    df.copts = copts;
+    df.out = &out;
+    rb_protect(dump_flush_body, (VALUE)&df, &state);
     if (out.allocated) {
 	xfree(out.buf);
     }
-    fclose(f);
-    if (!ok) {
-	int	err = ferror(f);
+    return state;
+}
 
-	rb_raise(rb_eIOError, "Write failed. [%d:%s]", err, strerror(err));
+// Dumps through a deflater that hands the compressed bytes to write.
+static int
+dump_to_deflater(VALUE obj, Options copts, Compression compression, DeflateWrite write, void *ctx) {
+    struct _deflater	d;
+    int			state;
+
+    oj_deflater_init(&d, compression, write, ctx);
+    state = dump_to_flush(obj, copts, deflate_flush, &d);
+    oj_deflater_cleanup(&d);
+
+    return state;
+}
+
+void
+oj_write_obj_to_file(VALUE obj, const char *path, Options copts, Compression compression) {
+    FILE	*f;
+    int		state;
+
+    if (0 == (f = fopen(path, "w"))) {
+	rb_raise(rb_eIOError, "%s", strerror(errno));
+    }
+    if (NO_COMPRESS == compression) {
+	state = dump_to_flush(obj, copts, file_flush, f);
+    } else {
+	state = dump_to_deflater(obj, copts, compression, deflate_to_file, f);
+    }
+    if (0 != fclose(f) && 0 == state) {
+	rb_raise(rb_eIOError, "Write failed. [%d:%s]", errno, strerror(errno));
+    }
+    if (0 != state) {
+	rb_jump_tag(state);
     }
 }
 
 void
-oj_write_obj_to_stream(VALUE obj, VALUE stream, Options copts) {
-    char	buf[4096];
-    struct _out out;
-    ssize_t	size;
+oj_write_obj_to_stream(VALUE obj, VALUE stream, Options copts, Compression compression) {
     VALUE	clas = rb_obj_class(stream);
+    int		state = 0;
 #if !IS_WINDOWS
     int		fd;
     VALUE	s;
 #endif
 
-    out.buf = buf;
-    out.end = buf + sizeof(buf) - BUFFER_EXTRA;
-    out.allocated = false;
-    out.omit_nil = copts->dump_opts.omit_nil;
-    oj_dump_obj_to_json(obj, copts, &out);
-    size = out.cur - out.buf;
     if (oj_stringio_class == clas) {
-	rb_funcall(stream, oj_write_id, 1, rb_str_new(out.buf, size));
+	if (NO_COMPRESS == compression) {
+	    state = dump_to_flush(obj, copts, io_flush, (void*)stream);
+	} else {
+	    state = dump_to_deflater(obj, copts, compression, oj_deflate_to_io, (void*)stream);
+	}
 #if !IS_WINDOWS
     } else if (rb_respond_to(stream, oj_fileno_id) &&
 	       Qnil != (s = rb_funcall(stream, oj_fileno_id, 0)) &&
 	       0 != (fd = FIX2INT(s))) {
-	if (size != write(fd, out.buf, size)) {
-	    if (out.allocated) {
-		xfree(out.buf);
-	    }
-	    rb_raise(rb_eIOError, "Write failed. [%d:%s]", errno, strerror(errno));
+	if (NO_COMPRESS == compression) {
+	    state = dump_to_flush(obj, copts, fd_flush, &fd);
+	} else {
+	    state = dump_to_deflater(obj, copts, compression, oj_deflate_to_fd, (void*)(intptr_t)fd);
 	}
 #endif
     } else if (rb_respond_to(stream, oj_write_id)) {
-	rb_funcall(stream, oj_write_id, 1, rb_str_new(out.buf, size));
-    } else {
-	if (out.allocated) {
-	    xfree(out.buf);
+	if (NO_COMPRESS == compression) {
+	    state = dump_to_flush(obj, copts, io_flush, (void*)stream);
+	} else {
+	    state = dump_to_deflater(obj, copts, compression, oj_deflate_to_io, (void*)stream);
 	}
+    } else {
 	rb_raise(rb_eArgError, "to_stream() expected an IO Object.");
     }
-    if (out.allocated) {
-	xfree(out.buf);
+    if (0 != state) {
+	rb_jump_tag(state);
     }
 }
 
@@ -743,7 +989,13 @@ debug_raise(const char *orig, size_t cnt, int line) {
 
 void
 oj_dump_raw_json(VALUE obj, int depth, Out out) {
-    if (oj_string_writer_class == rb_obj_class(obj)) {
+    VALUE	clas = rb_obj_class(obj);
+
+    if (oj_raw_json_class == clas) {
+	volatile VALUE	jv = rb_ivar_get(obj, oj_json_ivar_id);
+
+	oj_dump_raw(rb_string_value_ptr((VALUE*)&jv), (size_t)RSTRING_LEN(jv), out);
+    } else if (oj_string_writer_class == clas) {
 	StrWriter	sw = (StrWriter)DATA_PTR(obj);
 	size_t		len = sw->out.cur - sw->out.buf;
 
@@ -765,185 +1017,277 @@ oj_dump_raw_json(VALUE obj, int depth, Out out) {
     }
 }
 
-void
-oj_dump_cstr(const char *str, size_t cnt, bool is_sym, bool escape1, Out out) {
-    size_t	size;
-    char	*cmap;
-    const char	*orig = str;
-    bool	has_hi = false;
+// Bytes that may need escaping beyond the control characters, '"', and '\\'
+// which always stop a scan.
+typedef enum {
+    SCAN_HI	= 0x01, // high bit set
+    SCAN_DEL	= 0x02, // 0x7F
+    SCAN_HTML	= 0x04, // & < >
+    SCAN_SLASH	= 0x08, // /
+} ScanFlag;
+
+// Returns the first byte at or after str that is not a '1' in the cmap or
+// that is a high bit byte when flags has SCAN_HI. The scalar scan is exact.
+// The SIMD scans stop on a superset of those bytes and may return a byte
+// that only needs to be copied, which the caller handles.
+inline static const char*
+scan_clean_noSIMD(const char *str, const char *end, const char *cmap, int flags) {
+    if (0 != (SCAN_HI & flags)) {
+	for (; str < end && '1' == cmap[(uint8_t)*str] && 0 == (0x80 & *str); str++) {
+	}
+    } else {
+	for (; str < end && '1' == cmap[(uint8_t)*str]; str++) {
+	}
+    }
+    return str;
+}
 
+#ifdef OJ_USE_SSE2
+inline static const char*
+scan_clean_SSE2(const char *str, const char *end, const char *cmap, int flags) {
+    const __m128i	ctrl = _mm_set1_epi8(0x1F);
+    const __m128i	quote = _mm_set1_epi8('"');
+    const __m128i	back = _mm_set1_epi8('\\');
+    const __m128i	del = _mm_set1_epi8(0x7F);
+    const __m128i	amp = _mm_set1_epi8('&');
+    const __m128i	lt = _mm_set1_epi8('<');
+    const __m128i	gt = _mm_set1_epi8('>');
+    const __m128i	slash = _mm_set1_epi8('/');
+
+    for (; str + 16 <= end; str += 16) {
+	__m128i	chunk = _mm_loadu_si128((const __m128i*)str);
+	// A byte is a control character if max(byte, 0x1F) is 0x1F.
+	__m128i	hits = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(chunk, ctrl), ctrl),
+				    _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, back)));
+	int	mask;
+
+	if (0 != (SCAN_DEL & flags)) {
+	    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, del));
+	}
+	if (0 != (SCAN_HTML & flags)) {
+	    hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(chunk, amp),
+						   _mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, gt))));
+	}
+	if (0 != (SCAN_SLASH & flags)) {
+	    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, slash));
+	}
+	mask = _mm_movemask_epi8(hits);
+	if (0 != (SCAN_HI & flags)) {
+	    mask |= _mm_movemask_epi8(chunk);
+	}
+	if (0 != mask) {
+	    return str + __builtin_ctz(mask);
+	}
+    }
+    return scan_clean_noSIMD(str, end, cmap, flags);
+}
+#endif
+
+#ifdef OJ_USE_NEON
+inline static const char*
+scan_clean_NEON(const char *str, const char *end, const char *cmap, int flags) {
+    const uint8x16_t	ctrl = vdupq_n_u8(0x20);
+    const uint8x16_t	quote = vdupq_n_u8('"');
+    const uint8x16_t	back = vdupq_n_u8('\\');
+    const uint8x16_t	del = vdupq_n_u8(0x7F);
+    const uint8x16_t	amp = vdupq_n_u8('&');
+    const uint8x16_t	lt = vdupq_n_u8('<');
+    const uint8x16_t	gt = vdupq_n_u8('>');
+    const uint8x16_t	slash = vdupq_n_u8('/');
+    const uint8x16_t	hi = vdupq_n_u8(0x80);
+
+    for (; str + 16 <= end; str += 16) {
+	uint8x16_t	chunk = vld1q_u8((const uint8_t*)str);
+	uint8x16_t	hits = vorrq_u8(vcltq_u8(chunk, ctrl), vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, back)));
+
+	if (0 != (SCAN_DEL & flags)) {
+	    hits = vorrq_u8(hits, vceqq_u8(chunk, del));
+	}
+	if (0 != (SCAN_HTML & flags)) {
+	    hits = vorrq_u8(hits, vorrq_u8(vceqq_u8(chunk, amp), vorrq_u8(vceqq_u8(chunk, lt), vceqq_u8(chunk, gt))));
+	}
+	if (0 != (SCAN_SLASH & flags)) {
+	    hits = vorrq_u8(hits, vceqq_u8(chunk, slash));
+	}
+	if (0 != (SCAN_HI & flags)) {
+	    hits = vorrq_u8(hits, vcgeq_u8(chunk, hi));
+	}
+	if (0 != vmaxvq_u8(hits)) {
+	    // At least one hit in this block so let the scalar scan find it.
+	    return scan_clean_noSIMD(str, str + 16, cmap, flags);
+	}
+    }
+    return scan_clean_noSIMD(str, end, cmap, flags);
+}
+#endif
+
+inline static const char*
+scan_clean(const char *str, const char *end, const char *cmap, int flags) {
+#if defined(OJ_USE_NEON)
+    return scan_clean_NEON(str, end, cmap, flags);
+#elif defined(OJ_USE_SSE2)
+    return scan_clean_SSE2(str, end, cmap, flags);
+#else
+    return scan_clean_noSIMD(str, end, cmap, flags);
+#endif
+}
+
+// Returns the character map for the escape mode and sets the flags of the
+// characters a vectorized scan must stop on.
+static char*
+escape_cmap(Out out, int *flags) {
     switch (out->opts->escape_mode) {
     case NLEsc:
-	cmap = newline_friendly_chars;
-	size = newline_friendly_size((uint8_t*)str, cnt);
-	break;
+	*flags = 0;
+	return newline_friendly_chars;
     case ASCIIEsc:
-	cmap = ascii_friendly_chars;
-	size = ascii_friendly_size((uint8_t*)str, cnt);
-	break;
+	*flags = SCAN_HI | SCAN_DEL;
+	return ascii_friendly_chars;
     case XSSEsc:
-	cmap = xss_friendly_chars;
-	size = xss_friendly_size((uint8_t*)str, cnt);
-	break;
+	*flags = SCAN_HI | SCAN_DEL | SCAN_HTML | SCAN_SLASH;
+	return xss_friendly_chars;
     case JXEsc:
-	cmap = hixss_friendly_chars;
-	size = hixss_friendly_size((uint8_t*)str, cnt);
-	break;
-    case RailsXEsc: {
-	long	sz;
-
-	cmap = rails_xss_friendly_chars;
-	sz = rails_xss_friendly_size((uint8_t*)str, cnt);
-	if (sz < 0) {
-	    has_hi = true;
-	    size = (size_t)-sz;
-	} else {
-	    size = (size_t)sz;
-	}
-	break;
-    }
+	*flags = SCAN_HI;
+	return hixss_friendly_chars;
+    case RailsXEsc:
+	*flags = SCAN_HI | SCAN_HTML;
+	return rails_xss_friendly_chars;
     case RailsEsc:
-	cmap = rails_friendly_chars;
-	size = rails_friendly_size((uint8_t*)str, cnt);
-	break;
+	*flags = 0;
+	return rails_friendly_chars;
     case JSONEsc:
     default:
-	cmap = hibit_friendly_chars;
-	size = hibit_friendly_size((uint8_t*)str, cnt);
+	*flags = 0;
+	return hibit_friendly_chars;
     }
-    assure_size(out, size + BUFFER_EXTRA);
-    *out->cur++ = '"';
+}
 
-    if (escape1) {
-	*out->cur++ = '\\';
-	*out->cur++ = 'u';
-	*out->cur++ = '0';
-	*out->cur++ = '0';
-	dump_hex((uint8_t)*str, out);
-	cnt--;
-	size--;
-	str++;
-	is_sym = 0; // just to make sure
-    }
-    if (cnt == size && !has_hi) {
-	if (is_sym) {
-	    *out->cur++ = ':';
-	}
-	for (; '\0' != *str; str++) {
-	    *out->cur++ = *str;
-	}
-	*out->cur++ = '"';
-    } else {
-	const char	*end = str + cnt;
-	const char	*check_start = str;
+#define CSTR_FUNC	dump_cstr_json
+#define CSTR_CMAP	hibit_friendly_chars
+#define CSTR_FLAGS	0
+#define CSTR_CHECK	false
+#include "dump_cstr.h"
+
+#define CSTR_FUNC	dump_cstr_nl
+#define CSTR_CMAP	newline_friendly_chars
+#define CSTR_FLAGS	0
+#define CSTR_CHECK	false
+#include "dump_cstr.h"
+
+#define CSTR_FUNC	dump_cstr_rails
+#define CSTR_CMAP	rails_friendly_chars
+#define CSTR_FLAGS	0
+#define CSTR_CHECK	false
+#include "dump_cstr.h"
+
+#define CSTR_FUNC	dump_cstr_ascii
+#define CSTR_CMAP	ascii_friendly_chars
+#define CSTR_FLAGS	(SCAN_HI | SCAN_DEL)
+#define CSTR_CHECK	false
+#include "dump_cstr.h"
+
+#define CSTR_FUNC	dump_cstr_xss
+#define CSTR_CMAP	xss_friendly_chars
+#define CSTR_FLAGS	(SCAN_HI | SCAN_DEL | SCAN_HTML | SCAN_SLASH)
+#define CSTR_CHECK	false
+#include "dump_cstr.h"
+
+#define CSTR_FUNC	dump_cstr_jx
+#define CSTR_CMAP	hixss_friendly_chars
+#define CSTR_FLAGS	SCAN_HI
+#define CSTR_CHECK	true
+#include "dump_cstr.h"
+
+#define CSTR_FUNC	dump_cstr_rails_xss
+#define CSTR_CMAP	rails_xss_friendly_chars
+#define CSTR_FLAGS	(SCAN_HI | SCAN_HTML)
+#define CSTR_CHECK	true
+#include "dump_cstr.h"
+
+// The kernel is picked for each string instead of once per dump since rails
+// mode changes the escape mode part way through a dump.
+void
+oj_dump_cstr(const char *str, size_t cnt, bool is_sym, bool escape1, Out out) {
+    switch (out->opts->escape_mode) {
+    case NLEsc:		dump_cstr_nl(str, cnt, is_sym, escape1, out);		break;
+    case ASCIIEsc:	dump_cstr_ascii(str, cnt, is_sym, escape1, out);	break;
+    case XSSEsc:	dump_cstr_xss(str, cnt, is_sym, escape1, out);		break;
+    case JXEsc:		dump_cstr_jx(str, cnt, is_sym, escape1, out);		break;
+    case RailsXEsc:	dump_cstr_rails_xss(str, cnt, is_sym, escape1, out);	break;
+    case RailsEsc:	dump_cstr_rails(str, cnt, is_sym, escape1, out);	break;
+    case JSONEsc:
+    default:		dump_cstr_json(str, cnt, is_sym, escape1, out);		break;
+    }
+}
 
-	if (is_sym) {
-	    *out->cur++ = ':';
-	}
-	for (; str < end; str++) {
-	    switch (cmap[(uint8_t)*str]) {
-	    case '1':
-		if ((JXEsc == out->opts->escape_mode || RailsXEsc == out->opts->escape_mode) && check_start <= str) {
-		    if (0 != (0x80 & (uint8_t)*str)) {
-			if (0xC0 == (0xC0 & (uint8_t)*str)) {
-			    check_start = check_unicode(str, end, orig);
-			} else {
-			    raise_invalid_unicode(orig, (int)(end - orig), (int)(str - orig));
-			}
-		    }
-		}
-		*out->cur++ = *str;
-		break;
-	    case '2':
-		*out->cur++ = '\\';
-		switch (*str) {
-		case '\\':	*out->cur++ = '\\';	break;
-		case '\b':	*out->cur++ = 'b';	break;
-		case '\t':	*out->cur++ = 't';	break;
-		case '\n':	*out->cur++ = 'n';	break;
-		case '\f':	*out->cur++ = 'f';	break;
-		case '\r':	*out->cur++ = 'r';	break;
-		default:	*out->cur++ = *str;	break;
-		}
-		break;
-	    case '3': // Unicode
-		if (0xe2 == (uint8_t)*str && (JXEsc == out->opts->escape_mode || RailsXEsc == out->opts->escape_mode) && 2 <= end - str) {
-		    if (0x80 == (uint8_t)str[1] && (0xa8 == (uint8_t)str[2] || 0xa9 == (uint8_t)str[2])) {
-			str = dump_unicode(str, end, out, orig);
-		    } else {
-			check_start = check_unicode(str, end, orig);
-			*out->cur++ = *str;
-		    }
-		    break;
-		}
-		str = dump_unicode(str, end, out, orig);
-		break;
-	    case '6': // control characters
-		if (*(uint8_t*)str < 0x80) {
-		    *out->cur++ = '\\';
-		    *out->cur++ = 'u';
-		    *out->cur++ = '0';
-		    *out->cur++ = '0';
-		    dump_hex((uint8_t)*str, out);
-		} else {
-		    if (0xe2 == (uint8_t)*str && (JXEsc == out->opts->escape_mode || RailsXEsc == out->opts->escape_mode) && 2 <= end - str) {
-			if (0x80 == (uint8_t)str[1] && (0xa8 == (uint8_t)str[2] || 0xa9 == (uint8_t)str[2])) {
-			    str = dump_unicode(str, end, out, orig);
-			} else {
-			    check_start = check_unicode(str, end, orig);
-			    *out->cur++ = *str;
-			}
-			break;
-		    }
-		    str = dump_unicode(str, end, out, orig);
-		}
-		break;
-	    default:
-		break; // ignore, should never happen if the table is correct
-	    }
+static bool
+key_enc_ok(VALUE s) {
+    int	idx = rb_enc_get_index(s);
+
+    return idx == rb_utf8_encindex() || idx == rb_usascii_encindex();
+}
+
+// Returns true if the key is ASCII that the escape mode copies unchanged.
+static bool
+key_plain(const char *str, long len, Out out) {
+    int		flags;
+    const char	*cmap = escape_cmap(out, &flags);
+    const char	*end = str + len;
+
+    for (; str < end; str++) {
+	if (0x80 & *str || '1' != cmap[(uint8_t)*str]) {
+	    return false;
 	}
-	*out->cur++ = '"';
     }
-    if ((JXEsc == out->opts->escape_mode || RailsXEsc == out->opts->escape_mode) && 0 < str - orig && 0 != (0x80 & *(str - 1))) {
-	uint8_t	c = (uint8_t)*(str - 1);
-	int	i;
-	int	scnt = (int)(str - orig);
+    return true;
+}
 
-	// Last utf-8 characters must be 0x10xxxxxx. The start must be
-	// 0x110xxxxx for 2 characters, 0x1110xxxx for 3, and 0x11110xxx for
-	// 4.
-	if (0 != (0x40 & c)) {
-	    debug_raise(orig, cnt, __LINE__);
-	}
-	for (i = 1; i < (int)scnt && i < 4; i++) {
-	    c = str[-1 - i];
-	    if (0x80 != (0xC0 & c)) {
-		switch (i) {
-		case 1:
-		    if (0xC0 != (0xE0 & c)) {
-			debug_raise(orig, cnt, __LINE__);
-		    }
-		    break;
-		case 2:
-		    if (0xE0 != (0xF0 & c)) {
-			debug_raise(orig, cnt, __LINE__);
-		    }
-		    break;
-		case 3:
-		    if (0xF0 != (0xF8 & c)) {
-			debug_raise(orig, cnt, __LINE__);
-		    }
-		    break;
-		default: // can't get here
-		    break;
-		}
-		break;
-	    }
-	}
-	if (i == (int)scnt || 4 <= i) {
-	    debug_raise(orig, cnt, __LINE__);
+// Dumps a String or Symbol Hash key. Keys are usually repeated across the
+// Hashes of a record set so the quoted form of the short ones that need no
+// escapes is kept in the Out and copied on the next use. Static Symbols are
+// never collected so a match on the VALUE is enough, the bytes of anything
+// else are compared as well.
+void
+oj_dump_key(VALUE key, Out out) {
+    uint32_t		i = (uint32_t)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> (64 - KEY_CACHE_BITS));
+    uint64_t		bit = (uint64_t)1 << i;
+    KeySlot		slot = out->key_slots + i;
+    bool		sym = (T_SYMBOL == rb_type(key));
+    volatile VALUE	s;
+    const char		*str;
+    long		len;
+
+    if ((out->key_used & bit) && key == slot->key && sym && STATIC_SYM_P(key)) {
+	goto HIT;
+    }
+    s = sym ? rb_sym2str(key) : key;
+    str = RSTRING_PTR(s);
+    len = RSTRING_LEN(s);
+    if (!key_enc_ok(s)) {
+	if (sym) {
+	    oj_dump_cstr(str, (int)len, 0, 0, out);
+	} else {
+	    oj_dump_str(key, 0, out, false);
 	}
+	return;
+    }
+    if ((out->key_used & bit) && key == slot->key && len == slot->len && 0 == memcmp(str, slot->str, len)) {
+	goto HIT;
+    }
+    oj_dump_cstr(str, (int)len, 0, 0, out);
+    if (len <= KEY_CACHE_STR_MAX && key_plain(str, len, out)) {
+	slot->key = key;
+	slot->len = (uint8_t)len;
+	memcpy(slot->str, str, len);
+	out->key_used |= bit;
     }
+    return;
+HIT:
+    assure_size(out, slot->len + 2);
+    *out->cur++ = '"';
+    memcpy(out->cur, slot->str, slot->len);
+    out->cur += slot->len;
+    *out->cur++ = '"';
     *out->cur = '\0';
 }
 
@@ -958,6 +1302,7 @@ void
 oj_dump_obj_to_s(VALUE obj, Out out) {
     volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
+    oj_stats.to_s_calls++;
     oj_dump_cstr(rb_string_value_ptr((VALUE*)&rstr), (int)RSTRING_LEN(rstr), 0, 0, out);
 }
 
@@ -975,11 +1320,27 @@ oj_grow_out(Out out, size_t len) {
     long    pos = out->cur - out->buf;
     char    *buf = out->buf;
 
+    if (NULL != out->flush && out->flush_limit < size * 2 && OUT_FLUSH_KEEP < pos) {
+	// Write instead of growing past the limit. The last few bytes are kept
+	// since dumps look back to remove a trailing comma.
+	out->flush(out, out->buf, pos - OUT_FLUSH_KEEP);
+	oj_stats.bytes_dumped += pos - OUT_FLUSH_KEEP;
+	memmove(out->buf, out->cur - OUT_FLUSH_KEEP, OUT_FLUSH_KEEP);
+	out->cur = out->buf + OUT_FLUSH_KEEP;
+	if ((long)len < out->end - out->cur) {
+	    return;
+	}
+	pos = OUT_FLUSH_KEEP;
+    }
     size *= 2;
     if (size <= len * 2 + pos) {
 	size += len;
     }
-    if (out->allocated) {
+    if (Qnil != out->str) {
+	rb_str_set_len(out->str, pos);
+	rb_str_modify_expand(out->str, size + BUFFER_EXTRA - pos);
+	buf = RSTRING_PTR(out->str);
+    } else if (out->allocated) {
 	REALLOC_N(buf, char, (size + BUFFER_EXTRA));
     } else {
 	buf = ALLOC_N(char, (size + BUFFER_EXTRA));
@@ -992,6 +1353,8 @@ oj_grow_out(Out out, size_t len) {
     out->buf = buf;
     out->end = buf + size;
     out->cur = out->buf + pos;
+    oj_stats.out_grows++;
+    oj_stats.out_grow_bytes += size;
 }
 
 void
@@ -1028,43 +1391,30 @@ oj_dump_false(VALUE obj, int depth, Out out, bool as_ok) {
 void
 oj_dump_fixnum(VALUE obj, int depth, Out out, bool as_ok) {
     char	buf[32];
-    char	*b = buf + sizeof(buf) - 1;
+    char	*end = buf + sizeof(buf);
+    char	*b = end;
     long long	num = rb_num2ll(obj);
-    int		neg = 0;
     bool	dump_as_string = false;
 
     if (out->opts->int_range_max != 0 && out->opts->int_range_min != 0 &&
 	(out->opts->int_range_max < num || out->opts->int_range_min > num)) {
 	dump_as_string = true;
     }
-    if (0 > num) {
-	neg = 1;
-	num = -num;
-    }
-    *b-- = '\0';
-
     if (dump_as_string) {
-	*b-- = '"';
+	*--b = '"';
     }
-    if (0 < num) {
-	for (; 0 < num; num /= 10, b--) {
-	    *b = (num % 10) + '0';
-	}
-	if (neg) {
-	    *b = '-';
-	} else {
-	    b++;
-	}
+    if (0 > num) {
+	b = oj_ulong_digits(-(unsigned long long)num, b);
+	*--b = '-';
     } else {
-	*b = '0';
+	b = oj_ulong_digits((unsigned long long)num, b);
     }
     if (dump_as_string) {
 	*--b = '"';
     }
-    assure_size(out, (sizeof(buf) - (b - buf)));
-    for (; '\0' != *b; b++) {
-	*out->cur++ = *b;
-    }
+    assure_size(out, end - b);
+    memcpy(out->cur, b, end - b);
+    out->cur += end - b;
     *out->cur = '\0';
 }
 
@@ -1207,11 +1557,14 @@ oj_dump_float(VALUE obj, int depth, Out out, bool as_ok) {
 		break;
 	    }
 	}
+    } else if (ShortestFloat == out->opts->float_engine) {
+	cnt = oj_dump_float_shortest(d, buf);
     } else if (d == (double)(long long int)d) {
 	cnt = snprintf(buf, sizeof(buf), "%.1f", d);
     } else if (0 == out->opts->float_prec) {
 	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
+	oj_stats.to_s_calls++;
 	cnt = (int)RSTRING_LEN(rstr);
 	if ((int)sizeof(buf) <= cnt) {
 	    cnt = sizeof(buf) - 1;
@@ -1237,6 +1590,7 @@ oj_dump_float_printf(char *buf, size_t blen, VALUE obj, double d, const char *fo
     if (17 <= cnt && (0 == strcmp("0001", buf + cnt - 4) || 0 == strcmp("9999", buf + cnt - 4))) {
 	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
+	oj_stats.to_s_calls++;
 	strcpy(buf, rb_string_value_ptr((VALUE*)&rstr));
 	cnt = (int)RSTRING_LEN(rstr);
     }
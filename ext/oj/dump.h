@@ -3,6 +3,8 @@
 #ifndef OJ_DUMP_H
 #define OJ_DUMP_H
 
+#include <string.h>
+
 #include <ruby.h>
 
 #include "oj.h"
@@ -12,6 +14,11 @@
 // Extra padding at end of buffer.
 #define BUFFER_EXTRA 64
 
+// Dumps that flush as they go write once the buffer reaches OUT_FLUSH_LIMIT
+// but keep the last OUT_FLUSH_KEEP bytes.
+#define OUT_FLUSH_LIMIT	(64 * 1024)
+#define OUT_FLUSH_KEEP	16
+
 extern void	oj_dump_nil(VALUE obj, int depth, Out out, bool as_ok);
 extern void	oj_dump_true(VALUE obj, int depth, Out out, bool as_ok);
 extern void	oj_dump_false(VALUE obj, int depth, Out out, bool as_ok);
@@ -20,19 +27,25 @@ extern void	oj_dump_bignum(VALUE obj, int depth, Out out, bool as_ok);
 extern void	oj_dump_float(VALUE obj, int depth, Out out, bool as_ok);
 extern void	oj_dump_str(VALUE obj, int depth, Out out, bool as_ok);
 extern void	oj_dump_sym(VALUE obj, int depth, Out out, bool as_ok);
+extern void	oj_dump_key(VALUE key, Out out);
+extern int	oj_xml_time_str(char *buf, int64_t sec, long nsec, int prec, long tzsecs, bool zulu);
 extern void	oj_dump_class(VALUE obj, int depth, Out out, bool as_ok);
 
+extern int	oj_write_all(int fd, const char *buf, size_t len);
 extern void	oj_dump_raw(const char *str, size_t cnt, Out out);
 extern void	oj_dump_cstr(const char *str, size_t cnt, bool is_sym, bool escape1, Out out);
 extern void	oj_dump_ruby_time(VALUE obj, Out out);
 extern void	oj_dump_xml_time(VALUE obj, Out out);
 extern void	oj_dump_time(VALUE obj, Out out, int withZone);
+extern void	oj_dump_epoch(int64_t sec, long long nsec, bool with_zone, long tzsecs, Out out);
 extern void	oj_dump_obj_to_s(VALUE obj, Out out);
 
 extern const char*	oj_nan_str(VALUE obj, int opt, int mode, bool plus, int *lenp);
 
 extern void	oj_grow_out(Out out, size_t len);
 extern long	oj_check_circular(VALUE obj, Out out);
+extern void	oj_circ_cleanup(Out out);
+extern VALUE	oj_dump_to_str(VALUE obj, Options copts, Out out, int argc, VALUE *argv);
 
 extern void	oj_dump_strict_val(VALUE obj, int depth, Out out);
 extern void	oj_dump_null_val(VALUE obj, int depth, Out out);
@@ -44,14 +57,20 @@ extern void	oj_dump_wab_val(VALUE obj, int depth, Out out);
 
 extern void	oj_dump_raw_json(VALUE obj, int depth, Out out);
 
+extern VALUE	oj_mimic_to_json_method;
+extern void	oj_mimic_object_dump(VALUE obj, int argc, VALUE *argv, Out dest);
+
 extern VALUE	oj_add_to_json(int argc, VALUE *argv, VALUE self);
 extern VALUE	oj_remove_to_json(int argc, VALUE *argv, VALUE self);
 
 extern int	oj_dump_float_printf(char *buf, size_t blen, VALUE obj, double d, const char *format);
+extern int	oj_dump_float_shortest(double d, char *buf);
 
 extern bool	oj_dump_ignore(Options opts, VALUE obj);
 extern time_t	oj_sec_from_time_hard_way(VALUE obj);
 
+extern const char	oj_digit_pairs[201];
+
 inline static void
 assure_size(Out out, size_t len) {
     if (out->end - out->cur <= (long)len) {
@@ -59,34 +78,53 @@ assure_size(Out out, size_t len) {
     }
 }
 
+// True when nothing but a comma is written between the elements of a
+// container so the compact loops can be used.
+inline static bool
+dump_compact(Out out) {
+    return 0 == out->indent && !out->opts->dump_opts.use;
+}
+
 inline static void
 fill_indent(Out out, int cnt) {
     if (0 < out->indent) {
 	cnt *= out->indent;
 	*out->cur++ = '\n';
-	for (; 0 < cnt; cnt--) {
-	    *out->cur++ = ' ';
-	}
+	memset(out->cur, ' ', cnt);
+	out->cur += cnt;
     }
 }
 
+// Writes the decimal digits of num two at a time so that they end just
+// before end and returns the first digit.
+inline static char*
+oj_ulong_digits(uint64_t num, char *end) {
+    char	*b = end;
+
+    while (100 <= num) {
+	const char	*d = oj_digit_pairs + (num % 100) * 2;
+
+	num /= 100;
+	*--b = d[1];
+	*--b = d[0];
+    }
+    if (10 <= num) {
+	*--b = oj_digit_pairs[num * 2 + 1];
+	*--b = oj_digit_pairs[num * 2];
+    } else {
+	*--b = '0' + (char)num;
+    }
+    return b;
+}
+
 inline static void
 dump_ulong(unsigned long num, Out out) {
     char	buf[32];
-    char	*b = buf + sizeof(buf) - 1;
-
-    *b-- = '\0';
-    if (0 < num) {
-	for (; 0 < num; num /= 10, b--) {
-	    *b = (num % 10) + '0';
-	}
-	b++;
-    } else {
-	*b = '0';
-    }
-    for (; '\0' != *b; b++) {
-	*out->cur++ = *b;
-    }
+    char	*end = buf + sizeof(buf);
+    char	*b = oj_ulong_digits(num, end);
+
+    memcpy(out->cur, b, end - b);
+    out->cur += end - b;
     *out->cur = '\0';
 }
 
@@ -2,7 +2,9 @@
 
 #include "code.h"
 #include "dump.h"
+#include "local.h"
 #include "rails.h"
+#include "stats.h"
 #include "trace.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
@@ -110,6 +112,28 @@ dump_values_array(VALUE *values, int depth, Out out) {
     }
 }
 
+// Returns true if the to_json objects of the class (or singleton class) use
+// is the Object#to_json defined by mimic_JSON. The answer is kept in the Out
+// so the method is looked up once per class for each dump.
+static bool
+own_to_json(Out out, VALUE clas) {
+    uint32_t	i = (uint32_t)(((uint64_t)clas * 0x9E3779B97F4A7C15ULL) >> (64 - TJ_CACHE_BITS));
+    uint8_t	bit = (uint8_t)(1 << i);
+    TjSlot	slot = out->tj_slots + i;
+
+    if (Qnil == oj_mimic_to_json_method) {
+	return false;
+    }
+    if ((out->tj_used & bit) && clas == slot->clas) {
+	return slot->own;
+    }
+    slot->clas = clas;
+    slot->own = rb_equal(rb_funcall(clas, oj_instance_method_id, 1, ID2SYM(oj_to_json_id)), oj_mimic_to_json_method);
+    out->tj_used |= bit;
+
+    return slot->own;
+}
+
 static void
 dump_to_json(VALUE obj, Out out) {
     volatile VALUE	rs;
@@ -119,6 +143,15 @@ dump_to_json(VALUE obj, Out out) {
     if (Yes == out->opts->trace) {
 	oj_trace("to_json", obj, __FILE__, __LINE__, 0, TraceRubyIn);
     }
+    if (own_to_json(out, CLASS_OF(obj))) {
+	// Same output as calling it but without the call or the String.
+	oj_mimic_object_dump(obj, out->argc, out->argv, out);
+	if (Yes == out->opts->trace) {
+	    oj_trace("to_json", obj, __FILE__, __LINE__, 0, TraceRubyOut);
+	}
+	return;
+    }
+    oj_stats.to_json_calls++;
     if (0 == rb_obj_method_arity(obj, oj_to_json_id)) {
 	rs = rb_funcall(obj, oj_to_json_id, 0);
     } else {
@@ -157,6 +190,16 @@ dump_array(VALUE a, int depth, Out out, bool as_ok) {
     assure_size(out, 2);
     if (0 == cnt) {
 	*out->cur++ = ']';
+    } else if (dump_compact(out)) {
+	for (i = 0; i < cnt; i++) {
+	    assure_size(out, 2);
+	    if (0 < i) {
+		*out->cur++ = ',';
+	    }
+	    oj_dump_compat_val(rb_ary_entry(a, i), d2, out, true);
+	}
+	assure_size(out, 1);
+	*out->cur++ = ']';
     } else {
 	if (out->opts->dump_opts.use) {
 	    size = d2 * out->opts->dump_opts.indent_size + out->opts->dump_opts.array_size + 1;
@@ -507,6 +550,9 @@ VALUE
 oj_add_to_json(int argc, VALUE *argv, VALUE self) {
     Code	a;
 
+    oj_main_ractor_check("Oj.add_to_json");
+    // Class entries are resolved below so earlier look ups are stale.
+    oj_code_cache_clear();
     if (0 == argc) {
 	for (a = oj_compat_codes; NULL != a->name; a++) {
 	    if (Qnil == a->clas || Qundef == a->clas) {
@@ -557,6 +603,7 @@ oj_add_to_json(int argc, VALUE *argv, VALUE self) {
 
 VALUE
 oj_remove_to_json(int argc, VALUE *argv, VALUE self) {
+    oj_main_ractor_check("Oj.remove_to_json");
     if (0 == argc) {
 	oj_code_set_active(oj_compat_codes, Qnil, false);
 	use_struct_alt = false;
@@ -627,6 +674,8 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
 	} else {
 	    raise_json_err("NaN not allowed in JSON.", "GeneratorError");
 	}
+    } else if (ShortestFloat == out->opts->float_engine) {
+	cnt = oj_dump_float_shortest(d, buf);
     } else if (d == (double)(long long int)d) {
 	cnt = snprintf(buf, sizeof(buf), "%.1f", d);
     } else if (oj_rails_float_opt) {
@@ -634,6 +683,7 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
     } else {
 	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
+	oj_stats.to_s_calls++;
 	strcpy(buf, rb_string_value_ptr((VALUE*)&rstr));
 	cnt = (int)RSTRING_LEN(rstr);
     }
@@ -644,6 +694,29 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
     *out->cur = '\0';
 }
 
+// Used instead of hash_cb() for compact output without :omit_nil.
+static int
+compact_hash_cb(VALUE key, VALUE value, VALUE ov) {
+    Out	out = (Out)ov;
+    int	depth = out->depth;
+
+    switch (rb_type(key)) {
+    case T_STRING:
+    case T_SYMBOL:
+	oj_dump_key(key, out);
+	break;
+    default:
+	oj_dump_str(rb_funcall(key, oj_to_s_id, 0), 0, out, false);
+	break;
+    }
+    *out->cur++ = ':';
+    oj_dump_compat_val(value, depth, out, true);
+    out->depth = depth;
+    *out->cur++ = ',';
+
+    return ST_CONTINUE;
+}
+
 static int
 hash_cb(VALUE key, VALUE value, VALUE ov) {
     Out	out = (Out)ov;
@@ -671,10 +744,8 @@ hash_cb(VALUE key, VALUE value, VALUE ov) {
     }
     switch (rb_type(key)) {
     case T_STRING:
-	oj_dump_str(key, 0, out, false);
-	break;
     case T_SYMBOL:
-	oj_dump_sym(key, 0, out, false);
+	oj_dump_key(key, out);
 	break;
     default:
 	/*rb_raise(rb_eTypeError, "In :compat mode all Hash keys must be Strings or Symbols, not %s.\n", rb_class2name(rb_obj_class(key)));*/
@@ -723,7 +794,7 @@ dump_hash(VALUE obj, int depth, Out out, bool as_ok) {
     } else {
 	*out->cur++ = '{';
 	out->depth = depth + 1;
-	rb_hash_foreach(obj, hash_cb, (VALUE)out);
+	rb_hash_foreach(obj, (dump_compact(out) && !out->omit_nil) ? compact_hash_cb : hash_cb, (VALUE)out);
 	if (',' == *(out->cur - 1)) {
 	    out->cur--; // backup to overwrite last comma
 	}
@@ -754,6 +825,10 @@ dump_hash(VALUE obj, int depth, Out out, bool as_ok) {
 // called.
 static void
 dump_obj(VALUE obj, int depth, Out out, bool as_ok) {
+    if (oj_raw_json_class == rb_obj_class(obj)) {
+	oj_dump_raw_json(obj, depth, out);
+	return;
+    }
     if (oj_code_dump(oj_compat_codes, obj, depth, out)) {
 	return;
     }
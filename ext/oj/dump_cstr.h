@@ -0,0 +1,160 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+// The string dump kernel. This file is included by dump.c once for each
+// group of escape modes with the following defined so that the character
+// map and scan flags are constants and the escape mode is never tested while
+// dumping a string.
+//
+//   CSTR_FUNC	name of the function to define
+//   CSTR_CMAP	character map for the escape modes
+//   CSTR_FLAGS	ScanFlag bits the vectorized scan must stop on
+//   CSTR_CHECK	true if UTF-8 is validated as in the json gem modes
+//
+// There is no include guard as it is meant to be included more than once.
+
+static void
+CSTR_FUNC(const char *str, size_t cnt, bool is_sym, bool escape1, Out out) {
+    const char	*cmap = CSTR_CMAP;
+    const char	*orig = str;
+    const char	*end = str + cnt;
+    const char	*check_start = str;
+    const char	*clean;
+
+    // Enough for the string if nothing is escaped. The space is checked
+    // again before each escape for the rest of the string plus the longest
+    // escape so clean runs can always be copied without a check.
+    assure_size(out, cnt + BUFFER_EXTRA);
+    *out->cur++ = '"';
+
+    if (escape1) {
+	*out->cur++ = '\\';
+	*out->cur++ = 'u';
+	*out->cur++ = '0';
+	*out->cur++ = '0';
+	dump_hex((uint8_t)*str, out);
+	str++;
+	check_start = str;
+	is_sym = 0; // just to make sure
+    }
+    if (is_sym) {
+	*out->cur++ = ':';
+    }
+    while (str < end) {
+	if (str < (clean = scan_clean(str, end, cmap, CSTR_FLAGS))) {
+	    memcpy(out->cur, str, clean - str);
+	    out->cur += clean - str;
+	    if (end <= (str = clean)) {
+		break;
+	    }
+	}
+	assure_size(out, (end - str) + 16);
+	switch (cmap[(uint8_t)*str]) {
+	case '1':
+	    if (CSTR_CHECK && check_start <= str) {
+		if (0 != (0x80 & (uint8_t)*str)) {
+		    if (0xC0 == (0xC0 & (uint8_t)*str)) {
+			check_start = check_unicode(str, end, orig);
+		    } else {
+			raise_invalid_unicode(orig, (int)(end - orig), (int)(str - orig));
+		    }
+		}
+	    }
+	    *out->cur++ = *str;
+	    break;
+	case '2':
+	    *out->cur++ = '\\';
+	    switch (*str) {
+	    case '\\':	*out->cur++ = '\\';	break;
+	    case '\b':	*out->cur++ = 'b';	break;
+	    case '\t':	*out->cur++ = 't';	break;
+	    case '\n':	*out->cur++ = 'n';	break;
+	    case '\f':	*out->cur++ = 'f';	break;
+	    case '\r':	*out->cur++ = 'r';	break;
+	    default:	*out->cur++ = *str;	break;
+	    }
+	    break;
+	case '3': // Unicode
+	    if (CSTR_CHECK && 0xe2 == (uint8_t)*str && 2 <= end - str) {
+		if (0x80 == (uint8_t)str[1] && (0xa8 == (uint8_t)str[2] || 0xa9 == (uint8_t)str[2])) {
+		    str = dump_unicode(str, end, out, orig);
+		} else {
+		    check_start = check_unicode(str, end, orig);
+		    *out->cur++ = *str;
+		}
+		break;
+	    }
+	    str = dump_unicode(str, end, out, orig);
+	    break;
+	case '6': // control characters
+	    if (*(uint8_t*)str < 0x80) {
+		*out->cur++ = '\\';
+		*out->cur++ = 'u';
+		*out->cur++ = '0';
+		*out->cur++ = '0';
+		dump_hex((uint8_t)*str, out);
+	    } else {
+		if (CSTR_CHECK && 0xe2 == (uint8_t)*str && 2 <= end - str) {
+		    if (0x80 == (uint8_t)str[1] && (0xa8 == (uint8_t)str[2] || 0xa9 == (uint8_t)str[2])) {
+			str = dump_unicode(str, end, out, orig);
+		    } else {
+			check_start = check_unicode(str, end, orig);
+			*out->cur++ = *str;
+		    }
+		    break;
+		}
+		str = dump_unicode(str, end, out, orig);
+	    }
+	    break;
+	default:
+	    break; // ignore, should never happen if the table is correct
+	}
+	str++;
+    }
+    *out->cur++ = '"';
+    if (CSTR_CHECK && 0 < str - orig && 0 != (0x80 & *(str - 1))) {
+	uint8_t	c = (uint8_t)*(str - 1);
+	int	i;
+	int	scnt = (int)(str - orig);
+
+	// Last utf-8 characters must be 0x10xxxxxx. The start must be
+	// 0x110xxxxx for 2 characters, 0x1110xxxx for 3, and 0x11110xxx for
+	// 4.
+	if (0 != (0x40 & c)) {
+	    debug_raise(orig, cnt, __LINE__);
+	}
+	for (i = 1; i < (int)scnt && i < 4; i++) {
+	    c = str[-1 - i];
+	    if (0x80 != (0xC0 & c)) {
+		switch (i) {
+		case 1:
+		    if (0xC0 != (0xE0 & c)) {
+			debug_raise(orig, cnt, __LINE__);
+		    }
+		    break;
+		case 2:
+		    if (0xE0 != (0xF0 & c)) {
+			debug_raise(orig, cnt, __LINE__);
+		    }
+		    break;
+		case 3:
+		    if (0xF0 != (0xF8 & c)) {
+			debug_raise(orig, cnt, __LINE__);
+		    }
+		    break;
+		default: // can't get here
+		    break;
+		}
+		break;
+	    }
+	}
+	if (i == (int)scnt || 4 <= i) {
+	    debug_raise(orig, cnt, __LINE__);
+	}
+    }
+    *out->cur = '\0';
+}
+
+#undef CSTR_FUNC
+#undef CSTR_CMAP
+#undef CSTR_FLAGS
+#undef CSTR_CHECK
@@ -231,6 +231,8 @@ oj_write_leaf_to_file(Leaf leaf, const char *path, Options copts) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - BUFFER_EXTRA;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts->dump_opts.omit_nil;
     oj_dump_leaf_to_json(leaf, copts, &out);
     size = out.cur - out.buf;
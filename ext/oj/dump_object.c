@@ -65,6 +65,10 @@ static void
 dump_obj(VALUE obj, int depth, Out out, bool as_ok) {
     VALUE	clas = rb_obj_class(obj);
 
+    if (oj_raw_json_class == clas) {
+	oj_dump_raw_json(obj, depth, out);
+	return;
+    }
     if (oj_bigdecimal_class == clas) {
 	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 	const char	*str = rb_string_value_ptr((VALUE*)&rstr);
@@ -166,7 +170,11 @@ dump_array_class(VALUE a, VALUE clas, int depth, Out out) {
 		*out->cur++ = ',';
 	    }
 	}
-	size = depth * out->indent + 1;
+	if (out->opts->dump_opts.use) {
+	    size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.array_size + 1;
+	} else {
+	    size = depth * out->indent + 1;
+	}
 	assure_size(out, size);
 	if (out->opts->dump_opts.use) {
 	    //printf("*** d2: %u  indent: %u '%s'\n", d2, out->opts->dump_opts->indent_size, out->opts->dump_opts->indent);
@@ -397,12 +405,12 @@ dump_hash(VALUE obj, int depth, Out out, bool as_ok) {
 
 static void
 dump_odd(VALUE obj, Odd odd, VALUE clas, int depth, Out out) {
-    ID			*idp;
-    AttrGetFunc		*fp;
     volatile VALUE	v;
     const char		*name;
+    size_t		nlen;
     size_t		size;
     int			d2 = depth + 1;
+    int			i;
 
     assure_size(out, 2);
     *out->cur++ = '{';
@@ -445,44 +453,11 @@ dump_odd(VALUE obj, Odd odd, VALUE clas, int depth, Out out) {
 	}
     } else {
 	size = d2 * out->indent + 1;
-	for (idp = odd->attrs, fp = odd->attrFuncs; 0 != *idp; idp++, fp++) {
-	    size_t	nlen;
-
+	for (i = 0; i < odd->attr_cnt; i++) {
 	    assure_size(out, size);
-	    name = rb_id2name(*idp);
-	    nlen = strlen(name);
-	    if (0 != *fp) {
-		v = (*fp)(obj);
-	    } else if (0 == strchr(name, '.')) {
-		v = rb_funcall(obj, *idp, 0);
-	    } else {
-		char	nbuf[256];
-		char	*n2 = nbuf;
-		char	*n;
-		char	*end;
-		ID	i;
-
-		if (sizeof(nbuf) <= nlen) {
-		    if (NULL == (n2 = strdup(name))) {
-			rb_raise(rb_eNoMemError, "for attribute name.");
-		    }
-		} else {
-		    strcpy(n2, name);
-		}
-		n = n2;
-		v = obj;
-		while (0 != (end = strchr(n, '.'))) {
-		    *end = '\0';
-		    i = rb_intern(n);
-		    v = rb_funcall(v, i, 0);
-		    n = end + 1;
-		}
-		i = rb_intern(n);
-		v = rb_funcall(v, i, 0);
-		if (nbuf != n2) {
-		    free(n2);
-		}
-	    }
+	    name = odd->attr_names[i];
+	    nlen = odd->attr_lens[i];
+	    v = oj_odd_get_attr(odd, i, obj);
 	    fill_indent(out, d2);
 	    oj_dump_cstr(name, nlen, 0, 0, out);
 	    *out->cur++ = ':';
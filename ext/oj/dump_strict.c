@@ -9,6 +9,7 @@
 #include <errno.h>
 
 #include "dump.h"
+#include "stats.h"
 #include "trace.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
@@ -94,11 +95,14 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
 		cnt = sizeof(nan_val) - 1;
 		break;
 	    }
+	} else if (ShortestFloat == out->opts->float_engine) {
+	    cnt = oj_dump_float_shortest(d, buf);
 	} else if (d == (double)(long long int)d) {
 	    cnt = snprintf(buf, sizeof(buf), "%.1f", d);
 	} else if (0 == out->opts->float_prec) {
 	    volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
+	    oj_stats.to_s_calls++;
 	    cnt = (int)RSTRING_LEN(rstr);
 	    if ((int)sizeof(buf) <= cnt) {
 		cnt = sizeof(buf) - 1;
@@ -134,6 +138,18 @@ dump_array(VALUE a, int depth, Out out, bool as_ok) {
     assure_size(out, size);
     if (0 == cnt) {
 	*out->cur++ = ']';
+    } else if (dump_compact(out)) {
+	void	(*dump_val)(VALUE obj, int depth, Out out) = (NullMode == out->opts->mode) ? oj_dump_null_val : oj_dump_strict_val;
+
+	for (i = 0; i < cnt; i++) {
+	    assure_size(out, 2);
+	    if (0 < i) {
+		*out->cur++ = ',';
+	    }
+	    dump_val(rb_ary_entry(a, i), d2, out);
+	}
+	assure_size(out, 1);
+	*out->cur++ = ']';
     } else {
 	if (out->opts->dump_opts.use) {
 	    size = d2 * out->opts->dump_opts.indent_size + out->opts->dump_opts.array_size + 1;
@@ -167,7 +183,11 @@ dump_array(VALUE a, int depth, Out out, bool as_ok) {
 		*out->cur++ = ',';
 	    }
 	}
-	size = depth * out->indent + 1;
+	if (out->opts->dump_opts.use) {
+	    size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.array_size + 1;
+	} else {
+	    size = depth * out->indent + 1;
+	}
 	assure_size(out, size);
 	if (out->opts->dump_opts.use) {
 	    //printf("*** d2: %u  indent: %u '%s'\n", d2, out->opts->dump_opts->indent_size, out->opts->dump_opts->indent);
@@ -191,6 +211,29 @@ dump_array(VALUE a, int depth, Out out, bool as_ok) {
     *out->cur = '\0';
 }
 
+// Used instead of hash_cb() for compact output without :omit_nil.
+static int
+compact_hash_cb(VALUE key, VALUE value, VALUE ov) {
+    Out		out = (Out)ov;
+    int		depth = out->depth;
+    int		rtype = rb_type(key);
+
+    if (rtype != T_STRING && rtype != T_SYMBOL) {
+	rb_raise(rb_eTypeError, "In :strict and :null mode all Hash keys must be Strings or Symbols, not %s.\n", rb_class2name(rb_obj_class(key)));
+    }
+    oj_dump_key(key, out);
+    *out->cur++ = ':';
+    if (NullMode == out->opts->mode) {
+	oj_dump_null_val(value, depth, out);
+    } else {
+	oj_dump_strict_val(value, depth, out);
+    }
+    out->depth = depth;
+    *out->cur++ = ',';
+
+    return ST_CONTINUE;
+}
+
 static int
 hash_cb(VALUE key, VALUE value, VALUE ov) {
     Out		out = (Out)ov;
@@ -208,11 +251,7 @@ hash_cb(VALUE key, VALUE value, VALUE ov) {
 	size = depth * out->indent + 1;
 	assure_size(out, size);
 	fill_indent(out, depth);
-	if (rtype == T_STRING) {
-	    oj_dump_str(key, 0, out, false);
-	} else {
-	    oj_dump_sym(key, 0, out, false);
-	}
+	oj_dump_key(key, out);
 	*out->cur++ = ':';
     } else {
 	size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.hash_size + 1;
@@ -228,11 +267,7 @@ hash_cb(VALUE key, VALUE value, VALUE ov) {
 		out->cur += out->opts->dump_opts.indent_size;
 	    }
 	}
-	if (rtype == T_STRING) {
-	    oj_dump_str(key, 0, out, false);
-	} else {
-	    oj_dump_sym(key, 0, out, false);
-	}
+	oj_dump_key(key, out);
 	size = out->opts->dump_opts.before_size + out->opts->dump_opts.after_size + 2;
 	assure_size(out, size);
 	if (0 < out->opts->dump_opts.before_size) {
@@ -275,7 +310,7 @@ dump_hash(VALUE obj, int depth, Out out, bool as_ok) {
 	*out->cur++ = '}';
     } else {
 	out->depth = depth + 1;
-	rb_hash_foreach(obj, hash_cb, (VALUE)out);
+	rb_hash_foreach(obj, (dump_compact(out) && !out->omit_nil) ? compact_hash_cb : hash_cb, (VALUE)out);
 	if (',' == *(out->cur - 1)) {
 	    out->cur--; // backup to overwrite last comma
 	}
@@ -307,7 +342,9 @@ static void
 dump_data_strict(VALUE obj, int depth, Out out, bool as_ok) {
     VALUE	clas = rb_obj_class(obj);
 
-    if (oj_bigdecimal_class == clas) {
+    if (oj_raw_json_class == clas) {
+	oj_dump_raw_json(obj, depth, out);
+    } else if (oj_bigdecimal_class == clas) {
 	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
 	oj_dump_raw(rb_string_value_ptr((VALUE*)&rstr), (int)RSTRING_LEN(rstr), out);
@@ -320,7 +357,9 @@ static void
 dump_data_null(VALUE obj, int depth, Out out, bool as_ok) {
     VALUE	clas = rb_obj_class(obj);
 
-    if (oj_bigdecimal_class == clas) {
+    if (oj_raw_json_class == clas) {
+	oj_dump_raw_json(obj, depth, out);
+    } else if (oj_bigdecimal_class == clas) {
 	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
 	oj_dump_raw(rb_string_value_ptr((VALUE*)&rstr), (int)RSTRING_LEN(rstr), out);
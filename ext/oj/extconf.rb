@@ -29,8 +29,22 @@ have_func('rb_ivar_foreach')
 have_func('stpcpy')
 have_func('rb_data_object_wrap')
 have_func('pthread_mutex_init')
+have_func('rb_thread_call_without_gvl')
+have_func('rb_enc_interned_str')
+have_func('rb_check_symbol_cstr')
+have_func('rb_hash_bulk_insert')
+have_func('rb_ext_ractor_safe')
+
+# The :compression option reads and writes gzip when zlib is available.
+dflags['OJ_ZLIB'] = 1 if have_header('zlib.h') && have_library('z', 'inflate')
 
 dflags['OJ_DEBUG'] = true unless ENV['OJ_DEBUG'].nil?
+# The SIMD scanners are used when the platform supports them. Setting OJ_NO_SIMD
+# forces the scalar versions which is handy for comparisons.
+dflags['OJ_NO_SIMD'] = true unless ENV['OJ_NO_SIMD'].nil?
+# USDT probes are compiled in when the SystemTap sys/sdt.h is available unless
+# OJ_NO_USDT is set.
+dflags['OJ_USDT'] = 1 if ENV['OJ_NO_USDT'].nil? && have_macro('DTRACE_PROBE3', 'sys/sdt.h')
 
 dflags.each do |k,v|
   if v.nil?
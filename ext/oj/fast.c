@@ -15,15 +15,55 @@
 // maximum to allocate on the stack, arbitrary limit
 #define SMALL_XML	65536
 #define MAX_STACK	100
-//#define BATCH_SIZE	(4096 / sizeof(struct _leaf) - 1)
-#define BATCH_SIZE	100
+// Leaves are carved out of arena chunks. The first chunk is sized from the
+// JSON length and later ones double the leaves already allocated. Dense
+// documents have a leaf for every 5 or 6 bytes and ones with long strings
+// far fewer. A leaf takes 32 bytes so a first chunk of one leaf for every 16
+// bytes is about twice the JSON length and a dense document needs one more.
+#define BATCH_MIN	64
+#define BATCH_JSON_BYTES	16 // estimated JSON bytes per leaf
+// containers with fewer children are searched by walking the list
+#define INDEX_MIN	16
 
 typedef struct _batch {
     struct _batch	*next;
-    int			next_avail;
-    struct _leaf	leaves[BATCH_SIZE];
+    size_t		next_avail;
+    size_t		size;
+    struct _leaf	leaves[];
 } *Batch;
 
+// Children of a container in order and, for a hash, an open addressing
+// table of the children by key. Built on the first lookup in a container
+// with at least INDEX_MIN children.
+typedef struct _leafIndex {
+    size_t	cnt;
+    size_t	mask;
+    Leaf	*elements;
+    Leaf	*slots;	// NULL for arrays
+} *LeafIndex;
+
+typedef enum {
+    PATH_KEY	= 'k',
+    PATH_UP	= 'u',
+} PathType;
+
+// One step of a compiled path. The key is unescaped and is also used as
+// the index when it is all digits, otherwise the index is -1.
+typedef struct _pathStep {
+    const char	*key;
+    uint64_t	hash;
+    int		klen;
+    int		index;
+    char	type;
+} *PathStep;
+
+typedef struct _docPath {
+    VALUE		str;
+    bool		absolute;
+    int			cnt;
+    struct _pathStep	steps[];
+} *DocPath;
+
 typedef struct _doc {
     Leaf		data;
     Leaf		*where;	     // points to current location
@@ -32,7 +72,10 @@ typedef struct _doc {
     unsigned long	size;	     // number of leaves/branches in the doc
     VALUE		self;
     Batch		batches;
-    struct _batch	batch0;
+    size_t		batch_size;  // leaves in the next chunk
+    LeafIndex		*indexes;
+    uint32_t		icnt;
+    uint32_t		isize;
 } *Doc;
 
 typedef struct _parseInfo {
@@ -64,14 +107,14 @@ static char*	read_quoted_value(ParseInfo pi);
 static void	skip_comment(ParseInfo pi);
 
 static VALUE	protect_open_proc(VALUE x);
-static VALUE	parse_json(VALUE clas, char *json, bool given, bool allocated);
+static VALUE	parse_json(VALUE clas, char *json, size_t len, bool given, bool allocated);
 static void	each_leaf(Doc doc, VALUE self);
 static int	move_step(Doc doc, const char *path, int loc);
 static Leaf	get_doc_leaf(Doc doc, const char *path);
-static Leaf	get_leaf(Leaf *stack, Leaf *lp, const char *path);
+static Leaf	get_leaf(Doc doc, Leaf *stack, Leaf *lp, const char *path);
 static void	each_value(Doc doc, Leaf leaf);
 
-static void	doc_init(Doc doc);
+static void	doc_init(Doc doc, size_t len);
 static void	doc_free(Doc doc);
 static VALUE	doc_open(VALUE clas, VALUE str);
 static VALUE	doc_open_file(VALUE clas, VALUE filename);
@@ -88,6 +131,7 @@ static VALUE	doc_dump(int argc, VALUE *argv, VALUE self);
 static VALUE	doc_size(VALUE self);
 
 VALUE	oj_doc_class = Qundef;
+static VALUE	doc_path_class = Qundef;
 
 // This is only for CentOS 5.4 with Ruby 1.9.3-p0.
 #ifndef HAVE_STPCPY
@@ -144,6 +188,7 @@ leaf_init(Leaf leaf, int type) {
     leaf->next = 0;
     leaf->rtype = type;
     leaf->parent_type = T_NONE;
+    leaf->lindex = 0;
     switch (type) {
     case T_ARRAY:
     case T_HASH:
@@ -175,14 +220,15 @@ inline static Leaf
 leaf_new(Doc doc, int type) {
     Leaf	leaf;
 
-    if (0 == doc->batches || BATCH_SIZE == doc->batches->next_avail) {
-	Batch	b = ALLOC(struct _batch);
+    if (0 == doc->batches || doc->batches->size == doc->batches->next_avail) {
+	// Not cleared since leaf_init() sets every field that is read.
+	Batch	b = (Batch)xmalloc(sizeof(struct _batch) + sizeof(struct _leaf) * doc->batch_size);
 
-	// Initializes all leaves with a NO_VAL value_type
-	memset(b, 0, sizeof(struct _batch));
 	b->next = doc->batches;
-	doc->batches = b;
 	b->next_avail = 0;
+	b->size = doc->batch_size;
+	doc->batches = b;
+	doc->batch_size *= 2;
     }
     leaf = &doc->batches->leaves[doc->batches->next_avail];
     doc->batches->next_avail++;
@@ -705,11 +751,15 @@ read_quoted_value(ParseInfo pi) {
 
 // doc support functions
 inline static void
-doc_init(Doc doc) {
+doc_init(Doc doc, size_t len) {
     memset(doc, 0, sizeof(struct _doc));
     doc->where = doc->where_path;
     doc->self = Qundef;
-    doc->batches = &doc->batch0;
+    doc->batches = NULL;
+    doc->batch_size = len / BATCH_JSON_BYTES;
+    if (BATCH_MIN > doc->batch_size) {
+	doc->batch_size = BATCH_MIN;
+    }
 }
 
 static void
@@ -719,9 +769,17 @@ doc_free(Doc doc) {
 
 	while (0 != (b = doc->batches)) {
 	    doc->batches = doc->batches->next;
-	    if (&doc->batch0 != b) {
-		xfree(b);
+	    xfree(b);
+	}
+	if (NULL != doc->indexes) {
+	    uint32_t	i;
+
+	    for (i = 0; i < doc->icnt; i++) {
+		xfree(doc->indexes[i]);
 	    }
+	    xfree(doc->indexes);
+	    doc->indexes = NULL;
+	    doc->icnt = 0;
 	}
 	//xfree(f);
     }
@@ -784,7 +842,7 @@ mark_doc(void *ptr) {
 }
 
 static VALUE
-parse_json(VALUE clas, char *json, bool given, bool allocated) {
+parse_json(VALUE clas, char *json, size_t len, bool given, bool allocated) {
     struct _parseInfo	pi;
     volatile VALUE	result = Qnil;
     Doc			doc;
@@ -805,7 +863,7 @@ parse_json(VALUE clas, char *json, bool given, bool allocated) {
 	pi.str = json;
     }
     pi.s = pi.str;
-    doc_init(doc);
+    doc_init(doc, len);
     pi.doc = doc;
 #if IS_WINDOWS
     pi.stack_min = (void*)((char*)&pi - (512 * 1024)); // assume a 1M stack and give half to ruby
@@ -846,35 +904,6 @@ parse_json(VALUE clas, char *json, bool given, bool allocated) {
     return result;
 }
 
-static Leaf
-get_doc_leaf(Doc doc, const char *path) {
-    Leaf	leaf = *doc->where;
-
-    if (0 != doc->data && 0 != path) {
-	Leaf	stack[MAX_STACK];
-	Leaf	*lp;
-
-	if ('/' == *path) {
-	    path++;
-	    *stack = doc->data;
-	    lp = stack;
-	} else if (doc->where == doc->where_path) {
-	    *stack = doc->data;
-	    lp = stack;
-	} else {
-	    size_t	cnt = doc->where - doc->where_path;
-
-	    if (MAX_STACK <= cnt) {
-		rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
-	    }
-	    memcpy(stack, doc->where_path, sizeof(Leaf) * (cnt + 1));
-	    lp = stack + cnt;
-	}
-	return get_leaf(stack, lp, path);
-    }
-    return leaf;
-}
-
 static const char*
 next_slash(const char *s) {
     for (; '\0' != *s; s++) {
@@ -904,8 +933,293 @@ key_match(const char *pat, const char *key, int plen) {
     return '\0' == *key;
 }
 
+// FNV-1a over the key.
+static uint64_t
+key_hash(const char *key) {
+    uint64_t	h = 0xcbf29ce484222325ULL;
+
+    for (; '\0' != *key; key++) {
+	h = (h ^ (uint8_t)*key) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Same as key_hash() but for a path segment that may include escapes.
+static uint64_t
+path_key_hash(const char *pat, int plen) {
+    uint64_t	h = 0xcbf29ce484222325ULL;
+
+    for (; 0 < plen; plen--, pat++) {
+	if ('\\' == *pat) {
+	    plen--;
+	    pat++;
+	}
+	h = (h ^ (uint8_t)*pat) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Returns the index of the children of parent, building it if needed, or
+// NULL if the container is small enough to walk.
+static LeafIndex
+leaf_index(Doc doc, Leaf parent) {
+    LeafIndex	li;
+    Leaf	first;
+    Leaf	e;
+    size_t	cnt = 0;
+    size_t	i;
+
+    if (0 != parent->lindex) {
+	return doc->indexes[parent->lindex - 1];
+    }
+    if (NULL == parent->elements) {
+	return NULL;
+    }
+    first = parent->elements->next;
+    e = first;
+    do {
+	cnt++;
+	e = e->next;
+    } while (e != first && INDEX_MIN > cnt);
+    if (INDEX_MIN > cnt) {
+	return NULL;
+    }
+    for (; e != first; e = e->next) {
+	cnt++;
+    }
+    if (doc->isize <= doc->icnt) {
+	doc->isize = (0 == doc->isize) ? 16 : doc->isize * 2;
+	if (NULL == doc->indexes) {
+	    doc->indexes = ALLOC_N(LeafIndex, doc->isize);
+	} else {
+	    REALLOC_N(doc->indexes, LeafIndex, doc->isize);
+	}
+    }
+    if (T_HASH == parent->rtype) {
+	size_t	size = 2;
+
+	while (size < cnt * 2) {
+	    size *= 2;
+	}
+	li = (LeafIndex)xmalloc(sizeof(struct _leafIndex) + sizeof(Leaf) * (cnt + size));
+	li->slots = (Leaf*)(li + 1) + cnt;
+	li->mask = size - 1;
+	memset(li->slots, 0, sizeof(Leaf) * size);
+    } else {
+	li = (LeafIndex)xmalloc(sizeof(struct _leafIndex) + sizeof(Leaf) * cnt);
+	li->slots = NULL;
+	li->mask = 0;
+    }
+    li->elements = (Leaf*)(li + 1);
+    li->cnt = cnt;
+    for (i = 0, e = first; i < cnt; i++, e = e->next) {
+	li->elements[i] = e;
+	if (NULL != li->slots) {
+	    // Earlier duplicate keys are found first just as with a walk.
+	    size_t	s = (size_t)key_hash(e->key) & li->mask;
+
+	    while (NULL != li->slots[s]) {
+		s = (s + 1) & li->mask;
+	    }
+	    li->slots[s] = e;
+	}
+    }
+    doc->indexes[doc->icnt++] = li;
+    parent->lindex = doc->icnt;
+
+    return li;
+}
+
+// Returns the child at the 1 based position, the first one for 0, or NULL if
+// there is no such child.
+static Leaf
+leaf_child_at(Doc doc, Leaf parent, int cnt) {
+    LeafIndex	li = leaf_index(doc, parent);
+    Leaf	first;
+    Leaf	e;
+
+    if (1 > cnt) {
+	cnt = 1;
+    }
+    if (NULL != li) {
+	return ((size_t)cnt <= li->cnt) ? li->elements[cnt - 1] : NULL;
+    }
+    if (NULL == parent->elements) {
+	return NULL;
+    }
+    first = parent->elements->next;
+    e = first;
+    do {
+	if (1 >= cnt) {
+	    return e;
+	}
+	cnt--;
+	e = e->next;
+    } while (e != first);
+
+    return NULL;
+}
+
+// Returns the first child with a key matching the hash and key or NULL. An
+// escaped key is a path segment that may include backslash escapes.
+static Leaf
+leaf_child_hkey(Doc doc, Leaf parent, const char *key, int klen, uint64_t hash, bool escaped) {
+    LeafIndex	li = leaf_index(doc, parent);
+    Leaf	first;
+    Leaf	e;
+
+    if (NULL != li) {
+	size_t	s = (size_t)hash & li->mask;
+
+	for (; NULL != (e = li->slots[s]); s = (s + 1) & li->mask) {
+	    if (escaped ? key_match(key, e->key, klen) : (0 == strncmp(key, e->key, klen) && '\0' == e->key[klen])) {
+		return e;
+	    }
+	}
+	return NULL;
+    }
+    if (NULL == parent->elements) {
+	return NULL;
+    }
+    first = parent->elements->next;
+    e = first;
+    do {
+	if (escaped ? key_match(key, e->key, klen) : (0 == strncmp(key, e->key, klen) && '\0' == e->key[klen])) {
+	    return e;
+	}
+	e = e->next;
+    } while (e != first);
+
+    return NULL;
+}
+
+// Returns the first child with a key matching the path segment or NULL.
+inline static Leaf
+leaf_child_key(Doc doc, Leaf parent, const char *key, int klen) {
+    return leaf_child_hkey(doc, parent, key, klen, path_key_hash(key, klen), true);
+}
+
+// Follows a compiled path from the leaf at *lpp and leaves the leaves
+// visited on the stack. Returns 0 on success or the 1 based step that failed.
+static int
+path_walk(Doc doc, DocPath dp, Leaf *stack, Leaf **lpp) {
+    Leaf	*lp = *lpp;
+    PathStep	step = dp->steps;
+    PathStep	end = step + dp->cnt;
+    Leaf	leaf;
+    Leaf	e;
+
+    for (; step < end; step++) {
+	if (PATH_UP == step->type) {
+	    if (stack == lp) {
+		return (int)(step - dp->steps) + 1;
+	    }
+	    lp--;
+	    continue;
+	}
+	leaf = *lp;
+	e = NULL;
+	if (COL_VAL == leaf->value_type && NULL != leaf->elements) {
+	    if (T_ARRAY == leaf->rtype) {
+		if (0 <= step->index) {
+		    e = leaf_child_at(doc, leaf, step->index);
+		}
+	    } else if (T_HASH == leaf->rtype) {
+		e = leaf_child_hkey(doc, leaf, step->key, step->klen, step->hash, false);
+	    }
+	}
+	if (NULL == e) {
+	    return (int)(step - dp->steps) + 1;
+	}
+	if (MAX_STACK <= lp - stack + 1) {
+	    rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+	}
+	lp++;
+	*lp = e;
+    }
+    *lpp = lp;
+
+    return 0;
+}
+
+// Sets up the stack for a walk from the root or the current location and
+// returns the top of the stack.
+static Leaf*
+path_start(Doc doc, bool absolute, Leaf *stack) {
+    if (absolute || doc->where == doc->where_path) {
+	*stack = doc->data;
+	return stack;
+    } else {
+	size_t	cnt = doc->where - doc->where_path;
+
+	if (MAX_STACK <= cnt) {
+	    rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+	}
+	memcpy(stack, doc->where_path, sizeof(Leaf) * (cnt + 1));
+	return stack + cnt;
+    }
+}
+
+static Leaf
+get_path_leaf(Doc doc, DocPath dp) {
+    Leaf	stack[MAX_STACK];
+    Leaf	*lp;
+
+    if (0 == doc->data) {
+	return *doc->where;
+    }
+    lp = path_start(doc, dp->absolute, stack);
+    if (0 != path_walk(doc, dp, stack, &lp)) {
+	return NULL;
+    }
+    return *lp;
+}
+
+// Moves to the compiled path. The location is unchanged on failure.
+static int
+move_path(Doc doc, DocPath dp) {
+    Leaf	stack[MAX_STACK];
+    Leaf	*lp = path_start(doc, dp->absolute, stack);
+    int		loc;
+
+    if (0 == (loc = path_walk(doc, dp, stack, &lp))) {
+	memcpy(doc->where_path, stack, sizeof(Leaf) * (lp - stack + 1));
+	doc->where = doc->where_path + (lp - stack);
+    }
+    return loc;
+}
+
+static Leaf
+get_doc_leaf(Doc doc, const char *path) {
+    Leaf	leaf = *doc->where;
+
+    if (0 != doc->data && 0 != path) {
+	Leaf	stack[MAX_STACK];
+	Leaf	*lp;
+
+	if ('/' == *path) {
+	    path++;
+	    *stack = doc->data;
+	    lp = stack;
+	} else if (doc->where == doc->where_path) {
+	    *stack = doc->data;
+	    lp = stack;
+	} else {
+	    size_t	cnt = doc->where - doc->where_path;
+
+	    if (MAX_STACK <= cnt) {
+		rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+	    }
+	    memcpy(stack, doc->where_path, sizeof(Leaf) * (cnt + 1));
+	    lp = stack + cnt;
+	}
+	return get_leaf(doc, stack, lp, path);
+    }
+    return leaf;
+}
+
 static Leaf
-get_leaf(Leaf *stack, Leaf *lp, const char *path) {
+get_leaf(Doc doc, Leaf *stack, Leaf *lp, const char *path) {
     Leaf	leaf = *lp;
 
     if (MAX_STACK <= lp - stack) {
@@ -918,17 +1232,16 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 		path++;
 	    }
 	    if (stack < lp) {
-		leaf = get_leaf(stack, lp - 1, path);
+		leaf = get_leaf(doc, stack, lp - 1, path);
 	    } else {
 		return 0;
 	    }
 	} else if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
-	    Leaf	first = leaf->elements->next;
-	    Leaf	e = first;
-	    int		type = leaf->rtype;
+	    Leaf	parent = leaf;
+	    Leaf	e = 0;
 
 	    leaf = 0;
-	    if (T_ARRAY == type) {
+	    if (T_ARRAY == parent->rtype) {
 		int	cnt = 0;
 
 		for (; '0' <= *path && *path <= '9'; path++) {
@@ -937,17 +1250,8 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 		if ('/' == *path) {
 		    path++;
 		}
-		do {
-		    if (1 >= cnt) {
-			lp++;
-			*lp = e;
-			leaf = get_leaf(stack, lp, path);
-			break;
-		    }
-		    cnt--;
-		    e = e->next;
-		} while (e != first);
-	    } else if (T_HASH == type) {
+		e = leaf_child_at(doc, parent, cnt);
+	    } else if (T_HASH == parent->rtype) {
 		const char	*key = path;
 		const char	*slash = next_slash(path);
 		int		klen;
@@ -959,15 +1263,12 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 		    klen = (int)(slash - key);
 		    path += klen + 1;
 		}
-		do {
-		    if (key_match(key, e->key, klen)) {
-			lp++;
-			*lp = e;
-			leaf = get_leaf(stack, lp, path);
-			break;
-		    }
-		    e = e->next;
-		} while (e != first);
+		e = leaf_child_key(doc, parent, key, klen);
+	    }
+	    if (0 != e) {
+		lp++;
+		*lp = e;
+		leaf = get_leaf(doc, stack, lp, path);
 	    }
 	}
     }
@@ -1029,8 +1330,7 @@ move_step(Doc doc, const char *path, int loc) {
 		doc->where++;
 	    }
 	} else if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
-	    Leaf	first = leaf->elements->next;
-	    Leaf	e = first;
+	    Leaf	e = 0;
 
 	    if (T_ARRAY == leaf->rtype) {
 		int	cnt = 0;
@@ -1043,20 +1343,7 @@ move_step(Doc doc, const char *path, int loc) {
 		} else if ('\0' != *path) {
 		    return loc;
 		}
-		do {
-		    if (1 >= cnt) {
-			doc->where++;
-			*doc->where = e;
-			loc = move_step(doc, path, loc + 1);
-			if (0 != loc) {
-			    *doc->where = 0;
-			    doc->where--;
-			}
-			break;
-		    }
-		    cnt--;
-		    e = e->next;
-		} while (e != first);
+		e = leaf_child_at(doc, leaf, cnt);
 	    } else if (T_HASH == leaf->rtype) {
 		const char	*key = path;
 		const char	*slash = next_slash(path);
@@ -1069,19 +1356,16 @@ move_step(Doc doc, const char *path, int loc) {
 		    klen = (int)(slash - key);
 		    path += klen + 1;
 		}
-		do {
-		    if (key_match(key, e->key, klen)) {
-			doc->where++;
-			*doc->where = e;
-			loc = move_step(doc, path, loc + 1);
-			if (0 != loc) {
-			    *doc->where = 0;
-			    doc->where--;
-			}
-			break;
-		    }
-		    e = e->next;
-		} while (e != first);
+		e = leaf_child_key(doc, leaf, key, klen);
+	    }
+	    if (0 != e) {
+		doc->where++;
+		*doc->where = e;
+		loc = move_step(doc, path, loc + 1);
+		if (0 != loc) {
+		    *doc->where = 0;
+		    doc->where--;
+		}
 	    }
 	}
     }
@@ -1146,7 +1430,7 @@ doc_open(VALUE clas, VALUE str) {
     // the issue.
     rb_gc_disable();
     memcpy(json, StringValuePtr(str), len);
-    obj = parse_json(clas, json, given, allocate);
+    obj = parse_json(clas, json, len, given, allocate);
     rb_gc_enable();
     if (given && allocate) {
 	xfree(json);
@@ -1204,7 +1488,7 @@ doc_open_file(VALUE clas, VALUE filename) {
     fclose(f);
     json[len] = '\0';
     rb_gc_disable();
-    obj = parse_json(clas, json, given, allocate);
+    obj = parse_json(clas, json, len, given, allocate);
     rb_gc_enable();
     if (given && allocate) {
 	xfree(json);
@@ -1239,6 +1523,47 @@ append_key(char *p, const char *key) {
  * @see Oj::Doc.open
  */
 
+// Returns the compiled path if the argument is an Oj::Doc::Path or NULL.
+inline static DocPath
+arg_doc_path(VALUE arg) {
+    if (RB_TYPE_P(arg, T_DATA) && Qtrue == rb_obj_is_kind_of(arg, doc_path_class)) {
+	return (DocPath)DATA_PTR(arg);
+    }
+    return NULL;
+}
+
+// Returns the leaf at a String or Oj::Doc::Path location.
+static Leaf
+arg_leaf(Doc doc, VALUE arg) {
+    DocPath	dp = arg_doc_path(arg);
+
+    if (NULL != dp) {
+	return get_path_leaf(doc, dp);
+    }
+    Check_Type(arg, T_STRING);
+
+    return get_doc_leaf(doc, StringValuePtr(arg));
+}
+
+// Moves to a String or Oj::Doc::Path location and returns 0 or the 1 based
+// step that could not be followed.
+static int
+arg_move(Doc doc, VALUE arg) {
+    DocPath	dp = arg_doc_path(arg);
+    const char	*path;
+
+    if (NULL != dp) {
+	return move_path(doc, dp);
+    }
+    Check_Type(arg, T_STRING);
+    path = StringValuePtr(arg);
+    if ('/' == *path) {
+	doc->where = doc->where_path;
+	path++;
+    }
+    return move_step(doc, path, 1);
+}
+
 /* @overload where?() => String
  *
  * Returns a String that describes the absolute path to the current location
@@ -1328,7 +1653,7 @@ doc_home(VALUE self) {
  * or the current location if the path is nil or not provided. This method
  * does not create the Ruby Object at the location specified so the overhead
  * is low.
- *   @param [String] path path to the location to get the type of if provided
+ *   @param [String|Oj::Doc::Path] path path to the location to get the type of if provided
  * @example
  *   Oj::Doc.open('[1,2]') { |doc| doc.type() }	     #=> Array
  *   Oj::Doc.open('[1,2]') { |doc| doc.type('/1') }  #=> Fixnum
@@ -1337,14 +1662,14 @@ static VALUE
 doc_type(int argc, VALUE *argv, VALUE self) {
     Doc		doc = self_doc(self);
     Leaf	leaf;
-    const char	*path = 0;
     VALUE	type = Qnil;
 
     if (1 <= argc) {
-	Check_Type(*argv, T_STRING);
-	path = StringValuePtr(*argv);
+	leaf = arg_leaf(doc, *argv);
+    } else {
+	leaf = get_doc_leaf(doc, 0);
     }
-    if (0 != (leaf = get_doc_leaf(doc, path))) {
+    if (0 != leaf) {
 	switch (leaf->rtype) {
 	case T_NIL:	type = rb_cNilClass;	break;
 	case T_TRUE:	type = rb_cTrueClass;	break;
@@ -1371,7 +1696,7 @@ doc_type(int argc, VALUE *argv, VALUE self) {
  * return an Array or Hash if that is the type of Object at the location
  * specified. This is more expensive than navigating to the leaves of the JSON
  * document.
- *   @param [String] path path to the location to get the type of if provided
+ *   @param [String|Oj::Doc::Path] path path to the location to get the type of if provided
  * @example
  *   Oj::Doc.open('[1,2]') { |doc| doc.fetch() }      #=> [1, 2]
  *   Oj::Doc.open('[1,2]') { |doc| doc.fetch('/1') }  #=> 1
@@ -1381,17 +1706,17 @@ doc_fetch(int argc, VALUE *argv, VALUE self) {
     Doc			doc;
     Leaf		leaf;
     volatile VALUE	val = Qnil;
-    const char		*path = 0;
 
     doc = self_doc(self);
     if (1 <= argc) {
-	Check_Type(*argv, T_STRING);
-	path = StringValuePtr(*argv);
+	leaf = arg_leaf(doc, *argv);
 	if (2 == argc) {
 	    val = argv[1];
 	}
+    } else {
+	leaf = get_doc_leaf(doc, 0);
     }
-    if (0 != (leaf = get_doc_leaf(doc, path))) {
+    if (0 != leaf) {
 	val = leaf_value(doc, leaf);
     }
     return val;
@@ -1402,7 +1727,7 @@ doc_fetch(int argc, VALUE *argv, VALUE self) {
  * Yields to the provided block for each leaf node with the identified
  * location of the JSON document as the root. The parameter passed to the
  * block on yield is the Doc instance after moving to the child location.
- *   @param [String] path if provided it identified the top of the branch to process the leaves of
+ *   @param [String|Oj::Doc::Path] path if provided it identified the top of the branch to process the leaves of
  * @yieldparam [Doc] Doc at the child location
  * @example
  *   Oj::Doc.open('[3,[2,1]]') { |doc|
@@ -1417,7 +1742,6 @@ doc_each_leaf(int argc, VALUE *argv, VALUE self) {
     if (rb_block_given_p()) {
 	Leaf		save_path[MAX_STACK];
 	Doc		doc = self_doc(self);
-	const char	*path = 0;
 	size_t		wlen;
 
 	wlen = doc->where - doc->where_path;
@@ -1425,13 +1749,7 @@ doc_each_leaf(int argc, VALUE *argv, VALUE self) {
 	    memcpy(save_path, doc->where_path, sizeof(Leaf) * (wlen + 1));
 	}
 	if (1 <= argc) {
-	    Check_Type(*argv, T_STRING);
-	    path = StringValuePtr(*argv);
-	    if ('/' == *path) {
-		doc->where = doc->where_path;
-		path++;
-	    }
-	    if (0 != move_step(doc, path, 1)) {
+	    if (0 != arg_move(doc, *argv)) {
 		if (0 < wlen) {
 		    memcpy(doc->where_path, save_path, sizeof(Leaf) * (wlen + 1));
 		}
@@ -1450,16 +1768,23 @@ doc_each_leaf(int argc, VALUE *argv, VALUE self) {
  *
  * Moves the document marker to the path specified. The path can an absolute
  * path or a relative path.
- *   @param [String] path path to the location to move to
+ *   @param [String|Oj::Doc::Path] path path to the location to move to
  * @example
  *   Oj::Doc.open('{"one":[1,2]') { |doc| doc.move('/one/2'); doc.where? }  #=> "/one/2"
  */
 static VALUE
 doc_move(VALUE self, VALUE str) {
     Doc		doc = self_doc(self);
+    DocPath	dp = arg_doc_path(str);
     const char	*path;
     int		loc;
 
+    if (NULL != dp) {
+	if (0 != (loc = move_path(doc, dp))) {
+	    rb_raise(rb_eArgError, "Failed to locate element %d of the path %s.", loc, StringValuePtr(dp->str));
+	}
+	return Qnil;
+    }
     Check_Type(str, T_STRING);
     path = StringValuePtr(str);
     if ('/' == *path) {
@@ -1478,7 +1803,7 @@ doc_move(VALUE self, VALUE str) {
  * identified location of the JSON document as the root. The parameter passed
  * to the block on yield is the Doc instance after moving to the child
  * location.
- *   @param [String] path if provided it identified the top of the branch to process the chilren of
+ *   @param [String|Oj::Doc::Path] path if provided it identified the top of the branch to process the chilren of
  * @yieldparam [Doc] Doc at the child location
  * @example
  *   Oj::Doc.open('[3,[2,1]]') { |doc|
@@ -1493,7 +1818,6 @@ doc_each_child(int argc, VALUE *argv, VALUE self) {
     if (rb_block_given_p()) {
 	Leaf		save_path[MAX_STACK];
 	Doc		doc = self_doc(self);
-	const char	*path = 0;
 	size_t		wlen;
 
 	wlen = doc->where - doc->where_path;
@@ -1501,13 +1825,7 @@ doc_each_child(int argc, VALUE *argv, VALUE self) {
 	    memcpy(save_path, doc->where_path, sizeof(Leaf) * (wlen + 1));
 	}
 	if (1 <= argc) {
-	    Check_Type(*argv, T_STRING);
-	    path = StringValuePtr(*argv);
-	    if ('/' == *path) {
-		doc->where = doc->where_path;
-		path++;
-	    }
-	    if (0 != move_step(doc, path, 1)) {
+	    if (0 != arg_move(doc, *argv)) {
 		if (0 < wlen) {
 		    memcpy(doc->where_path, save_path, sizeof(Leaf) * (wlen + 1));
 		}
@@ -1538,7 +1856,7 @@ doc_each_child(int argc, VALUE *argv, VALUE self) {
  * of the JSON document. The parameter passed to the block on yield is the
  * value of the leaf. Only those leaves below the element specified by the
  * path parameter are processed.
- *   @param [String] path if provided it identified the top of the branch to process the leaf values of
+ *   @param [String|Oj::Doc::Path] path if provided it identified the top of the branch to process the leaf values of
  * @yieldparam [Object] val each leaf value
  * @example
  *   Oj::Doc.open('[3,[2,1]]') { |doc|
@@ -1559,14 +1877,14 @@ static VALUE
 doc_each_value(int argc, VALUE *argv, VALUE self) {
     if (rb_block_given_p()) {
 	Doc		doc = self_doc(self);
-	const char	*path = 0;
 	Leaf		leaf;
 
 	if (1 <= argc) {
-	    Check_Type(*argv, T_STRING);
-	    path = StringValuePtr(*argv);
+	    leaf = arg_leaf(doc, *argv);
+	} else {
+	    leaf = get_doc_leaf(doc, 0);
 	}
-	if (0 != (leaf = get_doc_leaf(doc, path))) {
+	if (0 != leaf) {
 	    each_value(doc, leaf);
 	}
     }
@@ -1577,7 +1895,7 @@ doc_each_value(int argc, VALUE *argv, VALUE self) {
  *
  * Dumps the document or nodes to a new JSON document. It uses the default
  * options for generating the JSON.
- *   @param path [String] if provided it identified the top of the branch to dump to JSON
+ *   @param path [String|Oj::Doc::Path] if provided it identified the top of the branch to dump to JSON
  *   @param filename [String] if provided it is the filename to write the output to
  * @example
  *   Oj::Doc.open('[3,[2,1]]') { |doc|
@@ -1588,21 +1906,24 @@ doc_each_value(int argc, VALUE *argv, VALUE self) {
 static VALUE
 doc_dump(int argc, VALUE *argv, VALUE self) {
     Doc		doc = self_doc(self);
-    Leaf	leaf;
-    const char	*path = 0;
+    Leaf	leaf = 0;
     const char	*filename = 0;
+    bool	found = false;
 
     if (1 <= argc) {
 	if (Qnil != *argv) {
-	    Check_Type(*argv, T_STRING);
-	    path = StringValuePtr(*argv);
+	    leaf = arg_leaf(doc, *argv);
+	    found = true;
 	}
 	if (2 <= argc) {
 	    Check_Type(argv[1], T_STRING);
 	    filename = StringValuePtr(argv[1]);
 	}
     }
-    if (0 != (leaf = get_doc_leaf(doc, path))) {
+    if (!found) {
+	leaf = get_doc_leaf(doc, 0);
+    }
+    if (0 != leaf) {
 	volatile VALUE	rjson;
 
 	if (0 == filename) {
@@ -1612,6 +1933,8 @@ doc_dump(int argc, VALUE *argv, VALUE self) {
 	    out.buf = buf;
 	    out.end = buf + sizeof(buf) - 10;
 	    out.allocated = false;
+	    out.str = Qnil;
+	    out.flush = NULL;
 	    out.omit_nil = oj_default_options.dump_opts.omit_nil;
 	    oj_dump_leaf_to_json(leaf, &oj_default_options, &out);
 	    rjson = rb_str_new2(out.buf);
@@ -1662,6 +1985,115 @@ doc_close(VALUE self) {
     }
     return Qnil;
 }
+static void
+mark_doc_path(void *ptr) {
+    if (NULL != ptr) {
+	rb_gc_mark(((DocPath)ptr)->str);
+    }
+}
+
+static void
+free_doc_path(void *ptr) {
+    xfree(ptr);
+}
+
+/* Document-class: Oj::Doc::Path
+ *
+ * A path split into steps once so it can be used with many documents without
+ * being parsed again. A Path can be used in place of a String path with the
+ * Oj::Doc #type, #fetch, #move, #each_leaf, #each_child, #each_value, and
+ * #dump methods.
+ */
+
+/* @overload new(path) => Oj::Doc::Path
+ *
+ * Compiles a path with the same syntax as the String paths used by Oj::Doc.
+ *   @param [String] path path to compile
+ * @example
+ *   path = Oj::Doc::Path.new('/one/2')
+ *   Oj::Doc.open('{"one":[1,2]}') { |doc| doc.fetch(path) }  #=> 2
+ */
+static VALUE
+doc_path_new(VALUE clas, VALUE str) {
+    const char	*path;
+    const char	*p;
+    const char	*d;
+    DocPath	dp;
+    PathStep	step;
+    char	*k;
+    int		cnt = 1;
+    size_t	len;
+
+    Check_Type(str, T_STRING);
+    str = rb_str_new_frozen(str);
+    path = StringValuePtr(str);
+    len = RSTRING_LEN(str);
+    for (p = path; '\0' != *p; p++) {
+	if ('\\' == *p && '\0' != p[1]) {
+	    p++;
+	} else if ('/' == *p) {
+	    cnt++;
+	}
+    }
+    dp = (DocPath)xmalloc(sizeof(struct _docPath) + sizeof(struct _pathStep) * cnt + len + cnt);
+    dp->str = str;
+    dp->cnt = 0;
+    dp->absolute = ('/' == *path);
+    k = (char*)(dp->steps + cnt);
+    p = path;
+    if (dp->absolute) {
+	p++;
+    }
+    while ('\0' != *p) {
+	step = dp->steps + dp->cnt;
+	if ('.' == *p && '.' == p[1] && ('/' == p[2] || '\0' == p[2])) {
+	    step->type = PATH_UP;
+	    p += 2;
+	} else {
+	    step->type = PATH_KEY;
+	    step->key = k;
+	    step->index = 0;
+	    for (; '\0' != *p && '/' != *p; p++) {
+		if ('\\' == *p && '\0' != p[1]) {
+		    p++;
+		}
+		*k++ = *p;
+	    }
+	    step->klen = (int)(k - step->key);
+	    *k++ = '\0';
+	    step->hash = key_hash(step->key);
+	    for (d = step->key; '\0' != *d; d++) {
+		if (*d < '0' || '9' < *d) {
+		    step->index = -1;
+		    break;
+		}
+		step->index = step->index * 10 + (*d - '0');
+	    }
+	    if (0 == step->klen) {
+		step->index = -1;
+	    }
+	}
+	dp->cnt++;
+	if ('/' == *p) {
+	    p++;
+	}
+    }
+#ifdef HAVE_RB_DATA_OBJECT_WRAP
+    return rb_data_object_wrap(clas, dp, mark_doc_path, free_doc_path);
+#else
+    return rb_data_object_alloc(clas, dp, mark_doc_path, free_doc_path);
+#endif
+}
+
+/* @overload to_s() => String
+ *
+ * Returns the path the Path was compiled from.
+ */
+static VALUE
+doc_path_to_s(VALUE self) {
+    return ((DocPath)DATA_PTR(self))->str;
+}
+
 #if 0
 // hack to keep the doc generator happy
 Oj = rb_define_module("Oj");
@@ -1740,4 +2172,10 @@ oj_init_doc() {
 
     rb_define_method(oj_doc_class, "clone", doc_not_implemented, 0);
     rb_define_method(oj_doc_class, "dup", doc_not_implemented, 0);
+
+    doc_path_class = rb_define_class_under(oj_doc_class, "Path", rb_cObject);
+    rb_gc_register_address(&doc_path_class);
+    rb_undef_alloc_func(doc_path_class);
+    rb_define_singleton_method(doc_path_class, "new", doc_path_new, 1);
+    rb_define_method(doc_path_class, "to_s", doc_path_to_s, 0);
 }
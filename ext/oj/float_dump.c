@@ -0,0 +1,224 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "dump.h"
+#include "float_parse.h"
+
+// Shortest round trip formatting of doubles based on the Schubfach algorithm
+// by Raffaello Giulietti. The value is scaled by a 126 bit approximation of
+// a power of ten and the shortest decimal in the rounding interval is
+// selected. Where more than one decimal of that length is in the interval
+// the closest one is used. The digits are the same as those Ruby's
+// Float#to_s produces and the layout is the same as well so the output is
+// identical but does not need a call into Ruby or printf.
+
+#define MASK63	0x7FFFFFFFFFFFFFFFULL
+
+// floor(q * log10(2))
+static inline int
+flog10pow2(int q) {
+    return (int)(((int64_t)q * 661971961083LL) >> 41);
+}
+
+// floor(log10(3/4 * 2^q))
+static inline int
+flog10_three_quarters_pow2(int q) {
+    return (int)(((int64_t)q * 661971961083LL - 274743187321LL) >> 41);
+}
+
+// floor(e * log2(10))
+static inline int
+flog2pow10(int e) {
+    return (int)(((int64_t)e * 913124641741LL) >> 38);
+}
+
+// Multiplies g (as two 63 bit halves) by cp and returns the top bits rounded
+// to odd so the ties and exact cases can still be detected.
+static inline uint64_t
+round_to_odd(uint64_t g1, uint64_t g0, uint64_t cp) {
+    uint64_t	x1;
+    uint64_t	x0;
+    uint64_t	y1;
+    uint64_t	y0;
+    uint64_t	z;
+
+    oj_mul64(g0, cp, &x1, &x0);
+    oj_mul64(g1, cp, &y1, &y0);
+    z = (y0 >> 1) + x1;
+
+    return (y1 + (z >> 63)) | (((z & MASK63) + MASK63) >> 63);
+}
+
+// Finds the shortest decimal f * 10^k for c * 2^q.
+static void
+to_decimal(int q, uint64_t c, uint64_t *fp, int *kp) {
+    uint64_t	out = c & 0x01;
+    uint64_t	cb = c << 2;
+    uint64_t	cbr = cb + 2;
+    uint64_t	cbl;
+    uint64_t	g1;
+    uint64_t	g0;
+    uint64_t	vb;
+    uint64_t	vbl;
+    uint64_t	vbr;
+    uint64_t	s;
+    uint64_t	t;
+    int		k;
+    int		h;
+    bool	uin;
+    bool	win;
+
+    if (c != (1ULL << 52) || -1074 == q) {
+	cbl = cb - 2;
+	k = flog10pow2(q);
+    } else {
+	// The interval below a power of two is half the size.
+	cbl = cb - 1;
+	k = flog10_three_quarters_pow2(q);
+    }
+    h = q + flog2pow10(-k) + 2;
+
+    // The table holds 128 bit truncated values so drop two bits and round
+    // up to get the 126 bit value the algorithm needs split into 63 bit
+    // halves.
+    g1 = oj_pow10_mantissas[-k - OJ_POW10_MIN][0];
+    g0 = oj_pow10_mantissas[-k - OJ_POW10_MIN][1];
+    g0 = (((g1 & 0x01) << 62) | (g0 >> 2)) + 1;
+    g1 >>= 1;
+    if (0 != (g0 >> 63)) {
+	g0 &= MASK63;
+	g1++;
+    }
+    vb = round_to_odd(g1, g0, cb << h);
+    vbl = round_to_odd(g1, g0, cbl << h);
+    vbr = round_to_odd(g1, g0, cbr << h);
+
+    s = vb >> 2;
+    if (100 <= s) {
+	uint64_t	sp10 = (s / 10) * 10;
+	uint64_t	tp10 = sp10 + 10;
+	bool		upin = vbl + out <= sp10 << 2;
+	bool		wpin = (tp10 << 2) + out <= vbr;
+
+	if (upin != wpin) {
+	    *fp = upin ? sp10 : tp10;
+	    *kp = k;
+	    return;
+	}
+    }
+    t = s + 1;
+    uin = vbl + out <= s << 2;
+    win = (t << 2) + out <= vbr;
+    if (uin != win) {
+	*fp = uin ? s : t;
+	*kp = k;
+	return;
+    }
+    // Both are in the interval so pick the closest, even on a tie.
+    if (vb < (s + t) << 1 || (vb == (s + t) << 1 && 0 == (s & 0x01))) {
+	*fp = s;
+    } else {
+	*fp = t;
+    }
+    *kp = k;
+}
+
+// Writes the shortest representation of d that reads back as the same value
+// in the same format as Float#to_s. The buffer must hold at least 32
+// characters. Infinity and NaN must be handled by the caller. Returns the
+// length written not including the terminating '\0'.
+int
+oj_dump_float_shortest(double d, char *buf) {
+    char	digits[24];
+    char	*b = buf;
+    char	*dp;
+    uint64_t	bits;
+    uint64_t	c;
+    uint64_t	f;
+    int		q;
+    int		k;
+    int		n;
+    int		decpt;
+
+    memcpy(&bits, &d, sizeof(bits));
+    if (0 != (bits >> 63)) {
+	*b++ = '-';
+    }
+    q = (int)((bits >> 52) & 0x7FF);
+    c = bits & 0x000FFFFFFFFFFFFFULL;
+    if (0 == q && 0 == c) {
+	strcpy(b, "0.0");
+	return (int)(b - buf) + 3;
+    }
+    if (0 == q) {
+	q = -1074;
+    } else {
+	q -= 1075;
+	c |= 1ULL << 52;
+    }
+    to_decimal(q, c, &f, &k);
+    for (; 0 == f % 10; f /= 10) {
+	k++;
+    }
+    dp = digits + sizeof(digits);
+    for (; 0 < f; f /= 10) {
+	*--dp = '0' + (char)(f % 10);
+    }
+    n = (int)(digits + sizeof(digits) - dp);
+    decpt = n + k;
+
+    // Float#to_s switches to an exponent at 16 digits unless there is a
+    // fraction part.
+    if (0 < decpt && (decpt < 16 || (16 == decpt && decpt < n))) {
+	if (n <= decpt) {
+	    memcpy(b, dp, n);
+	    b += n;
+	    memset(b, '0', decpt - n);
+	    b += decpt - n;
+	    *b++ = '.';
+	    *b++ = '0';
+	} else {
+	    memcpy(b, dp, decpt);
+	    b += decpt;
+	    *b++ = '.';
+	    memcpy(b, dp + decpt, n - decpt);
+	    b += n - decpt;
+	}
+    } else if (-4 < decpt && decpt <= 0) {
+	*b++ = '0';
+	*b++ = '.';
+	memset(b, '0', -decpt);
+	b += -decpt;
+	memcpy(b, dp, n);
+	b += n;
+    } else {
+	int	e = decpt - 1;
+
+	*b++ = *dp;
+	*b++ = '.';
+	if (1 < n) {
+	    memcpy(b, dp + 1, n - 1);
+	    b += n - 1;
+	} else {
+	    *b++ = '0';
+	}
+	*b++ = 'e';
+	if (0 > e) {
+	    *b++ = '-';
+	    e = -e;
+	} else {
+	    *b++ = '+';
+	}
+	if (100 <= e) {
+	    *b++ = '0' + (char)(e / 100);
+	    e %= 100;
+	}
+	*b++ = '0' + (char)(e / 10);
+	*b++ = '0' + (char)(e % 10);
+    }
+    *b = '\0';
+
+    return (int)(b - buf);
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_FLOAT_PARSE_H
+#define OJ_FLOAT_PARSE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define OJ_POW10_MIN	-342
+#define OJ_POW10_MAX	324
+
+extern const uint64_t	oj_pow10_mantissas[][2];
+
+// Converts man * 10^exp10 to the nearest double. Returns false if the value
+// can not be converted exactly, in that case the caller should use strtod().
+extern bool	oj_dec_to_double(uint64_t man, int exp10, bool neg, double *dp);
+
+// Returns the full 128 bit product of a and b.
+static inline void
+oj_mul64(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t	r = (__uint128_t)a * (__uint128_t)b;
+
+    *hi = (uint64_t)(r >> 64);
+    *lo = (uint64_t)r;
+#else
+    uint64_t	a_lo = (uint32_t)a;
+    uint64_t	a_hi = a >> 32;
+    uint64_t	b_lo = (uint32_t)b;
+    uint64_t	b_hi = b >> 32;
+    uint64_t	p0 = a_lo * b_lo;
+    uint64_t	p1 = a_lo * b_hi;
+    uint64_t	p2 = a_hi * b_lo;
+    uint64_t	p3 = a_hi * b_hi;
+    uint64_t	mid = (p0 >> 32) + (uint32_t)p1 + (uint32_t)p2;
+
+    *lo = (mid << 32) | (uint32_t)p0;
+    *hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+#endif
+}
+
+#endif /* OJ_FLOAT_PARSE_H */
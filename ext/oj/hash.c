@@ -1,24 +1,63 @@
 // Copyright (c) 2011 Peter Ohler. All rights reserved.
 
 #include "hash.h"
+#include "ruby/encoding.h"
 #include <stdint.h>
 
-#define HASH_MASK	0x000003FF
-#define  HASH_SLOT_CNT	1024
+// The tables use open addressing with linear probing and double when more
+// than half full. Each Ractor has its own set of tables so all lookups and
+// inserts on a table are made while holding that Ractor's lock and nothing
+// between a lookup and the matching insert yields to another Ruby thread
+// except an allocation, which only causes a GC mark of the consistent
+// table.
+#define HASH_MIN_SLOTS	256
+
+// Keys up to KEY_INLINE bytes are kept in the slot. Longer keys are copied
+// into blocks owned by the table.
+#define KEY_INLINE	16
+#define KEY_BLOCK_SIZE	4096
+
+// Keys longer than CACHE_MAX_KEY are rarely repeated so they are not cached
+// and the String and Symbol tables stop adding entries at CACHE_MAX_CNT to
+// bound the memory used by documents with many unique keys.
+#define CACHE_MAX_KEY	35
+#define CACHE_MAX_CNT	4096
 
 typedef struct _keyVal {
-    struct _keyVal	*next;
-    const char		*key;
-    size_t		len;
-    VALUE		val;
+    VALUE	val;
+    uint32_t	hash; // 0 for an empty slot
+    uint32_t	len;
+    union {
+	char		buf[KEY_INLINE];
+	const char	*ptr;
+    } key;
 } *KeyVal;
 
+typedef struct _keyBlock {
+    struct _keyBlock	*next;
+    size_t		len;
+    size_t		size;
+    char		data[];
+} *KeyBlock;
+
 struct _hash {
-    struct _keyVal	slots[HASH_SLOT_CNT];
+    KeyVal	slots;
+    uint32_t	mask;
+    uint32_t	cnt;
+    KeyBlock	blocks;
+    uint64_t	lookups;
+    uint64_t	hits;
+    uint64_t	probes;
+    uint32_t	max_probe;
 };
 
-struct _hash	class_hash;
-struct _hash	intern_hash;
+struct _caches {
+    struct _hash	class_hash;
+    struct _hash	intern_hash;
+    struct _hash	str_hash;
+    struct _hash	sym_hash;
+    struct _hash	val_hash;
+};
 
 // almost the Murmur hash algorithm
 #define M 0x5bd1e995
@@ -58,70 +97,360 @@ hash_calc(const uint8_t *key, size_t len) {
     h *= M;
     h ^= h >> 15;
 
-    return h;
+    // 0 marks an empty slot.
+    return (0 == h) ? 1 : h;
+}
+
+inline static const char*
+kv_key(KeyVal kv) {
+    return (KEY_INLINE < kv->len) ? kv->key.ptr : kv->key.buf;
+}
+
+static void
+mark_hash(Hash hash) {
+    KeyVal	kv;
+    KeyVal	end;
+
+    if (NULL == hash->slots) {
+	return;
+    }
+    for (kv = hash->slots, end = kv + hash->mask + 1; kv < end; kv++) {
+	if (0 != kv->hash && Qnil != kv->val) {
+	    rb_gc_mark(kv->val);
+	}
+    }
 }
 
+// The cached classes, Strings, and Symbols are only referenced from the
+// tables so the owner of the caches must call this when it is marked.
 void
-oj_hash_init() {
-    memset(class_hash.slots, 0, sizeof(class_hash.slots));
-    memset(intern_hash.slots, 0, sizeof(intern_hash.slots));
+oj_caches_mark(Caches c) {
+    mark_hash(&c->class_hash);
+    mark_hash(&c->str_hash);
+    mark_hash(&c->sym_hash);
+    mark_hash(&c->val_hash);
 }
 
-// if slotp is 0 then just lookup
-static VALUE
-hash_get(Hash hash, const char *key, size_t len, VALUE **slotp, VALUE def_value) {
-    uint32_t	h = hash_calc((const uint8_t*)key, len) & HASH_MASK;
-    KeyVal	bucket = hash->slots + h;
+static void
+hash_init(Hash hash) {
+    memset(hash, 0, sizeof(struct _hash));
+    hash->slots = ALLOC_N(struct _keyVal, HASH_MIN_SLOTS);
+    memset(hash->slots, 0, sizeof(struct _keyVal) * HASH_MIN_SLOTS);
+    hash->mask = HASH_MIN_SLOTS - 1;
+}
+
+static void
+hash_free(Hash hash) {
+    KeyBlock	b;
+
+    while (NULL != (b = hash->blocks)) {
+	hash->blocks = b->next;
+	xfree(b);
+    }
+    xfree(hash->slots);
+}
+
+Caches
+oj_caches_new() {
+    Caches	c = ALLOC(struct _caches);
+
+    hash_init(&c->class_hash);
+    hash_init(&c->intern_hash);
+    hash_init(&c->str_hash);
+    hash_init(&c->sym_hash);
+    hash_init(&c->val_hash);
+
+    return c;
+}
+
+void
+oj_caches_free(Caches c) {
+    hash_free(&c->class_hash);
+    hash_free(&c->intern_hash);
+    hash_free(&c->str_hash);
+    hash_free(&c->sym_hash);
+    hash_free(&c->val_hash);
+    xfree(c);
+}
 
-    if (0 != bucket->key) {
-	KeyVal	b;
+// Returns the slot for the key, either the matching one or the empty slot
+// where it would be inserted.
+static KeyVal
+hash_find(Hash hash, const char *key, size_t len, uint32_t h, uint32_t *probep) {
+    uint32_t	i = h & hash->mask;
+    uint32_t	probe = 0;
+    KeyVal	kv;
 
-	for (b = bucket; 0 != b; b = b->next) {
-	    if (len == b->len && 0 == strncmp(b->key, key, len)) {
-		*slotp = &b->val;
-		return b->val;
+    for (kv = hash->slots + i; 0 != kv->hash; kv = hash->slots + i) {
+	if (h == kv->hash && len == kv->len && 0 == memcmp(kv_key(kv), key, len)) {
+	    break;
+	}
+	i = (i + 1) & hash->mask;
+	probe++;
+    }
+    *probep = probe;
+
+    return kv;
+}
+
+static void
+hash_grow(Hash hash) {
+    uint32_t	size = (hash->mask + 1) * 2;
+    KeyVal	slots = ALLOC_N(struct _keyVal, size);
+    KeyVal	old = hash->slots;
+    KeyVal	end = old + hash->mask + 1;
+    KeyVal	kv;
+
+    memset(slots, 0, sizeof(struct _keyVal) * size);
+    for (kv = old; kv < end; kv++) {
+	if (0 != kv->hash) {
+	    uint32_t	i = kv->hash & (size - 1);
+
+	    while (0 != slots[i].hash) {
+		i = (i + 1) & (size - 1);
 	    }
-	    bucket = b;
+	    slots[i] = *kv;
 	}
     }
-    if (0 != slotp) {
-	if (0 != bucket->key) {
-	    KeyVal	b = ALLOC(struct _keyVal);
+    hash->slots = slots;
+    hash->mask = size - 1;
+    xfree(old);
+}
+
+static const char*
+hash_key_copy(Hash hash, const char *key, size_t len) {
+    KeyBlock	b = hash->blocks;
+    char	*k;
+
+    if (NULL == b || b->size < b->len + len) {
+	size_t	size = (KEY_BLOCK_SIZE < len) ? len : KEY_BLOCK_SIZE;
+
+	b = (KeyBlock)xmalloc(sizeof(struct _keyBlock) + size);
+	b->next = hash->blocks;
+	b->len = 0;
+	b->size = size;
+	hash->blocks = b;
+    }
+    k = b->data + b->len;
+    memcpy(k, key, len);
+    b->len += len;
+
+    return k;
+}
 
-	    b->next = 0;
-	    bucket->next = b;
-	    bucket = b;
+static VALUE
+hash_get(Hash hash, const char *key, size_t len, VALUE def_value) {
+    uint32_t	probe;
+    KeyVal	kv = hash_find(hash, key, len, hash_calc((const uint8_t*)key, len), &probe);
+
+    hash->lookups++;
+    hash->probes += probe;
+    if (hash->max_probe < probe) {
+	hash->max_probe = probe;
+    }
+    if (0 == kv->hash) {
+	return def_value;
+    }
+    hash->hits++;
+
+    return kv->val;
+}
+
+static void
+hash_set(Hash hash, const char *key, size_t len, VALUE val) {
+    uint32_t	h = hash_calc((const uint8_t*)key, len);
+    uint32_t	probe;
+    KeyVal	kv;
+
+    if ((hash->mask + 1) < (hash->cnt + 1) * 2) {
+	hash_grow(hash);
+    }
+    kv = hash_find(hash, key, len, h, &probe);
+    if (0 == kv->hash) {
+	// Copy the key before the hash is set so a GC triggered by the copy
+	// never sees a partially filled in slot.
+	if (KEY_INLINE < len) {
+	    kv->key.ptr = hash_key_copy(hash, key, len);
+	} else {
+	    memcpy(kv->key.buf, key, len);
 	}
-	bucket->key = oj_strndup(key, len);
-	bucket->len = len;
-	bucket->val = def_value;
-	*slotp = &bucket->val;
+	kv->len = (uint32_t)len;
+	kv->val = val;
+	kv->hash = h;
+	hash->cnt++;
+    } else {
+	kv->val = val;
     }
-    return def_value;
 }
 
 void
-oj_hash_print() {
-    int		i;
-    KeyVal	b;
-
-    for (i = 0; i < HASH_SLOT_CNT; i++) {
-	printf("%4d:", i);
-	for (b = class_hash.slots + i; 0 != b && 0 != b->key; b = b->next) {
-	    printf(" %s", b->key);
+oj_hash_print(Caches c) {
+    uint32_t	i;
+    KeyVal	kv;
+
+    for (i = 0; i <= c->class_hash.mask; i++) {
+	kv = c->class_hash.slots + i;
+	if (0 != kv->hash) {
+	    printf("%4u: %.*s\n", i, (int)kv->len, kv_key(kv));
 	}
-	printf("\n");
     }
 }
 
+static VALUE
+hash_stats(Hash hash) {
+    volatile VALUE	h = rb_hash_new();
+
+    rb_hash_aset(h, ID2SYM(rb_intern("size")), UINT2NUM(hash->cnt));
+    rb_hash_aset(h, ID2SYM(rb_intern("capacity")), UINT2NUM(hash->mask + 1));
+    rb_hash_aset(h, ID2SYM(rb_intern("lookups")), ULL2NUM(hash->lookups));
+    rb_hash_aset(h, ID2SYM(rb_intern("hits")), ULL2NUM(hash->hits));
+    rb_hash_aset(h, ID2SYM(rb_intern("hit_rate")), rb_float_new((0 == hash->lookups) ? 0.0 : (double)hash->hits / (double)hash->lookups));
+    rb_hash_aset(h, ID2SYM(rb_intern("avg_probe")), rb_float_new((0 == hash->lookups) ? 0.0 : (double)hash->probes / (double)hash->lookups));
+    rb_hash_aset(h, ID2SYM(rb_intern("max_probe")), UINT2NUM(hash->max_probe));
+
+    return h;
+}
+
 VALUE
-oj_class_hash_get(const char *key, size_t len, VALUE **slotp) {
-    return hash_get(&class_hash, key, len, slotp, Qnil);
+oj_hash_stats(Caches c) {
+    volatile VALUE	stats = rb_hash_new();
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("class")), hash_stats(&c->class_hash));
+    rb_hash_aset(stats, ID2SYM(rb_intern("attr")), hash_stats(&c->intern_hash));
+    rb_hash_aset(stats, ID2SYM(rb_intern("string")), hash_stats(&c->str_hash));
+    rb_hash_aset(stats, ID2SYM(rb_intern("symbol")), hash_stats(&c->sym_hash));
+    rb_hash_aset(stats, ID2SYM(rb_intern("value")), hash_stats(&c->val_hash));
+
+    return stats;
+}
+
+// Sets the lookups and hits of all the caches together.
+void
+oj_hash_counts(Caches c, uint64_t *lookups, uint64_t *hits) {
+    Hash	all[] = { &c->class_hash, &c->intern_hash, &c->str_hash, &c->sym_hash, &c->val_hash, NULL };
+    Hash	*hp;
+
+    *lookups = 0;
+    *hits = 0;
+    for (hp = all; NULL != *hp; hp++) {
+	*lookups += (*hp)->lookups;
+	*hits += (*hp)->hits;
+    }
+}
+
+// Zeros the counts of all the caches. The cached values are kept.
+void
+oj_hash_counts_reset(Caches c) {
+    Hash	all[] = { &c->class_hash, &c->intern_hash, &c->str_hash, &c->sym_hash, &c->val_hash, NULL };
+    Hash	*hp;
+
+    for (hp = all; NULL != *hp; hp++) {
+	(*hp)->lookups = 0;
+	(*hp)->hits = 0;
+	(*hp)->probes = 0;
+	(*hp)->max_probe = 0;
+    }
+}
+
+VALUE
+oj_class_hash_get(Caches c, const char *key, size_t len) {
+    return hash_get(&c->class_hash, key, len, Qnil);
+}
+
+void
+oj_class_hash_set(Caches c, const char *key, size_t len, VALUE clas) {
+    hash_set(&c->class_hash, key, len, clas);
 }
 
 ID
-oj_attr_hash_get(const char *key, size_t len, ID **slotp) {
-    return (ID)hash_get(&intern_hash, key, len, (VALUE**)slotp, 0);
+oj_attr_hash_get(Caches c, const char *key, size_t len) {
+    return (ID)hash_get(&c->intern_hash, key, len, 0);
+}
+
+void
+oj_attr_hash_set(Caches c, const char *key, size_t len, ID id) {
+    hash_set(&c->intern_hash, key, len, (VALUE)id);
+}
+
+static VALUE
+str_new(const char *key, size_t len) {
+#ifdef HAVE_RB_ENC_INTERNED_STR
+    return rb_enc_interned_str(key, len, rb_utf8_encoding());
+#else
+    VALUE	rstr = rb_utf8_str_new(key, len);
+
+    return rb_obj_freeze(rstr);
+#endif
+}
+
+VALUE
+oj_str_intern(Caches c, const char *key, size_t len) {
+    VALUE	rstr;
+
+    if (CACHE_MAX_KEY < len) {
+	return rb_utf8_str_new(key, len);
+    }
+    if (Qnil != (rstr = hash_get(&c->str_hash, key, len, Qnil))) {
+	return rstr;
+    }
+    rstr = str_new(key, len);
+    if (c->str_hash.cnt < CACHE_MAX_CNT) {
+	hash_set(&c->str_hash, key, len, rstr);
+    }
+    return rstr;
+}
+
+// String values are kept apart from keys so that a document with many
+// unique values does not fill the key table. Once the table is full the
+// value is still frozen and, when Ruby supports it, deduplicated.
+VALUE
+oj_str_val_intern(Caches c, const char *str, size_t len) {
+    VALUE	rstr;
+
+    if (CACHE_MAX_STR < len) {
+	return rb_utf8_str_new(str, len);
+    }
+    if (Qnil != (rstr = hash_get(&c->val_hash, str, len, Qnil))) {
+	return rstr;
+    }
+    rstr = str_new(str, len);
+    if (c->val_hash.cnt < CACHE_MAX_CNT) {
+	hash_set(&c->val_hash, str, len, rstr);
+    }
+    return rstr;
+}
+
+// Returns the Symbol for the UTF-8 key bytes. An existing Symbol is found
+// without making a String. A new one is made from a String so that it is a
+// dynamic Symbol that can be collected, unlike one from rb_intern3() which
+// would let a document with many unique keys grow the Symbol table forever.
+VALUE
+oj_sym_new(const char *key, size_t len) {
+#ifdef HAVE_RB_CHECK_SYMBOL_CSTR
+    VALUE	sym = rb_check_symbol_cstr(key, (long)len, rb_utf8_encoding());
+
+    if (Qnil != sym) {
+	return sym;
+    }
+#endif
+    return rb_str_intern(rb_utf8_str_new(key, len));
+}
+
+VALUE
+oj_sym_intern(Caches c, const char *key, size_t len) {
+    VALUE	sym;
+
+    if (CACHE_MAX_KEY < len) {
+	return oj_sym_new(key, len);
+    }
+    if (Qnil != (sym = hash_get(&c->sym_hash, key, len, Qnil))) {
+	return sym;
+    }
+    sym = oj_sym_new(key, len);
+    if (c->sym_hash.cnt < CACHE_MAX_CNT) {
+	hash_set(&c->sym_hash, key, len, sym);
+    }
+    return sym;
 }
 
 char*
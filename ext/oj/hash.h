@@ -3,16 +3,36 @@
 #ifndef OJ_HASH_H
 #define OJ_HASH_H
 
+#include <stdint.h>
+
 #include "ruby.h"
 
+// The longest String value the :cache_strings option will cache.
+#define CACHE_MAX_STR	64
+
 typedef struct _hash	*Hash;
 
-extern void	oj_hash_init();
+// A set of the class, attribute, key, Symbol, and value caches. Each Ractor
+// has its own, see local.h.
+typedef struct _caches	*Caches;
+
+extern Caches	oj_caches_new(void);
+extern void	oj_caches_mark(Caches c);
+extern void	oj_caches_free(Caches c);
 
-extern VALUE	oj_class_hash_get(const char *key, size_t len, VALUE **slotp);
-extern ID	oj_attr_hash_get(const char *key, size_t len, ID **slotp);
+extern VALUE	oj_class_hash_get(Caches c, const char *key, size_t len);
+extern void	oj_class_hash_set(Caches c, const char *key, size_t len, VALUE clas);
+extern ID	oj_attr_hash_get(Caches c, const char *key, size_t len);
+extern void	oj_attr_hash_set(Caches c, const char *key, size_t len, ID id);
+extern VALUE	oj_str_intern(Caches c, const char *key, size_t len);
+extern VALUE	oj_str_val_intern(Caches c, const char *str, size_t len);
+extern VALUE	oj_sym_intern(Caches c, const char *key, size_t len);
+extern VALUE	oj_sym_new(const char *key, size_t len);
 
-extern void	oj_hash_print();
+extern void	oj_hash_print(Caches c);
+extern VALUE	oj_hash_stats(Caches c);
+extern void	oj_hash_counts(Caches c, uint64_t *lookups, uint64_t *hits);
+extern void	oj_hash_counts_reset(Caches c);
 extern char*	oj_strndup(const char *s, size_t len);
 
 #endif /* OJ_HASH_H */
@@ -427,21 +427,18 @@ static void
 perf() {
     StrLen	d;
     VALUE	v;
-    VALUE	*slot = 0;
     uint64_t	dt, start;
     int		i, iter = 1000000;
     int		dataCnt = sizeof(data) / sizeof(*data);
+    Caches	c = oj_caches_new();
 
-    oj_hash_init();
     start = micro_time();
     for (i = iter; 0 < i; i--) {
 	for (d = data; 0 != d->str; d++) {
-	    v = oj_class_hash_get(d->str, d->len, &slot);
-	    if (Qundef == v) {
-		if (0 != slot) {
-		    v = ID2SYM(rb_intern(d->str));
-		    *slot = v;
-		}
+	    v = oj_class_hash_get(c, d->str, d->len);
+	    if (Qnil == v) {
+		v = ID2SYM(rb_intern(d->str));
+		oj_class_hash_set(c, d->str, d->len, v);
 	    }
 	}
     }
@@ -451,25 +448,21 @@ perf() {
 #else
     printf("%d iterations took %"PRIu64" msecs, %ld gets/msec\n", iter, dt / 1000, (long)(iter * dataCnt / (dt / 1000)));
 #endif
+    oj_caches_free(c);
 }
 
 void
 oj_hash_test() {
     StrLen	d;
     VALUE	v;
-    VALUE	*slot = 0;;
+    Caches	c = oj_caches_new();
 
-    oj_hash_init();
     for (d = data; 0 != d->str; d++) {
 	char	*s = oj_strndup(d->str, d->len);
-	v = oj_class_hash_get(d->str, d->len, &slot);
+	v = oj_class_hash_get(c, d->str, d->len);
 	if (Qnil == v) {
-	    if (0 == slot) {
-		printf("*** failed to get a slot for %s\n", s);
-	    } else {
-		v = ID2SYM(rb_intern(d->str));
-		*slot = v;
-	    }
+	    v = ID2SYM(rb_intern(d->str));
+	    oj_class_hash_set(c, d->str, d->len, v);
 	} else {
 	    VALUE	rs = rb_funcall2(v, rb_intern("to_s"), 0, 0);
 
@@ -478,7 +471,8 @@ oj_hash_test() {
 	/*oj_hash_print(c);*/
     }
     printf("*** ---------- hash table ------------\n");
-    oj_hash_print();
+    oj_hash_print(c);
+    oj_caches_free(c);
     perf();
 }
 #endif
@@ -0,0 +1,107 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <string.h>
+
+#include "local.h"
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+#include "ruby/ractor.h"
+#endif
+
+static OjLocal	main_local = NULL;
+
+static OjLocal
+local_new() {
+    OjLocal	local = ALLOC(struct _ojLocal);
+
+    memset(local, 0, sizeof(struct _ojLocal));
+    local->caches = oj_caches_new();
+    local->date_day = INT64_MIN;
+
+    return local;
+}
+
+static void
+local_mark(void *ptr) {
+    OjLocal	local = (OjLocal)ptr;
+    OddSlot	slot;
+    OddSlot	end;
+
+    if (NULL == local) {
+	return;
+    }
+    oj_caches_mark(local->caches);
+    for (slot = local->odd_cache, end = slot + (1 << ODD_CACHE_BITS); slot < end; slot++) {
+	if (!SPECIAL_CONST_P(slot->clas)) {
+	    rb_gc_mark(slot->clas);
+	}
+    }
+}
+
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+
+static void
+local_free(void *ptr) {
+    OjLocal	local = (OjLocal)ptr;
+
+    if (NULL == local) {
+	return;
+    }
+    oj_caches_free(local->caches);
+    xfree(local->dump_buf);
+    xfree(local);
+}
+
+static const struct rb_ractor_local_storage_type	local_type = { local_mark, local_free };
+static rb_ractor_local_key_t				local_key;
+
+// Returns the state of the current Ractor. The lookup for the main Ractor
+// does not search a table so it is cheap enough to make for every dump.
+OjLocal
+oj_local() {
+    OjLocal	local = (OjLocal)rb_ractor_local_storage_ptr(local_key);
+
+    if (NULL == local) {
+	local = local_new();
+	rb_ractor_local_storage_ptr_set(local_key, local);
+    }
+    return local;
+}
+
+void
+oj_local_init() {
+    local_key = rb_ractor_local_storage_ptr_newkey(&local_type);
+    main_local = local_new();
+    rb_ractor_local_storage_ptr_set(local_key, main_local);
+}
+
+#else
+
+static VALUE	local_holder = Qnil;
+
+OjLocal
+oj_local() {
+    return main_local;
+}
+
+void
+oj_local_init() {
+    main_local = local_new();
+    // The cached classes, Strings, and Symbols are only referenced from the
+    // caches so a hidden object is used to mark them.
+    local_holder = Data_Wrap_Struct(0, local_mark, 0, main_local);
+    rb_gc_register_address(&local_holder);
+}
+
+#endif
+
+// Raises a Ractor::UnsafeError unless called from the main Ractor. Used by
+// the methods that change process wide settings such as the default options
+// and the registered classes, which the other Ractors only read.
+void
+oj_main_ractor_check(const char *method) {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    if (main_local != oj_local()) {
+	rb_raise(rb_const_get(rb_cRactor, rb_intern("UnsafeError")), "%s can only be called from the main Ractor.", method);
+    }
+#endif
+}
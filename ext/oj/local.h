@@ -0,0 +1,36 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_LOCAL_H
+#define OJ_LOCAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ruby.h"
+#include "code.h"
+#include "hash.h"
+#include "odd.h"
+
+// The caches and buffers written while loading or dumping. Each Ractor has
+// its own so Ractors never write to shared tables. The one for the main
+// Ractor is made when Oj is loaded and the others on first use.
+typedef struct _ojLocal {
+    Caches		caches;
+    struct _codeSlot	code_cache[1 << CODE_CACHE_BITS];
+    struct _oddSlot	odd_cache[1 << ODD_CACHE_BITS];
+    // The buffer kept from the last Oj.dump, see dump.c.
+    char		*dump_buf;
+    size_t		dump_buf_size;
+    struct _out		*dump_buf_owner;
+    // The date part of the last time formatted by oj_xml_time_str().
+    int64_t		date_day;
+    char		date_str[32];
+    int			date_len;
+} *OjLocal;
+
+extern void	oj_local_init(void);
+extern OjLocal	oj_local(void);
+extern void	oj_main_ractor_check(const char *method);
+
+#endif /* OJ_LOCAL_H */
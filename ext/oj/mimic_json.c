@@ -20,6 +20,9 @@ VALUE	oj_space_sym;
 
 static VALUE	state_class;
 
+// The UnboundMethod for the Object#to_json defined by mimic_JSON or Qnil.
+VALUE	oj_mimic_to_json_method = Qnil;
+
 // mimic JSON documentation
 
 /* Document-module: JSON::Ext
@@ -203,6 +206,8 @@ mimic_dump(int argc, VALUE *argv, VALUE self) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.caller = CALLER_DUMP;
     copts.escape_mode = JXEsc;
     copts.mode = CompatMode;
@@ -236,13 +241,7 @@ mimic_dump(int argc, VALUE *argv, VALUE self) {
     // default ::JSON::State argument is passed in. Basically a hack to get
     // around the active support hack so two wrongs make a right this time.
     active_hack[0] = rb_funcall(state_class, oj_new_id, 0);
-    oj_dump_obj_to_json_using_params(*argv, &copts, &out, 1, active_hack);
-
-    if (0 == out.buf) {
-	rb_raise(rb_eNoMemError, "Not enough memory.");
-    }
-    rstr = rb_str_new2(out.buf);
-    rstr = oj_encode(rstr);
+    rstr = oj_dump_to_str(*argv, &copts, &out, 1, active_hack);
     if (2 <= argc && Qnil != argv[1] && rb_respond_to(argv[1], oj_write_id)) {
 	VALUE	io = argv[1];
 	VALUE	args[1];
@@ -251,9 +250,6 @@ mimic_dump(int argc, VALUE *argv, VALUE self) {
 	rb_funcall2(io, oj_write_id, 1, args);
 	rstr = io;
     }
-    if (out.allocated) {
-	xfree(out.buf);
-    }
     return rstr;
 }
 
@@ -369,6 +365,8 @@ mimic_generate_core(int argc, VALUE *argv, Options copts) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts->dump_opts.omit_nil;
     out.caller = CALLER_GENERATE;
     // For obj.to_json or generate nan is not allowed but if called from dump
@@ -384,16 +382,7 @@ mimic_generate_core(int argc, VALUE *argv, Options copts) {
 	rb_raise(rb_eTypeError, "nil not allowed.");
     }
     */
-    oj_dump_obj_to_json_using_params(*argv, copts, &out, argc - 1, argv + 1);
-
-    if (0 == out.buf) {
-	rb_raise(rb_eNoMemError, "Not enough memory.");
-    }
-    rstr = rb_str_new2(out.buf);
-    rstr = oj_encode(rstr);
-    if (out.allocated) {
-	xfree(out.buf);
-    }
+    rstr = oj_dump_to_str(*argv, copts, &out, argc - 1, argv + 1);
     return rstr;
 }
 
@@ -643,6 +632,7 @@ mimic_recurse_proc(VALUE self, VALUE obj) {
  */
 static VALUE
 mimic_set_create_id(VALUE self, VALUE id) {
+    oj_main_ractor_check("JSON.create_id=");
     Check_Type(id, T_STRING);
 
     if (NULL != oj_default_options.create_id) {
@@ -702,15 +692,24 @@ static struct _options	mimic_object_to_json_options = {
     No,		// safe
     false,	// sec_prec_set
     No,		// ignore_under
+    Yes,	// cache_keys
+    No,		// mmap_load
+    No,		// string_buf
+    0,		// cache_str
     0,		// int_range_min
     0,		// int_range_max
     oj_json_class,// create_id
     10,		// create_id_len
     3,		// sec_prec
+    0x1000,	// buffer_size
+    0,		// release_gvl
     0,		// float_prec
     "%0.16g",	// float_fmt
+    ClassicFloat,	// float_engine
     Qnil,	// hash_class
     Qnil,	// array_class
+    Qnil,	// only
+    Qnil,	// raw
     {		// dump_opts
 	false,	//use
 	"",	// indent
@@ -734,37 +733,104 @@ static struct _options	mimic_object_to_json_options = {
     }
 };
 
+// Sets up the options Object#to_json dumps with.
+static void
+object_to_json_options(int argc, VALUE *argv, Options copts) {
+    *copts = oj_default_options;
+    copts->str_rx.head = NULL;
+    copts->str_rx.tail = NULL;
+    copts->mode = CompatMode;
+    copts->to_json = No;
+    if (1 <= argc && Qnil != argv[0]) {
+	oj_parse_mimic_dump_options(argv[0], copts);
+    }
+}
+
 static VALUE
 mimic_object_to_json(int argc, VALUE *argv, VALUE self) {
     char		buf[4096];
     struct _out		out;
     VALUE		rstr;
-    struct _options	copts = oj_default_options;
+    struct _options	copts;
 
-    copts.str_rx.head = NULL;
-    copts.str_rx.tail = NULL;
+    object_to_json_options(argc, argv, &copts);
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts.dump_opts.omit_nil;
-    copts.mode = CompatMode;
-    copts.to_json = No;
-    if (1 <= argc && Qnil != argv[0]) {
-	oj_parse_mimic_dump_options(argv[0], &copts);
-    }
     // To be strict the mimic_object_to_json_options should be used but people
     // seem to prefer the option of changing that.
     //oj_dump_obj_to_json(self, &mimic_object_to_json_options, &out);
-    oj_dump_obj_to_json_using_params(self, &copts, &out, argc, argv);
-    if (0 == out.buf) {
+    rstr = oj_dump_to_str(self, &copts, &out, argc, argv);
+    return rstr;
+}
+
+typedef struct _objectDump {
+    VALUE	obj;
+    Options	copts;
+    Out		out;
+    Out		dest;
+    int		argc;
+    VALUE	*argv;
+} *ObjectDump;
+
+static VALUE
+object_dump_body(VALUE x) {
+    ObjectDump	od = (ObjectDump)x;
+    Out		out = od->out;
+    Out		dest = od->dest;
+    size_t	len;
+
+    oj_dump_obj_to_json_using_params(od->obj, od->copts, out, od->argc, od->argv);
+    if (0 == out->buf) {
 	rb_raise(rb_eNoMemError, "Not enough memory.");
     }
-    rstr = rb_str_new2(out.buf);
-    rstr = oj_encode(rstr);
-    if (out.allocated) {
-	xfree(out.buf);
+    len = out->cur - out->buf;
+    assure_size(dest, len + 1);
+    memcpy(dest->cur, out->buf, len);
+    dest->cur += len;
+    *dest->cur = '\0';
+
+    return Qnil;
+}
+
+static VALUE
+object_dump_ensure(VALUE x) {
+    Out	out = ((ObjectDump)x)->out;
+
+    if (out->allocated) {
+	xfree(out->buf);
     }
-    return rstr;
+    return Qnil;
+}
+
+// Writes what the Object#to_json defined by mimic_JSON would return for obj
+// to dest without calling it from Ruby or making a String of the
+// result. The dump is made with its own Out and options just as a call
+// would so the output is the same.
+void
+oj_mimic_object_dump(VALUE obj, int argc, VALUE *argv, Out dest) {
+    char		buf[4096];
+    struct _out		out;
+    struct _options	copts;
+    struct _objectDump	od;
+
+    object_to_json_options(argc, argv, &copts);
+    out.buf = buf;
+    out.end = buf + sizeof(buf) - 10;
+    out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
+    out.omit_nil = copts.dump_opts.omit_nil;
+    od.obj = obj;
+    od.copts = &copts;
+    od.out = &out;
+    od.dest = dest;
+    od.argc = argc;
+    od.argv = argv;
+    rb_ensure(object_dump_body, (VALUE)&od, object_dump_ensure, (VALUE)&od);
 }
 
 /* Document-method: state
@@ -856,6 +922,7 @@ oj_define_mimic_json(int argc, VALUE *argv, VALUE self) {
     VALUE	verbose;
     VALUE	json;
 
+    oj_main_ractor_check("Oj.mimic_JSON");
     // Either set the paths to indicate JSON has been loaded or replaces the
     // methods if it has been loaded.
     if (rb_const_defined_at(rb_cObject, rb_intern("JSON"))) {
@@ -881,6 +948,10 @@ oj_define_mimic_json(int argc, VALUE *argv, VALUE self) {
     oj_mimic_json_methods(json);
 
     rb_define_method(rb_cObject, "to_json", mimic_object_to_json, -1);
+    if (Qnil == oj_mimic_to_json_method) {
+	rb_gc_register_address(&oj_mimic_to_json_method);
+    }
+    oj_mimic_to_json_method = rb_funcall(rb_cObject, oj_instance_method_id, 1, ID2SYM(oj_to_json_id));
 
     rb_gv_set("$VERBOSE", verbose);
 
@@ -0,0 +1,538 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "oj.h"
+#include "err.h"
+#include "parse.h"
+#include "tape.h"
+
+#if defined(HAVE_PTHREAD_MUTEX_INIT) && defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+#include <pthread.h>
+#include <ruby/thread.h>
+#define OJ_NDJSON_THREADS 1
+#endif
+
+// Newline delimited JSON is loaded in rounds. Each round a window of the
+// input is split on line boundaries into one chunk per worker. The workers
+// record each line on a tape without the GVL and then the tapes are replayed
+// in order on the calling thread with the mode callbacks to build the Ruby
+// objects. With the :raw option the lines are parsed directly on the calling
+// thread instead.
+
+#define CHUNK_MIN	16384
+#define CHUNK_SIZE	65536
+#define MAX_THREADS	256
+
+typedef struct _ndLine {
+    const char	*json;
+    const char	*end;
+    long	line;	// line in the chunk, zero based
+    size_t	ev;	// first event on the tape
+} *NdLine;
+
+typedef struct _ndWork {
+    struct _parseInfo	pi;
+    struct _tape	tape;
+    char		*start;
+    char		*end;
+    NdLine		lines;
+    size_t		lcnt;
+    size_t		lsize;
+    long		line_cnt; // including blank lines
+    long		err_line; // -1 if no error
+#ifdef OJ_NDJSON_THREADS
+    pthread_t		thread;
+#endif
+} *NdWork;
+
+typedef struct _ndJson {
+    ParseInfo		pi;
+    volatile VALUE	input;
+    volatile VALUE	wrapped_stack;
+    volatile VALUE	result;
+    volatile VALUE	batch;
+    long		batch_size;
+    long		pos;	  // read position in the input string
+    char		*buf;
+    size_t		blen;
+    size_t		bsize;
+    NdWork		works;
+    int			wmax;
+    int			wcnt;
+    long		line;	  // first line of the window, one based
+    bool		eof;
+    bool		io;
+    bool		gc_disabled;
+} *NdJson;
+
+static bool
+blank_line(const char *s, const char *end) {
+    for (; s < end; s++) {
+	switch (*s) {
+	case ' ':
+	case '\t':
+	case '\r':
+	case '\f':
+	    break;
+	default:
+	    return false;
+	}
+    }
+    return true;
+}
+
+static char*
+last_newline(char *buf, size_t len) {
+    char	*s = buf + len;
+
+    while (buf < s) {
+	s--;
+	if ('\n' == *s) {
+	    return s;
+	}
+    }
+    return NULL;
+}
+
+// Records each line in the chunk. Must not call into Ruby.
+static void*
+work_run(void *arg) {
+    NdWork	w = (NdWork)arg;
+    char	*s = w->start;
+    char	*e;
+    long	line = 0;
+
+    for (; s <= w->end; s = e + 1, line++) {
+	size_t	ev = w->tape.ecnt;
+
+	if (NULL == (e = memchr(s, '\n', w->end - s))) {
+	    e = w->end;
+	}
+	*e = '\0';
+	if (blank_line(s, e)) {
+	    continue;
+	}
+	if (w->lsize <= w->lcnt) {
+	    size_t	size = (0 == w->lsize) ? 64 : w->lsize * 2;
+	    NdLine	lines;
+
+	    if (NULL == (lines = realloc(w->lines, sizeof(struct _ndLine) * size))) {
+		oj_err_set(&w->pi.err, rb_eNoMemError, "not enough memory");
+		w->err_line = line;
+		break;
+	    }
+	    w->lines = lines;
+	    w->lsize = size;
+	}
+	w->pi.json = s;
+	w->pi.end = e;
+	oj_tape_record(&w->pi);
+	if (err_has(&w->pi.err)) {
+	    oj_tape_reset(&w->tape, ev);
+	    w->err_line = line;
+	    break;
+	}
+	w->lines[w->lcnt].json = s;
+	w->lines[w->lcnt].end = e;
+	w->lines[w->lcnt].line = line;
+	w->lines[w->lcnt].ev = ev;
+	w->lcnt++;
+    }
+    w->line_cnt = line;
+
+    return NULL;
+}
+
+#ifdef OJ_NDJSON_THREADS
+static void*
+works_run(void *arg) {
+    NdJson	nd = (NdJson)arg;
+    NdWork	w;
+    NdWork	end = nd->works + nd->wcnt;
+
+    for (w = nd->works + 1; w < end; w++) {
+	if (0 != pthread_create(&w->thread, NULL, work_run, w)) {
+	    w->thread = 0;
+	    work_run(w);
+	}
+    }
+    work_run(nd->works);
+    for (w = nd->works + 1; w < end; w++) {
+	if (0 != w->thread) {
+	    pthread_join(w->thread, NULL);
+	}
+    }
+    return NULL;
+}
+#endif
+
+// Reads more of the input into the window. Returns false at the end of the
+// input.
+static bool
+fill(NdJson nd, size_t want) {
+    const char	*src;
+    long	len;
+
+    if (nd->eof) {
+	return false;
+    }
+    if (nd->bsize < nd->blen + want + 1) {
+	size_t	size = nd->blen + want + 1;
+	char	*buf;
+
+	if (NULL == (buf = realloc(nd->buf, size))) {
+	    rb_raise(rb_eNoMemError, "not enough memory");
+	}
+	nd->buf = buf;
+	nd->bsize = size;
+    }
+    if (nd->io) {
+	volatile VALUE	rstr = rb_funcall(nd->input, oj_read_id, 1, LONG2NUM((long)want));
+
+	if (Qnil == rstr) {
+	    nd->eof = true;
+	    return false;
+	}
+	Check_Type(rstr, T_STRING);
+	src = RSTRING_PTR(rstr);
+	len = RSTRING_LEN(rstr);
+	if ((long)want < len) {
+	    rb_raise(rb_eIOError, "read returned more bytes than requested");
+	}
+	if (0 == len) {
+	    nd->eof = true;
+	    return false;
+	}
+	memcpy(nd->buf + nd->blen, src, len);
+    } else {
+	len = RSTRING_LEN(nd->input) - nd->pos;
+	if ((long)want < len) {
+	    len = (long)want;
+	}
+	if (0 >= len) {
+	    nd->eof = true;
+	    return false;
+	}
+	memcpy(nd->buf + nd->blen, RSTRING_PTR(nd->input) + nd->pos, len);
+	nd->pos += len;
+    }
+    nd->blen += len;
+
+    return true;
+}
+
+static void
+raise_line_error(NdJson nd, Err err, long line) {
+    static const char	at[] = " at line 1, column ";
+    ParseInfo		pi = nd->pi;
+    VALUE		clas = err->clas;
+    const char		*s;
+
+    if (Qnil != pi->err_class) {
+	clas = pi->err_class;
+    }
+    if (CompatMode == pi->options.mode && oj_parse_error_class == clas) {
+	clas = oj_json_parser_error_class;
+    }
+    // Locations are relative to the start of the line the parser was given
+    // so replace the line number with the line in the input.
+    if (NULL != (s = strstr(err->msg, at))) {
+	rb_raise(clas, "%.*s at line %ld, column %s", (int)(s - err->msg), err->msg, line, s + sizeof(at) - 1);
+    }
+    rb_raise(clas, "%s", err->msg);
+}
+
+static void
+deliver(NdJson nd, VALUE obj) {
+    if (Qnil != nd->result) {
+	rb_ary_push(nd->result, obj);
+    } else if (0 < nd->batch_size) {
+	rb_ary_push(nd->batch, obj);
+	if (nd->batch_size <= RARRAY_LEN(nd->batch)) {
+	    VALUE	batch = nd->batch;
+
+	    nd->batch = rb_ary_new_capa(nd->batch_size);
+	    rb_yield(batch);
+	}
+    } else {
+	rb_yield(obj);
+    }
+}
+
+static void
+replay(NdJson nd, NdWork w, long line) {
+    ParseInfo	pi = nd->pi;
+    NdLine	ln = w->lines;
+    NdLine	end = w->lines + w->lcnt;
+
+    for (; ln < end; ln++) {
+	pi->json = ln->json;
+	pi->cur = ln->end;
+	pi->end = ln->end;
+	pi->stack.tail = pi->stack.head;
+	pi->stack.head->val = Qundef;
+	if (Yes == pi->options.circular) {
+	    pi->circ_array = oj_circ_array_new();
+	}
+	oj_tape_replay(pi, &w->tape, ln->ev);
+	if (0 != pi->circ_array) {
+	    oj_circ_array_free(pi->circ_array);
+	    pi->circ_array = 0;
+	}
+	if (err_has(&pi->err)) {
+	    raise_line_error(nd, &pi->err, line + ln->line);
+	}
+	deliver(nd, stack_head_val(&pi->stack));
+    }
+    if (0 <= w->err_line) {
+	raise_line_error(nd, &w->pi.err, line + w->err_line);
+    }
+}
+
+// Loads the lines of the window on the calling thread with the mode
+// callbacks. Used with the :raw option since the raw values are Ruby objects
+// that can not be made without the GVL or kept on a tape.
+static void
+direct_run(NdJson nd, size_t cut) {
+    ParseInfo	pi = nd->pi;
+    char	*s = nd->buf;
+    char	*end = nd->buf + cut;
+    char	*e;
+    long	line = 0;
+
+    for (; s <= end; s = e + 1, line++) {
+	if (NULL == (e = memchr(s, '\n', end - s))) {
+	    e = end;
+	}
+	*e = '\0';
+	if (blank_line(s, e)) {
+	    continue;
+	}
+	pi->json = s;
+	pi->cur = s;
+	pi->end = e;
+	if (Yes == pi->options.circular) {
+	    pi->circ_array = oj_circ_array_new();
+	}
+	oj_tape_record(pi);
+	if (0 != pi->circ_array) {
+	    oj_circ_array_free(pi->circ_array);
+	    pi->circ_array = 0;
+	}
+	if (err_has(&pi->err)) {
+	    raise_line_error(nd, &pi->err, nd->line + line);
+	}
+	deliver(nd, stack_head_val(&pi->stack));
+    }
+    nd->line += line;
+}
+
+static void
+works_setup(NdJson nd, size_t cut) {
+    NdWork	w = nd->works;
+    char	*s = nd->buf;
+    char	*end = nd->buf + cut;
+    int		cnt = (int)((cut + CHUNK_MIN - 1) / CHUNK_MIN);
+    int		i;
+
+    if (nd->wmax < cnt) {
+	cnt = nd->wmax;
+    }
+    if (0 == cnt) {
+	cnt = 1;
+    }
+    for (i = 0; i < cnt && s <= end; i++, w++) {
+	char	*e = end;
+
+	if (i < cnt - 1) {
+	    e = s + (end - s) / (cnt - i);
+	    if (NULL == (e = memchr(e, '\n', end - e))) {
+		e = end;
+	    }
+	}
+	w->start = s;
+	w->end = e;
+	w->lcnt = 0;
+	w->line_cnt = 0;
+	w->err_line = -1;
+	oj_tape_reset(&w->tape, 0);
+	w->tape.src = nd->buf;
+	w->tape.src_end = nd->buf + nd->blen + 1;
+	err_init(&w->pi.err);
+	s = e + 1;
+    }
+    nd->wcnt = i;
+}
+
+static VALUE
+ndjson_run(VALUE ndv) {
+    NdJson	nd = (NdJson)ndv;
+    int		i;
+
+    nd->works = ALLOC_N(struct _ndWork, nd->wmax);
+    memset(nd->works, 0, sizeof(struct _ndWork) * nd->wmax);
+    for (i = 0; i < nd->wmax; i++) {
+	NdWork	w = nd->works + i;
+
+	w->pi.options = nd->pi->options;
+	w->pi.handler = Qnil;
+	w->pi.err_class = Qnil;
+	oj_tape_init(&w->tape, NULL, NULL);
+	oj_tape_set_callbacks(&w->pi, &w->tape);
+	oj_stack_reset(&w->pi.stack);
+    }
+    while (true) {
+	size_t	want = (size_t)nd->wmax * CHUNK_SIZE;
+	size_t	cut;
+	char	*nl;
+
+	// Fill until there is at least one complete line or the input ends.
+	fill(nd, want);
+	while (NULL == (nl = last_newline(nd->buf, nd->blen)) && fill(nd, want)) {
+	    want *= 2;
+	}
+	if (NULL != nl && !nd->eof) {
+	    cut = nl - nd->buf;
+	} else {
+	    cut = nd->blen;
+	}
+	if (0 == nd->blen) {
+	    break;
+	}
+	nd->buf[nd->blen] = '\0';
+	if (Qnil != nd->pi->options.raw) {
+	    direct_run(nd, cut);
+	} else {
+	    works_setup(nd, cut);
+#ifdef OJ_NDJSON_THREADS
+	    if (1 < nd->wcnt) {
+		rb_thread_call_without_gvl(works_run, nd, NULL, NULL);
+	    } else {
+		rb_thread_call_without_gvl(work_run, nd->works, NULL, NULL);
+	    }
+#else
+	    for (i = 0; i < nd->wcnt; i++) {
+		work_run(nd->works + i);
+	    }
+#endif
+	    for (i = 0; i < nd->wcnt; i++) {
+		NdWork	w = nd->works + i;
+
+		replay(nd, w, nd->line);
+		nd->line += w->line_cnt;
+	    }
+	}
+	if (cut < nd->blen) {
+	    nd->blen -= cut + 1;
+	    memmove(nd->buf, nd->buf + cut + 1, nd->blen);
+	} else {
+	    nd->blen = 0;
+	}
+	if (nd->eof && 0 == nd->blen) {
+	    break;
+	}
+    }
+    if (0 < nd->batch_size && Qnil == nd->result && 0 < RARRAY_LEN(nd->batch)) {
+	rb_yield(nd->batch);
+    }
+    return nd->result;
+}
+
+static VALUE
+ndjson_cleanup(VALUE ndv) {
+    NdJson	nd = (NdJson)ndv;
+    int		i;
+
+    if (NULL != nd->works) {
+	for (i = 0; i < nd->wmax; i++) {
+	    NdWork	w = nd->works + i;
+
+	    oj_tape_cleanup(&w->tape);
+	    stack_cleanup(&w->pi.stack);
+	    free(w->lines);
+	}
+	xfree(nd->works);
+    }
+    free(nd->buf);
+    if (0 != nd->pi->circ_array) {
+	oj_circ_array_free(nd->pi->circ_array);
+    }
+    if (Qnil != nd->wrapped_stack) {
+	DATA_PTR(nd->wrapped_stack) = 0;
+    }
+    stack_cleanup(&nd->pi->stack);
+    if (nd->pi->str_rx.head != oj_default_options.str_rx.head) {
+	oj_rxclass_cleanup(&nd->pi->str_rx);
+    }
+    if (nd->gc_disabled) {
+	rb_gc_enable();
+    }
+    return Qnil;
+}
+
+// Loads each line of the input with the callbacks already set on pi. Each
+// object is yielded, yielded in batches of batch_size, or if no block is
+// given returned in an Array.
+VALUE
+oj_pi_ndjson(int argc, VALUE *argv, ParseInfo pi, int threads, long batch_size) {
+    struct _ndJson	nd;
+    volatile VALUE	result;
+
+    if (argc < 1) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to load_ndjson.");
+    }
+    if (2 <= argc && T_HASH == rb_type(argv[1])) {
+	oj_parse_options(argv[1], &pi->options);
+    }
+    memset(&nd, 0, sizeof(nd));
+    nd.pi = pi;
+    nd.input = argv[0];
+    nd.wrapped_stack = Qnil;
+    nd.result = Qnil;
+    nd.batch = Qnil;
+    nd.line = 1;
+    if (T_STRING == rb_type(nd.input)) {
+	rb_encoding	*enc = rb_to_encoding(rb_obj_encoding(nd.input));
+
+	if (rb_utf8_encoding() != enc) {
+	    nd.input = rb_str_conv_enc(nd.input, enc, rb_utf8_encoding());
+	}
+    } else if (rb_respond_to(nd.input, oj_read_id)) {
+	nd.io = true;
+    } else {
+	rb_raise(rb_eArgError, "load_ndjson() expected a String or IO Object.");
+    }
+    if (0 >= threads) {
+	threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads < 1) {
+	threads = 1;
+    } else if (MAX_THREADS < threads) {
+	threads = MAX_THREADS;
+    }
+    nd.wmax = threads;
+    if (rb_block_given_p()) {
+	nd.batch_size = batch_size;
+	if (0 < batch_size) {
+	    nd.batch = rb_ary_new_capa(batch_size);
+	}
+    } else {
+	nd.result = rb_ary_new();
+    }
+    pi->proc = Qundef;
+    pi->circ_array = 0;
+    err_init(&pi->err);
+    if (No == pi->options.allow_gc) {
+	rb_gc_disable();
+	nd.gc_disabled = true;
+    }
+    // The stack is wrapped so the GC marks the objects on it. See
+    // oj_pi_parse().
+    nd.wrapped_stack = oj_stack_init(&pi->stack);
+    result = rb_ensure(ndjson_run, (VALUE)&nd, ndjson_cleanup, (VALUE)&nd);
+
+    return result;
+}
@@ -1,5 +1,6 @@
 // Copyright (c) 2012 Peter Ohler. All rights reserved.
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <time.h>
@@ -10,6 +11,7 @@
 #include "resolve.h"
 #include "hash.h"
 #include "odd.h"
+#include "util.h"
 #include "encode.h"
 #include "trace.h"
 #include "util.h"
@@ -28,20 +30,24 @@ read_long(const char *str, size_t len) {
     return n;
 }
 
+inline static OddArgs
+parent_odd_args(ParseInfo pi, Val parent) {
+    ValCold	cold = stack_cold_peek(&pi->stack, parent);
+
+    return (NULL == cold) ? NULL : cold->odd_args;
+}
+
 static VALUE
 calc_hash_key(ParseInfo pi, Val kval, char k1) {
     volatile VALUE	rkey;
 
     if (':' == k1) {
-	rkey = rb_str_new(kval->key + 1, kval->klen - 1);
-	rkey = oj_encode(rkey);
-	rkey = rb_funcall(rkey, oj_to_sym_id, 0);
+	rkey = oj_sym_new(kval->key + 1, kval->klen - 1);
+    } else if (Yes == pi->options.sym_key) {
+	rkey = oj_sym_new(kval->key, kval->klen);
     } else {
 	rkey = rb_str_new(kval->key, kval->klen);
 	rkey = oj_encode(rkey);
-	if (Yes == pi->options.sym_key) {
-	    rkey = rb_str_intern(rkey);
-	}
     }
     return rkey;
 }
@@ -51,9 +57,7 @@ str_to_value(ParseInfo pi, const char *str, size_t len, const char *orig) {
     volatile VALUE	rstr = Qnil;
 
     if (':' == *orig && 0 < len) {
-	rstr = rb_str_new(str + 1, len - 1);
-	rstr = oj_encode(rstr);
-	rstr = rb_funcall(rstr, oj_to_sym_id, 0);
+	rstr = oj_sym_new(str + 1, len - 1);
     } else if (pi->circ_array && 3 <= len && '^' == *orig && 'r' == orig[1]) {
 	long	i = read_long(str + 2, len - 2);
 
@@ -69,145 +73,23 @@ str_to_value(ParseInfo pi, const char *str, size_t len, const char *orig) {
     return rstr;
 }
 
-#if (RUBY_VERSION_MAJOR == 1 && RUBY_VERSION_MINOR == 8)
-static VALUE
-oj_parse_xml_time(const char *str, int len) {
-    return rb_funcall(rb_cTime, oj_parse_id, 1, rb_str_new(str, len));
-}
-#else
-// The much faster approach (4x faster)
-static int
-parse_num(const char *str, const char *end, int cnt) {
-    int		n = 0;
-    char	c;
-    int		i;
-
-    for (i = cnt; 0 < i; i--, str++) {
-	c = *str;
-	if (end <= str || c < '0' || '9' < c) {
-	    return -1;
-	}
-	n = n * 10 + (c - '0');
-    }
-    return n;
-}
-
+// Returns a Time for an ISO 8601 date and time or Qnil if str is not one. A
+// Z zone gives a UTC Time, anything else a fixed offset which is 0 when no
+// zone is given. A day past the end of the month or a second of 60 rolls
+// over as it does with Time.utc.
 VALUE
 oj_parse_xml_time(const char *str, int len) {
-    VALUE	args[8];
-    const char	*end = str + len;
-    int		n;
+    struct _isoTime	it;
+    struct timespec	ts;
 
-    // year
-    if (0 > (n = parse_num(str, end, 4))) {
-	return Qnil;
-    }
-    str += 4;
-    args[0] = LONG2NUM(n);
-    if ('-' != *str++) {
-	return Qnil;
-    }
-    // month
-    if (0 > (n = parse_num(str, end, 2))) {
-	return Qnil;
-    }
-    str += 2;
-    args[1] = LONG2NUM(n);
-    if ('-' != *str++) {
-	return Qnil;
-    }
-    // day
-    if (0 > (n = parse_num(str, end, 2))) {
-	return Qnil;
-    }
-    str += 2;
-    args[2] = LONG2NUM(n);
-    if ('T' != *str++) {
-	return Qnil;
-    }
-    // hour
-    if (0 > (n = parse_num(str, end, 2))) {
+    if (!oj_parse_iso8601(str, (size_t)len, &it) || !it.has_time) {
 	return Qnil;
     }
-    str += 2;
-    args[3] = LONG2NUM(n);
-    if (':' != *str++) {
-	return Qnil;
-    }
-    // minute
-    if (0 > (n = parse_num(str, end, 2))) {
-	return Qnil;
-    }
-    str += 2;
-    args[4] = LONG2NUM(n);
-    if (':' != *str++) {
-	return Qnil;
-    }
-    // second
-    if (0 > (n = parse_num(str, end, 2))) {
-	return Qnil;
-    }
-    str += 2;
-    if (str == end) {
-	args[5] = LONG2NUM(n);
-	args[6] = LONG2NUM(0);
-    } else {
-	char	c = *str++;
-
-	if ('.' == c) {
-	    long long	nsec = 0;
+    ts.tv_sec = (time_t)it.secs;
+    ts.tv_nsec = it.nsecs;
 
-	    for (; str < end; str++) {
-		c = *str;
-		if (c < '0' || '9' < c) {
-		    str++;
-		    break;
-		}
-		nsec = nsec * 10 + (c - '0');
-	    }
-	    args[5] = rb_float_new((double)n + ((double)nsec + 0.5) / 1000000000.0);
-	} else {
-	    args[5] = rb_ll2inum(n);
-	}
-	if (end < str) {
-	    args[6] = LONG2NUM(0);
-	} else {
-	    if ('Z' == c) {
-		return rb_funcall2(rb_cTime, oj_utc_id, 6, args);
-	    } else if ('+' == c) {
-		int	hr = parse_num(str, end, 2);
-		int	min;
-
-		str += 2;
-		if (0 > hr || ':' != *str++) {
-		    return Qnil;
-		}
-		min = parse_num(str, end, 2);
-		if (0 > min) {
-		    return Qnil;
-		}
-		args[6] = LONG2NUM(hr * 3600 + min * 60);
-	    } else if ('-' == c) {
-		int	hr = parse_num(str, end, 2);
-		int	min;
-
-		str += 2;
-		if (0 > hr || ':' != *str++) {
-		    return Qnil;
-		}
-		min = parse_num(str, end, 2);
-		if (0 > min) {
-		    return Qnil;
-		}
-		args[6] = LONG2NUM(-(hr * 3600 + min * 60));
-	    } else {
-		args[6] = LONG2NUM(0);
-	    }
-	}
-    }
-    return rb_funcall2(rb_cTime, oj_new_id, 7, args);
+    return rb_time_timespec_new(&ts, it.utc ? INT_MAX - 1 : it.offset);
 }
-#endif
 
 static int
 hat_cstr(ParseInfo pi, Val parent, Val kval, const char *str, size_t len) {
@@ -233,13 +115,11 @@ hat_cstr(ParseInfo pi, Val parent, Val kval, const char *str, size_t len) {
 		    return 0;
 		}
 		parent->val = odd->clas;
-		parent->odd_args = oj_odd_alloc_args(odd);
+		stack_cold(&pi->stack, parent)->odd_args = oj_odd_alloc_args(odd);
 	    }
 	    break;
 	case 'm':
-	    parent->val = rb_str_new(str + 1, len - 1);
-	    parent->val = oj_encode(parent->val);
-	    parent->val = rb_funcall(parent->val, oj_to_sym_id, 0);
+	    parent->val = oj_sym_new(str + 1, len - 1);
 	    break;
 	case 's':
 	    parent->val = rb_str_new(str, len);
@@ -401,18 +281,12 @@ hat_value(ParseInfo pi, Val parent, const char *key, size_t klen, volatile VALUE
 }
 
 void
-oj_set_obj_ivar(Val parent, Val kval, VALUE value) {
+oj_set_obj_ivar(ParseInfo pi, Val parent, Val kval, VALUE value) {
     const char	*key = kval->key;
     int		klen = kval->klen;
     ID		var_id;
-    ID		*slot;
 
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-    pthread_mutex_lock(&oj_cache_mutex);
-#else
-    rb_mutex_lock(oj_cache_mutex);
-#endif
-    if (0 == (var_id = oj_attr_hash_get(key, klen, &slot))) {
+    if (0 == (var_id = oj_attr_hash_get(parse_caches(pi), key, klen))) {
 	char	attr[256];
 
 	if ((int)sizeof(attr) <= klen + 2) {
@@ -439,13 +313,8 @@ oj_set_obj_ivar(Val parent, Val kval, VALUE value) {
 	    }
 	    var_id = rb_intern(attr);
 	}
-	*slot = var_id;
+	oj_attr_hash_set(parse_caches(pi), key, klen, var_id);
     }
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-    pthread_mutex_unlock(&oj_cache_mutex);
-#else
-    rb_mutex_unlock(oj_cache_mutex);
-#endif
     rb_ivar_set(parent->val, var_id, value);
 }
 
@@ -459,7 +328,6 @@ hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *o
  WHICH_TYPE:
     switch (rb_type(parent->val)) {
     case T_NIL:
-	parent->odd_args = NULL; // make sure it is NULL in case not odd
 	if ('^' != *key || !hat_cstr(pi, parent, kval, str, len)) {
 	    parent->val = rb_hash_new();
 	    goto WHICH_TYPE;
@@ -473,20 +341,20 @@ hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *o
 	if (4 == klen && 's' == *key && 'e' == key[1] && 'l' == key[2] && 'f' == key[3]) {
 	    rb_funcall(parent->val, oj_replace_id, 1, rval);
 	} else {
-	    oj_set_obj_ivar(parent, kval, rval);
+	    oj_set_obj_ivar(pi, parent, kval, rval);
 	}
 	break;
     case T_OBJECT:
 	rval = str_to_value(pi, str, len, orig);
-	oj_set_obj_ivar(parent, kval, rval);
+	oj_set_obj_ivar(pi, parent, kval, rval);
 	break;
     case T_CLASS:
-	if (NULL == parent->odd_args) {
+	if (NULL == parent_odd_args(pi, parent)) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "%s is not an odd class", rb_class2name(rb_obj_class(parent->val)));
 	    return;
 	} else {
 	    rval = str_to_value(pi, str, len, orig);
-	    if (0 != oj_odd_set_arg(parent->odd_args, kval->key, kval->klen, rval)) {
+	    if (0 != oj_odd_set_arg(parent_odd_args(pi, parent), kval->key, kval->klen, rval)) {
 		char	buf[256];
 
 		if ((int)sizeof(buf) - 1 <= klen) {
@@ -517,7 +385,6 @@ hash_set_num(ParseInfo pi, Val kval, NumInfo ni) {
  WHICH_TYPE:
     switch (rb_type(parent->val)) {
     case T_NIL:
-	parent->odd_args = NULL; // make sure it is NULL in case not odd
 	if ('^' != *key || !hat_num(pi, parent, kval, ni)) {
 	    parent->val = rb_hash_new();
 	    goto WHICH_TYPE;
@@ -533,16 +400,16 @@ hash_set_num(ParseInfo pi, Val kval, NumInfo ni) {
 	    oj_circ_array_set(pi->circ_array, parent->val, ni->i);
 	} else {
 	    rval = oj_num_as_value(ni);
-	    oj_set_obj_ivar(parent, kval, rval);
+	    oj_set_obj_ivar(pi, parent, kval, rval);
 	}
 	break;
     case T_CLASS:
-	if (NULL == parent->odd_args) {
+	if (NULL == parent_odd_args(pi, parent)) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "%s is not an odd class", rb_class2name(rb_obj_class(parent->val)));
 	    return;
 	} else {
 	    rval = oj_num_as_value(ni);
-	    if (0 != oj_odd_set_arg(parent->odd_args, key, klen, rval)) {
+	    if (0 != oj_odd_set_arg(parent_odd_args(pi, parent), key, klen, rval)) {
 		char	buf[256];
 
 		if ((int)sizeof(buf) - 1 <= klen) {
@@ -572,7 +439,6 @@ hash_set_value(ParseInfo pi, Val kval, VALUE value) {
  WHICH_TYPE:
     switch (rb_type(parent->val)) {
     case T_NIL:
-	parent->odd_args = NULL; // make sure it is NULL in case not odd
 	if ('^' != *key || !hat_value(pi, parent, key, klen, value)) {
 	    parent->val = rb_hash_new();
 	    goto WHICH_TYPE;
@@ -583,7 +449,7 @@ hash_set_value(ParseInfo pi, Val kval, VALUE value) {
 	    if (4 == klen && 's' == *key && 'e' == key[1] && 'l' == key[2] && 'f' == key[3]) {
 		rb_funcall(parent->val, oj_replace_id, 1, value);
 	    } else {
-		oj_set_obj_ivar(parent, kval, value);
+		oj_set_obj_ivar(pi, parent, kval, value);
 	    }
 	} else {
 	    if (3 <= klen && '^' == *key && '#' == key[1] && T_ARRAY == rb_type(value)) {
@@ -604,19 +470,19 @@ hash_set_value(ParseInfo pi, Val kval, VALUE value) {
 	if (4 == klen && 's' == *key && 'e' == key[1] && 'l' == key[2] && 'f' == key[3]) {
 	    rb_funcall(parent->val, oj_replace_id, 1, value);
 	} else {
-	    oj_set_obj_ivar(parent, kval, value);
+	    oj_set_obj_ivar(pi, parent, kval, value);
 	}
 	break;
     case T_STRING: // for subclassed strings
     case T_OBJECT:
-	oj_set_obj_ivar(parent, kval, value);
+	oj_set_obj_ivar(pi, parent, kval, value);
 	break;
     case T_MODULE:
     case T_CLASS:
-	if (NULL == parent->odd_args) {
+	if (NULL == parent_odd_args(pi, parent)) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "%s is not an odd class", rb_class2name(rb_obj_class(parent->val)));
 	    return;
-	} else if (0 !=	oj_odd_set_arg(parent->odd_args, key, klen, value)) {
+	} else if (0 !=	oj_odd_set_arg(parent_odd_args(pi, parent), key, klen, value)) {
 	    char	buf[256];
 
 	    if ((int)sizeof(buf) - 1 <= klen) {
@@ -650,12 +516,13 @@ end_hash(ParseInfo pi) {
 
     if (Qnil == parent->val) {
 	parent->val = rb_hash_new();
-    } else if (NULL != parent->odd_args) {
-	OddArgs	oa = parent->odd_args;
+    } else if (NULL != parent_odd_args(pi, parent)) {
+	ValCold	cold = stack_cold_peek(&pi->stack, parent);
+	OddArgs	oa = cold->odd_args;
 
 	parent->val = rb_funcall2(oa->odd->create_obj, oa->odd->create_op, oa->odd->attr_cnt, oa->args);
 	oj_odd_free(oa);
-	parent->odd_args = NULL;
+	cold->odd_args = NULL;
     }
     if (Yes == pi->options.trace) {
 	oj_trace_parse_hash_end(pi, __FILE__, __LINE__);
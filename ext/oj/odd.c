@@ -1,8 +1,10 @@
 // Copyright (c) 2011 Peter Ohler. All rights reserved.
 
+#include <stdint.h>
 #include <string.h>
 
 #include "odd.h"
+#include "local.h"
 
 static struct _odd	_odds[4]; // bump up if new initial Odd classes are added
 static struct _odd	*odds = _odds;
@@ -15,6 +17,27 @@ static ID		denominator_id;
 static ID		rational_id;
 static VALUE		rational_class;
 
+// Classes seen by oj_get_odd() are kept in a direct mapped cache along with
+// the Odd found for them, or NULL if there is none. Each Ractor has its own
+// cache and marks the classes in it so a slot can not outlive its class and
+// be matched by a new class at the same address. Registering an Odd, which
+// is only allowed on the main Ractor, moves the odds array so the caches
+// are invalidated and the name table is rebuilt.
+
+// Names map to the index of the last Odd registered with that name and, for
+// module prefix matches, the last module. -1 indicates none.
+typedef struct _oddName {
+    const char	*name;
+    size_t	len;
+    uint32_t	hash;
+    long	exact;
+    long	module;
+} *OddName;
+
+static uint32_t		odd_gen = 1;
+static OddName		odd_names = NULL;
+static uint32_t		odd_name_mask = 0;
+
 static void
 set_class(Odd odd, const char *classname) {
     const char	**np;
@@ -29,10 +52,13 @@ set_class(Odd odd, const char *classname) {
     odd->raw = 0;
     for (np = odd->attr_names, idp = odd->attrs; 0 != *np; np++, idp++) {
 	*idp = rb_intern(*np);
+	odd->attr_lens[np - odd->attr_names] = strlen(*np);
     }
     *idp = 0;
 }
 
+static void	build_names(void);
+
 static VALUE
 get_datetime_secs(VALUE obj) {
     volatile VALUE	rsecs = rb_funcall(obj, sec_id, 0);
@@ -106,16 +132,97 @@ oj_odd_init() {
     odd->attr_cnt = 3;
 
     odd_cnt = odd - odds + 1;
+    build_names();
+}
+
+static uint32_t
+name_hash(const char *name, size_t len) {
+    uint32_t	h = 2166136261u;
+
+    for (; 0 < len; len--, name++) {
+	h = (h ^ (uint8_t)*name) * 16777619u;
+    }
+    return h | 1; // never 0 so 0 marks an empty slot
+}
+
+static OddName
+name_find(const char *name, size_t len) {
+    uint32_t	h = name_hash(name, len);
+    OddName	on;
+
+    for (on = odd_names + (h & odd_name_mask); 0 != on->hash; on = odd_names + ((on - odd_names + 1) & odd_name_mask)) {
+	if (h == on->hash && len == on->len && 0 == memcmp(name, on->name, len)) {
+	    break;
+	}
+    }
+    return on;
+}
+
+static void
+build_names() {
+    uint32_t	size = 16;
+    long	i;
+
+    while (size < odd_cnt * 2) {
+	size *= 2;
+    }
+    if (odd_name_mask + 1 != size) {
+	xfree(odd_names);
+	odd_names = ALLOC_N(struct _oddName, size);
+	odd_name_mask = size - 1;
+    }
+    memset(odd_names, 0, sizeof(struct _oddName) * size);
+    for (i = 0; i < odd_cnt; i++) {
+	Odd	odd = odds + i;
+	OddName	on = name_find(odd->classname, odd->clen);
+
+	if (0 == on->hash) {
+	    on->name = odd->classname;
+	    on->len = odd->clen;
+	    on->hash = name_hash(odd->classname, odd->clen);
+	    on->module = -1;
+	}
+	on->exact = i;
+	if (odd->is_module) {
+	    on->module = i;
+	}
+    }
+}
+
+// Returns the last registered Odd named classname or, if later, the last
+// registered module whose name is a prefix of classname up to a ':'.
+static Odd
+odd_by_name(const char *classname, size_t len) {
+    OddName	on;
+    long	best = -1;
+    size_t	i;
+
+    if (0 != (on = name_find(classname, len))->hash) {
+	best = on->exact;
+    }
+    for (i = 1; i < len; i++) {
+	if (':' == classname[i] &&
+	    0 != (on = name_find(classname, i))->hash &&
+	    best < on->module) {
+	    best = on->module;
+	}
+    }
+    return (0 <= best) ? odds + best : NULL;
 }
 
 Odd
 oj_get_odd(VALUE clas) {
+    uint64_t	h = (uint64_t)clas * 0x9E3779B97F4A7C15ULL;
+    OddSlot	slot = oj_local()->odd_cache + (h >> (64 - ODD_CACHE_BITS));
     Odd		odd;
     const char	*classname = NULL;
 
+    if (odd_gen == slot->gen && clas == slot->clas) {
+	return slot->odd;
+    }
     for (odd = odds + odd_cnt - 1; odds <= odd; odd--) {
 	if (clas == odd->clas) {
-	    return odd;
+	    break;
 	}
 	if (odd->is_module) {
 	    if (NULL == classname) {
@@ -123,28 +230,20 @@ oj_get_odd(VALUE clas) {
 	    }
 	    if (0 == strncmp(odd->classname, classname, odd->clen) &&
 		':' == classname[odd->clen]) {
-		return odd;
+		break;
 	    }
 	}
     }
-    return NULL;
+    slot->clas = clas;
+    slot->odd = (odds <= odd) ? odd : NULL;
+    slot->gen = odd_gen;
+
+    return slot->odd;
 }
 
 Odd
 oj_get_oddc(const char *classname, size_t len) {
-    Odd	odd;
-
-    for (odd = odds + odd_cnt - 1; odds <= odd; odd--) {
-	if (len == odd->clen && 0 == strncmp(classname, odd->classname, len)) {
-	    return odd;
-	}
-	if (odd->is_module &&
-	    0 == strncmp(odd->classname, classname, odd->clen) &&
-	    ':' == classname[odd->clen]) {
-	    return odd;
-	}
-    }
-    return 0;
+    return odd_by_name(classname, len);
 }
 
 OddArgs
@@ -165,6 +264,45 @@ oj_odd_free(OddArgs args) {
     xfree(args);
 }
 
+VALUE
+oj_odd_get_attr(Odd odd, int i, VALUE obj) {
+    ID	*idp;
+
+    if (0 != odd->attrFuncs[i]) {
+	return odd->attrFuncs[i](obj);
+    }
+    if (NULL == odd->attr_paths[i]) {
+	return rb_funcall(obj, odd->attrs[i], 0);
+    }
+    for (idp = odd->attr_paths[i]; 0 != *idp; idp++) {
+	obj = rb_funcall(obj, *idp, 0);
+    }
+    return obj;
+}
+
+// Splits a dotted attribute name into the IDs of the methods called in turn
+// to get the value.
+static ID*
+attr_path(const char *name) {
+    const char	*n;
+    const char	*end;
+    ID		*path;
+    ID		*ip;
+    int		cnt = 2;
+
+    for (n = name; NULL != (n = strchr(n, '.')); n++) {
+	cnt++;
+    }
+    path = ALLOC_N(ID, cnt);
+    for (n = name, ip = path; NULL != (end = strchr(n, '.')); n = end + 1, ip++) {
+	*ip = rb_intern2(n, end - n);
+    }
+    *ip++ = rb_intern(n);
+    *ip = 0;
+
+    return path;
+}
+
 int
 oj_odd_set_arg(OddArgs args, const char *key, size_t klen, VALUE value) {
     const char	**np;
@@ -194,6 +332,7 @@ oj_reg_odd(VALUE clas, VALUE create_object, VALUE create_method, int mcnt, VALUE
     } else {
 	REALLOC_N(odds, struct _odd, odd_cnt + 1);
     }
+    odd_gen++;
     odd = odds + odd_cnt;
     odd->clas = clas;
     if (NULL == (odd->classname = strdup(rb_class2name(clas)))) {
@@ -221,8 +360,11 @@ oj_reg_odd(VALUE clas, VALUE create_object, VALUE create_method, int mcnt, VALUE
 	    break;
 	}
 	*ap = rb_intern(*np);
+	odd->attr_lens[np - odd->attr_names] = strlen(*np);
+	odd->attr_paths[np - odd->attr_names] = (NULL == strchr(*np, '.')) ? NULL : attr_path(*np);
     }
     *np = 0;
     *ap = 0;
     odd_cnt++;
+    build_names();
 }
@@ -4,6 +4,7 @@
 #define OJ_ODD_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "ruby.h"
 
@@ -23,8 +24,18 @@ typedef struct _odd {
     const char	*attr_names[MAX_ODD_ARGS]; // NULL terminated attr names
     ID		attrs[MAX_ODD_ARGS];	   // 0 terminated attr IDs
     AttrGetFunc	attrFuncs[MAX_ODD_ARGS];
+    size_t	attr_lens[MAX_ODD_ARGS];
+    ID		*attr_paths[MAX_ODD_ARGS]; // 0 terminated method chain for dotted names, NULL otherwise
 } *Odd;
 
+#define ODD_CACHE_BITS	8
+
+typedef struct _oddSlot {
+    VALUE	clas;
+    Odd		odd;
+    uint32_t	gen;
+} *OddSlot;
+
 typedef struct _oddArgs {
     Odd		odd;
     VALUE	args[MAX_ODD_ARGS];
@@ -35,6 +46,7 @@ extern Odd	oj_get_odd(VALUE clas);
 extern Odd	oj_get_oddc(const char *classname, size_t len);
 extern OddArgs	oj_odd_alloc_args(Odd odd);
 extern void	oj_odd_free(OddArgs args);
+extern VALUE	oj_odd_get_attr(Odd odd, int i, VALUE obj);
 extern int	oj_odd_set_arg(OddArgs args, const char *key, size_t klen, VALUE value);
 extern void	oj_reg_odd(VALUE clas, VALUE create_object, VALUE create_method, int mcnt, VALUE *members, bool raw);
 
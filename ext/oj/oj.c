@@ -7,14 +7,23 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
+#if !IS_WINDOWS
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "oj.h"
 #include "parse.h"
+#include "compress.h"
 #include "hash.h"
+#include "local.h"
+#include "stats.h"
 #include "odd.h"
 #include "dump.h"
 #include "rails.h"
 #include "encode.h"
+#include "only.h"
+#include "shape.h"
 
 typedef struct _yesNoOpt {
     VALUE	sym;
@@ -44,8 +53,10 @@ ID	oj_hash_key_id;
 ID	oj_hash_set_id;
 ID	oj_hash_start_id;
 ID	oj_iconv_id;
+ID	oj_instance_method_id;
 ID	oj_instance_variables_id;
 ID	oj_json_create_id;
+ID	oj_json_ivar_id;
 ID	oj_length_id;
 ID	oj_new_id;
 ID	oj_parse_id;
@@ -78,6 +89,7 @@ VALUE	oj_date_class;
 VALUE	oj_datetime_class;
 VALUE	oj_enumerable_class;
 VALUE	oj_parse_error_class;
+VALUE	oj_raw_json_class;
 VALUE	oj_stream_writer_class;
 VALUE	oj_string_writer_class;
 VALUE	oj_stringio_class;
@@ -102,9 +114,13 @@ static VALUE	allow_invalid_unicode_sym;
 static VALUE	ascii_sym;
 static VALUE	auto_define_sym;
 static VALUE	auto_sym;
+static VALUE	batch_size_sym;
 static VALUE	bigdecimal_as_decimal_sym;
 static VALUE	bigdecimal_load_sym;
 static VALUE	bigdecimal_sym;
+static VALUE	buffer_size_sym;
+static VALUE	cache_keys_sym;
+static VALUE	cache_strings_sym;
 static VALUE	circular_sym;
 static VALUE	class_cache_sym;
 static VALUE	compat_bigdecimal_sym;
@@ -114,7 +130,10 @@ static VALUE	custom_sym;
 static VALUE	empty_string_sym;
 static VALUE	escape_mode_sym;
 static VALUE	integer_range_sym;
+static VALUE	classic_sym;
 static VALUE	fast_sym;
+static VALUE	rational_sym;
+static VALUE	float_engine_sym;
 static VALUE	float_prec_sym;
 static VALUE	float_sym;
 static VALUE	huge_sym;
@@ -122,6 +141,7 @@ static VALUE	ignore_sym;
 static VALUE	ignore_under_sym;
 static VALUE	json_sym;
 static VALUE	match_string_sym;
+static VALUE	mmap_sym;
 static VALUE	mode_sym;
 static VALUE	nan_sym;
 static VALUE	newline_sym;
@@ -129,12 +149,18 @@ static VALUE	nilnil_sym;
 static VALUE	null_sym;
 static VALUE	object_sym;
 static VALUE	omit_nil_sym;
+static VALUE	only_sym;
 static VALUE	rails_sym;
+static VALUE	raw_sym;
 static VALUE	raise_sym;
+static VALUE	release_gvl_sym;
 static VALUE	ruby_sym;
 static VALUE	sec_prec_sym;
+static VALUE	shortest_sym;
 static VALUE	strict_sym;
+static VALUE	string_buffer_sym;
 static VALUE	symbol_keys_sym;
+static VALUE	threads_sym;
 static VALUE	time_format_sym;
 static VALUE	unicode_xss_sym;
 static VALUE	unix_sym;
@@ -150,12 +176,6 @@ static VALUE	xss_safe_sym;
 
 rb_encoding	*oj_utf8_encoding = 0;
 
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-pthread_mutex_t	oj_cache_mutex;
-#else
-VALUE oj_cache_mutex = Qnil;
-#endif
-
 const char	oj_json_class[] = "json_class";
 
 struct _options	oj_default_options = {
@@ -185,15 +205,24 @@ struct _options	oj_default_options = {
     No,		// safe
     false,	// sec_prec_set
     No,		// ignore_under
+    Yes,	// cache_keys
+    No,		// mmap_load
+    No,		// string_buf
+    0,		// cache_str
     0,		// int_range_min
     0,		// int_range_max
     oj_json_class,	// create_id
     10,		// create_id_len
     9,		// sec_prec
+    0x1000,	// buffer_size
+    0,		// release_gvl
     16,		// float_prec
     "%0.15g",	// float_fmt
+    ClassicFloat,	// float_engine
     Qnil,	// hash_class
     Qnil,	// array_class
+    Qnil,	// only
+    Qnil,	// raw
     {		// dump_opts
 	false,	//use
 	"",	// indent
@@ -231,12 +260,15 @@ struct _options	oj_default_options = {
  * - *:mode* [_:object_|_:strict_|_:compat_|_:null_|_:custom_|_:rails_|_:wab_] load and dump modes to use for JSON
  * - *:time_format* [_:unix_|_:unix_zone_|_:xmlschema_|_:ruby_] time format when dumping
  * - *:bigdecimal_as_decimal* [_Boolean_|_nil_] dump BigDecimal as a decimal number or as a String
- * - *:bigdecimal_load* [_:bigdecimal_|_:float_|_:auto_|_:fast_] load decimals as BigDecimal instead of as a Float. :auto pick the most precise for the number of digits. :float should be the same as ruby. :fast may require rounding but is must faster.
+ * - *:bigdecimal_load* [_:bigdecimal_|_:float_|_:auto_|_:fast_|_:rational_] load decimals as BigDecimal instead of as a Float. :auto pick the most precise for the number of digits. :float should be the same as ruby. :fast may require rounding but is must faster. :rational loads exact Rationals, or Integers for whole values, when the digits fit in 128 bits and BigDecimals otherwise.
  * - *:compat_bigdecimal* [_true_|_false_] load decimals as BigDecimal instead of as a Float when in compat or rails mode.
  * - *:create_id* [_String_|_nil_] create id for json compatible object encoding, default is 'json_class'
  * - *:create_additions* [_Boolean_|_nil_] if true allow creation of instances using create_id on load.
  * - *:second_precision* [_Fixnum_|_nil_] number of digits after the decimal when dumping the seconds portion of time
+ * - *:buffer_size* [_Fixnum_] size of the read buffer used by the stream parser, at least 4096
+ * - *:release_gvl* [_Fixnum_|_nil_] string loads of at least this many bytes are tokenized without holding the GVL, 0 or nil for never
  * - *:float_precision* [_Fixnum_|_nil_] number of digits of precision when dumping floats, 0 indicates use Ruby
+ * - *:float_engine* [_:classic_|_:shortest_] :classic dumps floats with printf and the float_precision or with Ruby, :shortest dumps the shortest form that loads back to the same value
  * - *:use_to_json* [_Boolean_|_nil_] call to_json() methods on dump, default is false
  * - *:use_as_json* [_Boolean_|_nil_] call as_json() methods on dump, default is false
  * - *:use_raw_json* [_Boolean_|_nil_] call raw_json() methods on dump, default is false
@@ -254,10 +286,16 @@ struct _options	oj_default_options = {
  * - *:nan* [_:null_|_:huge_|_:word_|_:raise_|_:auto_] how to dump Infinity and NaN. :null places a null, :huge places a huge number, :word places Infinity or NaN, :raise raises and exception, :auto uses default for each mode.
  * - *:hash_class* [_Class_|_nil_] Class to use instead of Hash on load, :object_class can also be used
  * - *:array_class* [_Class_|_nil_] Class to use instead of Array on load
+ * - *:only* [_Array_|_nil_] paths such as 'user/name' of the values to keep on load, a * step matches any key or element, other values are skipped without being built
+ * - *:raw* [_Array_|_nil_] paths in the same form as :only of the values to load as Oj::RawJSON without building them
  * - *:omit_nil* [_true_|_false_] if true Hash and Object attributes with nil values are omitted
  * - *:ignore* [_nil_|Array] either nil or an Array of classes to ignore when dumping
  * - *:ignore_under* [Boolean] if true then attributes that start with _ are ignored when dumping in object or custom mode.
  * - *:integer_range* [_Range_] Dump integers outside range as strings.
+ * - *:cache_keys* [_Boolean_] if true then hash keys are cached when loading in strict, compat, and custom modes.
+ * - *:cache_strings* [_Fixnum_] String values up to this many bytes are loaded as shared frozen Strings in strict, compat, custom, and wab modes, 0 turns caching off.
+ * - *:mmap* [_Boolean_] if true then load_file maps regular files into memory and parses them in place.
+ * - *:string_buffer* [_Boolean_] if true then dump writes directly into the returned String instead of a reused buffer that is then copied.
  * - *:trace* [_true,_|_false_] Trace all load and dump calls, default is false (trace is off)
  * - *:safe* [_true,_|_false_] Safe mimic breaks JSON mimic to be safer, default is false (safe is off)
  *
@@ -273,6 +311,8 @@ get_def_opts(VALUE self) {
 	rb_hash_aset(opts, oj_indent_sym, rb_str_new2(oj_default_options.dump_opts.indent_str));
     }
     rb_hash_aset(opts, sec_prec_sym, INT2FIX(oj_default_options.sec_prec));
+    rb_hash_aset(opts, buffer_size_sym, ULONG2NUM(oj_default_options.buffer_size));
+    rb_hash_aset(opts, release_gvl_sym, ULONG2NUM(oj_default_options.release_gvl));
     rb_hash_aset(opts, circular_sym, (Yes == oj_default_options.circular) ? Qtrue : ((No == oj_default_options.circular) ? Qfalse : Qnil));
     rb_hash_aset(opts, class_cache_sym, (Yes == oj_default_options.class_cache) ? Qtrue : ((No == oj_default_options.class_cache) ? Qfalse : Qnil));
     rb_hash_aset(opts, auto_define_sym, (Yes == oj_default_options.auto_define) ? Qtrue : ((No == oj_default_options.auto_define) ? Qfalse : Qnil));
@@ -292,7 +332,12 @@ get_def_opts(VALUE self) {
     rb_hash_aset(opts, oj_trace_sym, (Yes == oj_default_options.trace) ? Qtrue : ((No == oj_default_options.trace) ? Qfalse : Qnil));
     rb_hash_aset(opts, oj_safe_sym, (Yes == oj_default_options.safe) ? Qtrue : ((No == oj_default_options.safe) ? Qfalse : Qnil));
     rb_hash_aset(opts, float_prec_sym, INT2FIX(oj_default_options.float_prec));
+    rb_hash_aset(opts, float_engine_sym, (ShortestFloat == oj_default_options.float_engine) ? shortest_sym : classic_sym);
     rb_hash_aset(opts, ignore_under_sym, (Yes == oj_default_options.ignore_under) ? Qtrue : ((No == oj_default_options.ignore_under) ? Qfalse : Qnil));
+    rb_hash_aset(opts, cache_keys_sym, (Yes == oj_default_options.cache_keys) ? Qtrue : ((No == oj_default_options.cache_keys) ? Qfalse : Qnil));
+    rb_hash_aset(opts, mmap_sym, (Yes == oj_default_options.mmap_load) ? Qtrue : ((No == oj_default_options.mmap_load) ? Qfalse : Qnil));
+    rb_hash_aset(opts, cache_strings_sym, INT2FIX(oj_default_options.cache_str));
+    rb_hash_aset(opts, string_buffer_sym, (Yes == oj_default_options.string_buf) ? Qtrue : ((No == oj_default_options.string_buf) ? Qfalse : Qnil));
     switch (oj_default_options.mode) {
     case StrictMode:	rb_hash_aset(opts, mode_sym, strict_sym);	break;
     case CompatMode:	rb_hash_aset(opts, mode_sym, compat_sym);	break;
@@ -334,6 +379,7 @@ get_def_opts(VALUE self) {
     case BigDec:	rb_hash_aset(opts, bigdecimal_load_sym, bigdecimal_sym);break;
     case FloatDec:	rb_hash_aset(opts, bigdecimal_load_sym, float_sym);	break;
     case FastDec:	rb_hash_aset(opts, bigdecimal_load_sym, fast_sym);	break;
+    case RationalDec:	rb_hash_aset(opts, bigdecimal_load_sym, rational_sym);	break;
     case AutoDec:
     default:		rb_hash_aset(opts, bigdecimal_load_sym, auto_sym);	break;
     }
@@ -355,6 +401,8 @@ get_def_opts(VALUE self) {
     rb_hash_aset(opts, omit_nil_sym, oj_default_options.dump_opts.omit_nil ? Qtrue : Qfalse);
     rb_hash_aset(opts, oj_hash_class_sym, oj_default_options.hash_class);
     rb_hash_aset(opts, oj_array_class_sym, oj_default_options.array_class);
+    rb_hash_aset(opts, only_sym, oj_only_paths(oj_default_options.only));
+    rb_hash_aset(opts, raw_sym, oj_only_paths(oj_default_options.raw));
 
     if (NULL == oj_default_options.ignore) {
 	rb_hash_aset(opts, ignore_sym, Qnil);
@@ -389,7 +437,10 @@ get_def_opts(VALUE self) {
  *   - *:create_id* [_String_|_nil_] create id for json compatible object encoding
  *   - *:create_additions* [_Boolean_|_nil_] if true allow creation of instances using create_id on load.
  *   - *:second_precision* [_Fixnum_|_nil_] number of digits after the decimal when dumping the seconds portion of time.
+ *   - *:buffer_size* [_Fixnum_] size of the read buffer used by the stream parser, at least 4096.
+ *   - *:release_gvl* [_Fixnum_|_nil_] string loads of at least this many bytes are tokenized without holding the GVL, 0 or nil for never.
  *   - *:float_precision* [_Fixnum_|_nil_] number of digits of precision when dumping floats, 0 indicates use Ruby.
+ *   - *:float_engine* [_:classic_|_:shortest_] :classic dumps floats with printf and the float_precision or with Ruby, :shortest dumps the shortest form that loads back to the same value.
  *   - *:use_to_json* [_Boolean_|_nil_] call to_json() methods on dump, default is false.
  *   - *:use_as_json* [_Boolean_|_nil_] call as_json() methods on dump, default is false.
  *   - *:use_to_hash* [_Boolean_|_nil_] call to_hash() methods on dump, default is false.
@@ -406,15 +457,22 @@ get_def_opts(VALUE self) {
  *   - *:nan* [_:null_|_:huge_|_:word_|_:raise_] how to dump Infinity and NaN in null, strict, and compat mode. :null places a null, :huge places a huge number, :word places Infinity or NaN, :raise raises and exception, :auto uses default for each mode.
  *   - *:hash_class* [_Class_|_nil_] Class to use instead of Hash on load, :object_class can also be used.
  *   - *:array_class* [_Class_|_nil_] Class to use instead of Array on load.
+ *   - *:only* [_Array_|_nil_] paths such as 'user/name' of the values to keep on load, a * step matches any key or element, other values are skipped without being built.
+ *   - *:raw* [_Array_|_nil_] paths in the same form as :only of the values to load as Oj::RawJSON without building them.
  *   - *:omit_nil* [_true_|_false_] if true Hash and Object attributes with nil values are omitted.
  *   - *:ignore* [_nil_|Array] either nil or an Array of classes to ignore when dumping
  *   - *:ignore_under* [_Boolean_] if true then attributes that start with _ are ignored when dumping in object or custom mode.
  *   - *:integer_range* [_Range_] Dump integers outside range as strings.
+ *   - *:cache_keys* [_Boolean_] if true then hash keys are cached when loading.
+ *   - *:cache_strings* [_Fixnum_|_false_] String values up to this many bytes, at most 64, are loaded as shared frozen Strings, 0 or false turns caching off.
+ *   - *:mmap* [_Boolean_] if true then load_file maps regular files into memory and parses them in place.
+ *   - *:string_buffer* [_Boolean_] if true then dump writes directly into the returned String instead of a reused buffer that is then copied.
  *   - *:trace* [_Boolean_] turn trace on or off.
  *   - *:safe* [_Boolean_] turn safe mimic on or off.
  */
 static VALUE
 set_def_opts(VALUE self, VALUE opts) {
+    oj_main_ractor_check("Oj.default_options=");
     Check_Type(opts, T_HASH);
     oj_parse_options(opts, &oj_default_options);
 
@@ -444,6 +502,9 @@ oj_parse_options(VALUE ropts, Options copts) {
 	{ oj_safe_sym, &copts->safe },
 	{ ignore_under_sym, &copts->ignore_under },
 	{ oj_create_additions_sym, &copts->create_ok },
+	{ cache_keys_sym, &copts->cache_keys },
+	{ mmap_sym, &copts->mmap_load },
+	{ string_buffer_sym, &copts->string_buf },
 	{ Qnil, 0 }
     };
     YesNoOpt		o;
@@ -503,6 +564,37 @@ oj_parse_options(VALUE ropts, Options copts) {
 	    copts->float_prec = n;
 	}
     }
+    if (Qnil != (v = rb_hash_lookup(ropts, float_engine_sym))) {
+	if (classic_sym == v) {
+	    copts->float_engine = ClassicFloat;
+	} else if (shortest_sym == v) {
+	    copts->float_engine = ShortestFloat;
+	} else {
+	    rb_raise(rb_eArgError, ":float_engine must be :classic or :shortest.");
+	}
+    }
+    if (Qnil != (v = rb_hash_lookup(ropts, cache_strings_sym))) {
+	int	n = 0;
+
+	if (Qfalse != v) {
+#ifdef RUBY_INTEGER_UNIFICATION
+	    if (rb_cInteger != rb_obj_class(v)) {
+		rb_raise(rb_eArgError, ":cache_strings must be a Integer or false.");
+	    }
+#else
+	    if (T_FIXNUM != rb_type(v)) {
+		rb_raise(rb_eArgError, ":cache_strings must be a Fixnum or false.");
+	    }
+#endif
+	    n = NUM2INT(v);
+	}
+	if (0 > n) {
+	    n = 0;
+	} else if (CACHE_MAX_STR < n) {
+	    n = CACHE_MAX_STR;
+	}
+	copts->cache_str = (char)n;
+    }
     if (Qnil != (v = rb_hash_lookup(ropts, sec_prec_sym))) {
 	int	n;
 
@@ -527,6 +619,47 @@ oj_parse_options(VALUE ropts, Options copts) {
 	}
 	copts->sec_prec = n;
     }
+    if (Qnil != (v = rb_hash_lookup(ropts, buffer_size_sym))) {
+	long	n;
+
+#ifdef RUBY_INTEGER_UNIFICATION
+	if (rb_cInteger != rb_obj_class(v)) {
+	    rb_raise(rb_eArgError, ":buffer_size must be a Integer.");
+	}
+#else
+	if (T_FIXNUM != rb_type(v)) {
+	    rb_raise(rb_eArgError, ":buffer_size must be a Fixnum.");
+	}
+#endif
+	n = NUM2LONG(v);
+	if (0x1000 > n) {
+	    n = 0x1000;
+	} else if (0x40000000 < n) {
+	    n = 0x40000000;
+	}
+	copts->buffer_size = (size_t)n;
+    }
+    if (Qundef != (v = rb_hash_lookup2(ropts, release_gvl_sym, Qundef))) {
+	if (Qnil == v || Qfalse == v) {
+	    copts->release_gvl = 0;
+	} else {
+	    long	n;
+
+#ifdef RUBY_INTEGER_UNIFICATION
+	    if (rb_cInteger != rb_obj_class(v)) {
+		rb_raise(rb_eArgError, ":release_gvl must be a Integer.");
+	    }
+#else
+	    if (T_FIXNUM != rb_type(v)) {
+		rb_raise(rb_eArgError, ":release_gvl must be a Fixnum.");
+	    }
+#endif
+	    if (0 > (n = NUM2LONG(v))) {
+		rb_raise(rb_eArgError, ":release_gvl must not be negative.");
+	    }
+	    copts->release_gvl = (size_t)n;
+	}
+    }
     if (Qnil != (v = rb_hash_lookup(ropts, mode_sym))) {
 	if (wab_sym == v) {
 	    copts->mode = WabMode;
@@ -581,10 +714,12 @@ oj_parse_options(VALUE ropts, Options copts) {
 	    copts->bigdec_load = FloatDec;
 	} else if (fast_sym == v) {
 	    copts->bigdec_load = FastDec;
+	} else if (rational_sym == v) {
+	    copts->bigdec_load = RationalDec;
 	} else if (auto_sym == v || Qfalse == v) {
 	    copts->bigdec_load = AutoDec;
 	} else {
-	    rb_raise(rb_eArgError, ":bigdecimal_load must be :bigdecimal, :float, or :auto.");
+	    rb_raise(rb_eArgError, ":bigdecimal_load must be :bigdecimal, :float, :fast, :rational, or :auto.");
 	}
     }
     if (Qnil != (v = rb_hash_lookup(ropts, compat_bigdecimal_sym))) {
@@ -748,6 +883,20 @@ oj_parse_options(VALUE ropts, Options copts) {
 	    copts->array_class = v;
 	}
     }
+    if (Qtrue == rb_funcall(ropts, oj_has_key_id, 1, only_sym)) {
+	if (Qnil == (v = rb_hash_lookup(ropts, only_sym))) {
+	    copts->only = Qnil;
+	} else {
+	    copts->only = oj_only_new(v);
+	}
+    }
+    if (Qtrue == rb_funcall(ropts, oj_has_key_id, 1, raw_sym)) {
+	if (Qnil == (v = rb_hash_lookup(ropts, raw_sym))) {
+	    copts->raw = Qnil;
+	} else {
+	    copts->raw = oj_only_new(v);
+	}
+    }
     oj_parse_opt_match_string(&copts->str_rx, ropts);
     if (Qtrue == rb_funcall(ropts, oj_has_key_id, 1, ignore_sym)) {
 	xfree(copts->ignore);
@@ -785,6 +934,29 @@ oj_parse_options(VALUE ropts, Options copts) {
     }
 }
 
+// Sets copts to the default options with ropts, if not nil, applied along
+// with the compat mode settings dump() uses.
+void
+oj_dump_options(VALUE ropts, Options copts) {
+    *copts = oj_default_options;
+    oj_apply_dump_options(ropts, copts);
+}
+
+// Applies ropts, if not nil, and the compat mode settings dump() uses to
+// copts already set from the default options.
+void
+oj_apply_dump_options(VALUE ropts, Options copts) {
+    if (CompatMode == copts->mode) {
+	copts->dump_opts.nan_dump = WordNan;
+    }
+    if (Qnil != ropts) {
+	oj_parse_options(ropts, copts);
+    }
+    if (CompatMode == copts->mode && copts->escape_mode != ASCIIEsc) {
+	copts->escape_mode = JSONEsc;
+    }
+}
+
 static int
 match_string_cb(VALUE key, VALUE value, VALUE rx) {
     RxClass	rc = (RxClass)rx;
@@ -865,7 +1037,9 @@ load(int argc, VALUE *argv, VALUE self) {
 	VALUE	ropts = argv[1];
 	VALUE	v;
 
-	if (Qnil != ropts || CompatMode != mode) {
+	if (oj_options_class == rb_obj_class(ropts)) {
+	    mode = oj_options_load(ropts)->mode;
+	} else if (Qnil != ropts || CompatMode != mode) {
 	    Check_Type(ropts, T_HASH);
 	    if (Qnil != (v = rb_hash_lookup(ropts, mode_sym))) {
 		if (object_sym == v) {
@@ -906,6 +1080,75 @@ load(int argc, VALUE *argv, VALUE self) {
     return oj_object_parse(argc, argv, self);
 }
 
+#if !IS_WINDOWS
+typedef struct _mappedFile {
+    int		argc;
+    VALUE	*argv;
+    ParseInfo	pi;
+    char	*map;
+    size_t	map_len;
+    size_t	size;
+} *MappedFile;
+
+// Maps a regular file so the string parser can run over it directly. The
+// string parser expects a terminating '\0' so anonymous memory is reserved
+// one byte past the end of the file and the file is mapped over the start of
+// it. Bytes past the end of the file in the last page are zero as well.
+// Returns false if the file is not a regular file or can not be mapped.
+static bool
+map_file(MappedFile mf, int fd) {
+    struct stat	st;
+    long	page = sysconf(_SC_PAGESIZE);
+    size_t	len;
+    char	*base;
+
+    if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode) || 0 >= st.st_size) {
+	return false;
+    }
+    len = ((size_t)st.st_size + page) / page * page;
+    if (MAP_FAILED == (base = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANON, -1, 0))) {
+	return false;
+    }
+    if (MAP_FAILED == mmap(base, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)) {
+	munmap(base, len);
+	return false;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+    mf->map = base;
+    mf->map_len = len;
+    mf->size = (size_t)st.st_size;
+
+    return true;
+}
+
+static VALUE
+mapped_file_parse(VALUE mfv) {
+    MappedFile	mf = (MappedFile)mfv;
+    char	*json = mf->map;
+    size_t	size = mf->size;
+
+    // skip UTF-8 BOM if present
+    if (3 <= size && 0xEF == (uint8_t)*json && 0xBB == (uint8_t)json[1] && 0xBF == (uint8_t)json[2]) {
+	json += 3;
+	size -= 3;
+    }
+    mf->pi->mapped = true;
+
+    return oj_pi_parse(mf->argc, mf->argv, mf->pi, json, size, true);
+}
+
+static VALUE
+mapped_file_unmap(VALUE mfv) {
+    MappedFile	mf = (MappedFile)mfv;
+
+    munmap(mf->map, mf->map_len);
+
+    return Qnil;
+}
+#endif
+
 /* Document-method: load_file
  * call-seq: load_file(path, options={}) { _|_obj, start, len_|_ }
  *
@@ -923,7 +1166,14 @@ load(int argc, VALUE *argv, VALUE self) {
  * JSON document) an exception is raised.
  *
  * This is a stream based parser which allows a large or huge file to be loaded
- * without pulling the whole file into memory.
+ * without pulling the whole file into memory. If the :mmap option is true
+ * then a regular file is mapped into memory instead and parsed in place
+ * which is much faster. Pipes and other special files always use the stream
+ * parser.
+ *
+ * With the _:compression_ option set to _:gzip_ the file is inflated as it
+ * is read so neither the compressed nor the inflated document is held in
+ * memory. Compressed files are never mapped.
  *
  * A block can be provided with a single argument. That argument will be the
  * parsed JSON document. This is useful when parsing a string that includes
@@ -945,6 +1195,7 @@ load_file(int argc, VALUE *argv, VALUE self) {
     char		*path;
     int			fd;
     Mode		mode = oj_default_options.mode;
+    bool		use_mmap = (Yes == oj_default_options.mmap_load);
     struct _parseInfo	pi;
 
     if (1 > argc) {
@@ -956,7 +1207,11 @@ load_file(int argc, VALUE *argv, VALUE self) {
     pi.handler = Qnil;
     pi.err_class = Qnil;
     pi.max_depth = 0;
-    if (2 <= argc) {
+    if (2 <= argc && oj_options_class == rb_obj_class(argv[1])) {
+	mode = oj_options_load(argv[1])->mode;
+	use_mmap = (Yes == oj_options_load(argv[1])->mmap_load);
+	pi.compression = oj_options_compression(argv[1]);
+    } else if (2 <= argc) {
 	VALUE	ropts = argv[1];
 	VALUE	v;
 
@@ -980,35 +1235,167 @@ load_file(int argc, VALUE *argv, VALUE self) {
 		rb_raise(rb_eArgError, ":mode must be :object, :strict, :compat, :null, :custom, :rails, or :wab.");
 	    }
 	}
+	if (Qnil != (v = rb_hash_lookup(ropts, mmap_sym))) {
+	    use_mmap = (Qtrue == v);
+	}
+	pi.compression = oj_compression(ropts);
     }
     path = StringValuePtr(*argv);
-    if (0 == (fd = open(path, O_RDONLY))) {
+    if (0 > (fd = open(path, O_RDONLY))) {
 	rb_raise(rb_eIOError, "%s", strerror(errno));
     }
     switch (mode) {
     case StrictMode:
     case NullMode:
-	oj_set_strict_callbacks(&pi);
-	return oj_pi_sparse(argc, argv, &pi, fd);
+	oj_set_strict_bulk_callbacks(&pi);
+	break;
     case CustomMode:
 	oj_set_custom_callbacks(&pi);
-	return oj_pi_sparse(argc, argv, &pi, fd);
+	break;
     case CompatMode:
     case RailsMode:
 	oj_set_compat_callbacks(&pi);
-	return oj_pi_sparse(argc, argv, &pi, fd);
+	break;
     case WabMode:
 	oj_set_wab_callbacks(&pi);
-	return oj_pi_sparse(argc, argv, &pi, fd);
+	break;
     case ObjectMode:
     default:
+	oj_set_object_callbacks(&pi);
 	break;
     }
-    oj_set_object_callbacks(&pi);
-
+#if !IS_WINDOWS
+    if (use_mmap && NO_COMPRESS == pi.compression) {
+	struct _mappedFile	mf;
+
+	mf.argc = argc;
+	mf.argv = argv;
+	mf.pi = &pi;
+	if (map_file(&mf, fd)) {
+	    // The mapping remains valid after the file is closed.
+	    close(fd);
+	    return rb_ensure(mapped_file_parse, (VALUE)&mf, mapped_file_unmap, (VALUE)&mf);
+	}
+    }
+#endif
     return oj_pi_sparse(argc, argv, &pi, fd);
 }
 
+// Sets the callbacks and the mode defaults that load() uses for the :mode
+// in ropts or for the default mode if ropts is nil or has no :mode.
+void
+oj_set_mode_callbacks(ParseInfo pi, VALUE ropts) {
+    Mode	mode = oj_default_options.mode;
+    VALUE	v;
+
+    if (T_HASH == rb_type(ropts) && Qnil != (v = rb_hash_lookup(ropts, mode_sym))) {
+	if (object_sym == v) {
+	    mode = ObjectMode;
+	} else if (strict_sym == v) {
+	    mode = StrictMode;
+	} else if (compat_sym == v || json_sym == v) {
+	    mode = CompatMode;
+	} else if (null_sym == v) {
+	    mode = NullMode;
+	} else if (custom_sym == v) {
+	    mode = CustomMode;
+	} else if (rails_sym == v) {
+	    mode = RailsMode;
+	} else if (wab_sym == v) {
+	    mode = WabMode;
+	} else {
+	    rb_raise(rb_eArgError, ":mode must be :object, :strict, :compat, :null, :custom, :rails, or :wab.");
+	}
+    }
+    switch (mode) {
+    case StrictMode:
+    case NullMode:
+	oj_set_strict_bulk_callbacks(pi);
+	break;
+    case CustomMode:
+	pi->options.allow_nan = Yes;
+	pi->options.nilnil = Yes;
+	oj_set_custom_callbacks(pi);
+	break;
+    case CompatMode:
+    case RailsMode:
+	pi->options.allow_nan = Yes;
+	pi->options.nilnil = Yes;
+	pi->options.empty_string = No;
+	oj_set_compat_callbacks(pi);
+	break;
+    case WabMode:
+	oj_set_wab_callbacks(pi);
+	break;
+    case ObjectMode:
+    default:
+	oj_set_object_callbacks(pi);
+	break;
+    }
+}
+
+/* Document-method: load_ndjson
+ * call-seq: load_ndjson(json, options={}) { _|_obj_|_ }
+ *
+ * Parses newline delimited JSON where each line of the input is a separate
+ * JSON document. Blank lines are skipped. The lines are split across worker
+ * threads that parse them without holding the GVL and the Ruby objects are
+ * then created on the calling thread in the same order as the lines so the
+ * results are the same as loading each line with Oj.load() using the same
+ * mode and options.
+ *
+ * If a block is given each object is yielded to it in order, or if the
+ * :batch_size option is set, Arrays of up to that many objects are yielded.
+ * Without a block an Array of all the objects is returned. An error on a line
+ * raises an exception after the objects on the lines before it have been
+ * yielded and the error reports the line number in the input.
+ *
+ * - *json* [_String_|_IO_] newline delimited JSON String or an Object that responds to read()
+ * - *options* [_Hash_] load options (same as default_options) plus
+ *   - *:threads* [_Integer_] number of worker threads, defaults to the number of processors
+ *   - *:batch_size* [_Integer_] number of objects yielded at a time in an Array
+ * - *obj* [_Hash_|_Array_|_String_|_Fixnum_|_Float_|_Boolean_|_nil_] parsed object or Array of objects.
+ *
+ * Returns [_Array_|_nil_]
+ */
+static VALUE
+load_ndjson(int argc, VALUE *argv, VALUE self) {
+    int			threads = 0;
+    long		batch_size = 0;
+    struct _parseInfo	pi;
+
+    if (1 > argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to load_ndjson().");
+    }
+    parse_info_init(&pi);
+    pi.options = oj_default_options;
+    pi.handler = Qnil;
+    pi.err_class = Qnil;
+    pi.max_depth = 0;
+    if (2 <= argc) {
+	VALUE	ropts = argv[1];
+	VALUE	v;
+
+	Check_Type(ropts, T_HASH);
+	oj_set_mode_callbacks(&pi, ropts);
+	if (Qnil != (v = rb_hash_lookup(ropts, threads_sym))) {
+	    threads = NUM2INT(v);
+	    if (0 >= threads) {
+		rb_raise(rb_eArgError, ":threads must be greater than zero.");
+	    }
+	}
+	if (Qnil != (v = rb_hash_lookup(ropts, batch_size_sym))) {
+	    batch_size = NUM2LONG(v);
+	    if (0 >= batch_size) {
+		rb_raise(rb_eArgError, ":batch_size must be greater than zero.");
+	    }
+	}
+    } else {
+	oj_set_mode_callbacks(&pi, Qnil);
+    }
+    return oj_pi_ndjson(argc, argv, &pi, threads, batch_size);
+}
+
 /* Document-method: safe_load
  * call-seq: safe_load(doc)
  *
@@ -1032,7 +1419,7 @@ safe_load(VALUE self, VALUE doc) {
     pi.options.auto_define = No;
     pi.options.sym_key = No;
     pi.options.mode = StrictMode;
-    oj_set_strict_callbacks(&pi);
+    oj_set_strict_bulk_callbacks(&pi);
     *args = doc;
 
     return oj_pi_parse(1, args, &pi, 0, 0, 1);
@@ -1051,7 +1438,7 @@ safe_load(VALUE self, VALUE doc) {
  */
 
 /* Document-method: sc_parse
- * call-seq: sc_parse(handler, io)
+ * call-seq: sc_parse(handler, io, options={})
  *
  * Parses an IO stream or file containing a JSON document. Raises an exception
  * if the JSON is malformed. This is a callback parser (Simple Callback Parser)
@@ -1060,6 +1447,14 @@ safe_load(VALUE self, VALUE doc) {
  * callback parser is slightly more efficient than the Saj callback parser and
  * requires less argument checking.
  *
+ * If the _:compression_ option is _:gzip_ the input is inflated as it is
+ * read.
+ *
+ * The _:only_ option limits the callbacks to the values on the given paths,
+ * such as ['user/name'], and the containers that lead to them. Everything
+ * else is skipped without calling the handler, even when reading from an
+ * IO.
+ *
  * - *handler* [_Oj_::ScHandler_] responds to Oj::ScHandler methods
  * - *io* [_IO__|_String_] IO Object to read from
  */
@@ -1075,35 +1470,29 @@ static VALUE
 dump(int argc, VALUE *argv, VALUE self) {
     char		buf[4096];
     struct _out		out;
-    struct _options	copts = oj_default_options;
+    struct _options	copts;
     VALUE		rstr;
+    VALUE		args[2];
 
     if (1 > argc) {
 	rb_raise(rb_eArgError, "wrong number of arguments (0 for 1).");
     }
-    if (CompatMode == copts.mode) {
-	copts.dump_opts.nan_dump = WordNan;
-    }
-    if (2 == argc) {
-	oj_parse_options(argv[1], &copts);
-    }
-    if (CompatMode == copts.mode && copts.escape_mode != ASCIIEsc) {
-	copts.escape_mode = JSONEsc;
+    if (2 == argc && oj_options_class == rb_obj_class(argv[1])) {
+	// The to_json() methods are given the options Hash.
+	copts = *oj_options_dump(argv[1], args + 1);
+	args[0] = *argv;
+	argv = args;
+    } else {
+	oj_dump_options((2 == argc) ? argv[1] : Qnil, &copts);
     }
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts.dump_opts.omit_nil;
     out.caller = CALLER_DUMP;
-    oj_dump_obj_to_json_using_params(*argv, &copts, &out, argc - 1,argv + 1);
-    if (0 == out.buf) {
-	rb_raise(rb_eNoMemError, "Not enough memory.");
-    }
-    rstr = rb_str_new2(out.buf);
-    rstr = oj_encode(rstr);
-    if (out.allocated) {
-	xfree(out.buf);
-    }
+    rstr = oj_dump_to_str(*argv, &copts, &out, argc - 1,argv + 1);
     return rstr;
 }
 
@@ -1146,19 +1535,12 @@ to_json(int argc, VALUE *argv, VALUE self) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts.dump_opts.omit_nil;
     // For obj.to_json or generate nan is not allowed but if called from dump
     // it is.
-    oj_dump_obj_to_json_using_params(*argv, &copts, &out, argc - 1, argv + 1);
-
-    if (0 == out.buf) {
-	rb_raise(rb_eNoMemError, "Not enough memory.");
-    }
-    rstr = rb_str_new2(out.buf);
-    rstr = oj_encode(rstr);
-    if (out.allocated) {
-	xfree(out.buf);
-    }
+    rstr = oj_dump_to_str(*argv, &copts, &out, argc - 1, argv + 1);
     return rstr;
 }
 
@@ -1171,16 +1553,19 @@ to_json(int argc, VALUE *argv, VALUE self) {
  * - *options* [_Hash_] formating options
  *   - *:indent* [_Fixnum_] format expected
  *   - *:circular* [_Boolean_] allow circular references, default: false
+ *   - *:compression* [_Symbol_] _:gzip_ to write the file gzip compressed
  */
 static VALUE
 to_file(int argc, VALUE *argv, VALUE self) {
     struct _options	copts = oj_default_options;
+    Compression		compression = NO_COMPRESS;
 
     if (3 == argc) {
 	oj_parse_options(argv[2], &copts);
+	compression = oj_compression(argv[2]);
     }
     Check_Type(*argv, T_STRING);
-    oj_write_obj_to_file(argv[1], StringValuePtr(*argv), &copts);
+    oj_write_obj_to_file(argv[1], StringValuePtr(*argv), &copts, compression);
 
     return Qnil;
 }
@@ -1194,15 +1579,18 @@ to_file(int argc, VALUE *argv, VALUE self) {
  * - *options* [_Hash_] formating options
  *   - *:indent* [_Fixnum_] format expected
  *   - *:circular* [_Boolean_] allow circular references, default: false
+ *   - *:compression* [_Symbol_] _:gzip_ to write gzip compressed output
  */
 static VALUE
 to_stream(int argc, VALUE *argv, VALUE self) {
     struct _options	copts = oj_default_options;
+    Compression		compression = NO_COMPRESS;
 
     if (3 == argc) {
 	oj_parse_options(argv[2], &copts);
+	compression = oj_compression(argv[2]);
     }
-    oj_write_obj_to_stream(argv[1], *argv, &copts);
+    oj_write_obj_to_stream(argv[1], *argv, &copts, compression);
 
     return Qnil;
 }
@@ -1223,6 +1611,7 @@ to_stream(int argc, VALUE *argv, VALUE self) {
  */
 static VALUE
 register_odd(int argc, VALUE *argv, VALUE self) {
+    oj_main_ractor_check("Oj.register_odd");
     if (3 > argc) {
 	rb_raise(rb_eArgError, "incorrect number of arguments.");
     }
@@ -1261,6 +1650,7 @@ register_odd(int argc, VALUE *argv, VALUE self) {
  */
 static VALUE
 register_odd_raw(int argc, VALUE *argv, VALUE self) {
+    oj_main_ractor_check("Oj.register_odd_raw");
     if (3 > argc) {
 	rb_raise(rb_eArgError, "incorrect number of arguments.");
     }
@@ -1281,6 +1671,232 @@ register_odd_raw(int argc, VALUE *argv, VALUE self) {
     return Qnil;
 }
 
+/* Document-method: register_shape
+ *	call-seq: register_shape(clas, fields=nil, types=nil)
+ *
+ * Registers a class or Struct as a shape that can be filled directly by
+ * Oj.load_shape(). The fields are matched to JSON keys once by the parser and
+ * set as instance variables of a class (without calling initialize) or as
+ * Struct members. Keys that are not fields are skipped without being built.
+ *
+ * - *clas* [_Class_] Class or Struct subclass to fill
+ * - *fields* [_Array_|_nil_] Symbols or Strings of the fields, nil for the members of a Struct
+ * - *types* [_Hash_|_nil_] field to Integer, Float, String, Symbol, a registered shape class, or an Array of one registered shape class to coerce the field value to
+ */
+static VALUE
+register_shape(int argc, VALUE *argv, VALUE self) {
+    oj_main_ractor_check("Oj.register_shape");
+    if (1 > argc || 3 < argc) {
+	rb_raise(rb_eArgError, "incorrect number of arguments.");
+    }
+    oj_shape_register(argv[0], (2 <= argc) ? argv[1] : Qnil, (3 <= argc) ? argv[2] : Qnil);
+
+    return Qnil;
+}
+
+/* Document-method: load_shape
+ *	call-seq: load_shape(json, clas, options={})
+ *
+ * Parses a JSON document into an instance of a class registered with
+ * Oj.register_shape(). If the document is an Array then each element is
+ * loaded as an instance. Nested values that are not shapes are loaded as
+ * they would be in :strict mode.
+ *
+ * - *json* [_String_|_IO_] JSON String or an Object that responds to read()
+ * - *clas* [_Class_] registered shape to load
+ * - *options* [_Hash_] load options
+ */
+static VALUE
+load_shape(int argc, VALUE *argv, VALUE self) {
+    return oj_shape_parse(argc, argv, self);
+}
+
+/* Document-method: valid?
+ *	call-seq: valid?(json, options={})
+ *
+ * Checks that a JSON document is well formed for the options given and that
+ * its strings are valid UTF-8. No Ruby objects are created for the document
+ * so classes named by the document, such as with a "^o" key in :object mode
+ * or the :create_id, are not looked up and a document that names a missing
+ * class is valid even though loading it raises. Large documents are checked
+ * without holding the GVL.
+ *
+ *   Oj.valid?('{"a":[1,2]}') # => true
+ *   Oj.valid?('{"a":[1,2}')  # => false
+ *
+ * - *json* [_String_|_IO_] JSON String or an Object that responds to read()
+ * - *options* [_Hash_|_Oj::Options_] load options
+ *
+ * Returns [_true_|_false_]
+ */
+static VALUE
+valid_p(int argc, VALUE *argv, VALUE self) {
+    return oj_valid_p(argc, argv, self);
+}
+
+/* Document-method: validate
+ *	call-seq: validate(json, options={})
+ *
+ * Checks a JSON document in the same way as Oj.valid?() but reports where
+ * the first error is. The report is a Hash with the :message, the byte
+ * :offset, and the 1 based :line and :column of the error.
+ *
+ *   Oj.validate('[1,]') # => {:message=>"unexpected character", :offset=>3, :line=>1, :column=>4}
+ *
+ * - *json* [_String_|_IO_] JSON String or an Object that responds to read()
+ * - *options* [_Hash_|_Oj::Options_] load options
+ *
+ * Returns [_nil_|_Hash_] nil if the document is valid
+ */
+static VALUE
+validate(int argc, VALUE *argv, VALUE self) {
+    return oj_validate(argc, argv, self);
+}
+
+/* Document-method: reformat
+ *	call-seq: reformat(json, options={})
+ *
+ * Re-indents a JSON document without loading it. The document is checked
+ * with the load options given and then copied with the whitespace and
+ * comments replaced by the :indent option. A String :indent or any of the
+ * :space, :space_before, :object_nl, and :array_nl options lay the document
+ * out the way Oj.dump() does with the same options. Strings and numbers are
+ * copied byte for byte.
+ *
+ *   Oj.reformat('{"a":[1,2]}', indent: 2) # => "{\n  \"a\":[\n    1,\n    2\n  ]\n}\n"
+ *
+ * - *json* [_String_|_IO_] JSON String or an Object that responds to read()
+ * - *options* [_Hash_|_Oj::Options_] load options and :indent
+ *
+ * Returns [_String_|_nil_] the reformatted document or nil if it is empty
+ */
+static VALUE
+reformat(int argc, VALUE *argv, VALUE self) {
+    return oj_reformat(argc, argv, self);
+}
+
+/* Document-method: minify
+ *	call-seq: minify(json, options={})
+ *
+ * Removes all the whitespace and comments from a JSON document in the same
+ * way as Oj.reformat() with an :indent of 0.
+ *
+ *   Oj.minify("{ \"a\" : [ 1, 2 ] }") # => "{\"a\":[1,2]}"
+ *
+ * - *json* [_String_|_IO_] JSON String or an Object that responds to read()
+ * - *options* [_Hash_|_Oj::Options_] load options
+ *
+ * Returns [_String_|_nil_] the minified document or nil if it is empty
+ */
+static VALUE
+minify(int argc, VALUE *argv, VALUE self) {
+    return oj_minify(argc, argv, self);
+}
+
+/* Document-method: to_msgpack
+ *	call-seq: to_msgpack(obj, options={})
+ *
+ * Dumps an Object to a MessagePack String. The mode and options are the
+ * same as for Oj.dump() and give the same values, only the encoding
+ * differs. Floats that fit are written as float32 and Integers that do not
+ * fit in 64 bits as decimal Strings.
+ *
+ * - *obj* [_Object_] Object to serialize
+ * - *options* [_Hash_|_Oj::Options_] same as for Oj.dump()
+ *
+ * Returns [_String_] ASCII-8BIT encoded MessagePack
+ */
+static VALUE
+to_msgpack(int argc, VALUE *argv, VALUE self) {
+    return oj_msgpack_dump(argc, argv, self);
+}
+
+/* Document-method: to_cbor
+ *	call-seq: to_cbor(obj, options={})
+ *
+ * Dumps an Object to a CBOR String in the same way as Oj.to_msgpack().
+ * Integers that do not fit in 64 bits are written as CBOR bignums.
+ *
+ * - *obj* [_Object_] Object to serialize
+ * - *options* [_Hash_|_Oj::Options_] same as for Oj.dump()
+ *
+ * Returns [_String_] ASCII-8BIT encoded CBOR
+ */
+static VALUE
+to_cbor(int argc, VALUE *argv, VALUE self) {
+    return oj_cbor_dump(argc, argv, self);
+}
+
+/* Document-method: load_msgpack
+ *	call-seq: load_msgpack(data, options={})
+ *
+ * Loads a MessagePack document with the same mode and options as
+ * Oj.load(). Strings, numbers, and keys are given to the mode just as they
+ * are when loading JSON so the result is the same as loading the JSON
+ * form of the document. MessagePack extension types are not supported.
+ *
+ * - *data* [_String_|_IO_] MessagePack String or an Object that responds to read()
+ * - *options* [_Hash_|_Oj::Options_] same as for Oj.load()
+ */
+static VALUE
+load_msgpack(int argc, VALUE *argv, VALUE self) {
+    return oj_msgpack_load(argc, argv, self);
+}
+
+/* Document-method: load_cbor
+ *	call-seq: load_cbor(data, options={})
+ *
+ * Loads a CBOR document in the same way as Oj.load_msgpack(). Bignum tags
+ * are loaded as Integers and the self-described CBOR tag is skipped. Any
+ * other tag raises an Oj::ParseError.
+ *
+ * - *data* [_String_|_IO_] CBOR String or an Object that responds to read()
+ * - *options* [_Hash_|_Oj::Options_] same as for Oj.load()
+ */
+static VALUE
+load_cbor(int argc, VALUE *argv, VALUE self) {
+    return oj_cbor_load(argc, argv, self);
+}
+
+/* Document-method: cache_stats
+ *	call-seq: cache_stats()
+ *
+ * Returns the statistics of the class, attribute, String, and Symbol caches
+ * as a Hash of Hashes with the :size, :capacity, :lookups, :hits, :hit_rate,
+ * :avg_probe, and :max_probe of each cache. Each Ractor has its own caches
+ * and the ones of the calling Ractor are returned.
+ */
+static VALUE
+cache_stats(VALUE self) {
+    return oj_hash_stats(oj_local()->caches);
+}
+
+/* Document-method: stats
+ *	call-seq: stats(reset=false)
+ *
+ * Returns the counters Oj always keeps as a Hash. The counts are totals
+ * since Oj was loaded or last reset.
+ *
+ * - *:loads* documents loaded
+ * - *:bytes_parsed* bytes of JSON loaded
+ * - *:objects_created* Ruby objects allocated while loading
+ * - *:dumps* documents dumped
+ * - *:bytes_dumped* bytes of JSON dumped
+ * - *:out_grows*, *:out_grow_bytes* dump buffer growths and the sizes grown to
+ * - *:reader_grows*, *:reader_grow_bytes* stream read buffer growths and the sizes grown to
+ * - *:cache_hits*, *:cache_misses* lookups in the caches reported by Oj.cache_stats
+ * - *:circular_inserts* objects added to the circular reference check
+ * - *:as_json_calls*, *:to_json_calls*, *:to_s_calls* calls back to Ruby while dumping
+ *
+ * - *reset* [_true_|_false_] if true all the counts are set to zero after they are read
+ *
+ * Returns [_Hash_]
+ */
+static VALUE
+stats(int argc, VALUE *argv, VALUE self) {
+    return oj_stats_hash(1 <= argc && RTEST(*argv));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // RDoc entries must be in the same file as the rb_define_method and must be
 // directly above the C method function. The extern declaration is enough to
@@ -1548,12 +2164,21 @@ void
 Init_oj() {
     int	err = 0;
 
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    // Loads and dumps only write to the state of the Ractor they run on, see
+    // local.h, and the methods that change shared settings raise unless
+    // called from the main Ractor.
+    rb_ext_ractor_safe(true);
+#endif
     Oj = rb_define_module("Oj");
+    oj_local_init();
 
     oj_cstack_class = rb_define_class_under(Oj, "CStack", rb_cObject);
 
     oj_string_writer_init();
     oj_stream_writer_init();
+    oj_parser_init();
+    oj_options_init();
 
     rb_require("date");
     // On Rubinius the require fails but can be done from a ruby file.
@@ -1565,17 +2190,29 @@ Init_oj() {
 
     rb_define_module_function(Oj, "default_options", get_def_opts, 0);
     rb_define_module_function(Oj, "default_options=", set_def_opts, 1);
+    rb_define_module_function(Oj, "cache_stats", cache_stats, 0);
+    rb_define_module_function(Oj, "stats", stats, -1);
 
     rb_define_module_function(Oj, "mimic_JSON", oj_define_mimic_json, -1);
     rb_define_module_function(Oj, "load", load, -1);
     rb_define_module_function(Oj, "load_file", load_file, -1);
+    rb_define_module_function(Oj, "load_ndjson", load_ndjson, -1);
+    rb_define_module_function(Oj, "load_shape", load_shape, -1);
     rb_define_module_function(Oj, "safe_load", safe_load, 1);
+    rb_define_module_function(Oj, "valid?", valid_p, -1);
+    rb_define_module_function(Oj, "validate", validate, -1);
+    rb_define_module_function(Oj, "load_msgpack", load_msgpack, -1);
+    rb_define_module_function(Oj, "load_cbor", load_cbor, -1);
     rb_define_module_function(Oj, "strict_load", oj_strict_parse, -1);
     rb_define_module_function(Oj, "compat_load", oj_compat_parse, -1);
     rb_define_module_function(Oj, "object_load", oj_object_parse, -1);
     rb_define_module_function(Oj, "wab_load", oj_wab_parse, -1);
 
     rb_define_module_function(Oj, "dump", dump, -1);
+    rb_define_module_function(Oj, "to_msgpack", to_msgpack, -1);
+    rb_define_module_function(Oj, "to_cbor", to_cbor, -1);
+    rb_define_module_function(Oj, "reformat", reformat, -1);
+    rb_define_module_function(Oj, "minify", minify, -1);
 
     rb_define_module_function(Oj, "to_file", to_file, -1);
     rb_define_module_function(Oj, "to_stream", to_stream, -1);
@@ -1589,6 +2226,7 @@ Init_oj() {
 
     rb_define_module_function(Oj, "register_odd", register_odd, -1);
     rb_define_module_function(Oj, "register_odd_raw", register_odd_raw, -1);
+    rb_define_module_function(Oj, "register_shape", register_shape, -1);
 
     rb_define_module_function(Oj, "saj_parse", oj_saj_parse, -1);
     rb_define_module_function(Oj, "sc_parse", oj_sc_parse, -1);
@@ -1614,8 +2252,10 @@ Init_oj() {
     oj_hash_set_id = rb_intern("hash_set");
     oj_hash_start_id = rb_intern("hash_start");
     oj_iconv_id = rb_intern("iconv");
+    oj_instance_method_id = rb_intern("instance_method");
     oj_instance_variables_id = rb_intern("instance_variables");
     oj_json_create_id = rb_intern("json_create");
+    oj_json_ivar_id = rb_intern("@json");
     oj_length_id = rb_intern("length");
     oj_new_id = rb_intern("new");
     oj_parse_id = rb_intern("parse");
@@ -1643,11 +2283,14 @@ Init_oj() {
     rb_require("oj/bag");
     rb_require("oj/error");
     rb_require("oj/mimic");
+    rb_require("oj/raw_json");
     rb_require("oj/saj");
     rb_require("oj/schandler");
 
     oj_bag_class = rb_const_get_at(Oj, rb_intern("Bag"));
     rb_gc_register_mark_object(oj_bag_class);
+    oj_raw_json_class = rb_const_get_at(Oj, rb_intern("RawJSON"));
+    rb_gc_register_mark_object(oj_raw_json_class);
     oj_bigdecimal_class = rb_const_get(rb_cObject, rb_intern("BigDecimal"));
     rb_gc_register_mark_object(oj_bigdecimal_class);
     oj_date_class = rb_const_get(rb_cObject, rb_intern("Date"));
@@ -1671,9 +2314,13 @@ Init_oj() {
     ascii_sym = ID2SYM(rb_intern("ascii"));			rb_gc_register_address(&ascii_sym);
     auto_define_sym = ID2SYM(rb_intern("auto_define"));		rb_gc_register_address(&auto_define_sym);
     auto_sym = ID2SYM(rb_intern("auto"));			rb_gc_register_address(&auto_sym);
+    batch_size_sym = ID2SYM(rb_intern("batch_size"));		rb_gc_register_address(&batch_size_sym);
     bigdecimal_as_decimal_sym = ID2SYM(rb_intern("bigdecimal_as_decimal"));rb_gc_register_address(&bigdecimal_as_decimal_sym);
     bigdecimal_load_sym = ID2SYM(rb_intern("bigdecimal_load"));	rb_gc_register_address(&bigdecimal_load_sym);
     bigdecimal_sym = ID2SYM(rb_intern("bigdecimal"));		rb_gc_register_address(&bigdecimal_sym);
+    buffer_size_sym = ID2SYM(rb_intern("buffer_size"));		rb_gc_register_address(&buffer_size_sym);
+    cache_keys_sym = ID2SYM(rb_intern("cache_keys"));		rb_gc_register_address(&cache_keys_sym);
+    cache_strings_sym = ID2SYM(rb_intern("cache_strings"));	rb_gc_register_address(&cache_strings_sym);
     circular_sym = ID2SYM(rb_intern("circular"));		rb_gc_register_address(&circular_sym);
     class_cache_sym = ID2SYM(rb_intern("class_cache"));		rb_gc_register_address(&class_cache_sym);
     compat_bigdecimal_sym = ID2SYM(rb_intern("compat_bigdecimal"));rb_gc_register_address(&compat_bigdecimal_sym);
@@ -1683,7 +2330,10 @@ Init_oj() {
     empty_string_sym = ID2SYM(rb_intern("empty_string"));	rb_gc_register_address(&empty_string_sym);
     escape_mode_sym = ID2SYM(rb_intern("escape_mode"));		rb_gc_register_address(&escape_mode_sym);
     integer_range_sym = ID2SYM(rb_intern("integer_range"));	rb_gc_register_address(&integer_range_sym);
+    classic_sym = ID2SYM(rb_intern("classic"));		rb_gc_register_address(&classic_sym);
     fast_sym = ID2SYM(rb_intern("fast"));			rb_gc_register_address(&fast_sym);
+    rational_sym = ID2SYM(rb_intern("rational"));		rb_gc_register_address(&rational_sym);
+    float_engine_sym = ID2SYM(rb_intern("float_engine"));	rb_gc_register_address(&float_engine_sym);
     float_prec_sym = ID2SYM(rb_intern("float_precision"));	rb_gc_register_address(&float_prec_sym);
     float_sym = ID2SYM(rb_intern("float"));			rb_gc_register_address(&float_sym);
     huge_sym = ID2SYM(rb_intern("huge"));			rb_gc_register_address(&huge_sym);
@@ -1691,6 +2341,7 @@ Init_oj() {
     ignore_under_sym = ID2SYM(rb_intern("ignore_under"));	rb_gc_register_address(&ignore_under_sym);
     json_sym = ID2SYM(rb_intern("json"));			rb_gc_register_address(&json_sym);
     match_string_sym = ID2SYM(rb_intern("match_string"));	rb_gc_register_address(&match_string_sym);
+    mmap_sym = ID2SYM(rb_intern("mmap"));			rb_gc_register_address(&mmap_sym);
     mode_sym = ID2SYM(rb_intern("mode"));			rb_gc_register_address(&mode_sym);
     nan_sym = ID2SYM(rb_intern("nan"));				rb_gc_register_address(&nan_sym);
     newline_sym = ID2SYM(rb_intern("newline"));			rb_gc_register_address(&newline_sym);
@@ -1714,12 +2365,18 @@ Init_oj() {
     oj_space_sym = ID2SYM(rb_intern("space"));			rb_gc_register_address(&oj_space_sym);
     oj_trace_sym = ID2SYM(rb_intern("trace"));			rb_gc_register_address(&oj_trace_sym);
     omit_nil_sym = ID2SYM(rb_intern("omit_nil"));		rb_gc_register_address(&omit_nil_sym);
+    only_sym = ID2SYM(rb_intern("only"));			rb_gc_register_address(&only_sym);
     rails_sym = ID2SYM(rb_intern("rails"));			rb_gc_register_address(&rails_sym);
+    raw_sym = ID2SYM(rb_intern("raw"));				rb_gc_register_address(&raw_sym);
     raise_sym = ID2SYM(rb_intern("raise"));			rb_gc_register_address(&raise_sym);
+    release_gvl_sym = ID2SYM(rb_intern("release_gvl"));		rb_gc_register_address(&release_gvl_sym);
     ruby_sym = ID2SYM(rb_intern("ruby"));			rb_gc_register_address(&ruby_sym);
     sec_prec_sym = ID2SYM(rb_intern("second_precision"));	rb_gc_register_address(&sec_prec_sym);
+    shortest_sym = ID2SYM(rb_intern("shortest"));		rb_gc_register_address(&shortest_sym);
     strict_sym = ID2SYM(rb_intern("strict"));			rb_gc_register_address(&strict_sym);
+    string_buffer_sym = ID2SYM(rb_intern("string_buffer"));	rb_gc_register_address(&string_buffer_sym);
     symbol_keys_sym = ID2SYM(rb_intern("symbol_keys"));		rb_gc_register_address(&symbol_keys_sym);
+    threads_sym = ID2SYM(rb_intern("threads"));			rb_gc_register_address(&threads_sym);
     time_format_sym = ID2SYM(rb_intern("time_format"));		rb_gc_register_address(&time_format_sym);
     unicode_xss_sym = ID2SYM(rb_intern("unicode_xss"));		rb_gc_register_address(&unicode_xss_sym);
     unix_sym = ID2SYM(rb_intern("unix"));			rb_gc_register_address(&unix_sym);
@@ -1737,18 +2394,14 @@ Init_oj() {
     OBJ_FREEZE(oj_slash_string);
 
     oj_default_options.mode = ObjectMode;
+    // The compiled :only and :raw paths live only in the options.
+    rb_gc_register_address(&oj_default_options.only);
+    rb_gc_register_address(&oj_default_options.raw);
 
-    oj_hash_init();
+    oj_compress_init();
+    oj_stats_init();
+    oj_scanner_init();
     oj_odd_init();
     oj_mimic_rails_init();
-
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-    if (0 != (err = pthread_mutex_init(&oj_cache_mutex, 0))) {
-	rb_raise(rb_eException, "failed to initialize a mutex. %s", strerror(err));
-    }
-#else
-    oj_cache_mutex = rb_mutex_new();
-    rb_gc_register_address(&oj_cache_mutex);
-#endif
     oj_init_doc();
 }
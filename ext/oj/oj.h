@@ -21,7 +21,6 @@ extern "C" {
 #ifdef HAVE_PTHREAD_MUTEX_INIT
 #include <pthread.h>
 #endif
-#include "cache8.h"
 
 #ifdef RUBINIUS_RUBY
 #undef T_RATIONAL
@@ -33,11 +32,14 @@ enum st_retval {ST_CONTINUE = 0, ST_STOP = 1, ST_DELETE = 2, ST_CHECK};
 
 #include "rxclass.h"
 #include "err.h"
+#include "compress.h"
 
 #define INF_VAL		"3.0e14159265358979323846"
 #define NINF_VAL	"-3.0e14159265358979323846"
 #define NAN_VAL		"3.3e14159265358979323846"
 
+typedef uint64_t	slot_t;
+
 typedef enum {
     Yes	   = 'y',
     No	   = 'n',
@@ -77,8 +79,14 @@ typedef enum {
     AutoDec	= 'a',
     FastDec	= 'F',
     RubyDec	= 'r',
+    RationalDec	= 'q',
 } BigLoad;
 
+typedef enum {
+    ClassicFloat	= 'c',
+    ShortestFloat	= 's',
+} FloatEngine;
+
 typedef enum {
     ArrayNew	= 'A',
     ArrayType	= 'a',
@@ -151,15 +159,24 @@ typedef struct _options {
     char		safe;		// YesNo
     char		sec_prec_set;	// boolean (0 or 1)
     char		ignore_under;	// YesNo - ignore attrs starting with _ if true in object and custom modes
+    char		cache_keys;	// YesNo - cache hash keys on load
+    char		mmap_load;	// YesNo - mmap regular files in load_file
+    char		string_buf;	// YesNo - dump directly into the String
+    char		cache_str;	// longest loaded String value to cache, 0 for none
     int64_t		int_range_min;	// dump numbers below as string
     int64_t		int_range_max;	// dump numbers above as string
     const char		*create_id;	// 0 or string
     size_t		create_id_len;	// length of create_id
     int			sec_prec;	// second precision when dumping time
+    size_t		buffer_size;	// stream parser read buffer size
+    size_t		release_gvl;	// tokenize without the GVL at this size, 0 never
     char		float_prec;	// float precision, linked to float_fmt
     char		float_fmt[7];	// float format for dumping, if empty use Ruby
+    char		float_engine;	// FloatEngine
     VALUE		hash_class;	// class to use in place of Hash on load
     VALUE		array_class;	// class to use in place of Array on load
+    VALUE		only;		// compiled :only load paths or Qnil
+    VALUE		raw;		// compiled :raw load paths or Qnil
     struct _dumpOpts	dump_opts;
     struct _rxClass	str_rx;
     VALUE		*ignore;	// Qnil terminated array of classes or NULL
@@ -181,11 +198,47 @@ typedef struct _rOptTable {
     ROpt		table;
 } *ROptTable;
 
+#define KEY_CACHE_BITS	6
+#define KEY_CACHE_STR_MAX	38
+
+// A Hash key that dumps without any escapes. The bytes are the key itself
+// and are compared on lookup so a key that has been collected and its slot
+// reused by another VALUE is never mistaken.
+typedef struct _keySlot {
+    VALUE	key;
+    uint8_t	len;
+    char	str[KEY_CACHE_STR_MAX + 1];
+} *KeySlot;
+
+#define ROPT_CACHE_BITS	4
+
+// A class and the dump function the rails optimize table resolved it to or
+// NULL if the class is not optimized. Slots are only trusted while gen
+// matches the generation of the tables.
+typedef struct _rOptSlot {
+    VALUE	clas;
+    DumpFunc	dump;
+} *ROptSlot;
+
+#define TJ_CACHE_BITS	2
+
+// A class and whether its to_json is the Object#to_json mimic_JSON defined.
+typedef struct _tjSlot {
+    VALUE	clas;
+    bool	own;
+} *TjSlot;
+
+struct _out;
+
+// Writes len bytes of buf from the Out to wherever the dump is going.
+typedef void	(*OutFlush)(struct _out *out, const char *buf, size_t len);
+
 typedef struct _out {
     char		*buf;
     char		*end;
     char		*cur;
-    Cache8		circ_cache;
+    struct _circSlot	*circ_slots; // objects already dumped when :circular is true
+    uint32_t		circ_mask;
     slot_t		circ_cnt;
     int			indent;
     int			depth; // used by dump_hash
@@ -197,6 +250,17 @@ typedef struct _out {
     VALUE		*argv;
     DumpCaller		caller; // used for the mimic json only
     ROptTable		ropts;
+    VALUE		str; // String written into directly or Qnil
+    OutFlush		flush; // NULL or called instead of growing past flush_limit
+    void		*flush_ctx;
+    size_t		flush_limit;
+    uint64_t		key_used; // bit for each key_slots entry that is set
+    struct _keySlot	key_slots[1 << KEY_CACHE_BITS];
+    uint32_t		ropt_gen;  // optimize generation the ropt_slots are for
+    uint16_t		ropt_used; // bit for each ropt_slots entry that is set
+    struct _rOptSlot	ropt_slots[1 << ROPT_CACHE_BITS];
+    uint8_t		tj_used; // bit for each tj_slots entry that is set
+    struct _tjSlot	tj_slots[1 << TJ_CACHE_BITS];
 } *Out;
 
 typedef struct _strWriter {
@@ -215,6 +279,8 @@ typedef struct _streamWriter {
     VALUE		stream;
     int			fd;
     int			flush_limit; // indicator of when to flush
+    struct _asyncWriter	*async; // NULL unless writes are made on a writer thread
+    struct _deflater	*deflater; // NULL unless the output is compressed
 } *StreamWriter;
 
 enum {
@@ -238,6 +304,7 @@ typedef struct _leaf {
     uint8_t		rtype;
     uint8_t		parent_type;
     uint8_t		value_type;
+    uint32_t		lindex;	   // 1 based child index slot in the doc, 0 if none
 } *Leaf;
 
 extern VALUE	oj_saj_parse(int argc, VALUE *argv, VALUE self);
@@ -250,6 +317,14 @@ extern VALUE	oj_compat_load(int argc, VALUE *argv, VALUE self);
 extern VALUE	oj_object_parse(int argc, VALUE *argv, VALUE self);
 extern VALUE	oj_custom_parse(int argc, VALUE *argv, VALUE self);
 extern VALUE	oj_wab_parse(int argc, VALUE *argv, VALUE self);
+extern VALUE	oj_valid_p(int argc, VALUE *argv, VALUE self);
+extern VALUE	oj_validate(int argc, VALUE *argv, VALUE self);
+extern VALUE	oj_msgpack_dump(int argc, VALUE *argv, VALUE self);
+extern VALUE	oj_cbor_dump(int argc, VALUE *argv, VALUE self);
+extern VALUE	oj_msgpack_load(int argc, VALUE *argv, VALUE self);
+extern VALUE	oj_cbor_load(int argc, VALUE *argv, VALUE self);
+extern VALUE	oj_reformat(int argc, VALUE *argv, VALUE self);
+extern VALUE	oj_minify(int argc, VALUE *argv, VALUE self);
 
 extern VALUE	oj_strict_parse_cstr(int argc, VALUE *argv, char *json, size_t len);
 extern VALUE	oj_compat_parse_cstr(int argc, VALUE *argv, char *json, size_t len);
@@ -257,11 +332,16 @@ extern VALUE	oj_object_parse_cstr(int argc, VALUE *argv, char *json, size_t len)
 extern VALUE	oj_custom_parse_cstr(int argc, VALUE *argv, char *json, size_t len);
 
 extern void	oj_parse_options(VALUE ropts, Options copts);
+extern void	oj_dump_options(VALUE ropts, Options copts);
+extern void	oj_apply_dump_options(VALUE ropts, Options copts);
+extern Options	oj_options_load(VALUE handle);
+extern Options	oj_options_dump(VALUE handle, VALUE *ropts);
+extern Compression	oj_options_compression(VALUE handle);
 
 extern void	oj_dump_obj_to_json(VALUE obj, Options copts, Out out);
 extern void	oj_dump_obj_to_json_using_params(VALUE obj, Options copts, Out out, int argc, VALUE *argv);
-extern void	oj_write_obj_to_file(VALUE obj, const char *path, Options copts);
-extern void	oj_write_obj_to_stream(VALUE obj, VALUE stream, Options copts);
+extern void	oj_write_obj_to_file(VALUE obj, const char *path, Options copts, Compression compression);
+extern void	oj_write_obj_to_stream(VALUE obj, VALUE stream, Options copts, Compression compression);
 extern void	oj_dump_leaf_to_json(Leaf leaf, Options copts, Out out);
 extern void	oj_write_leaf_to_file(Leaf leaf, const char *path, Options copts);
 
@@ -270,12 +350,16 @@ extern void	oj_str_writer_push_object(StrWriter sw, const char *key);
 extern void	oj_str_writer_push_array(StrWriter sw, const char *key);
 extern void	oj_str_writer_push_value(StrWriter sw, VALUE val, const char *key);
 extern void	oj_str_writer_push_json(StrWriter sw, const char *json, const char *key);
+extern void	oj_str_writer_push_values(StrWriter sw, VALUE ary, void (*flush)(StrWriter sw));
+extern void	oj_str_writer_push_rows(StrWriter sw, VALUE keys, VALUE rows, void (*flush)(StrWriter sw));
 extern void	oj_str_writer_pop(StrWriter sw);
 extern void	oj_str_writer_pop_all(StrWriter sw);
 
 extern void	oj_init_doc(void);
 extern void	oj_string_writer_init();
 extern void	oj_stream_writer_init();
+extern void	oj_parser_init();
+extern void	oj_options_init();
 extern void	oj_str_writer_init(StrWriter sw, int buf_size);
 extern VALUE	oj_define_mimic_json(int argc, VALUE *argv, VALUE self);
 extern VALUE	oj_mimic_generate(int argc, VALUE *argv, VALUE self);
@@ -301,6 +385,8 @@ extern VALUE	oj_doc_class;
 extern VALUE	oj_enumerable_class;
 extern VALUE	oj_json_generator_error_class;
 extern VALUE	oj_json_parser_error_class;
+extern VALUE	oj_options_class;
+extern VALUE	oj_raw_json_class;
 extern VALUE	oj_stream_writer_class;
 extern VALUE	oj_string_writer_class;
 extern VALUE	oj_stringio_class;
@@ -343,6 +429,7 @@ extern ID	oj_hash_key_id;
 extern ID	oj_hash_set_id;
 extern ID	oj_hash_start_id;
 extern ID	oj_iconv_id;
+extern ID	oj_instance_method_id;
 extern ID	oj_instance_variables_id;
 extern ID	oj_json_create_id;
 extern ID	oj_length_id;
@@ -355,6 +442,7 @@ extern ID	oj_replace_id;
 extern ID	oj_stat_id;
 extern ID	oj_string_id;
 extern ID	oj_raw_json_id;
+extern ID	oj_json_ivar_id;
 extern ID	oj_to_h_id;
 extern ID	oj_to_hash_id;
 extern ID	oj_to_json_id;
@@ -373,12 +461,6 @@ extern bool	oj_use_hash_alt;
 extern bool	oj_use_array_alt;
 extern bool	string_writer_optimized;
 
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-extern pthread_mutex_t	oj_cache_mutex;
-#else
-extern VALUE	oj_cache_mutex;
-#endif
-
 #if defined(cplusplus)
 #if 0
 { /* satisfy cc-mode */
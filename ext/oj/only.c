@@ -0,0 +1,204 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <string.h>
+
+#include "only.h"
+
+typedef struct _only {
+    VALUE		paths;
+    struct _onlyNode	root;
+} *Only;
+
+static void
+node_free(OnlyNode node) {
+    int	i;
+
+    for (i = 0; i < node->cnt; i++) {
+	node_free(node->children + i);
+    }
+    xfree(node->children);
+    xfree((char*)node->key);
+}
+
+static void
+only_free(void *ptr) {
+    if (NULL != ptr) {
+	node_free(&((Only)ptr)->root);
+	xfree(ptr);
+    }
+}
+
+static void
+only_mark(void *ptr) {
+    if (NULL != ptr) {
+	rb_gc_mark(((Only)ptr)->paths);
+    }
+}
+
+static OnlyNode
+node_add(OnlyNode node, const char *key, size_t klen) {
+    OnlyNode	child;
+    char	*k;
+    int		i;
+
+    for (i = 0; i < node->cnt; i++) {
+	child = node->children + i;
+	if (klen == child->klen && 0 == memcmp(key, child->key, klen)) {
+	    return child;
+	}
+    }
+    if (node->size <= node->cnt) {
+	node->size = (0 == node->size) ? 4 : node->size * 2;
+	REALLOC_N(node->children, struct _onlyNode, node->size);
+    }
+    child = node->children + node->cnt;
+    memset(child, 0, sizeof(struct _onlyNode));
+    k = ALLOC_N(char, klen + 1);
+    memcpy(k, key, klen);
+    k[klen] = '\0';
+    child->key = k;
+    child->klen = klen;
+    node->cnt++;
+
+    return child;
+}
+
+static void
+path_add(Only only, VALUE path) {
+    OnlyNode	node = &only->root;
+    const char	*p;
+    const char	*end;
+    char	*key;
+    char	*k;
+
+    if (T_SYMBOL == rb_type(path)) {
+	path = rb_sym2str(path);
+    }
+    Check_Type(path, T_STRING);
+    p = RSTRING_PTR(path);
+    end = p + RSTRING_LEN(path);
+    if (p < end && '/' == *p) {
+	p++;
+    }
+    if (end <= p) {
+	rb_raise(rb_eArgError, ":only paths must not be empty.");
+    }
+    key = ALLOCA_N(char, end - p);
+    while (p < end) {
+	for (k = key; p < end && '/' != *p; p++) {
+	    if ('\\' == *p && p + 1 < end) {
+		p++;
+	    }
+	    *k++ = *p;
+	}
+	node = node_add(node, key, k - key);
+	p++;
+    }
+    node->keep = true;
+}
+
+// Adds the paths under src to dst.
+static void
+node_merge(OnlyNode dst, OnlyNode src) {
+    int	i;
+
+    if (src->keep) {
+	dst->keep = true;
+    }
+    for (i = 0; i < src->cnt; i++) {
+	OnlyNode	c = src->children + i;
+
+	node_merge(node_add(dst, c->key, c->klen), c);
+    }
+}
+
+// A "*" step matches any key so the paths under a "*" child are also copied
+// under each of its siblings. A lookup then only needs the exact child when
+// there is one.
+static void
+star_merge(OnlyNode node) {
+    OnlyNode	star = NULL;
+    int		i;
+
+    for (i = 0; i < node->cnt; i++) {
+	if (1 == node->children[i].klen && '*' == *node->children[i].key) {
+	    star = node->children + i;
+	}
+    }
+    if (NULL != star) {
+	for (i = 0; i < node->cnt; i++) {
+	    if (node->children + i != star) {
+		node_merge(node->children + i, star);
+	    }
+	}
+    }
+    for (i = 0; i < node->cnt; i++) {
+	star_merge(node->children + i);
+    }
+}
+
+// Compiles an Array of String paths such as 'user/name' or 'items/*/sku'
+// into a projection tree wrapped in a hidden Ruby object so it is freed
+// once no options refer to it.
+VALUE
+oj_only_new(VALUE paths) {
+    Only	only;
+    VALUE	obj;
+    long	i;
+    long	cnt;
+
+    if (T_ARRAY != rb_type(paths)) {
+	rb_raise(rb_eArgError, ":only must be nil or an Array of Strings.");
+    }
+    only = ALLOC(struct _only);
+    memset(only, 0, sizeof(struct _only));
+    only->paths = rb_ary_dup(paths);
+    rb_obj_freeze(only->paths);
+#ifdef HAVE_RB_DATA_OBJECT_WRAP
+    obj = rb_data_object_wrap(0, only, only_mark, only_free);
+#else
+    obj = rb_data_object_alloc(0, only, only_mark, only_free);
+#endif
+    cnt = RARRAY_LEN(paths);
+    for (i = 0; i < cnt; i++) {
+	path_add(only, rb_ary_entry(paths, i));
+    }
+    star_merge(&only->root);
+
+    return obj;
+}
+
+VALUE
+oj_only_paths(VALUE only) {
+    if (Qnil == only) {
+	return Qnil;
+    }
+    return ((Only)DATA_PTR(only))->paths;
+}
+
+OnlyNode
+oj_only_root(VALUE only) {
+    if (Qnil == only) {
+	return NULL;
+    }
+    return &((Only)DATA_PTR(only))->root;
+}
+
+// Returns the child matching the key, the "*" child, or NULL if the value
+// should be skipped.
+OnlyNode
+oj_only_child(OnlyNode node, const char *key, size_t klen) {
+    OnlyNode	star = NULL;
+    OnlyNode	child = node->children;
+    OnlyNode	end = child + node->cnt;
+
+    for (; child < end; child++) {
+	if (klen == child->klen && 0 == memcmp(key, child->key, klen)) {
+	    return child;
+	}
+	if (1 == child->klen && '*' == *child->key) {
+	    star = child;
+	}
+    }
+    return star;
+}
@@ -0,0 +1,39 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_ONLY_H
+#define OJ_ONLY_H
+
+#include <stdbool.h>
+
+#include "ruby.h"
+
+// A tree of the paths given with the :only load option. The root holds the
+// first step of each path. A keep node keeps the whole value at that
+// location while any other node with children keeps only the matching
+// members of the value. A "*" key matches any key or array element.
+
+typedef struct _onlyNode {
+    struct _onlyNode	*children;
+    const char		*key;
+    size_t		klen;
+    int			cnt;
+    int			size;
+    bool		keep;
+} *OnlyNode;
+
+extern VALUE	oj_only_new(VALUE paths);
+extern VALUE	oj_only_paths(VALUE only);
+extern OnlyNode	oj_only_root(VALUE only);
+extern OnlyNode	oj_only_child(OnlyNode node, const char *key, size_t klen);
+
+// Returns the node to filter the members of a container with or NULL if the
+// whole container is kept.
+inline static OnlyNode
+oj_only_filter(OnlyNode node) {
+    if (NULL == node || node->keep || 0 == node->cnt) {
+	return NULL;
+    }
+    return node;
+}
+
+#endif /* OJ_ONLY_H */
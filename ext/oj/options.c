@@ -0,0 +1,232 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <string.h>
+
+#include "oj.h"
+#include "parse.h"
+#include "compress.h"
+#include "rxclass.h"
+
+extern const char	oj_json_class[];
+
+// An Oj::Options holds the options from a Hash already applied to the
+// defaults so calls that are given one copy a struct instead of looking up
+// every option in the Hash. The load options include the mode defaults load()
+// sets before the Hash is applied, and the dump options the ones dump() sets,
+// so the results are the same as passing the Hash.
+typedef struct _optsHandle {
+    struct _options	load;
+    struct _options	dump;
+    Compression		compression;
+    VALUE		ropts;	 // frozen copy of the Hash, given to to_json()
+} *OptsHandle;
+
+VALUE	oj_options_class = Qundef;
+
+static void
+mark_opts(Options o) {
+    rb_gc_mark(o->hash_class);
+    rb_gc_mark(o->array_class);
+    rb_gc_mark(o->only);
+    rb_gc_mark(o->raw);
+    if (NULL != o->ignore) {
+	VALUE	*vp;
+
+	for (vp = o->ignore; Qnil != *vp; vp++) {
+	    rb_gc_mark(*vp);
+	}
+    }
+    oj_rxclass_mark(&o->str_rx);
+}
+
+static void
+opts_mark(void *ptr) {
+    OptsHandle	h = (OptsHandle)ptr;
+
+    if (NULL == ptr) {
+	return;
+    }
+    rb_gc_mark(h->ropts);
+    mark_opts(&h->load);
+    mark_opts(&h->dump);
+}
+
+static void
+free_create_id(const char *create_id) {
+    if (oj_json_class != create_id) {
+	xfree((char*)create_id);
+    }
+}
+
+// The ignore list, create_id, and match_string classes of the defaults are
+// on the heap and are freed when Oj.default_options= replaces them so the
+// handle makes its own copies.
+static void
+copy_shared(Options o) {
+    struct _rxClass	rx = o->str_rx;
+
+    if (NULL != o->ignore) {
+	VALUE	*vp;
+	VALUE	*ignore;
+	size_t	cnt = 1;
+
+	for (vp = o->ignore; Qnil != *vp; vp++) {
+	    cnt++;
+	}
+	ignore = ALLOC_N(VALUE, cnt);
+	memcpy(ignore, o->ignore, sizeof(VALUE) * cnt);
+	o->ignore = ignore;
+    }
+    if (NULL != o->create_id && oj_json_class != o->create_id) {
+	char	*id = ALLOC_N(char, o->create_id_len + 1);
+
+	memcpy(id, o->create_id, o->create_id_len + 1);
+	o->create_id = id;
+    }
+    oj_rxclass_copy(&rx, &o->str_rx);
+}
+
+// Applies the Hash to options that own copies of the shared defaults and
+// frees the copies the Hash replaced. A replaced ignore list is freed by
+// oj_parse_options().
+static void
+apply_opts(Options o, VALUE ropts, bool dump) {
+    const char		*create_id = o->create_id;
+    struct _rxClass	rx = o->str_rx;
+
+    if (dump) {
+	oj_apply_dump_options(ropts, o);
+    } else {
+	oj_parse_options(ropts, o);
+    }
+    if (create_id != o->create_id) {
+	free_create_id(create_id);
+    }
+    if (rx.head != o->str_rx.head) {
+	oj_rxclass_cleanup(&rx);
+    }
+}
+
+static void
+release_opts(Options o) {
+    xfree(o->ignore);
+    oj_rxclass_cleanup(&o->str_rx);
+    free_create_id(o->create_id);
+}
+
+static void
+opts_free(void *ptr) {
+    OptsHandle	h = (OptsHandle)ptr;
+
+    if (NULL == ptr) {
+	return;
+    }
+    release_opts(&h->load);
+    release_opts(&h->dump);
+    xfree(h);
+}
+
+static OptsHandle
+get_handle(VALUE self) {
+    OptsHandle	h = (OptsHandle)DATA_PTR(self);
+
+    if (NULL == h) {
+	rb_raise(rb_eArgError, "Oj::Options not initialized.");
+    }
+    return h;
+}
+
+// Returns the load options of an Oj::Options.
+Options
+oj_options_load(VALUE handle) {
+    return &get_handle(handle)->load;
+}
+
+// Returns the dump options of an Oj::Options and sets *ropts to the Hash
+// they were made from.
+Options
+oj_options_dump(VALUE handle, VALUE *ropts) {
+    OptsHandle	h = get_handle(handle);
+
+    *ropts = h->ropts;
+
+    return &h->dump;
+}
+
+Compression
+oj_options_compression(VALUE handle) {
+    return get_handle(handle)->compression;
+}
+
+/* Document-method: new
+ * call-seq: new(options={})
+ *
+ * Creates a set of options that can be given to Oj.load, Oj.load_file,
+ * Oj.dump, and the mode specific load methods in place of an options
+ * Hash. The options are applied to the default options when the
+ * Oj::Options is created so later changes to Oj.default_options do not
+ * change it.
+ *
+ *   opts = Oj::Options.new(mode: :strict, symbol_keys: true)
+ *   Oj.load('{"a":1}', opts) # => {:a=>1}
+ *
+ * - *options* [_Hash_] same as for Oj.load and Oj.dump
+ *
+ * Returns [_Oj::Options_]
+ */
+static VALUE
+opts_new(int argc, VALUE *argv, VALUE self) {
+    OptsHandle		h = ALLOC(struct _optsHandle);
+    VALUE		ropts = (1 <= argc) ? *argv : Qnil;
+    struct _parseInfo	pi;
+
+    memset(h, 0, sizeof(struct _optsHandle));
+    h->load = oj_default_options;
+    h->dump = oj_default_options;
+    h->ropts = Qnil;
+    copy_shared(&h->load);
+    copy_shared(&h->dump);
+    self = Data_Wrap_Struct(oj_options_class, opts_mark, opts_free, h);
+
+    if (Qnil == ropts) {
+	ropts = rb_hash_new();
+    }
+    Check_Type(ropts, T_HASH);
+    h->ropts = rb_obj_freeze(rb_hash_dup(ropts));
+
+    parse_info_init(&pi);
+    pi.options = h->load;
+    oj_set_mode_callbacks(&pi, h->ropts);
+    h->load = pi.options;
+    apply_opts(&h->load, h->ropts, false);
+
+    apply_opts(&h->dump, h->ropts, true);
+    h->compression = oj_compression(h->ropts);
+
+    return self;
+}
+
+/* Document-method: to_h
+ * call-seq: to_h()
+ *
+ * Returns [_Hash_] the options Hash the Oj::Options was created with.
+ */
+static VALUE
+opts_to_h(VALUE self) {
+    return rb_hash_dup(get_handle(self)->ropts);
+}
+
+/* Document-class: Oj::Options
+ *
+ * A set of load and dump options compiled once so that calls made with
+ * them skip parsing an options Hash. Useful when many small documents are
+ * loaded or dumped with the same options.
+ */
+void
+oj_options_init() {
+    oj_options_class = rb_define_class_under(Oj, "Options", rb_cObject);
+    rb_gc_register_address(&oj_options_class);
+    rb_undef_alloc_func(oj_options_class);
+    rb_define_module_function(oj_options_class, "new", opts_new, -1);
+    rb_define_method(oj_options_class, "to_h", opts_to_h, 0);
+}
@@ -13,6 +13,13 @@
 #include "buf.h"
 #include "val_stack.h"
 #include "rxclass.h"
+#include "hash.h"
+#include "probes.h"
+#include "stats.h"
+#include "float_parse.h"
+#include "tape.h"
+#include "only.h"
+#include "simd.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
 #define OJ_INFINITY	(1.0/0.0)
@@ -21,10 +28,32 @@
 #define EXP_MAX		100000
 #define DEC_MAX		15
 
-static void
-next_non_white(ParseInfo pi) {
-    for (; 1; pi->cur++) {
-	switch(*pi->cur) {
+// The scanners find the next byte of interest in a run of string or
+// whitespace characters. Each returns a pointer to the first byte that stops
+// the scan or end if none is found. The SIMD versions only look at full
+// blocks before end and then hand the remainder to the scalar versions so
+// they never read past the input.
+typedef const char*	(*ScanFunc)(const char *str, const char *end);
+
+static const char*
+scan_string_noSIMD(const char *str, const char *end) {
+    for (; str < end; str++) {
+	switch (*str) {
+	case '"':
+	case '\\':
+	case '\0':
+	    return str;
+	default:
+	    break;
+	}
+    }
+    return end;
+}
+
+static const char*
+scan_white_noSIMD(const char *str, const char *end) {
+    for (; str < end; str++) {
+	switch (*str) {
 	case ' ':
 	case '\t':
 	case '\f':
@@ -32,9 +61,189 @@ next_non_white(ParseInfo pi) {
 	case '\r':
 	    break;
 	default:
-	    return;
+	    return str;
+	}
+    }
+    return end;
+}
+
+#ifdef OJ_USE_SSE2
+static const char*
+scan_string_SSE2(const char *str, const char *end) {
+    const __m128i	quote = _mm_set1_epi8('"');
+    const __m128i	back = _mm_set1_epi8('\\');
+    const __m128i	zero = _mm_setzero_si128();
+
+    for (; str + 16 <= end; str += 16) {
+	__m128i	chunk = _mm_loadu_si128((const __m128i*)str);
+	int	mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+								   _mm_cmpeq_epi8(chunk, back)),
+						      _mm_cmpeq_epi8(chunk, zero)));
+
+	if (0 != mask) {
+	    return str + __builtin_ctz(mask);
 	}
     }
+    return scan_string_noSIMD(str, end);
+}
+
+static const char*
+scan_white_SSE2(const char *str, const char *end) {
+    const __m128i	space = _mm_set1_epi8(' ');
+    const __m128i	tab = _mm_set1_epi8('\t');
+    const __m128i	nl = _mm_set1_epi8('\n');
+    const __m128i	cr = _mm_set1_epi8('\r');
+    const __m128i	ff = _mm_set1_epi8('\f');
+
+    for (; str + 16 <= end; str += 16) {
+	__m128i	chunk = _mm_loadu_si128((const __m128i*)str);
+	__m128i	white = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+				     _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, nl), _mm_cmpeq_epi8(chunk, cr)),
+						  _mm_cmpeq_epi8(chunk, ff)));
+	int	mask = ~_mm_movemask_epi8(white) & 0x0000FFFF;
+
+	if (0 != mask) {
+	    return str + __builtin_ctz(mask);
+	}
+    }
+    return scan_white_noSIMD(str, end);
+}
+#endif
+
+#ifdef OJ_USE_AVX2
+__attribute__((target("avx2")))
+static const char*
+scan_string_AVX2(const char *str, const char *end) {
+    const __m256i	quote = _mm256_set1_epi8('"');
+    const __m256i	back = _mm256_set1_epi8('\\');
+    const __m256i	zero = _mm256_setzero_si256();
+
+    for (; str + 32 <= end; str += 32) {
+	__m256i		chunk = _mm256_loadu_si256((const __m256i*)str);
+	uint32_t	mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+											     _mm256_cmpeq_epi8(chunk, back)),
+									    _mm256_cmpeq_epi8(chunk, zero)));
+
+	if (0 != mask) {
+	    return str + __builtin_ctz(mask);
+	}
+    }
+    return scan_string_SSE2(str, end);
+}
+
+__attribute__((target("avx2")))
+static const char*
+scan_white_AVX2(const char *str, const char *end) {
+    const __m256i	space = _mm256_set1_epi8(' ');
+    const __m256i	tab = _mm256_set1_epi8('\t');
+    const __m256i	nl = _mm256_set1_epi8('\n');
+    const __m256i	cr = _mm256_set1_epi8('\r');
+    const __m256i	ff = _mm256_set1_epi8('\f');
+
+    for (; str + 32 <= end; str += 32) {
+	__m256i		chunk = _mm256_loadu_si256((const __m256i*)str);
+	__m256i		white = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(chunk, tab)),
+						_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, nl), _mm256_cmpeq_epi8(chunk, cr)),
+								_mm256_cmpeq_epi8(chunk, ff)));
+	uint32_t	mask = ~(uint32_t)_mm256_movemask_epi8(white);
+
+	if (0 != mask) {
+	    return str + __builtin_ctz(mask);
+	}
+    }
+    return scan_white_SSE2(str, end);
+}
+#endif
+
+#ifdef OJ_USE_NEON
+static const char*
+scan_string_NEON(const char *str, const char *end) {
+    const uint8x16_t	quote = vdupq_n_u8('"');
+    const uint8x16_t	back = vdupq_n_u8('\\');
+    const uint8x16_t	zero = vdupq_n_u8(0);
+
+    for (; str + 16 <= end; str += 16) {
+	uint8x16_t	chunk = vld1q_u8((const uint8_t*)str);
+	uint8x16_t	hits = vorrq_u8(vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, back)), vceqq_u8(chunk, zero));
+
+	if (0 != vmaxvq_u8(hits)) {
+	    // At least one hit in this block so let the scalar scan find it.
+	    return scan_string_noSIMD(str, str + 16);
+	}
+    }
+    return scan_string_noSIMD(str, end);
+}
+
+static const char*
+scan_white_NEON(const char *str, const char *end) {
+    const uint8x16_t	space = vdupq_n_u8(' ');
+    const uint8x16_t	tab = vdupq_n_u8('\t');
+    const uint8x16_t	nl = vdupq_n_u8('\n');
+    const uint8x16_t	cr = vdupq_n_u8('\r');
+    const uint8x16_t	ff = vdupq_n_u8('\f');
+
+    for (; str + 16 <= end; str += 16) {
+	uint8x16_t	chunk = vld1q_u8((const uint8_t*)str);
+	uint8x16_t	white = vorrq_u8(vorrq_u8(vceqq_u8(chunk, space), vceqq_u8(chunk, tab)),
+					 vorrq_u8(vorrq_u8(vceqq_u8(chunk, nl), vceqq_u8(chunk, cr)), vceqq_u8(chunk, ff)));
+
+	if (0xFF != vminvq_u8(white)) {
+	    return scan_white_noSIMD(str, str + 16);
+	}
+    }
+    return scan_white_noSIMD(str, end);
+}
+#endif
+
+static ScanFunc	scan_string = scan_string_noSIMD;
+static ScanFunc	scan_white = scan_white_noSIMD;
+
+// Called once from Init_oj() to pick the best scanners for the CPU.
+void
+oj_scanner_init() {
+#if defined(OJ_USE_NEON)
+    scan_string = scan_string_NEON;
+    scan_white = scan_white_NEON;
+#elif defined(OJ_USE_SSE2)
+    scan_string = scan_string_SSE2;
+    scan_white = scan_white_SSE2;
+#ifdef OJ_USE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	scan_string = scan_string_AVX2;
+	scan_white = scan_white_AVX2;
+    }
+#endif
+#endif
+}
+
+// The scanners for other files. Each returns the first byte that is not
+// part of the run.
+const char*
+oj_scan_string(const char *str, const char *end) {
+    return scan_string(str, end);
+}
+
+const char*
+oj_scan_white(const char *str, const char *end) {
+    return scan_white(str, end);
+}
+
+static void
+next_non_white(ParseInfo pi) {
+    switch (*pi->cur) {
+    case ' ':
+    case '\t':
+    case '\f':
+    case '\n':
+    case '\r':
+	break;
+    default:
+	// Most of the time there is no whitespace at all so don't bother
+	// with the scanner.
+	return;
+    }
+    pi->cur = scan_white(pi->cur + 1, pi->end);
 }
 
 static void
@@ -82,9 +291,10 @@ add_value(ParseInfo pi, VALUE rval) {
 	    break;
 	case NEXT_HASH_VALUE:
 	    pi->hash_set_value(pi, parent, rval);
-	    if (0 != parent->key && 0 < parent->klen && (parent->key < pi->json || pi->cur < parent->key)) {
+	    if (parent->kalloc) {
 		xfree((char*)parent->key);
 		parent->key = 0;
+		parent->kalloc = 0;
 	    }
 	    parent->next = NEXT_HASH_COMMA;
 	    break;
@@ -197,6 +407,17 @@ read_escaped_str(ParseInfo pi, const char *start) {
 	buf_append_string(&buf, start, cnt);
     }
     for (s = pi->cur; '"' != *s; s++) {
+	if ('\\' != *s && '\0' != *s) {
+	    // Copy the run of plain characters up to the next quote,
+	    // backslash, or NULL in one step.
+	    const char	*run = scan_string(s, pi->end);
+
+	    buf_append_string(&buf, s, run - s);
+	    s = run;
+	    if ('"' == *s && s < pi->end) {
+		break;
+	    }
+	}
 	if (s >= pi->end) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
 	    buf_cleanup(&buf);
@@ -266,6 +487,11 @@ read_escaped_str(ParseInfo pi, const char *start) {
 	    buf_append(&buf, *s);
 	}
     }
+    if (buf.no_mem) {
+	oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	buf_cleanup(&buf);
+	return;
+    }
     if (0 == parent) {
 	pi->add_cstr(pi, buf.head, buf_len(&buf), start);
     } else {
@@ -277,9 +503,20 @@ read_escaped_str(ParseInfo pi, const char *start) {
 	    break;
 	case NEXT_HASH_NEW:
 	case NEXT_HASH_KEY:
-	    if (Qundef == (parent->key_val = pi->hash_key(pi, buf.head, buf_len(&buf)))) {
+	    if (Qnil != pi->options.raw) {
+		ValCold	cold = stack_cold_peek(&pi->stack, parent);
+
+		if (NULL != cold && NULL != cold->raw) {
+		    cold->raw_child = oj_only_child(cold->raw, buf.head, buf_len(&buf));
+		}
+	    }
+	    if (NULL != parent->only && NULL == (parent->only_child = oj_only_child(parent->only, buf.head, buf_len(&buf)))) {
+		parent->key = "";
+		parent->klen = 0;
+	    } else if (Qundef == (parent->key_val = pi->hash_key(pi, buf.head, buf_len(&buf)))) {
 		parent->klen = buf_len(&buf);
 		parent->key = malloc(parent->klen + 1);
+		parent->kalloc = 1;
 		memcpy((char*)parent->key, buf.head, parent->klen);
 		*(char*)(parent->key + parent->klen) = '\0';
 	    } else {
@@ -291,9 +528,10 @@ read_escaped_str(ParseInfo pi, const char *start) {
 	    break;
 	case NEXT_HASH_VALUE:
 	    pi->hash_set_cstr(pi, parent, buf.head, buf_len(&buf), start);
-	    if (0 != parent->key && 0 < parent->klen && (parent->key < pi->json || pi->cur < parent->key)) {
+	    if (parent->kalloc) {
 		xfree((char*)parent->key);
 		parent->key = 0;
+		parent->kalloc = 0;
 	    }
 	    parent->next = NEXT_HASH_COMMA;
 	    break;
@@ -315,17 +553,16 @@ read_str(ParseInfo pi) {
     const char	*str = pi->cur;
     Val		parent = stack_peek(&pi->stack);
 
-    for (; '"' != *pi->cur; pi->cur++) {
-	if (pi->end <= pi->cur) {
-	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
-	    return;
-	} else if ('\0' == *pi->cur) {
-	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "NULL byte in string");
-	    return;
-	} else if ('\\' == *pi->cur) {
-	    read_escaped_str(pi, str);
-	    return;
-	}
+    pi->cur = scan_string(pi->cur, pi->end);
+    if (pi->end <= pi->cur) {
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
+	return;
+    } else if ('\0' == *pi->cur) {
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "NULL byte in string");
+	return;
+    } else if ('\\' == *pi->cur) {
+	read_escaped_str(pi, str);
+	return;
     }
     if (0 == parent) { // simple add
 	pi->add_cstr(pi, str, pi->cur - str, str);
@@ -338,7 +575,17 @@ read_str(ParseInfo pi) {
 	    break;
 	case NEXT_HASH_NEW:
 	case NEXT_HASH_KEY:
-	    if (Qundef == (parent->key_val = pi->hash_key(pi, str, pi->cur - str))) {
+	    if (Qnil != pi->options.raw) {
+		ValCold	cold = stack_cold_peek(&pi->stack, parent);
+
+		if (NULL != cold && NULL != cold->raw) {
+		    cold->raw_child = oj_only_child(cold->raw, str, pi->cur - str);
+		}
+	    }
+	    if (NULL != parent->only && NULL == (parent->only_child = oj_only_child(parent->only, str, pi->cur - str))) {
+		parent->key = "";
+		parent->klen = 0;
+	    } else if (Qundef == (parent->key_val = pi->hash_key(pi, str, pi->cur - str))) {
 		parent->key = str;
 		parent->klen = pi->cur - str;
 	    } else {
@@ -350,9 +597,10 @@ read_str(ParseInfo pi) {
 	    break;
 	case NEXT_HASH_VALUE:
 	    pi->hash_set_cstr(pi, parent, str, pi->cur - str, str);
-	    if (0 != parent->key && 0 < parent->klen && (parent->key < pi->json || pi->cur < parent->key)) {
+	    if (parent->kalloc) {
 		xfree((char*)parent->key);
 		parent->key = 0;
+		parent->kalloc = 0;
 	    }
 	    parent->next = NEXT_HASH_COMMA;
 	    break;
@@ -385,6 +633,7 @@ read_num(ParseInfo pi) {
     ni.nan = 0;
     ni.neg = 0;
     ni.has_exp = 0;
+    ni.truncated = 0;
     if (CompatMode == pi->options.mode) {
 	ni.no_big = !pi->options.compat_bigdec;
 	ni.bigdec_load = pi->options.compat_bigdec;
@@ -466,8 +715,10 @@ read_num(ParseInfo pi) {
 		if (0 < ni.num || 0 < ni.i) {
 		    dec_cnt++;
 		}
-		if (INT64_MAX <= ni.div) {
-		    if (!ni.no_big) {
+		// Stop collecting digits before num or div overflow.
+		if (INT64_MAX / 10 <= ni.div || (INT64_MAX - 9) / 10 < ni.num) {
+		    ni.truncated = 1;
+		    if (DEC_MAX < dec_cnt && !ni.no_big) {
 			ni.big = true;
 		    }
 		} else {
@@ -493,6 +744,10 @@ read_num(ParseInfo pi) {
 	    } else if ('+' == *pi->cur) {
 		pi->cur++;
 	    }
+	    if (*pi->cur < '0' || '9' < *pi->cur) {
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Invalid float");
+		return;
+	    }
 	    for (; '0' <= *pi->cur && *pi->cur <= '9'; pi->cur++) {
 		ni.exp = ni.exp * 10 + (*pi->cur - '0');
 		if (EXP_MAX <= ni.exp) {
@@ -534,9 +789,10 @@ read_num(ParseInfo pi) {
 	    break;
 	case NEXT_HASH_VALUE:
 	    pi->hash_set_num(pi, parent, &ni);
-	    if (0 != parent->key && 0 < parent->klen && (parent->key < pi->json || pi->cur < parent->key)) {
+	    if (parent->kalloc) {
 		xfree((char*)parent->key);
 		parent->key = 0;
+		parent->kalloc = 0;
 	    }
 	    parent->next = NEXT_HASH_COMMA;
 	    break;
@@ -547,11 +803,206 @@ read_num(ParseInfo pi) {
     }
 }
 
+// Reads the number in the NUL terminated str as if it were the JSON being
+// parsed and adds it to the parent on the stack. The binary loaders use it so
+// numbers are given to the mode callbacks the same way as numbers in JSON.
+void
+oj_pi_add_num_str(ParseInfo pi, const char *str) {
+    const char	*json = pi->json;
+    const char	*cur = pi->cur;
+
+    pi->json = str;
+    pi->cur = str;
+    read_num(pi);
+    pi->json = json;
+    pi->cur = cur;
+}
+
+// Skips the string that starts at s and returns the position after the
+// closing quote or NULL if not terminated.
+static const char*
+skip_str(ParseInfo pi, const char *s) {
+    for (s++; true; s += 2) {
+	s = scan_string(s, pi->end);
+	if (pi->end <= s || '\0' == *s) {
+	    return NULL;
+	}
+	if ('"' == *s) {
+	    return s + 1;
+	}
+    }
+}
+
+// Skips an unwanted value without building it. Only enough of the value is
+// checked to find where it ends.
+static void
+skip_value(ParseInfo pi) {
+    const char	*s;
+    int		depth = 0;
+
+    next_non_white(pi);
+    s = pi->cur;
+    switch (*s) {
+    case '"':
+	if (NULL == (s = skip_str(pi, s))) {
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
+	    return;
+	}
+	break;
+    case '{':
+    case '[':
+	while (s < pi->end) {
+	    switch (*s) {
+	    case '"':
+		if (NULL == (s = skip_str(pi, s))) {
+		    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
+		    return;
+		}
+		continue;
+	    case '{':
+	    case '[':
+		depth++;
+		break;
+	    case '}':
+	    case ']':
+		depth--;
+		break;
+	    case '\0':
+		s = pi->end;
+		continue;
+	    default:
+		break;
+	    }
+	    s++;
+	    if (0 == depth) {
+		break;
+	    }
+	}
+	if (0 != depth) {
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "%s not terminated", ('{' == *pi->cur) ? "hash" : "array");
+	    return;
+	}
+	break;
+    default:
+	for (; s < pi->end; s++) {
+	    if (',' == *s || '}' == *s || ']' == *s || '/' == *s || '\0' == *s ||
+		' ' == *s || '\t' == *s || '\n' == *s || '\r' == *s || '\f' == *s) {
+		break;
+	    }
+	}
+	if (s == pi->cur) {
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected character");
+	    return;
+	}
+	break;
+    }
+    pi->cur = s;
+}
+
+// Reads the next value as an Oj::RawJSON of its bytes without building it.
+static void
+read_raw(ParseInfo pi) {
+    const char		*start;
+    volatile VALUE	raw;
+
+    next_non_white(pi);
+    start = pi->cur;
+    skip_value(pi);
+    if (!err_has(&pi->err)) {
+	raw = rb_obj_alloc(oj_raw_json_class);
+	rb_ivar_set(raw, oj_json_ivar_id, oj_encode(rb_str_new(start, pi->cur - start)));
+	add_value(pi, raw);
+    }
+}
+
+// Returns the :raw node for the members of a container about to be started.
+static OnlyNode
+raw_for_new(ParseInfo pi) {
+    Val		parent = stack_peek(&pi->stack);
+    ValCold	cold;
+
+    if (NULL == parent) {
+	return oj_only_root(pi->options.raw);
+    }
+    cold = stack_cold_peek(&pi->stack, parent);
+    if (NULL == cold || NULL == cold->raw || NULL == cold->raw_child || 0 == cold->raw_child->cnt) {
+	return NULL;
+    }
+    return cold->raw_child;
+}
+
+// Returns true if the next member of parent is to be read as raw JSON.
+inline static bool
+raw_keep(ParseInfo pi, Val parent) {
+    ValCold	cold;
+
+    if (Qnil == pi->options.raw || NULL == (cold = stack_cold_peek(&pi->stack, parent))) {
+	return false;
+    }
+    return NULL != cold->raw_child && cold->raw_child->keep;
+}
+
+// Returns the :only filter for a container about to be started.
+static OnlyNode
+only_for_new(ParseInfo pi) {
+    Val	parent = stack_peek(&pi->stack);
+
+    if (NULL == parent) {
+	return (NULL != pi->only) ? pi->only : oj_only_root(pi->options.only);
+    }
+    if (NULL == parent->only) {
+	return NULL;
+    }
+    return oj_only_filter(parent->only_child);
+}
+
 static void
 array_start(ParseInfo pi) {
+    OnlyNode		only = (Qnil == pi->options.only && NULL == pi->only) ? NULL : only_for_new(pi);
+    OnlyNode		raw = (Qnil == pi->options.raw) ? NULL : raw_for_new(pi);
     volatile VALUE	v = pi->start_array(pi);
 
-    stack_push(&pi->stack, v, NEXT_ARRAY_NEW);
+    if (!stack_push(&pi->stack, v, NEXT_ARRAY_NEW)) {
+	oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	return;
+    }
+    if (NULL != raw) {
+	ValCold	cold = stack_cold(&pi->stack, stack_peek(&pi->stack));
+
+	cold->raw = raw;
+	cold->raw_child = oj_only_child(raw, "*", 1);
+    }
+    if (NULL != only) {
+	Val	array = stack_peek(&pi->stack);
+
+	array->only = only;
+	array->only_child = oj_only_child(only, "*", 1);
+	if (NULL == array->only_child) {
+	    // No element can match so skip them all and leave the close.
+	    while (!err_has(&pi->err)) {
+		next_non_white(pi);
+		if (']' == *pi->cur) {
+		    break;
+		}
+		skip_value(pi);
+		next_non_white(pi);
+		if (',' == *pi->cur) {
+		    pi->cur++;
+		} else if (']' != *pi->cur) {
+		    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "expected comma or array close");
+		}
+	    }
+	    return;
+	}
+    }
+    if (NULL != raw) {
+	if (raw_keep(pi, stack_peek(&pi->stack))) {
+	    next_non_white(pi);
+	    if (']' != *pi->cur) {
+		read_raw(pi);
+	    }
+	}
+    }
 }
 
 static void
@@ -570,9 +1021,20 @@ array_end(ParseInfo pi) {
 
 static void
 hash_start(ParseInfo pi) {
+    OnlyNode		only = (Qnil == pi->options.only && NULL == pi->only) ? NULL : only_for_new(pi);
+    OnlyNode		raw = (Qnil == pi->options.raw) ? NULL : raw_for_new(pi);
     volatile VALUE	v = pi->start_hash(pi);
 
-    stack_push(&pi->stack, v, NEXT_HASH_NEW);
+    if (!stack_push(&pi->stack, v, NEXT_HASH_NEW)) {
+	oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	return;
+    }
+    if (NULL != raw) {
+	stack_cold(&pi->stack, stack_peek(&pi->stack))->raw = raw;
+    }
+    if (NULL != only) {
+	stack_peek(&pi->stack)->only = only;
+    }
 }
 
 static void
@@ -599,6 +1061,9 @@ comma(ParseInfo pi) {
 	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected comma");
     } else if (NEXT_ARRAY_COMMA == parent->next) {
 	parent->next = NEXT_ARRAY_ELEMENT;
+	if (raw_keep(pi, parent)) {
+	    read_raw(pi);
+	}
     } else if (NEXT_HASH_COMMA == parent->next) {
 	parent->next = NEXT_HASH_KEY;
     } else {
@@ -612,6 +1077,12 @@ colon(ParseInfo pi) {
 
     if (0 != parent && NEXT_HASH_COLON == parent->next) {
 	parent->next = NEXT_HASH_VALUE;
+	if (NULL != parent->only && NULL == parent->only_child) {
+	    skip_value(pi);
+	    parent->next = NEXT_HASH_COMMA;
+	} else if (raw_keep(pi, parent)) {
+	    read_raw(pi);
+	}
     } else {
 	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected colon");
     }
@@ -728,7 +1199,14 @@ oj_parse2(ParseInfo pi) {
 	    return;
 	}
 	if (stack_empty(&pi->stack)) {
-	    if (Qundef != pi->proc) {
+	    if (NULL != pi->add_doc) {
+		// A comment after a value also gets here so only a new value is
+		// passed on.
+		if (Qundef != pi->stack.head->val) {
+		    pi->add_doc(pi, pi->stack.head->val);
+		    pi->stack.head->val = Qundef;
+		}
+	    } else if (Qundef != pi->proc) {
 		VALUE	args[3];
 		long	len = (pi->cur - pi->json) - start;
 
@@ -760,6 +1238,118 @@ parse_big_decimal(VALUE str) {
     return rb_funcall(rb_cObject, oj_bigdecimal_id, 1, str);
 }
 
+// The scanner has checked the number syntax except for a . with no digits
+// after it and exponents too large for BigDecimal(). Anything else is
+// accepted by BigDecimal() so it can be called without a rescue frame.
+static VALUE
+big_decimal(NumInfo ni) {
+    volatile VALUE	bd = rb_str_new(ni->str, ni->len);
+    const char		*end = ni->str + ni->len;
+    const char		*dot = memchr(ni->str, '.', ni->len);
+
+    if (0 < ni->len && '0' <= end[-1] && end[-1] <= '9' &&
+	(NULL == dot || ('0' <= dot[1] && dot[1] <= '9')) &&
+	-EXP_MAX < ni->exp && ni->exp < EXP_MAX) {
+	return parse_big_decimal(bd);
+    }
+    return rb_rescue2(parse_big_decimal, bd, rescue_big_decimal, bd, rb_eException, 0);
+}
+
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128	Mant;
+#define MANT_DIGITS	38
+#else
+typedef uint64_t		Mant;
+#define MANT_DIGITS	19
+#endif
+#define MANT_MAX	((Mant)~(Mant)0)
+
+static VALUE
+mant_to_int(Mant m, bool neg) {
+    if (m <= (Mant)INT64_MAX) {
+	return rb_ll2inum(neg ? -(long long)m : (long long)m);
+    }
+    return rb_integer_unpack(&m, 1, sizeof(m), 0, INTEGER_PACK_LSWORD_FIRST | INTEGER_PACK_NATIVE_BYTE_ORDER | (neg ? INTEGER_PACK_NEGATIVE : 0));
+}
+
+// Returns the exact value of a decimal as an Integer if whole or otherwise
+// as a Rational. Qundef is returned if the significant digits or the power
+// of ten do not fit in a Mant.
+static VALUE
+num_as_rational(NumInfo ni) {
+    const char	*s = ni->str;
+    const char	*end = s + ni->len;
+    Mant	m = 0;
+    Mant	den = 1;
+    int		digits = 0;
+    long	exp = 0;
+    bool	neg = false;
+
+    if (s < end && ('-' == *s || '+' == *s)) {
+	neg = ('-' == *s);
+	s++;
+    }
+    for (; s < end && '0' <= *s && *s <= '9'; s++) {
+	if (0 < m || '0' != *s) {
+	    if (MANT_DIGITS <= digits++) {
+		return Qundef;
+	    }
+	}
+	m = m * 10 + (Mant)(*s - '0');
+    }
+    if (s < end && '.' == *s) {
+	for (s++; s < end && '0' <= *s && *s <= '9'; s++, exp--) {
+	    if (0 < m || '0' != *s) {
+		if (MANT_DIGITS <= digits++) {
+		    return Qundef;
+		}
+	    }
+	    m = m * 10 + (Mant)(*s - '0');
+	}
+    }
+    if (s < end && ('e' == *s || 'E' == *s)) {
+	bool	eneg = false;
+	long	x = 0;
+
+	s++;
+	if (s < end && ('-' == *s || '+' == *s)) {
+	    eneg = ('-' == *s);
+	    s++;
+	}
+	for (; s < end && '0' <= *s && *s <= '9'; s++) {
+	    if (EXP_MAX < (x = x * 10 + (*s - '0'))) {
+		return Qundef;
+	    }
+	}
+	exp += eneg ? -x : x;
+    }
+    if (s != end) {
+	return Qundef;
+    }
+    if (0 == m) {
+	return INT2FIX(0);
+    }
+    for (; exp < 0 && 0 == m % 10; exp++) {
+	m /= 10;
+    }
+    if (0 <= exp) {
+	for (; 0 < exp; exp--) {
+	    if (MANT_MAX / 10 < m) {
+		return Qundef;
+	    }
+	    m *= 10;
+	}
+	return mant_to_int(m, neg);
+    }
+    if (MANT_DIGITS < -exp) {
+	return Qundef;
+    }
+    for (; exp < 0; exp++) {
+	den *= 10;
+    }
+    return rb_rational_new(mant_to_int(m, neg), mant_to_int(den, false));
+}
+
 static long double	exp_plus[] = {
     1.0,
     1.0e1,
@@ -813,6 +1403,26 @@ static long double	exp_plus[] = {
     1.0e49,
 };
 
+// Converts the scanned mantissa and exponent to a double using the fast
+// correctly rounded conversion. Returns false if the digits did not all fit
+// in the mantissa or the conversion could not be done.
+static bool
+num_to_double(NumInfo ni, double *dp) {
+    uint64_t	man;
+
+    // Digits past what fits in 64 bits are not collected so leave those to
+    // the slower conversions.
+    if (ni->truncated || 18 < ni->di || ni->i < 0 || ni->num < 0) {
+	return false;
+    }
+    if (0 < ni->i && (uint64_t)ni->i > (UINT64_MAX - (uint64_t)ni->num) / (uint64_t)ni->div) {
+	return false;
+    }
+    man = (uint64_t)ni->i * (uint64_t)ni->div + (uint64_t)ni->num;
+
+    return oj_dec_to_double(man, (int)(ni->exp - ni->di), ni->neg, dp);
+}
+
 VALUE
 oj_num_as_value(NumInfo ni) {
     volatile VALUE	rnum = Qnil;
@@ -849,16 +1459,25 @@ oj_num_as_value(NumInfo ni) {
 	    }
 	}
     } else { // decimal
-	if (ni->big) {
-	    volatile VALUE	bd = rb_str_new(ni->str, ni->len);
-
-	    rnum = rb_rescue2(parse_big_decimal, bd, rescue_big_decimal, bd, rb_eException, 0);
+	if (RationalDec == ni->bigdec_load) {
+	    if (Qundef == (rnum = num_as_rational(ni))) {
+		rnum = big_decimal(ni);
+	    }
+	} else if (ni->big) {
+	    rnum = big_decimal(ni);
 	    if (ni->no_big) {
 		rnum = rb_funcall(rnum, rb_intern("to_f"), 0);
 	    }
 	} else if (FastDec == ni->bigdec_load) {
-	    long double	ld = (long double)ni->i * (long double)ni->div + (long double)ni->num;
-	    int		x = (int)((int64_t)ni->exp - ni->di);
+	    long double	ld;
+	    int		x;
+	    double	d;
+
+	    if (num_to_double(ni, &d)) {
+		return rb_float_new(d);
+	    }
+	    ld = (long double)ni->i * (long double)ni->div + (long double)ni->num;
+	    x = (int)((int64_t)ni->exp - ni->di);
 
 	    if (0 < x) {
 		if (x < (int)(sizeof(exp_plus) / sizeof(*exp_plus))) {
@@ -883,8 +1502,12 @@ oj_num_as_value(NumInfo ni) {
 	    rnum = rb_funcall(sv, rb_intern("to_f"), 0);
 	} else {
 	    char	*end;
-	    double	d = strtod(ni->str, &end);
+	    double	d;
 
+	    if (num_to_double(ni, &d)) {
+		return rb_float_new(d);
+	    }
+	    d = strtod(ni->str, &end);
 	    if ((long)ni->len != (long)(end - ni->str)) {
 		rb_raise(oj_parse_error_class, "Invalid float");
 	    }
@@ -894,6 +1517,48 @@ oj_num_as_value(NumInfo ni) {
     return rnum;
 }
 
+// Returns the key for a hash member. Unless caching is turned off the raw key
+// bytes are used to look up a frozen String or Symbol from the cache so that
+// repeated keys do not create new objects.
+VALUE
+oj_calc_hash_key(ParseInfo pi, Val parent) {
+    volatile VALUE	rkey = parent->key_val;
+
+    if (Qundef != rkey) {
+	rkey = oj_encode(rkey);
+	if (Yes == pi->options.sym_key) {
+	    rkey = rb_str_intern(rkey);
+	}
+	return rkey;
+    }
+    if (Yes == pi->options.cache_keys) {
+	if (Yes == pi->options.sym_key) {
+	    return oj_sym_intern(parse_caches(pi), parent->key, parent->klen);
+	}
+	return oj_str_intern(parse_caches(pi), parent->key, parent->klen);
+    }
+    if (Yes == pi->options.sym_key) {
+	return oj_sym_new(parent->key, parent->klen);
+    }
+    rkey = rb_str_new(parent->key, parent->klen);
+
+    return oj_encode(rkey);
+}
+
+// Returns a String for a loaded value. Values no longer than the
+// :cache_strings option are shared frozen Strings from the value cache.
+VALUE
+oj_cstr_to_value(ParseInfo pi, const char *str, size_t len) {
+    volatile VALUE	rstr;
+
+    if (0 < len && len <= (size_t)pi->options.cache_str) {
+	return oj_str_val_intern(parse_caches(pi), str, len);
+    }
+    rstr = rb_str_new(str, len);
+
+    return oj_encode(rstr);
+}
+
 void
 oj_set_error_at(ParseInfo pi, VALUE err_clas, const char* file, int line, const char *format, ...) {
     va_list	ap;
@@ -929,10 +1594,14 @@ oj_set_error_at(ParseInfo pi, VALUE err_clas, const char* file, int line, const
 		p += vp->klen;
 	    } else {
 		if (RUBY_T_ARRAY == rb_type(vp->val)) {
+		    // Elements collected by the bulk callbacks are not in the
+		    // Array yet.
+		    size_t	vend = (vp + 1 < pi->stack.tail) ? (vp + 1)->vstart : pi->stack.vlen;
+
 		    if (end <= p + 12) {
 			break;
 		    }
-		    p += snprintf(p, end - p, "[%ld]", RARRAY_LEN(vp->val));
+		    p += snprintf(p, end - p, "[%ld]", RARRAY_LEN(vp->val) + (long)(vend - vp->vstart));
 		}
 	    }
 	}
@@ -940,7 +1609,11 @@ oj_set_error_at(ParseInfo pi, VALUE err_clas, const char* file, int line, const
     }
     *p = '\0';
     if (0 == pi->json) {
-	oj_err_set(&pi->err, err_clas, "%s at line %d, column %d [%s:%d]", msg, pi->rd.line, pi->rd.col, file, line);
+	int	rline;
+	int	rcol;
+
+	oj_reader_location(&pi->rd, &rline, &rcol);
+	oj_err_set(&pi->err, err_clas, "%s at line %d, column %d [%s:%d]", msg, rline, rcol, file, line);
     } else {
 	_oj_err_set_with_location(&pi->err, err_clas, msg, pi->json, pi->cur - 1, file, line);
     }
@@ -953,6 +1626,30 @@ protect_parse(VALUE pip) {
     return Qnil;
 }
 
+typedef struct _tapeArgs {
+    ParseInfo	pi;
+    VALUE	input;
+} *TapeArgs;
+
+static VALUE
+protect_tape_parse(VALUE ap) {
+    TapeArgs	args = (TapeArgs)ap;
+
+    oj_tape_parse(args->pi, args->input);
+
+    return Qnil;
+}
+
+// The two stage parse only handles a single document without a block.
+static bool
+use_tape(ParseInfo pi) {
+    return (0 < pi->options.release_gvl &&
+	    pi->options.release_gvl <= (size_t)(pi->end - pi->json) &&
+	    Qundef == pi->proc &&
+	    !pi->has_callbacks &&
+	    Qnil == pi->options.raw);
+}
+
 extern int oj_utf8_index;
 
 static void
@@ -974,6 +1671,7 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
     volatile VALUE	result = Qnil;
     int			line = 0;
     int			free_json = 0;
+    size_t		alloc_start;
 
     if (argc < 1) {
 	rb_raise(rb_eArgError, "Wrong number of arguments to parse.");
@@ -982,6 +1680,8 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
     if (2 <= argc) {
 	if (T_HASH == rb_type(argv[1])) {
 	    oj_parse_options(argv[1], &pi->options);
+	} else if (oj_options_class == rb_obj_class(argv[1])) {
+	    pi->options = *oj_options_load(argv[1]);
 	} else if (3 <= argc && T_HASH == rb_type(argv[2])) {
 	    oj_parse_options(argv[2], &pi->options);
 	}
@@ -994,7 +1694,7 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
     if (0 != json) {
 	pi->json = json;
 	pi->end = json + len;
-	free_json = 1;
+	free_json = !pi->mapped;
     } else if (T_STRING == rb_type(input)) {
 	if (CompatMode == pi->options.mode) {
 	    if (No == pi->options.nilnil && 0 == RSTRING_LEN(input)) {
@@ -1056,8 +1756,18 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
     // freed. We protect against this by wrapping the value stack in a ruby
     // data object and poviding a mark function for ruby objects on the
     // value stack (while it is in scope).
+    alloc_start = oj_stats_allocated();
+    OJ_PROBE2(load__start, (size_t)(pi->end - pi->json), (int)pi->options.mode);
     wrapped_stack = oj_stack_init(&pi->stack);
-    rb_protect(protect_parse, (VALUE)pi, &line);
+    if (use_tape(pi)) {
+	struct _tapeArgs	args;
+
+	args.pi = pi;
+	args.input = (T_STRING == rb_type(input)) ? input : Qnil;
+	rb_protect(protect_tape_parse, (VALUE)&args, &line);
+    } else {
+	rb_protect(protect_parse, (VALUE)pi, &line);
+    }
     if (Qundef == pi->stack.head->val && !empty_ok(&pi->options)) {
 	if (No == pi->options.nilnil || (CompatMode == pi->options.mode && 0 < pi->cur - pi->json)) {
 	    oj_set_error_at(pi, oj_json_parser_error_class, __FILE__, __LINE__, "Empty input");
@@ -1065,6 +1775,9 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
     }
     result = stack_head_val(&pi->stack);
     DATA_PTR(wrapped_stack) = 0;
+    oj_stats.loads++;
+    oj_stats.bytes_parsed += pi->end - pi->json;
+    oj_stats.objects_created += oj_stats_allocated() - alloc_start;
     if (No == pi->options.allow_gc) {
 	rb_gc_enable();
     }
@@ -1104,6 +1817,7 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
     }
 CLEANUP:
     // proceed with cleanup
+    OJ_PROBE3(load__done, (size_t)(pi->end - pi->json), (int)pi->options.mode, 0 != line || err_has(&pi->err));
     if (0 != pi->circ_array) {
 	oj_circ_array_free(pi->circ_array);
     }
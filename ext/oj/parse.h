@@ -13,8 +13,12 @@
 #include "circarray.h"
 #include "reader.h"
 #include "rxclass.h"
+#include "local.h"
 
 struct _rxClass;
+struct _tape;
+struct _onlyNode;
+struct _shape;
 
 typedef struct _numInfo {
     int64_t	i;
@@ -30,6 +34,7 @@ typedef struct _numInfo {
     int		neg;
     int		has_exp;
     int		no_big;
+    int		truncated; // digits dropped to avoid overflow
     int		bigdec_load;
 } *NumInfo;
 
@@ -66,29 +71,57 @@ typedef struct _parseInfo {
     void		(*add_cstr)(struct _parseInfo *pi, const char *str, size_t len, const char *orig);
     void		(*add_num)(struct _parseInfo *pi, NumInfo ni);
     void		(*add_value)(struct _parseInfo *pi, VALUE val);
+    void		(*add_doc)(struct _parseInfo *pi, VALUE doc); // each top-level value, used in place of proc
     VALUE		err_class;
     bool		has_callbacks;
+    bool		mapped;	// json is a file mapping released by the caller
+    struct _tape	*tape;	// recording target when parsing to a tape
+    struct _onlyNode	*only;	// root filter used in place of the :only option
+    struct _shape	*shape;	// root shape for Oj.load_shape()
+    struct _shape	*shape_next; // shape of shape_obj until its stack entry takes it
+    VALUE		shape_obj;
+    Compression		compression; // the sparse parser inflates the input as it reads
+    struct _caches	*caches; // the current Ractor's, set on first use
 } *ParseInfo;
 
+extern void	oj_scanner_init();
 extern void	oj_parse2(ParseInfo pi);
+extern const char*	oj_scan_string(const char *str, const char *end);
+extern const char*	oj_scan_white(const char *str, const char *end);
 extern void	oj_set_error_at(ParseInfo pi, VALUE err_clas, const char* file, int line, const char *format, ...);
 extern VALUE	oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yieldOk);
 extern VALUE	oj_num_as_value(NumInfo ni);
+extern void	oj_pi_add_num_str(ParseInfo pi, const char *str);
+extern VALUE	oj_calc_hash_key(ParseInfo pi, Val parent);
+extern VALUE	oj_cstr_to_value(ParseInfo pi, const char *str, size_t len);
 
 extern void	oj_set_strict_callbacks(ParseInfo pi);
+extern void	oj_set_strict_bulk_callbacks(ParseInfo pi);
 extern void	oj_set_object_callbacks(ParseInfo pi);
 extern void	oj_set_compat_callbacks(ParseInfo pi);
 extern void	oj_set_custom_callbacks(ParseInfo pi);
 extern void	oj_set_wab_callbacks(ParseInfo pi);
+extern void	oj_set_mode_callbacks(ParseInfo pi, VALUE ropts);
 
 extern void	oj_sparse2(ParseInfo pi);
 extern VALUE	oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd);
+extern VALUE	oj_pi_ndjson(int argc, VALUE *argv, ParseInfo pi, int threads, long batch_size);
 
 static inline void
 parse_info_init(ParseInfo pi) {
     memset(pi, 0, sizeof(struct _parseInfo));
 }
 
+// Returns the caches of the Ractor the parse is running on. They are looked
+// up once per parse instead of on every key.
+static inline struct _caches*
+parse_caches(ParseInfo pi) {
+    if (NULL == pi->caches) {
+	pi->caches = oj_local()->caches;
+    }
+    return pi->caches;
+}
+
 static inline bool
 empty_ok(Options options) {
     switch (options->mode) {
@@ -0,0 +1,499 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "oj.h"
+#include "err.h"
+#include "hash.h"
+#include "stats.h"
+#include "parse.h"
+
+// The push parser runs the string parser over each chunk given to feed().
+// Between tokens all of the parse state is on the value stack so the stack
+// is kept from one chunk to the next. A chunk is only parsed up to the last
+// point between tokens. The rest, a partial string, number, or comment, is
+// held and parsed with the next chunk. Each byte is scanned once to find
+// that point and parsed once.
+//
+// Values skipped by :only or loaded by :raw are read by scanning ahead to
+// their end, which can not be resumed in the next chunk, so with either
+// option a chunk is only parsed up to the end of the last complete
+// top-level value.
+
+#define BUF_SIZE	4096
+
+typedef enum {
+    SCAN_NONE		= 0,   // between tokens
+    SCAN_TOKEN		= 't', // in a number or a literal such as true
+    SCAN_STR		= 's',
+    SCAN_ESC		= 'e', // after a backslash in a string
+    SCAN_SLASH		= '/', // the start of a comment
+    SCAN_LINE		= 'l', // in a // comment
+    SCAN_BLOCK		= 'b', // in a /* comment
+    SCAN_STAR		= '*', // after a * in a /* comment
+} ScanState;
+
+typedef struct _parser {
+    struct _parseInfo	pi;
+    volatile VALUE	wrapped_stack;
+    volatile VALUE	results; // values collected when there is no block
+    char		*buf;	 // input not yet parsed
+    size_t		len;
+    size_t		size;
+    long		depth;	 // open containers at the end of buf
+    char		state;	 // ScanState at the end of buf
+    bool		started; // true once input has been fed
+    bool		whole;	 // only cut between top-level values
+} *Parser;
+
+static VALUE	oj_parser_class = Qundef;
+
+static void
+parser_mark(void *ptr) {
+    Parser	p = (Parser)ptr;
+
+    if (NULL == ptr) {
+	return;
+    }
+    rb_gc_mark(p->wrapped_stack);
+    rb_gc_mark(p->results);
+    rb_gc_mark(p->pi.options.hash_class);
+    rb_gc_mark(p->pi.options.array_class);
+    rb_gc_mark(p->pi.options.only);
+    rb_gc_mark(p->pi.options.raw);
+}
+
+// Returns true if the value has a key that is waiting for its value. The
+// key of a member that has been set is left as is by the string parser.
+inline static bool
+key_pending(Val v) {
+    return (NEXT_HASH_COLON == v->next || NEXT_HASH_VALUE == v->next) && NULL != v->key && 0 < v->klen;
+}
+
+// Frees the keys that were copied out of the input or that the string
+// parser allocated. The string parser frees them once the value is set but
+// a value never arrives after an error.
+static void
+free_pending_keys(Parser p) {
+    Val	v;
+
+    for (v = p->pi.stack.head; v < p->pi.stack.tail; v++) {
+	if (key_pending(v) && (v->key < p->buf || p->buf + p->size <= v->key)) {
+	    xfree((char*)v->key);
+	}
+	v->key = NULL;
+    }
+}
+
+static void
+parser_reset(Parser p) {
+    free_pending_keys(p);
+    stack_cleanup(&p->pi.stack);
+    oj_stack_reset(&p->pi.stack);
+    p->len = 0;
+    p->depth = 0;
+    p->state = SCAN_NONE;
+    p->started = false;
+}
+
+static void
+parser_free(void *ptr) {
+    Parser	p = (Parser)ptr;
+
+    if (NULL == ptr) {
+	return;
+    }
+    free_pending_keys(p);
+    stack_cleanup(&p->pi.stack);
+    if (Qnil != p->wrapped_stack) {
+	DATA_PTR(p->wrapped_stack) = NULL;
+    }
+    if (0 != p->pi.circ_array) {
+	oj_circ_array_free(p->pi.circ_array);
+    }
+    if (p->pi.options.str_rx.head != oj_default_options.str_rx.head) {
+	oj_rxclass_cleanup(&p->pi.options.str_rx);
+    }
+    xfree(p->buf);
+    xfree(p);
+}
+
+static void
+add_doc(ParseInfo pi, VALUE doc) {
+    Parser	p = (Parser)pi;
+
+    if (Qnil == p->results) {
+	rb_yield(doc);
+    } else {
+	rb_ary_push(p->results, doc);
+    }
+}
+
+// Scans the bytes of buf starting at start and returns the length of buf
+// that ends between tokens, or between top-level values if p->whole is set.
+static size_t
+scan(Parser p, size_t start) {
+    char	*s = p->buf + start;
+    char	*end = p->buf + p->len;
+    char	*cut = p->buf;
+    char	state = p->state;
+    long	depth = p->depth;
+    bool	whole = p->whole;
+
+    if (SCAN_NONE == state && (!whole || 0 >= depth)) {
+	cut = s;
+    }
+    for (; s < end; s++) {
+	switch (state) {
+	case SCAN_NONE:
+	case SCAN_TOKEN:
+	    switch (*s) {
+	    case '{':
+	    case '[':
+		depth++;
+		state = SCAN_NONE;
+		if (!whole) {
+		    cut = s + 1;
+		}
+		break;
+	    case '}':
+	    case ']':
+		depth--;
+		state = SCAN_NONE;
+		if (!whole || 0 >= depth) {
+		    cut = s + 1;
+		}
+		break;
+	    case ' ':
+	    case '\t':
+	    case '\f':
+	    case '\n':
+	    case '\r':
+	    case ',':
+	    case ':':
+		state = SCAN_NONE;
+		if (!whole || 0 >= depth) {
+		    cut = s + 1;
+		}
+		break;
+	    case '"':
+		state = SCAN_STR;
+		break;
+	    case '/':
+		state = SCAN_SLASH;
+		break;
+	    case '\0':
+		parser_reset(p);
+		rb_raise(oj_parse_error_class, "unexpected null character");
+		break;
+	    default:
+		state = SCAN_TOKEN;
+		break;
+	    }
+	    break;
+	case SCAN_STR:
+	    if ('"' == *s) {
+		state = SCAN_NONE;
+		if (!whole || 0 >= depth) {
+		    cut = s + 1;
+		}
+	    } else if ('\\' == *s) {
+		state = SCAN_ESC;
+	    } else if ('\0' == *s) {
+		parser_reset(p);
+		rb_raise(oj_parse_error_class, "unexpected null character");
+	    }
+	    break;
+	case SCAN_ESC:
+	    state = SCAN_STR;
+	    break;
+	case SCAN_SLASH:
+	    if ('*' == *s) {
+		state = SCAN_BLOCK;
+	    } else if ('/' == *s) {
+		state = SCAN_LINE;
+	    } else {
+		// Not a comment, the parser reports the error.
+		state = SCAN_NONE;
+		if (!whole || 0 >= depth) {
+		    cut = s;
+		}
+	    }
+	    break;
+	case SCAN_LINE:
+	    if ('\n' == *s) {
+		state = SCAN_NONE;
+		if (!whole || 0 >= depth) {
+		    cut = s + 1;
+		}
+	    }
+	    break;
+	case SCAN_BLOCK:
+	    if ('*' == *s) {
+		state = SCAN_STAR;
+	    }
+	    break;
+	case SCAN_STAR:
+	    if ('/' == *s) {
+		state = SCAN_NONE;
+		if (!whole || 0 >= depth) {
+		    cut = s + 1;
+		}
+	    } else if ('*' != *s) {
+		state = SCAN_BLOCK;
+	    }
+	    break;
+	}
+    }
+    p->state = state;
+    p->depth = depth;
+
+    return cut - p->buf;
+}
+
+static VALUE
+protect_parse(VALUE pip) {
+    oj_parse2((ParseInfo)pip);
+
+    return Qnil;
+}
+
+// Parses the first len bytes of buf, which must end between tokens, and
+// drops them from buf. There is always room in buf for the terminator.
+static void
+parse_buf(Parser p, size_t len) {
+    ParseInfo	pi = &p->pi;
+    char	*json = p->buf;
+    char	c = json[len];
+    int		line = 0;
+    size_t	alloc_start = oj_stats_allocated();
+    Val		v;
+
+    json[len] = '\0';
+    pi->json = json;
+    pi->end = json + len;
+    rb_protect(protect_parse, (VALUE)pi, &line);
+    json[len] = c;
+    oj_stats.bytes_parsed += len;
+    oj_stats.objects_created += oj_stats_allocated() - alloc_start;
+    if (err_has(&pi->err) || 0 != line) {
+	parser_reset(p);
+	if (0 != line) {
+	    rb_jump_tag(line);
+	}
+	if (Qnil != pi->err_class) {
+	    pi->err.clas = pi->err_class;
+	}
+	oj_err_raise(&pi->err);
+    }
+    // Keys of open objects still point into the buffer which is about to
+    // be reused. The string parser frees a key that is not in its input
+    // after setting the value so heap copies are used.
+    for (v = pi->stack.head; v < pi->stack.tail; v++) {
+	if (key_pending(v) && json <= v->key && v->key < json + len) {
+	    v->key = oj_strndup(v->key, v->klen);
+	}
+    }
+    p->len -= len;
+    memmove(json, json + len, p->len);
+}
+
+static void
+append(Parser p, const char *str, size_t len) {
+    if (p->size <= p->len + len) {
+	size_t	size = p->size * 2;
+
+	if (size <= p->len + len) {
+	    size = p->len + len + 1;
+	}
+	REALLOC_N(p->buf, char, size);
+	p->size = size;
+    }
+    memcpy(p->buf + p->len, str, len);
+    p->len += len;
+}
+
+/* Document-method: new
+ * call-seq: new(opts={})
+ *
+ * Creates a new push parser. JSON is given to the parser in chunks that can
+ * split the input anywhere, even in the middle of a string or number. Each
+ * complete top-level value is returned or yielded as soon as it has been
+ * read. Nothing that has been parsed is parsed again. With the :only or
+ * :raw option each top-level value is held until all of it has been fed
+ * and then parsed.
+ *
+ * - *opts* [_Hash_] load options, the same as for Oj.load
+ *
+ * Returns [_Oj::Parser_]
+ */
+static VALUE
+parser_new(int argc, VALUE *argv, VALUE self) {
+    Parser	p = ALLOC(struct _parser);
+    ParseInfo	pi = &p->pi;
+    VALUE	ropts = (1 <= argc) ? *argv : Qnil;
+
+    memset(p, 0, sizeof(struct _parser));
+    p->wrapped_stack = Qnil;
+    p->results = Qnil;
+    pi->options = oj_default_options;
+    oj_stack_reset(&pi->stack);
+    self = Data_Wrap_Struct(oj_parser_class, parser_mark, parser_free, p);
+
+    pi->handler = Qnil;
+    pi->err_class = Qnil;
+    pi->max_depth = 0;
+    if (Qnil != ropts) {
+	Check_Type(ropts, T_HASH);
+    }
+    oj_set_mode_callbacks(pi, ropts);
+    if (Qnil != ropts) {
+	oj_parse_options(ropts, &pi->options);
+    }
+    // Chunks of white space are expected so they are not an error.
+    pi->options.empty_string = Yes;
+    p->whole = (Qnil != pi->options.only || Qnil != pi->options.raw);
+    pi->proc = Qundef;
+    pi->add_doc = add_doc;
+    if (Yes == pi->options.circular) {
+	pi->circ_array = oj_circ_array_new();
+    }
+    p->wrapped_stack = oj_stack_init(&pi->stack);
+    p->size = BUF_SIZE;
+    p->buf = ALLOC_N(char, p->size);
+
+    return self;
+}
+
+/* Document-method: feed
+ * call-seq: feed(json) { |obj| ... }
+ *
+ * Parses the next chunk of JSON. Each top-level value completed by the
+ * chunk is yielded. A value that is not finished yet is kept and completed
+ * by later calls. A number at the end of the input is not known to be
+ * complete until something follows it or #finish is called.
+ *
+ * If there is an error, or the block raises, the parser is reset and the
+ * partial values are dropped.
+ *
+ * - *json* [_String_] the next chunk of the input
+ *
+ * Returns [_Array_|_nil_] the completed values when no block is given
+ */
+static VALUE
+parser_feed(VALUE self, VALUE json) {
+    Parser		p = (Parser)DATA_PTR(self);
+    volatile VALUE	results = Qnil;
+    const char		*str;
+    size_t		len;
+    size_t		start;
+    size_t		cut;
+
+    Check_Type(json, T_STRING);
+    if (!rb_block_given_p()) {
+	results = rb_ary_new();
+    }
+    p->results = results;
+    str = RSTRING_PTR(json);
+    len = RSTRING_LEN(json);
+    if (!p->started && 0 < len) {
+	p->started = true;
+	// skip UTF-8 BOM if present
+	if (3 <= len && 0xEF == (uint8_t)*str && 0xBB == (uint8_t)str[1] && 0xBF == (uint8_t)str[2]) {
+	    str += 3;
+	    len -= 3;
+	}
+    }
+    start = p->len;
+    append(p, str, len);
+    if (0 < (cut = scan(p, start))) {
+	parse_buf(p, cut);
+    }
+    p->results = Qnil;
+
+    return results;
+}
+
+/* Document-method: finish
+ * call-seq: finish() { |obj| ... }
+ *
+ * Parses what is left of the input as the end of the input. An error is
+ * raised if a value was not completed. The parser can then be used for the
+ * next input.
+ *
+ * Returns [_Array_|_nil_] the completed values when no block is given
+ */
+static VALUE
+parser_finish(VALUE self) {
+    Parser		p = (Parser)DATA_PTR(self);
+    volatile VALUE	results = Qnil;
+    const char		*msg = NULL;
+    Val			v;
+
+    if (!rb_block_given_p()) {
+	results = rb_ary_new();
+    }
+    p->results = results;
+    if (0 < p->len) {
+	parse_buf(p, p->len);
+    }
+    p->results = Qnil;
+    if (NULL != (v = stack_peek(&p->pi.stack))) {
+	switch (v->next) {
+	case NEXT_ARRAY_NEW:
+	case NEXT_ARRAY_ELEMENT:
+	case NEXT_ARRAY_COMMA:
+	    msg = "Array not terminated";
+	    break;
+	case NEXT_HASH_NEW:
+	case NEXT_HASH_KEY:
+	case NEXT_HASH_COLON:
+	case NEXT_HASH_VALUE:
+	case NEXT_HASH_COMMA:
+	    msg = "Hash/Object not terminated";
+	    break;
+	default:
+	    msg = "not terminated";
+	    break;
+	}
+    }
+    parser_reset(p);
+    if (NULL != msg) {
+	rb_raise(oj_parse_error_class, "%s", msg);
+    }
+    return results;
+}
+
+/* Document-method: reset
+ * call-seq: reset()
+ *
+ * Drops any partial input and values so the parser can be used for new
+ * input.
+ */
+static VALUE
+parser_reset_m(VALUE self) {
+    parser_reset((Parser)DATA_PTR(self));
+
+    return Qnil;
+}
+
+/* Document-class: Oj::Parser
+ *
+ * A push parser for JSON that arrives in pieces such as from a socket. The
+ * pieces are given to #feed and each complete top-level value is yielded.
+ *
+ *   parser = Oj::Parser.new(mode: :strict)
+ *   parser.feed('{"a":[1,') { |obj| p obj }
+ *   parser.feed('2]}{"b"') { |obj| p obj } # prints {"a"=>[1, 2]}
+ *   parser.feed(':3}') { |obj| p obj }      # prints {"b"=>3}
+ */
+void
+oj_parser_init() {
+    oj_parser_class = rb_define_class_under(Oj, "Parser", rb_cObject);
+    rb_undef_alloc_func(oj_parser_class);
+    rb_define_module_function(oj_parser_class, "new", parser_new, -1);
+    rb_define_method(oj_parser_class, "feed", parser_feed, 1);
+    rb_define_method(oj_parser_class, "finish", parser_finish, 0);
+    rb_define_method(oj_parser_class, "reset", parser_reset_m, 0);
+}
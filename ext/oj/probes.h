@@ -0,0 +1,30 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_PROBES_H
+#define OJ_PROBES_H
+
+// Static USDT probes for bpftrace, SystemTap, and perf. They are compiled in
+// when the SystemTap sys/sdt.h is found and cost only a nop when no tracer is
+// attached. With bpftrace the probes are usdt:<path to oj.so>:oj:<name>.
+//
+//   load__start	bytes (0 if read from a stream), mode
+//   load__done		bytes, mode, true if an error was raised
+//   dump__start	mode
+//   dump__done		bytes, mode
+//   stream__flush	bytes written by a StreamWriter
+//   reader__refill	bytes read into the stream reader buffer
+#ifdef OJ_USDT
+#include <sys/sdt.h>
+
+#define OJ_PROBE1(name, a)		DTRACE_PROBE1(oj, name, a)
+#define OJ_PROBE2(name, a, b)		DTRACE_PROBE2(oj, name, a, b)
+#define OJ_PROBE3(name, a, b, c)	DTRACE_PROBE3(oj, name, a, b, c)
+#else
+// The arguments are still referenced so they are checked and do not leave
+// unused variables behind. They have no side effects and compile away.
+#define OJ_PROBE1(name, a)		(void)(a)
+#define OJ_PROBE2(name, a, b)		(void)(a), (void)(b)
+#define OJ_PROBE3(name, a, b, c)	(void)(a), (void)(b), (void)(c)
+#endif
+
+#endif /* OJ_PROBES_H */
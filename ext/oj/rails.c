@@ -4,6 +4,8 @@
 #include "encode.h"
 #include "code.h"
 #include "encode.h"
+#include "local.h"
+#include "stats.h"
 #include "trace.h"
 #include "util.h"
 
@@ -23,6 +25,8 @@ bool	oj_rails_float_opt = false;
 extern void	oj_mimic_json_methods(VALUE json);
 
 static void	dump_rails_val(VALUE obj, int depth, Out out, bool as_ok);
+static int	hash_cb(VALUE key, VALUE value, VALUE ov);
+static void	dump_hash_close(Out out, int depth);
 
 extern VALUE	Oj;
 
@@ -30,6 +34,7 @@ static struct _rOptTable	ropts = { 0, 0, NULL };
 
 static VALUE	encoder_class = Qnil;
 static bool	escape_html = true;
+static uint32_t	ropt_gen = 1; // changed whenever an optimize table changes
 static bool	xml_time = true;
 
 static ROpt	create_opt(ROptTable rot, VALUE clas);
@@ -224,11 +229,8 @@ dump_bigdecimal(VALUE obj, int depth, Out out, bool as_ok) {
 static void
 dump_sec_nano(VALUE obj, int64_t sec, long nsec, Out out) {
     char		buf[64];
-    struct _timeInfo	ti;
     long		one = 1000000000;
     long		tzsecs = NUM2LONG(rb_funcall2(obj, oj_utc_offset_id, 0, 0));
-    int			tzhour, tzmin;
-    char		tzsign = '+';
     int			len;
 
     if (out->end - out->cur <= 36) {
@@ -249,41 +251,25 @@ dump_sec_nano(VALUE obj, int64_t sec, long nsec, Out out) {
     }
     // 2012-01-05T23:58:07.123456000+09:00 or 2012/01/05 23:58:07 +0900
     sec += tzsecs;
-    sec_as_time(sec, &ti);
-    if (0 > tzsecs) {
-        tzsign = '-';
-        tzhour = (int)(tzsecs / -3600);
-        tzmin = (int)(tzsecs / -60) - (tzhour * 60);
-    } else {
-        tzhour = (int)(tzsecs / 3600);
-        tzmin = (int)(tzsecs / 60) - (tzhour * 60);
-    }
     if (!xml_time) {
-	len = sprintf(buf, "%04d/%02d/%02d %02d:%02d:%02d %c%02d%02d", ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec, tzsign, tzhour, tzmin);
-    } else if (0 == out->opts->sec_prec) {
-	if (0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0)) {
-	    len = sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02dZ", ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec);
+	struct _timeInfo	ti;
+	int			tzhour, tzmin;
+	char			tzsign = '+';
+
+	sec_as_time(sec, &ti);
+	if (0 > tzsecs) {
+	    tzsign = '-';
+	    tzhour = (int)(tzsecs / -3600);
+	    tzmin = (int)(tzsecs / -60) - (tzhour * 60);
 	} else {
-	    len = sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02d%c%02d:%02d", ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec, tzsign, tzhour, tzmin);
-	}
-    } else if (0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0)) {
-	char	format[64] = "%04d-%02d-%02dT%02d:%02d:%02d.%09ldZ";
-
-	len = 30;
-	if (9 > out->opts->sec_prec) {
-	    format[32] = '0' + out->opts->sec_prec;
-	    len -= 9 - out->opts->sec_prec;
+	    tzhour = (int)(tzsecs / 3600);
+	    tzmin = (int)(tzsecs / 60) - (tzhour * 60);
 	}
-	len = sprintf(buf, format, ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec, nsec);
+	len = sprintf(buf, "%04d/%02d/%02d %02d:%02d:%02d %c%02d%02d", ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec, tzsign, tzhour, tzmin);
     } else {
-	char	format[64] = "%04d-%02d-%02dT%02d:%02d:%02d.%09ld%c%02d:%02d";
+	int	prec = 9 > out->opts->sec_prec ? out->opts->sec_prec : 9;
 
-	len = 35;
-	if (9 > out->opts->sec_prec) {
-	    format[32] = '0' + out->opts->sec_prec;
-	    len -= 9 - out->opts->sec_prec;
-	}
-	len = sprintf(buf, format, ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec, nsec, tzsign, tzhour, tzmin);
+	len = oj_xml_time_str(buf, sec, nsec, prec, tzsecs, 0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0));
     }
     oj_dump_cstr(buf, len, 0, 0, out);
 }
@@ -310,11 +296,29 @@ dump_time(VALUE obj, int depth, Out out, bool as_ok) {
     dump_sec_nano(obj, sec, nsec, out);
 }
 
+static ID	utc_ivar_id = 0;
+
+// The UTC Time a TimeWithZone wraps is read directly and only the offset is
+// asked of the TimeWithZone itself.
 static void
 dump_timewithzone(VALUE obj, int depth, Out out, bool as_ok) {
-    int64_t	sec = NUM2LONG(rb_funcall2(obj, oj_tv_sec_id, 0, 0));
-    long long	nsec = 0;
+    int64_t		sec;
+    long long		nsec = 0;
+#ifdef HAVE_RB_TIME_TIMESPEC
+    volatile VALUE	utc;
 
+    if (0 == utc_ivar_id) {
+	utc_ivar_id = rb_intern("@utc");
+    }
+    utc = rb_attr_get(obj, utc_ivar_id);
+    if (16 <= sizeof(struct timespec) && rb_cTime == rb_obj_class(utc)) {
+	struct timespec	ts = rb_time_timespec(utc);
+
+	dump_sec_nano(obj, (int64_t)ts.tv_sec, ts.tv_nsec, out);
+	return;
+    }
+#endif
+    sec = NUM2LONG(rb_funcall2(obj, oj_tv_sec_id, 0, 0));
     if (rb_respond_to(obj, oj_tv_nsec_id)) {
 	nsec = rb_num2ll(rb_funcall2(obj, oj_tv_nsec_id, 0, 0));
     } else if (rb_respond_to(obj, oj_tv_usec_id)) {
@@ -327,16 +331,12 @@ static void
 dump_to_s(VALUE obj, int depth, Out out, bool as_ok) {
     volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
+    oj_stats.to_s_calls++;
     oj_dump_cstr(rb_string_value_ptr((VALUE*)&rstr), (int)RSTRING_LEN(rstr), 0, 0, out);
 }
 
 static ID	parameters_id = 0;
 
-typedef struct _strLen {
-    const char	*str;
-    int		len;
-} *StrLen;
-
 static void
 dump_actioncontroller_parameters(VALUE obj, int depth, Out out, bool as_ok) {
     if (0 == parameters_id) {
@@ -346,37 +346,47 @@ dump_actioncontroller_parameters(VALUE obj, int depth, Out out, bool as_ok) {
     dump_rails_val(rb_ivar_get(obj, parameters_id), depth, out, true);
 }
 
-static StrLen
-columns_array(VALUE rcols, int *ccnt) {
-    volatile VALUE	v;
-    StrLen		cp;
-    StrLen		cols;
-    int			i;
-    int			cnt = (int)RARRAY_LEN(rcols);
-
-    *ccnt = cnt;
-    cols = ALLOC_N(struct _strLen, cnt);
-    for (i = 0, cp = cols; i < cnt; i++, cp++) {
-	v = rb_ary_entry(rcols, i);
-	if (T_STRING != rb_type(v)) {
-	    v = rb_funcall(v, oj_to_s_id, 0);
+// Returns the column names as an Array of Strings. The names are the keys
+// of every row so they are dumped with the key cache in the Out.
+static VALUE
+column_names(VALUE rcols) {
+    volatile VALUE	cols = rcols;
+    long		cnt = RARRAY_LEN(rcols);
+    long		i;
+
+    for (i = 0; i < cnt; i++) {
+	if (T_STRING != rb_type(rb_ary_entry(rcols, i))) {
+	    break;
+	}
+    }
+    if (i < cnt) {
+	cols = rb_ary_new_capa(cnt);
+	for (i = 0; i < cnt; i++) {
+	    VALUE	v = rb_ary_entry(rcols, i);
+
+	    if (T_STRING != rb_type(v)) {
+		v = rb_funcall(v, oj_to_s_id, 0);
+	    }
+	    rb_ary_push(cols, v);
 	}
-	cp->str = StringValuePtr(v);
-	cp->len = (int)RSTRING_LEN(v);
     }
     return cols;
 }
 
 static void
-dump_row(VALUE row, StrLen cols, int ccnt, int depth, Out out) {
+dump_row(VALUE row, VALUE cols, int ccnt, int depth, Out out) {
     size_t	size;
     int		d2 = depth + 1;
     int		i;
 
     assure_size(out, 2);
     *out->cur++ = '{';
-    size = depth * out->indent + 3;
-    for (i = 0; i < ccnt; i++, cols++) {
+    if (out->opts->dump_opts.use) {
+	size = d2 * out->opts->dump_opts.indent_size + out->opts->dump_opts.array_size + 3;
+    } else {
+	size = depth * out->indent + 3;
+    }
+    for (i = 0; i < ccnt; i++) {
 	assure_size(out, size);
 	if (out->opts->dump_opts.use) {
 	    if (0 < out->opts->dump_opts.array_size) {
@@ -393,14 +403,18 @@ dump_row(VALUE row, StrLen cols, int ccnt, int depth, Out out) {
 	} else {
 	    fill_indent(out, d2);
 	}
-	oj_dump_cstr(cols->str, cols->len, 0, 0, out);
+	oj_dump_key(rb_ary_entry(cols, i), out);
 	*out->cur++ = ':';
 	dump_rails_val(rb_ary_entry(row, i), depth, out, true);
 	if (i < ccnt - 1) {
 	    *out->cur++ = ',';
 	}
     }
-    size = depth * out->indent + 1;
+    if (out->opts->dump_opts.use) {
+	size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.array_size + 1;
+    } else {
+	size = depth * out->indent + 1;
+    }
     assure_size(out, size);
     if (out->opts->dump_opts.use) {
 	if (0 < out->opts->dump_opts.array_size) {
@@ -427,7 +441,7 @@ static ID	columns_id = 0;
 static void
 dump_activerecord_result(VALUE obj, int depth, Out out, bool as_ok) {
     volatile VALUE	rows;
-    StrLen		cols;
+    volatile VALUE	cols;
     int			ccnt = 0;
     int			i, rcnt;
     size_t		size;
@@ -438,7 +452,8 @@ dump_activerecord_result(VALUE obj, int depth, Out out, bool as_ok) {
 	columns_id = rb_intern("@columns");
     }
     out->argc = 0;
-    cols = columns_array(rb_ivar_get(obj, columns_id), &ccnt);
+    cols = column_names(rb_ivar_get(obj, columns_id));
+    ccnt = (int)RARRAY_LEN(cols);
     rows = rb_ivar_get(obj, rows_id);
     rcnt = (int)RARRAY_LEN(rows);
     assure_size(out, 2);
@@ -471,8 +486,11 @@ dump_activerecord_result(VALUE obj, int depth, Out out, bool as_ok) {
 	    *out->cur++ = ',';
 	}
     }
-    xfree(cols);
-    size = depth * out->indent + 1;
+    if (out->opts->dump_opts.use) {
+	size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.array_size + 1;
+    } else {
+	size = depth * out->indent + 1;
+    }
     assure_size(out, size);
     if (out->opts->dump_opts.use) {
 	if (0 < out->opts->dump_opts.array_size) {
@@ -514,6 +532,7 @@ dump_as_json(VALUE obj, int depth, Out out, bool as_ok) {
     if (Yes == out->opts->trace) {
 	oj_trace("as_json", obj, __FILE__, __LINE__, depth + 1, TraceRubyIn);
     }
+    oj_stats.as_json_calls++;
     // Some classes elect to not take an options argument so check the arity
     // of as_json.
     if (0 == rb_obj_method_arity(obj, oj_as_json_id)) {
@@ -564,14 +583,104 @@ static struct _namedFunc	dump_map[] = {
 
 static VALUE	activerecord_base = Qundef;
 static ID	attributes_id = 0;
+static ID	fetch_value_id = 0;
+static ID	keys_id = 0;
+static VALUE	except_sym = Qundef;
+static VALUE	include_sym = Qundef;
+static VALUE	methods_sym = Qundef;
+static VALUE	only_sym = Qundef;
+
+// Returns the :only or :except names as an Array of Strings or Qnil.
+static VALUE
+attr_names_opt(VALUE v) {
+    volatile VALUE	names;
+    long		i;
+
+    if (Qnil == v || Qfalse == v) {
+	return Qnil;
+    }
+    if (T_ARRAY != rb_type(v)) {
+	v = rb_ary_new_from_args(1, v);
+    }
+    names = rb_ary_new_capa(RARRAY_LEN(v));
+    for (i = 0; i < RARRAY_LEN(v); i++) {
+	rb_ary_push(names, rb_funcall(rb_ary_entry(v, i), oj_to_s_id, 0));
+    }
+    return names;
+}
 
+static bool
+attr_name_in(VALUE names, VALUE name) {
+    long	i;
+
+    for (i = RARRAY_LEN(names) - 1; 0 <= i; i--) {
+	if (Qtrue == rb_str_equal(rb_ary_entry(names, i), name)) {
+	    return true;
+	}
+    }
+    return false;
+}
+
+// Dumps a record from its attribute set without building the Hash that
+// as_json builds. The values are the type cast values the attribute set
+// holds and the :only and :except options are applied as serializable_hash
+// applies them. The :include and :methods options need the model so those
+// still go through as_json. Before Rails 4.2 the attributes were a Hash
+// and that is dumped as is.
 static void
 dump_activerecord(VALUE obj, int depth, Out out, bool as_ok) {
+    volatile VALUE	attrs;
+    volatile VALUE	names;
+    volatile VALUE	only = Qnil;
+    volatile VALUE	except = Qnil;
+    long		cnt;
+    long		i;
+
     if (0 == attributes_id) {
 	attributes_id = rb_intern("@attributes");
+	fetch_value_id = rb_intern("fetch_value");
+	keys_id = rb_intern("keys");
+	except_sym = ID2SYM(rb_intern("except"));	rb_gc_register_address(&except_sym);
+	include_sym = ID2SYM(rb_intern("include"));	rb_gc_register_address(&include_sym);
+	methods_sym = ID2SYM(rb_intern("methods"));	rb_gc_register_address(&methods_sym);
+	only_sym = ID2SYM(rb_intern("only"));		rb_gc_register_address(&only_sym);
+    }
+    if (0 < out->argc && T_HASH == rb_type(*out->argv)) {
+	VALUE	opts = *out->argv;
+
+	if (as_ok && (Qnil != rb_hash_lookup(opts, include_sym) || Qnil != rb_hash_lookup(opts, methods_sym))) {
+	    dump_as_json(obj, depth, out, false);
+	    return;
+	}
+	if (Qnil == (only = attr_names_opt(rb_hash_lookup(opts, only_sym)))) {
+	    except = attr_names_opt(rb_hash_lookup(opts, except_sym));
+	}
     }
     out->argc = 0;
-    dump_rails_val(rb_ivar_get(obj, attributes_id), depth, out, true);
+    attrs = rb_ivar_get(obj, attributes_id);
+    if (T_HASH == rb_type(attrs) || !rb_respond_to(attrs, fetch_value_id)) {
+	dump_rails_val(attrs, depth, out, true);
+	return;
+    }
+    names = rb_funcall(attrs, keys_id, 0);
+    cnt = RARRAY_LEN(names);
+    assure_size(out, 2);
+    *out->cur++ = '{';
+    for (i = 0; i < cnt; i++) {
+	VALUE	name = rb_ary_entry(names, i);
+
+	if ((Qnil != only && !attr_name_in(only, name)) || (Qnil != except && attr_name_in(except, name))) {
+	    continue;
+	}
+	out->depth = depth + 1;
+	hash_cb(name, rb_funcall(attrs, fetch_value_id, 1, name), (VALUE)out);
+    }
+    if ('{' == *(out->cur - 1)) {
+	*out->cur++ = '}';
+    } else {
+	dump_hash_close(out, depth);
+    }
+    *out->cur = '\0';
 }
 
 static ROpt
@@ -605,6 +714,7 @@ create_opt(ROptTable rot, VALUE clas) {
 	    }
 	}
     }
+    ropt_gen++;
     ro->clas = clas;
     ro->on = true;
     ro->dump = dump_obj_attrs;
@@ -723,6 +833,7 @@ static void
 optimize(int argc, VALUE *argv, ROptTable rot, bool on) {
     ROpt	ro;
 
+    ropt_gen++;
     if (0 == argc) {
 	int		i;
 	NamedFunc	nf;
@@ -794,6 +905,7 @@ encoder_optimize(int argc, VALUE *argv, VALUE self) {
  */
 static VALUE
 rails_optimize(int argc, VALUE *argv, VALUE self) {
+    oj_main_ractor_check("Oj::Rails.optimize");
     optimize(argc, argv, &ropts, true);
     string_writer_optimized = true;
 
@@ -810,6 +922,7 @@ VALUE
 rails_mimic_json(VALUE self) {
     VALUE	json;
 
+    oj_main_ractor_check("Oj::Rails.mimic_JSON");
     if (rb_const_defined_at(rb_cObject, rb_intern("JSON"))) {
 	json = rb_const_get_at(rb_cObject, rb_intern("JSON"));
     } else {
@@ -846,6 +959,7 @@ encoder_deoptimize(int argc, VALUE *argv, VALUE self) {
  */
 static VALUE
 rails_deoptimize(int argc, VALUE *argv, VALUE self) {
+    oj_main_ractor_check("Oj::Rails.deoptimize");
     optimize(argc, argv, &ropts, false);
     string_writer_optimized = false;
 
@@ -921,6 +1035,8 @@ encode(VALUE obj, ROptTable ropts, Options opts, int argc, VALUE *argv) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts.dump_opts.omit_nil;
     out.caller = 0;
     out.cur = out.buf;
@@ -931,9 +1047,11 @@ encode(VALUE obj, ROptTable ropts, Options opts, int argc, VALUE *argv) {
     out.argc = argc;
     out.argv = argv;
     out.ropts = ropts;
-    if (Yes == copts.circular) {
-	oj_cache8_new(&out.circ_cache);
-    }
+    out.circ_slots = NULL;
+    out.circ_mask = 0;
+    out.key_used = 0;
+    out.ropt_used = 0;
+    out.tj_used = 0;
     //dump_rails_val(*argv, 0, &out, true);
     rb_protect(protect_dump, (VALUE)&oo, &line);
 
@@ -953,12 +1071,12 @@ encode(VALUE obj, ROptTable ropts, Options opts, int argc, VALUE *argv) {
 	if (0 == out.buf) {
 	    rb_raise(rb_eNoMemError, "Not enough memory.");
 	}
+	oj_stats.dumps++;
+	oj_stats.bytes_dumped += out.cur - out.buf;
 	rstr = rb_str_new2(out.buf);
 	rstr = oj_encode(rstr);
     }
-    if (Yes == copts.circular) {
-	oj_cache8_delete(out.circ_cache);
-    }
+    oj_circ_cleanup(&out);
     if (out.allocated) {
 	xfree(out.buf);
     }
@@ -1011,6 +1129,7 @@ rails_encode(int argc, VALUE *argv, VALUE self) {
 
 static VALUE
 rails_use_standard_json_time_format(VALUE self, VALUE state) {
+    oj_main_ractor_check("ActiveSupport.use_standard_json_time_format=");
     if (Qtrue == state || Qfalse == state) {
 	// no change needed
     } else if (Qnil == state) {
@@ -1031,6 +1150,7 @@ rails_use_standard_json_time_format_get(VALUE self) {
 
 static VALUE
 rails_escape_html_entities_in_json(VALUE self, VALUE state) {
+    oj_main_ractor_check("ActiveSupport.escape_html_entities_in_json=");
     rb_iv_set(self, "@escape_html_entities_in_json", state);
     escape_html = Qtrue == state;
 
@@ -1044,6 +1164,7 @@ rails_escape_html_entities_in_json_get(VALUE self) {
 
 static VALUE
 rails_time_precision(VALUE self, VALUE prec) {
+    oj_main_ractor_check("ActiveSupport::JSON::Encoding.time_precision=");
     rb_iv_set(self, "@time_precision", prec);
     oj_default_options.sec_prec = NUM2INT(prec);
     oj_default_options.sec_prec_set = true;
@@ -1067,6 +1188,7 @@ rails_set_encoder(VALUE self) {
     VALUE	verbose;
     VALUE	enc = resolve_classpath("ActiveSupport::JSON::Encoding");
 
+    oj_main_ractor_check("Oj::Rails.set_encoder");
     if (Qnil != enc) {
 	escape_html = Qtrue == rb_iv_get(self, "@escape_html_entities_in_json");
 	xml_time = Qtrue == rb_iv_get(enc, "@use_standard_json_time_format");
@@ -1119,6 +1241,7 @@ rails_set_decoder(VALUE self) {
     VALUE	json_error;
     VALUE	verbose;
 
+    oj_main_ractor_check("Oj::Rails.set_decoder");
     if (rb_const_defined_at(rb_cObject, rb_intern("JSON"))) {
 	json = rb_const_get_at(rb_cObject, rb_intern("JSON"));
     } else {
@@ -1152,6 +1275,7 @@ rails_set_decoder(VALUE self) {
  */
 VALUE
 oj_optimize_rails(VALUE self) {
+    oj_main_ractor_check("Oj.optimize_rails");
     rails_set_encoder(self);
     rails_set_decoder(self);
     rails_optimize(0, NULL, self);
@@ -1213,6 +1337,8 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
 	if (isnan(d) || OJ_INFINITY == d || -OJ_INFINITY == d) {
 	    strcpy(buf, "null");
 	    cnt = 4;
+	} else if (ShortestFloat == out->opts->float_engine) {
+	    cnt = oj_dump_float_shortest(d, buf);
 	} else if (d == (double)(long long int)d) {
 	    cnt = snprintf(buf, sizeof(buf), "%.1f", d);
 	} else if (oj_rails_float_opt) {
@@ -1220,6 +1346,7 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
 	} else {
 	    volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
+	    oj_stats.to_s_calls++;
 	    strcpy(buf, rb_string_value_ptr((VALUE*)&rstr));
 	    cnt = (int)RSTRING_LEN(rstr);
 	}
@@ -1283,7 +1410,11 @@ dump_array(VALUE a, int depth, Out out, bool as_ok) {
 		*out->cur++ = ',';
 	    }
 	}
-	size = depth * out->indent + 1;
+	if (out->opts->dump_opts.use) {
+	    size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.array_size + 1;
+	} else {
+	    size = depth * out->indent + 1;
+	}
 	assure_size(out, size);
 	if (out->opts->dump_opts.use) {
 	    if (0 < out->opts->dump_opts.array_size) {
@@ -1318,17 +1449,12 @@ hash_cb(VALUE key, VALUE value, VALUE ov) {
     }
     if (rtype != T_STRING && rtype != T_SYMBOL) {
 	key = rb_funcall(key, oj_to_s_id, 0);
-	rtype = rb_type(key);
     }
     if (!out->opts->dump_opts.use) {
 	size = depth * out->indent + 1;
 	assure_size(out, size);
 	fill_indent(out, depth);
-	if (rtype == T_STRING) {
-	    oj_dump_str(key, 0, out, false);
-	} else {
-	    oj_dump_sym(key, 0, out, false);
-	}
+	oj_dump_key(key, out);
 	*out->cur++ = ':';
     } else {
 	size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.hash_size + 1;
@@ -1344,11 +1470,7 @@ hash_cb(VALUE key, VALUE value, VALUE ov) {
 		out->cur += out->opts->dump_opts.indent_size;
 	    }
 	}
-	if (rtype == T_STRING) {
-	    oj_dump_str(key, 0, out, false);
-	} else {
-	    oj_dump_sym(key, 0, out, false);
-	}
+	oj_dump_key(key, out);
 	size = out->opts->dump_opts.before_size + out->opts->dump_opts.after_size + 2;
 	assure_size(out, size);
 	if (0 < out->opts->dump_opts.before_size) {
@@ -1368,10 +1490,40 @@ hash_cb(VALUE key, VALUE value, VALUE ov) {
     return ST_CONTINUE;
 }
 
+// Writes the end of a Hash after the members have been written with
+// hash_cb.
+static void
+dump_hash_close(Out out, int depth) {
+    size_t	size = depth * out->indent + 2;
+
+    if (',' == *(out->cur - 1)) {
+	out->cur--; // backup to overwrite last comma
+    }
+    if (!out->opts->dump_opts.use) {
+	assure_size(out, size);
+	fill_indent(out, depth);
+    } else {
+	size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.hash_size + 1;
+	assure_size(out, size);
+	if (0 < out->opts->dump_opts.hash_size) {
+	    strcpy(out->cur, out->opts->dump_opts.hash_nl);
+	    out->cur += out->opts->dump_opts.hash_size;
+	}
+	if (0 < out->opts->dump_opts.indent_size) {
+	    int	i;
+
+	    for (i = depth; 0 < i; i--) {
+		strcpy(out->cur, out->opts->dump_opts.indent_str);
+		out->cur += out->opts->dump_opts.indent_size;
+	    }
+	}
+    }
+    *out->cur++ = '}';
+}
+
 static void
 dump_hash(VALUE obj, int depth, Out out, bool as_ok) {
     int		cnt;
-    size_t	size;
 
     if (Yes == out->opts->circular) {
 	if (0 > oj_check_circular(obj, out)) {
@@ -1384,7 +1536,6 @@ dump_hash(VALUE obj, int depth, Out out, bool as_ok) {
 	return;
     }
     cnt = (int)RHASH_SIZE(obj);
-    size = depth * out->indent + 2;
     assure_size(out, 2);
     *out->cur++ = '{';
     if (0 == cnt) {
@@ -1392,47 +1543,55 @@ dump_hash(VALUE obj, int depth, Out out, bool as_ok) {
     } else {
 	out->depth = depth + 1;
 	rb_hash_foreach(obj, hash_cb, (VALUE)out);
-	if (',' == *(out->cur - 1)) {
-	    out->cur--; // backup to overwrite last comma
-	}
-	if (!out->opts->dump_opts.use) {
-	    assure_size(out, size);
-	    fill_indent(out, depth);
-	} else {
-	    size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.hash_size + 1;
-	    assure_size(out, size);
-	    if (0 < out->opts->dump_opts.hash_size) {
-		strcpy(out->cur, out->opts->dump_opts.hash_nl);
-		out->cur += out->opts->dump_opts.hash_size;
-	    }
-	    if (0 < out->opts->dump_opts.indent_size) {
-		int	i;
-
-		for (i = depth; 0 < i; i--) {
-		    strcpy(out->cur, out->opts->dump_opts.indent_str);
-		    out->cur += out->opts->dump_opts.indent_size;
-		}
-	    }
-	}
-	*out->cur++ = '}';
+	dump_hash_close(out, depth);
     }
     *out->cur = '\0';
 }
 
+// Returns the optimized dump function for the class or NULL if the class is
+// not optimized. Either answer is kept in the Out so the table is searched
+// once per class for each dump.
+static DumpFunc
+ropt_dump_func(Out out, VALUE clas) {
+    uint32_t	i = (uint32_t)(((uint64_t)clas * 0x9E3779B97F4A7C15ULL) >> (64 - ROPT_CACHE_BITS));
+    uint16_t	bit = (uint16_t)(1 << i);
+    ROptSlot	slot = out->ropt_slots + i;
+    ROpt	ro;
+
+    if (ropt_gen != out->ropt_gen) {
+	out->ropt_gen = ropt_gen;
+	out->ropt_used = 0;
+    } else if ((out->ropt_used & bit) && clas == slot->clas) {
+	return slot->dump;
+    }
+    slot->clas = clas;
+    if (NULL != (ro = oj_rails_get_opt(out->ropts, clas)) && ro->on) {
+	slot->dump = ro->dump;
+    } else {
+	slot->dump = NULL;
+    }
+    out->ropt_used |= bit;
+
+    return slot->dump;
+}
+
 static void
 dump_obj(VALUE obj, int depth, Out out, bool as_ok) {
-    VALUE	clas;
+    VALUE	clas = rb_obj_class(obj);
 
+    if (oj_raw_json_class == clas) {
+	oj_dump_raw_json(obj, depth, out);
+	return;
+    }
     if (oj_code_dump(oj_compat_codes, obj, depth, out)) {
 	out->argc = 0;
 	return;
     }
-    clas = rb_obj_class(obj);
     if (as_ok) {
-	ROpt	ro;
+	DumpFunc	dump;
 
-	if (NULL != (ro = oj_rails_get_opt(out->ropts, clas)) && ro->on) {
-	    ro->dump(obj, depth, out, as_ok);
+	if (NULL != (dump = ropt_dump_func(out, clas))) {
+	    dump(obj, depth, out, as_ok);
 	} else if (Yes == out->opts->raw_json && rb_respond_to(obj, oj_raw_json_id)) {
 	    oj_dump_raw_json(obj, depth, out);
 	} else if (rb_respond_to(obj, oj_as_json_id)) {
@@ -1517,8 +1676,14 @@ oj_dump_rails_val(VALUE obj, int depth, Out out) {
     out->opts->str_rx.head = NULL;
     out->opts->str_rx.tail = NULL;
     if (escape_html) {
+	if (RailsXEsc != out->opts->escape_mode) {
+	    out->key_used = 0;
+	}
 	out->opts->escape_mode = RailsXEsc;
     } else {
+	if (RailsEsc != out->opts->escape_mode) {
+	    out->key_used = 0;
+	}
 	out->opts->escape_mode = RailsEsc;
     }
     dump_rails_val(obj, depth, out, true);
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/types.h>
 #if NEEDS_UIO
@@ -14,6 +15,8 @@
 #include "ruby.h"
 #include "oj.h"
 #include "reader.h"
+#include "probes.h"
+#include "stats.h"
 
 #define BUF_PAD	4
 
@@ -25,8 +28,35 @@ static int		read_from_fd(Reader reader);
 static int		read_from_io_partial(Reader reader);
 //static int		read_from_str(Reader reader);
 
+// Starts with a heap buffer if the requested size is larger than the one
+// embedded in the reader.
+static void
+buf_init(Reader reader, size_t size) {
+    if (sizeof(reader->base) < size) {
+	reader->head = ALLOC_N(char, size);
+	*((char*)reader->head) = '\0';
+	reader->end = reader->head + size - BUF_PAD;
+	reader->tail = reader->head;
+	reader->read_end = reader->head;
+	reader->free_head = 1;
+    }
+}
+
+// Ruby IO objects can read into a String passed as the second argument so
+// one String is reused for all the reads instead of a new one each time.
+// Other objects that respond to read() or readpartial() may not accept the
+// extra argument.
+static void
+io_init(Reader reader, VALUE io, size_t size) {
+    reader->io = io;
+    buf_init(reader, size);
+    if (Qtrue == rb_obj_is_kind_of(io, rb_cIO)) {
+	reader->rbuf = rb_str_buf_new(reader->end - reader->head);
+    }
+}
+
 void
-oj_reader_init(Reader reader, VALUE io, int fd, bool to_s) {
+oj_reader_init(Reader reader, VALUE io, int fd, bool to_s, size_t size) {
     VALUE	io_class = rb_obj_class(io);
     VALUE	stat;
     VALUE	ftype;
@@ -38,14 +68,17 @@ oj_reader_init(Reader reader, VALUE io, int fd, bool to_s) {
     reader->read_end = reader->head;
     reader->pro = 0;
     reader->str = 0;
-    reader->pos = 0;
-    reader->line = 1;
-    reader->col = 0;
+    reader->head_pos = 0;
+    reader->head_line = 1;
+    reader->head_col = 0;
     reader->free_head = 0;
+    reader->rbuf = Qnil;
+    reader->inflater = 0;
 
     if (0 != fd) {
 	reader->read_func = read_from_fd;
 	reader->fd = fd;
+	buf_init(reader, size);
     } else if (rb_cString == io_class) {
 	reader->read_func = 0;
 	reader->in_str = StringValuePtr(io);
@@ -67,12 +100,13 @@ oj_reader_init(Reader reader, VALUE io, int fd, bool to_s) {
 	       0 == FIX2INT(rb_funcall(io, oj_pos_id, 0))) {
 	reader->read_func = read_from_fd;
 	reader->fd = FIX2INT(rb_funcall(io, oj_fileno_id, 0));
+	buf_init(reader, size);
     } else if (rb_respond_to(io, oj_readpartial_id)) {
 	reader->read_func = read_from_io_partial;
-	reader->io = io;
+	io_init(reader, io, size);
     } else if (rb_respond_to(io, oj_read_id)) {
 	reader->read_func = read_from_io;
-	reader->io = io;
+	io_init(reader, io, size);
     } else if (to_s) {
 	volatile VALUE	rstr = rb_funcall(io, oj_to_s_id, 0);
 
@@ -86,10 +120,51 @@ oj_reader_init(Reader reader, VALUE io, int fd, bool to_s) {
     }
 }
 
+// Moves the line and column kept for the head past the bytes about to be
+// dropped from the front of the buffer.
+static void
+advance_head(Reader reader, size_t shift) {
+    const char	*s = reader->head;
+    const char	*end = s + shift;
+    const char	*nl = NULL;
+
+    for (; NULL != (s = memchr(s, '\n', end - s)); s++) {
+	reader->head_line++;
+	nl = s;
+    }
+    if (NULL == nl) {
+	reader->head_col += (int)shift;
+    } else {
+	reader->head_col = (int)(end - nl);
+    }
+    reader->head_pos += (long)shift;
+}
+
+// Finds the line and column of the tail. Only the bytes still in the buffer
+// are looked at so it is only called when reporting an error.
+void
+oj_reader_location(Reader reader, int *line, int *col) {
+    const char	*s = reader->head;
+    const char	*nl = NULL;
+    int		cnt = 0;
+
+    for (; s < reader->tail && NULL != (s = memchr(s, '\n', reader->tail - s)); s++) {
+	cnt++;
+	nl = s;
+    }
+    *line = reader->head_line + cnt;
+    if (NULL == nl) {
+	*col = reader->head_col + (int)(reader->tail - reader->head);
+    } else {
+	*col = (int)(reader->tail - nl);
+    }
+}
+
 int
 oj_reader_read(Reader reader) {
     int		err;
     size_t	shift = 0;
+    const char	*start;
 
     if (0 == reader->read_func) {
 	return -1;
@@ -98,7 +173,7 @@ oj_reader_read(Reader reader) {
     if (reader->head < reader->tail && 4096 > reader->end - reader->tail) {
 	if (0 == reader->pro) {
 	    shift = reader->tail - reader->head;
-	} else {
+	} else if (reader->head < reader->pro) {
 	    shift = reader->pro - reader->head - 1; // leave one character so we can backup one
 	}
 	if (0 >= shift) { /* no space left so allocate more */
@@ -113,6 +188,8 @@ oj_reader_read(Reader reader) {
 	    }
 	    reader->free_head = 1;
 	    reader->end = reader->head + size * 2 - BUF_PAD;
+	    oj_stats.reader_grows++;
+	    oj_stats.reader_grow_bytes += size * 2;
 	    reader->tail = reader->head + (reader->tail - old);
 	    reader->read_end = reader->head + (reader->read_end - old);
 	    if (0 != reader->pro) {
@@ -122,6 +199,7 @@ oj_reader_read(Reader reader) {
 		reader->str = reader->head + (reader->str - old);
 	    }
 	} else {
+	    advance_head(reader, shift);
 	    memmove((char*)reader->head, reader->head + shift, reader->read_end - (reader->head + shift));
 	    reader->tail -= shift;
 	    reader->read_end -= shift;
@@ -133,8 +211,10 @@ oj_reader_read(Reader reader) {
 	    }
 	}
     }
+    start = reader->read_end;
     err = reader->read_func(reader);
     *(char*)reader->read_end = '\0';
+    OJ_PROBE1(reader__refill, (size_t)(reader->read_end - start));
 
     return err;
 }
@@ -145,54 +225,48 @@ rescue_cb(VALUE rbuf, VALUE err) {
 
     if (rb_eTypeError != clas && rb_eEOFError != clas) {
 	Reader	reader = (Reader)rbuf;
+	int	line;
+	int	col;
 
-	rb_raise(clas, "at line %d, column %d\n", reader->line, reader->col);
+	oj_reader_location(reader, &line, &col);
+	rb_raise(clas, "at line %d, column %d\n", line, col);
     }
     return Qfalse;
 }
 
+// Reads up to the space left in the buffer with the method provided and
+// copies the bytes read to the tail of the buffer.
 static VALUE
-partial_io_cb(VALUE rbuf) {
-    Reader	reader = (Reader)rbuf;
-    VALUE	args[1];
+io_read(Reader reader, ID method) {
+    VALUE	args[2];
     VALUE	rstr;
-    char	*str;
+    size_t	max = reader->end - reader->tail;
     size_t	cnt;
 
-    args[0] = ULONG2NUM(reader->end - reader->tail);
-    rstr = rb_funcall2(reader->io, oj_readpartial_id, 1, args);
+    args[0] = ULONG2NUM(max);
+    args[1] = reader->rbuf;
+    rstr = rb_funcall2(reader->io, method, (Qnil == reader->rbuf) ? 1 : 2, args);
     if (Qnil == rstr) {
 	return Qfalse;
     }
-    str = StringValuePtr(rstr);
-    cnt = RSTRING_LEN(rstr);
-    //printf("*** partial read %lu bytes, str: '%s'\n", cnt, str);
-    strcpy(reader->tail, str);
+    Check_Type(rstr, T_STRING);
+    if (max < (cnt = RSTRING_LEN(rstr))) {
+	rb_raise(rb_eIOError, "read %lu bytes when at most %lu were requested.", (unsigned long)cnt, (unsigned long)max);
+    }
+    memcpy(reader->tail, RSTRING_PTR(rstr), cnt);
     reader->read_end = reader->tail + cnt;
 
     return Qtrue;
 }
 
 static VALUE
-io_cb(VALUE rbuf) {
-    Reader	reader = (Reader)rbuf;
-    VALUE	args[1];
-    VALUE	rstr;
-    char	*str;
-    size_t	cnt;
-
-    args[0] = ULONG2NUM(reader->end - reader->tail);
-    rstr = rb_funcall2(reader->io, oj_read_id, 1, args);
-    if (Qnil == rstr) {
-	return Qfalse;
-    }
-    str = StringValuePtr(rstr);
-    cnt = RSTRING_LEN(rstr);
-    //printf("*** read %lu bytes, str: '%s'\n", cnt, str);
-    strcpy(reader->tail, str);
-    reader->read_end = reader->tail + cnt;
+partial_io_cb(VALUE rbuf) {
+    return io_read((Reader)rbuf, oj_readpartial_id);
+}
 
-    return Qtrue;
+static VALUE
+io_cb(VALUE rbuf) {
+    return io_read((Reader)rbuf, oj_read_id);
 }
 
 static int
@@ -219,6 +293,121 @@ read_from_fd(Reader reader) {
     return 0;
 }
 
+#ifdef OJ_ZLIB
+// Compressed input is read into a buffer of its own with the read function
+// the reader would have used and then inflated into the reader buffer so
+// the document is never held inflated all at once.
+typedef struct _inflater {
+    z_stream	zs;
+    int		(*read_func)(Reader reader); // 0 when all the input is in memory
+    bool	eof;
+    char	buf[0x00004000];
+} *Inflater;
+
+// Points the reader at the inflater buffer for the raw read and then puts
+// it back.
+static int
+read_raw(Reader reader, Inflater inf) {
+    char	*tail = reader->tail;
+    char	*end = reader->end;
+    char	*read_end = reader->read_end;
+    int		err;
+
+    reader->tail = inf->buf;
+    reader->end = inf->buf + sizeof(inf->buf);
+    reader->read_end = inf->buf;
+    err = inf->read_func(reader);
+    inf->zs.next_in = (Bytef*)inf->buf;
+    inf->zs.avail_in = (uInt)(reader->read_end - inf->buf);
+    reader->tail = tail;
+    reader->end = end;
+    reader->read_end = read_end;
+
+    return err;
+}
+
+static int
+read_inflated(Reader reader) {
+    Inflater	inf = reader->inflater;
+    size_t	max = reader->end - reader->tail;
+    int		rc;
+
+    inf->zs.next_out = (Bytef*)reader->tail;
+    inf->zs.avail_out = (uInt)max;
+    while (max == inf->zs.avail_out) {
+	if (0 == inf->zs.avail_in) {
+	    if (inf->eof || 0 == inf->read_func || 0 != read_raw(reader, inf)) {
+		inf->eof = true;
+		return -1;
+	    }
+	    continue;
+	}
+	rc = inflate(&inf->zs, Z_NO_FLUSH);
+	if (Z_STREAM_END == rc) {
+	    // Concatenated gzip members are read as one stream.
+	    inflateReset(&inf->zs);
+	} else if (Z_OK != rc) {
+	    rb_raise(rb_eIOError, "gzip: %s", (0 == inf->zs.msg) ? "invalid compressed data" : inf->zs.msg);
+	}
+    }
+    reader->read_end = reader->tail + (max - inf->zs.avail_out);
+
+    return 0;
+}
+
+void
+oj_reader_inflate(Reader reader, Compression c) {
+    Inflater	inf;
+
+    if (NO_COMPRESS == c) {
+	return;
+    }
+    inf = ALLOC(struct _inflater);
+    memset(&inf->zs, 0, sizeof(inf->zs));
+    inf->read_func = reader->read_func;
+    inf->eof = false;
+    if (0 == inf->read_func) {
+	// All the compressed input is already in memory so inflate from there
+	// into the embedded buffer.
+	inf->zs.next_in = (Bytef*)reader->head;
+	inf->zs.avail_in = (uInt)(reader->read_end - reader->head);
+	reader->head = reader->base;
+	reader->end = reader->head + sizeof(reader->base) - BUF_PAD;
+	reader->tail = reader->head;
+	reader->read_end = reader->head;
+	*reader->head = '\0';
+    }
+    // Adding 32 to the window bits accepts either a gzip or a zlib header.
+    if (Z_OK != inflateInit2(&inf->zs, 15 + 32)) {
+	xfree(inf);
+	rb_raise(rb_eNoMemError, "failed to initialize gzip decompression.");
+    }
+    reader->inflater = inf;
+    reader->read_func = read_inflated;
+}
+
+void
+oj_reader_inflater_free(Reader reader) {
+    inflateEnd(&reader->inflater->zs);
+    xfree(reader->inflater);
+    reader->inflater = 0;
+}
+
+#else
+
+void
+oj_reader_inflate(Reader reader, Compression c) {
+    if (NO_COMPRESS != c) {
+	rb_raise(rb_eNotImpError, "gzip compression is not available, Oj was built without zlib.");
+    }
+}
+
+void
+oj_reader_inflater_free(Reader reader) {
+}
+
+#endif
+
 // This is only called when the end of the string is reached so just return -1.
 /*
 static int
@@ -3,6 +3,8 @@
 #ifndef OJ_READER_H
 #define OJ_READER_H
 
+#include "compress.h"
+
 typedef struct _reader {
     char	base[0x00001000];
     char	*head;
@@ -11,11 +13,13 @@ typedef struct _reader {
     char	*read_end;	/* one past last character read */
     char	*pro;		/* protection start, buffer can not slide past this point */
     char	*str;		/* start of current string being read */
-    long	pos;
-    int		line;
-    int		col;
+    long	head_pos;	/* stream offset of head */
+    int		head_line;	/* line and column at head */
+    int		head_col;
     int		free_head;
     int		(*read_func)(struct _reader *reader);
+    VALUE	rbuf;		/* String reused for each read from an IO */
+    struct _inflater	*inflater; /* NULL unless the input is compressed */
     union {
 	int		fd;
 	VALUE		io;
@@ -23,8 +27,11 @@ typedef struct _reader {
     };
 } *Reader;
 
-extern void	oj_reader_init(Reader reader, VALUE io, int fd, bool to_s);
+extern void	oj_reader_init(Reader reader, VALUE io, int fd, bool to_s, size_t size);
 extern int	oj_reader_read(Reader reader);
+extern void	oj_reader_inflate(Reader reader, Compression c);
+extern void	oj_reader_inflater_free(Reader reader);
+extern void	oj_reader_location(Reader reader, int *line, int *col);
 
 static inline char
 reader_get(Reader reader) {
@@ -34,25 +41,19 @@ reader_get(Reader reader) {
 	    return '\0';
 	}
     }
-    if ('\n' == *reader->tail) {
-	reader->line++;
-	reader->col = 0;
-    }
-    reader->col++;
-    reader->pos++;
-
     return *reader->tail++;
 }
 
 static inline void
 reader_backup(Reader reader) {
     reader->tail--;
-    reader->col--;
-    reader->pos--;
-    if (0 >= reader->col) {
-	reader->line--;
-	// allow col to be negative since we never backup twice in a row
-    }
+}
+
+// The line and column are not tracked per character. They are found with
+// oj_reader_location() when needed from the bytes still in the buffer.
+static inline long
+reader_pos(Reader reader) {
+    return reader->head_pos + (reader->tail - reader->head);
 }
 
 static inline void
@@ -123,6 +124,9 @@ reader_expect(Reader reader, const char *s) {
 
 static inline void
 reader_cleanup(Reader reader) {
+    if (0 != reader->inflater) {
+	oj_reader_inflater_free(reader);
+    }
     if (reader->free_head && 0 != reader->head) {
 	xfree((char*)reader->head);
 	reader->head = 0;
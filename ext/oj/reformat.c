@@ -0,0 +1,233 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <string.h>
+
+#include "oj.h"
+#include "dump.h"
+#include "encode.h"
+#include "err.h"
+#include "parse.h"
+#include "stats.h"
+#include "validate.h"
+
+// A document is reformatted in two passes over the bytes. The validator
+// checks it with the options given so the errors are the same as for a load
+// and then the tokens are copied to the output with the whitespace and
+// comments replaced. Strings and numbers are copied byte for byte and no
+// Ruby objects other than the result are created.
+
+inline static void
+newline(Out out, int depth) {
+    size_t	cnt = (size_t)depth * out->indent;
+
+    assure_size(out, cnt + 1);
+    *out->cur++ = '\n';
+    memset(out->cur, ' ', cnt);
+    out->cur += cnt;
+}
+
+// With dump options, such as a String :indent, the line breaks and indents
+// are the ones Oj.dump writes with the same options.
+static void
+dump_opts_newline(Out out, DumpOpts dopts, bool hash, int depth) {
+    const char	*nl = hash ? dopts->hash_nl : dopts->array_nl;
+    size_t	nlen = hash ? dopts->hash_size : dopts->array_size;
+
+    assure_size(out, nlen + (size_t)depth * dopts->indent_size);
+    memcpy(out->cur, nl, nlen);
+    out->cur += nlen;
+    for (; 0 < depth; depth--) {
+	memcpy(out->cur, dopts->indent_str, dopts->indent_size);
+	out->cur += dopts->indent_size;
+    }
+}
+
+// Breaks the line before a member or a close at depth.
+inline static void
+member_newline(Out out, DumpOpts dopts, bool hash, int depth) {
+    if (NULL == dopts) {
+	newline(out, depth);
+    } else {
+	dump_opts_newline(out, dopts, hash, depth);
+    }
+}
+
+// If dopts is not NULL it is used in place of out->indent. Each open
+// container is noted in kinds, true for a Hash, since the dump options for
+// a Hash and an Array differ.
+static void
+reformat_doc(Out out, DumpOpts dopts, const char *s, const char *end) {
+    const char		*start;
+    int			depth = 0;
+    bool		opened = false; // a container was just opened
+    bool		pretty = (0 < out->indent || NULL != dopts);
+    volatile VALUE	rkinds = Qnil;
+    char		*kinds = NULL;
+    long		kcap = 0;
+
+    while (s < end) {
+	switch (*s) {
+	case ' ':
+	case '\t':
+	case '\f':
+	case '\n':
+	case '\r':
+	    s = oj_scan_white(s + 1, end);
+	    continue;
+	case '/':
+	    if ('*' == s[1]) {
+		for (s += 2; s + 1 < end && ('*' != *s || '/' != s[1]); s++) {
+		}
+		s += 2;
+	    } else {
+		for (; s < end && '\n' != *s && '\r' != *s && '\f' != *s; s++) {
+		}
+	    }
+	    continue;
+	case '}':
+	case ']':
+	    depth--;
+	    if (pretty && !opened) {
+		member_newline(out, dopts, '}' == *s, depth);
+	    }
+	    assure_size(out, 1);
+	    *out->cur++ = *s++;
+	    opened = false;
+	    continue;
+	case ',':
+	    assure_size(out, 1);
+	    *out->cur++ = *s++;
+	    if (pretty) {
+		member_newline(out, dopts, NULL != kinds && kinds[depth - 1], depth);
+	    }
+	    continue;
+	case ':':
+	    if (NULL != dopts) {
+		assure_size(out, dopts->before_size + dopts->after_size + 1);
+		memcpy(out->cur, dopts->before_sep, dopts->before_size);
+		out->cur += dopts->before_size;
+		*out->cur++ = *s++;
+		memcpy(out->cur, dopts->after_sep, dopts->after_size);
+		out->cur += dopts->after_size;
+		continue;
+	    }
+	    assure_size(out, 1);
+	    *out->cur++ = *s++;
+	    continue;
+	default:
+	    break;
+	}
+	if (pretty && opened) {
+	    member_newline(out, dopts, NULL != kinds && kinds[depth - 1], depth);
+	}
+	opened = false;
+	start = s;
+	switch (*s) {
+	case '{':
+	case '[':
+	    if (NULL != dopts) {
+		if (kcap <= depth) {
+		    // A String so the GC frees it if an allocation raises.
+		    kcap = (0 == kcap) ? 64 : kcap * 2;
+		    if (Qnil == rkinds) {
+			rkinds = rb_str_new(NULL, kcap);
+		    } else {
+			rb_str_resize(rkinds, kcap);
+		    }
+		    kinds = RSTRING_PTR(rkinds);
+		}
+		kinds[depth] = ('{' == *s);
+	    }
+	    depth++;
+	    opened = true;
+	    s++;
+	    break;
+	case '"':
+	    for (s = oj_scan_string(s + 1, end); '\\' == *s; s = oj_scan_string(s + 2, end)) {
+	    }
+	    s++;
+	    break;
+	default:
+	    // A number, true, false, null, NaN, or Infinity. The validator has
+	    // already checked it so it runs to the next delimiter.
+	    for (s++; s < end; s++) {
+		switch (*s) {
+		case ' ':
+		case '\t':
+		case '\f':
+		case '\n':
+		case '\r':
+		case ',':
+		case ':':
+		case '}':
+		case ']':
+		case '/':
+		    goto done;
+		default:
+		    break;
+		}
+	    }
+	done:
+	    break;
+	}
+	assure_size(out, s - start);
+	memcpy(out->cur, start, s - start);
+	out->cur += s - start;
+    }
+    // Oj.dump only ends an indented Array or Hash with a newline.
+    if (NULL == dopts && pretty && out->buf < out->cur && (']' == out->cur[-1] || '}' == out->cur[-1])) {
+	assure_size(out, 1);
+	*out->cur++ = '\n';
+    }
+    RB_GC_GUARD(rkinds);
+}
+
+static VALUE
+reformat(int argc, VALUE *argv, bool minify) {
+    struct _validation	val;
+    struct _out		out;
+    volatile VALUE	rstr;
+    size_t		len;
+
+    if (!oj_validate_doc(argc, argv, &val)) {
+	if (Qnil != val.pi.err_class) {
+	    val.pi.err.clas = val.pi.err_class;
+	}
+	oj_err_raise(&val.pi.err);
+    }
+    if (Qnil == *argv) {
+	return Qnil;
+    }
+    len = val.pi.cur - val.pi.json;
+
+    // The output is written directly into the String. Minified output is
+    // never longer than the input.
+    rstr = rb_str_buf_new(len + BUFFER_EXTRA);
+    out.str = rstr;
+    out.buf = RSTRING_PTR(rstr);
+    out.end = out.buf + rb_str_capacity(rstr) - BUFFER_EXTRA;
+    out.cur = out.buf;
+    out.allocated = false;
+    out.flush = NULL;
+    out.indent = minify ? 0 : val.pi.options.indent;
+    reformat_doc(&out, (!minify && val.pi.options.dump_opts.use) ? &val.pi.options.dump_opts : NULL, val.pi.json, val.pi.cur);
+    RB_GC_GUARD(val.input);
+    if (out.buf == out.cur) {
+	return Qnil;
+    }
+    rb_str_set_len(rstr, out.cur - out.buf);
+    oj_stats.dumps++;
+    oj_stats.bytes_dumped += out.cur - out.buf;
+
+    return oj_encode(rstr);
+}
+
+VALUE
+oj_reformat(int argc, VALUE *argv, VALUE self) {
+    return reformat(argc, argv, false);
+}
+
+VALUE
+oj_minify(int argc, VALUE *argv, VALUE self) {
+    return reformat(argc, argv, true);
+}
@@ -3,9 +3,6 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-#include <pthread.h>
-#endif
 
 #include "oj.h"
 #include "err.h"
@@ -67,26 +64,18 @@ resolve_classpath(ParseInfo pi, const char *name, size_t len, int auto_define, V
 VALUE
 oj_name2class(ParseInfo pi, const char *name, size_t len, int auto_define, VALUE error_class) {
     VALUE	clas;
-    VALUE	*slot;
 
     if (No == pi->options.class_cache) {
 	return resolve_classpath(pi, name, len, auto_define, error_class);
     }
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-    pthread_mutex_lock(&oj_cache_mutex);
-#else
-    rb_mutex_lock(oj_cache_mutex);
-#endif
-    if (Qnil == (clas = oj_class_hash_get(name, len, &slot))) {
+    // The class is resolved without holding a slot or lock since resolving
+    // can run Ruby code, such as an autoload, that switches threads. Two
+    // threads resolving the same name just set the same class.
+    if (Qnil == (clas = oj_class_hash_get(parse_caches(pi), name, len))) {
 	if (Qundef != (clas = resolve_classpath(pi, name, len, auto_define, error_class))) {
-	    *slot = clas;
+	    oj_class_hash_set(parse_caches(pi), name, len, clas);
 	}
     }
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-    pthread_mutex_unlock(&oj_cache_mutex);
-#else
-    rb_mutex_unlock(oj_cache_mutex);
-#endif
     return clas;
 }
 
@@ -11,6 +11,10 @@
 
 #include "rxclass.h"
 
+// Same as Regexp::IGNORECASE and Regexp::EXTENDED.
+#define RX_IGNORECASE	1
+#define RX_EXTENDED	2
+
 typedef struct _rxC {
     struct _rxC	*next;
     VALUE	rrx;
@@ -18,9 +22,55 @@ typedef struct _rxC {
     regex_t	rx;
 #endif
     VALUE	clas;
+    size_t	plen;
+    bool	line_anchor; // ^ matches after any newline, not just at the start
+    char	prefix[32];
     char	src[256];
 } *RxC;
 
+static ID	match_p_id = 0;
+
+// Collects the literal characters an anchored expression must start with so
+// strings that can not match are skipped without running the expression.
+// Anything that is not plain leaves the prefix empty and the expression is
+// always run.
+static void
+set_prefix(RxC rxc, const char *src, bool ruby) {
+    const char	*s = src;
+
+    rxc->plen = 0;
+    rxc->line_anchor = false;
+    if ('^' == *s) {
+	s++;
+	rxc->line_anchor = ruby;
+    } else if (ruby && '\\' == *s && 'A' == s[1]) {
+	s += 2;
+    } else {
+	return;
+    }
+    if (NULL != strchr(s, '|')) {
+	return;
+    }
+    for (; '\0' != *s && NULL == strchr(".[]()*+?{}|^$\\", *s) && rxc->plen < sizeof(rxc->prefix); s++) {
+	rxc->prefix[rxc->plen++] = *s;
+    }
+    // A repeat makes the last character optional. Back up to the lead byte
+    // if that character is multibyte UTF-8.
+    if (0 < rxc->plen && '\0' != *s && NULL != strchr("*+?{", *s)) {
+	do {
+	    rxc->plen--;
+	} while (0 < rxc->plen && 0x80 == (0xC0 & (unsigned char)rxc->prefix[rxc->plen]));
+    }
+}
+
+inline static bool
+prefix_miss(RxC rxc, const char *str, int len) {
+    if (0 == rxc->plen || (rxc->line_anchor && NULL != memchr(str, '\n', len))) {
+	return false;
+    }
+    return len < (int)rxc->plen || 0 != memcmp(str, rxc->prefix, rxc->plen);
+}
+
 void
 oj_rxclass_init(RxClass rc) {
     *rc->err = '\0';
@@ -38,8 +88,8 @@ oj_rxclass_cleanup(RxClass rc) {
 	if (Qnil == rxc->rrx) {
 	    regfree(&rxc->rx);
 	}
-	xfree(rxc);
 #endif
+	xfree(rxc);
     }
 }
 
@@ -50,6 +100,15 @@ oj_rxclass_rappend(RxClass rc, VALUE rx, VALUE clas) {
     memset(rxc, 0, sizeof(struct _rxC));
     rxc->rrx = rx;
     rxc->clas = clas;
+    if (0 == (rb_reg_options(rx) & (RX_IGNORECASE | RX_EXTENDED))) {
+	volatile VALUE	src = rb_funcall(rx, rb_intern("source"), 0);
+
+	if (RSTRING_LEN(src) < (long)sizeof(rxc->src)) {
+	    memcpy(rxc->src, RSTRING_PTR(src), RSTRING_LEN(src));
+	    rxc->src[RSTRING_LEN(src)] = '\0';
+	    set_prefix(rxc, rxc->src, true);
+	}
+    }
     if (NULL == rc->tail) {
 	rc->head = rxc;
     } else {
@@ -71,18 +130,21 @@ oj_rxclass_append(RxClass rc, const char *expr, VALUE clas) {
 	return EINVAL;
     }
     rxc = ALLOC_N(struct _rxC, 1);
-    rxc->next = 0;
+    memset(rxc, 0, sizeof(struct _rxC));
     rxc->clas = clas;
+    strcpy(rxc->src, expr);
 
 #if IS_WINDOWS
     rxc->rrx = rb_funcall(rb_cRegexp, rb_intern("new"), 1, rb_str_new2(expr));
+    set_prefix(rxc, expr, true);
 #else
     rxc->rrx = Qnil;
     if (0 != (err = regcomp(&rxc->rx, expr, flags))) {
 	regerror(err, &rxc->rx, rc->err, sizeof(rc->err));
-	free(rxc);
+	xfree(rxc);
 	return err;
     }
+    set_prefix(rxc, expr, false);
 #endif
     if (NULL == rc->tail) {
 	rc->head = rxc;
@@ -94,31 +156,57 @@ oj_rxclass_append(RxClass rc, const char *expr, VALUE clas) {
     return 0;
 }
 
+// Ruby expressions are run with match? which does not create a MatchData
+// and one String is shared by all of them.
 VALUE
 oj_rxclass_match(RxClass rc, const char *str, int len) {
-    RxC		rxc;
-    char	buf[4096];
+    RxC			rxc;
+    volatile VALUE	rstr = Qnil;
 
     for (rxc = rc->head; NULL != rxc; rxc = rxc->next) {
+	if (prefix_miss(rxc, str, len)) {
+	    continue;
+	}
 	if (Qnil != rxc->rrx) {
-	    // Must use a valiabel for this to work.
-	    volatile VALUE	rstr = rb_str_new(str, len);
-
-	    //if (Qtrue == rb_funcall(rxc->rrx, rb_intern("match?"), 1, rstr)) {
-	    if (Qnil != rb_funcall(rxc->rrx, rb_intern("match"), 1, rstr)) {
+	    if (0 == match_p_id) {
+		match_p_id = rb_intern("match?");
+	    }
+	    if (Qnil == rstr) {
+		rstr = rb_utf8_str_new(str, len);
+	    }
+	    if (Qtrue == rb_funcall(rxc->rrx, match_p_id, 1, rstr)) {
 		return rxc->clas;
 	    }
-	} else if (len < (int)sizeof(buf)) {
+	} else {
 #if !IS_WINDOWS
-	    // string is not \0 terminated so copy and atempt a match
-	    memcpy(buf, str, len);
-	    buf[len] = '\0';
-	    if (0 == regexec(&rxc->rx, buf, 0, NULL, 0)) { // match
+#ifdef REG_STARTEND
+	    regmatch_t	m;
+
+	    m.rm_so = 0;
+	    m.rm_eo = len;
+	    if (0 == regexec(&rxc->rx, str, 1, &m, REG_STARTEND)) {
+		return rxc->clas;
+	    }
+#else
+	    // string is not \0 terminated so copy and attempt a match
+	    char	buf[4096];
+	    char	*b = buf;
+	    int		err;
+
+	    if ((int)sizeof(buf) <= len) {
+		b = ALLOC_N(char, len + 1);
+	    }
+	    memcpy(b, str, len);
+	    b[len] = '\0';
+	    err = regexec(&rxc->rx, b, 0, NULL, 0);
+	    if (buf != b) {
+		xfree(b);
+	    }
+	    if (0 == err) {
 		return rxc->clas;
 	    }
 #endif
-	} else {
-	    // TBD allocate a larger buffer and attempt
+#endif
 	}
     }
     return Qnil;
@@ -142,3 +230,13 @@ oj_rxclass_copy(RxClass src, RxClass dest) {
 	}
     }
 }
+
+void
+oj_rxclass_mark(RxClass rc) {
+    RxC	rxc;
+
+    for (rxc = rc->head; NULL != rxc; rxc = rxc->next) {
+	rb_gc_mark(rxc->rrx);
+	rb_gc_mark(rxc->clas);
+    }
+}
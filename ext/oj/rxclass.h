@@ -20,5 +20,6 @@ extern int	oj_rxclass_append(RxClass rc, const char *expr, VALUE clas);
 extern VALUE	oj_rxclass_match(RxClass rc, const char *str, int len);
 extern void	oj_rxclass_copy(RxClass src, RxClass dest);
 extern void	oj_rxclass_rappend(RxClass rc, VALUE rx, VALUE clas);
+extern void	oj_rxclass_mark(RxClass rc);
 
 #endif /* OJ_RXCLASS_H */
@@ -1,309 +1,264 @@
 // Copyright (c) 2012 Peter Ohler. All rights reserved.
 
-#if !IS_WINDOWS
-#include <sys/resource.h>  /* for getrlimit() on linux */
-#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
-#include <sys/types.h>
-#include <unistd.h>
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
 #define OJ_INFINITY (1.0/0.0)
 
 #include "oj.h"
 #include "encode.h"
+#include "buf.h"
+#include "parse.h"
+#include "reader.h"
 
-typedef struct _parseInfo {
-    char	*str;		/* buffer being read from */
-    char	*s;		/* current position in buffer */
-    void	*stack_min;
-    VALUE	handler;
-    int		has_hash_start;
-    int		has_hash_end;
-    int		has_array_start;
-    int		has_array_end;
-    int		has_add_value;
-    int		has_error;
-} *ParseInfo;
-
-static void	read_next(ParseInfo pi, const char *key);
-static void	read_hash(ParseInfo pi, const char *key);
-static void	read_array(ParseInfo pi, const char *key);
-static void	read_str(ParseInfo pi, const char *key);
-static void	read_num(ParseInfo pi, const char *key);
-static void	read_true(ParseInfo pi, const char *key);
-static void	read_false(ParseInfo pi, const char *key);
-static void	read_nil(ParseInfo pi, const char *key);
-static void	next_non_white(ParseInfo pi);
-static char*	read_quoted_value(ParseInfo pi);
-static void	skip_comment(ParseInfo pi);
-
-/* This JSON parser is a single pass, destructive, callback parser. It is a
- * single pass parse since it only make one pass over the characters in the
- * JSON document string. It is destructive because it re-uses the content of
- * the string for values in the callback and places \0 characters at various
- * places to mark the end of tokens and strings. It is a callback parser like
- * a SAX parser because it uses callback when document elements are
- * encountered.
- *
- * Parsing is very tolerant. Lack of headers and even misspelled element
- * endings are passed over without raising an error. A best attempt is made in
- * all cases to parse the string.
- */
-
-inline static void
-call_error(const char *msg, ParseInfo pi, const char* file, int line) {
-    char	buf[128];
-    const char	*s = pi->s;
-    int		jline = 1;
-    int		col = 1;
+#ifdef RUBINIUS_RUBY
+#define NUM_MAX 0x07FFFFFF
+#else
+#define NUM_MAX (FIXNUM_MAX >> 8)
+#endif
 
-    for (; pi->str < s && '\n' != *s; s--) {
-	col++;
-    }
-    for (; pi->str < s; s--) {
-	if ('\n' == *s) {
-	    jline++;
-	}
-    }
-    sprintf(buf, "%s at line %d, column %d [%s:%d]", msg, jline, col, file, line);
-    rb_funcall(pi->handler, oj_error_id, 3, rb_str_new2(buf), LONG2NUM(jline), LONG2NUM(col));
-}
+/* This JSON parser is a single pass callback parser like a SAX parser. It
+ * reads with the same reader as the stream parser so an IO is never read
+ * completely first and a String is read in place. Open arrays and objects
+ * are kept on a stack instead of recursing so the memory used depends on
+ * the nesting depth and the length of the keys of the open objects, not on
+ * the size of the document.
+ */
 
-inline static void
-next_non_white(ParseInfo pi) {
-    for (; 1; pi->s++) {
-	switch(*pi->s) {
-	case ' ':
-	case '\t':
-	case '\f':
-	case '\n':
-	case '\r':
-	    break;
-	case '/':
-	    skip_comment(pi);
-	    break;
-	default:
+typedef struct _sajFrame {
+    size_t	koff;	// offset of the container key in the key store
+    long	klen;	// -1 if the container has no key
+    bool	hash;
+} *SajFrame;
+
+typedef struct _saj {
+    struct _reader	rd;
+    struct _buf		buf;	// string or number being read
+    struct _buf		keys;	// keys of the open containers back to back
+    SajFrame		head;
+    SajFrame		end;
+    SajFrame		tail;
+    VALUE		handler;
+    bool		has_hash_start;
+    bool		has_hash_end;
+    bool		has_array_start;
+    bool		has_array_end;
+    bool		has_add_value;
+    bool		has_error;
+} *Saj;
+
+#define saj_error(saj, msg) saj_err(saj, msg, __FILE__, __LINE__, true)
+
+// Reports an error to the handler's error() method if it has one. Errors
+// other than extra characters after the document also raise.
+static void
+saj_err(Saj saj, const char *msg, const char *file, int line, bool fatal) {
+    char	buf[256];
+    int		rline;
+    int		rcol;
+
+    oj_reader_location(&saj->rd, &rline, &rcol);
+    snprintf(buf, sizeof(buf), "%s at line %d, column %d [%s:%d]", msg, rline, rcol, file, line);
+    if (saj->has_error) {
+	rb_funcall(saj->handler, oj_error_id, 3, rb_str_new2(buf), INT2FIX(rline), INT2FIX(rcol));
+	if (!fatal) {
 	    return;
 	}
     }
+    rb_raise(oj_parse_error_class, "%s", buf);
 }
 
-inline static void
-call_add_value(VALUE handler, VALUE value, const char *key) {
-    volatile VALUE	k;
-
-    if (0 == key) {
-	k = Qnil;
-    } else {
-	k = rb_str_new2(key);
-	k = oj_encode(k);
+static VALUE
+key_value(Saj saj, size_t koff, long klen) {
+    if (0 > klen) {
+	return Qnil;
     }
-    rb_funcall(handler, oj_add_value_id, 2, value, k);
-}
-
-inline static void
-call_no_value(VALUE handler, ID method, const char *key) {
-    volatile VALUE	k;
-
-    if (0 == key) {
-	k = Qnil;
-    } else {
-	k = rb_str_new2(key);
-	k = oj_encode(k);
-    }
-    rb_funcall(handler, method, 1, k);
+    return oj_encode(rb_str_new(saj->keys.head + koff, klen));
 }
 
 static void
-skip_comment(ParseInfo pi) {
-    pi->s++; /* skip first / */
-    if ('*' == *pi->s) {
-	pi->s++;
-	for (; '\0' != *pi->s; pi->s++) {
-	    if ('*' == *pi->s && '/' == *(pi->s + 1)) {
-		pi->s++;
-		return;
-	    } else if ('\0' == *pi->s) {
-		if (pi->has_error) {
-		    call_error("comment not terminated", pi, __FILE__, __LINE__);
-		} else {
-		    raise_error("comment not terminated", pi->str, pi->s);
+skip_comment(Saj saj) {
+    char	c = reader_get(&saj->rd);
+
+    if ('*' == c) {
+	while ('\0' != (c = reader_get(&saj->rd))) {
+	    if ('*' == c) {
+		if ('/' == (c = reader_get(&saj->rd))) {
+		    return;
 		}
+		reader_backup(&saj->rd);
 	    }
 	}
-    } else if ('/' == *pi->s) {
-	for (; 1; pi->s++) {
-	    switch (*pi->s) {
+	saj_error(saj, "comment not terminated");
+    } else if ('/' == c) {
+	while ('\0' != (c = reader_get(&saj->rd))) {
+	    switch (c) {
 	    case '\n':
 	    case '\r':
 	    case '\f':
-	    case '\0':
 		return;
 	    default:
 		break;
 	    }
 	}
     } else {
-	if (pi->has_error) {
-	    call_error("invalid comment", pi, __FILE__, __LINE__);
-	} else {
-	    raise_error("invalid comment", pi->str, pi->s);
-	}
+	saj_error(saj, "invalid comment");
     }
 }
 
-static void
-read_next(ParseInfo pi, const char *key) {
-    VALUE	obj;
+// Returns the next character that is not white space or part of a comment
+// or '\0' at the end of the input. White space is scanned in the reader
+// buffer directly since that is where most of the time goes.
+static char
+next_non_white(Saj saj) {
+    Reader	rd = &saj->rd;
 
-    if ((void*)&obj < pi->stack_min) {
-	rb_raise(rb_eSysStackError, "JSON is too deeply nested");
-    }
-    next_non_white(pi);	/* skip white space */
-    switch (*pi->s) {
-    case '{':
-	read_hash(pi, key);
-	break;
-    case '[':
-	read_array(pi, key);
-	break;
-    case '"':
-	read_str(pi, key);
-	break;
-    case '+':
-    case '-':
-    case '0':
-    case '1':
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-	read_num(pi, key);
-	break;
-    case 'I':
-	read_num(pi, key);
-	break;
-    case 't':
-	read_true(pi, key);
-	break;
-    case 'f':
-	read_false(pi, key);
-	break;
-    case 'n':
-	read_nil(pi, key);
-	break;
-    case '\0':
-	return;
-    default:
-	return;
-    }
-}
+    while (true) {
+	char	*end = rd->read_end;
+	char	*s = (char*)oj_scan_white(rd->tail, end);
 
-static void
-read_hash(ParseInfo pi, const char *key) {
-    const char	*ks;
+	rd->tail = s;
+	if (s < end) {
+	    char	c = reader_get(rd);
 
-    if (pi->has_hash_start) {
-	call_no_value(pi->handler, oj_hash_start_id, key);
-    }
-    pi->s++;
-    next_non_white(pi);
-    if ('}' == *pi->s) {
-	pi->s++;
-    } else {
-	while (1) {
-	    next_non_white(pi);
-	    ks = read_quoted_value(pi);
-	    next_non_white(pi);
-	    if (':' == *pi->s) {
-		pi->s++;
-	    } else {
-		if (pi->has_error) {
-		    call_error("invalid format, expected :", pi, __FILE__, __LINE__);
-		}
-		raise_error("invalid format, expected :", pi->str, pi->s);
-	    }
-	    read_next(pi, ks);
-	    next_non_white(pi);
-	    if ('}' == *pi->s) {
-		pi->s++;
-		break;
-	    } else if (',' == *pi->s) {
-		pi->s++;
-	    } else {
-		if (pi->has_error) {
-		    call_error("invalid format, expected , or } while in an object", pi, __FILE__, __LINE__);
-		}
-		raise_error("invalid format, expected , or } while in an object", pi->str, pi->s);
+	    if ('/' != c) {
+		return c;
 	    }
+	    skip_comment(saj);
+	} else if (0 != oj_reader_read(rd)) {
+	    return '\0';
 	}
     }
-    if (pi->has_hash_end) {
-	call_no_value(pi->handler, oj_hash_end_id, key);
+}
+
+static uint32_t
+read_hex(Saj saj) {
+    uint32_t	b = 0;
+    int		i;
+    char	c;
+
+    for (i = 0; i < 4; i++) {
+	c = reader_get(&saj->rd);
+	b = b << 4;
+	if ('0' <= c && c <= '9') {
+	    b += c - '0';
+	} else if ('A' <= c && c <= 'F') {
+	    b += c - 'A' + 10;
+	} else if ('a' <= c && c <= 'f') {
+	    b += c - 'a' + 10;
+	} else {
+	    saj_error(saj, "invalid hex character");
+	}
     }
+    return b;
 }
 
 static void
-read_array(ParseInfo pi, const char *key) {
-    if (pi->has_array_start) {
-	call_no_value(pi->handler, oj_array_start_id, key);
-    }
-    pi->s++;
-    next_non_white(pi);
-    if (']' == *pi->s) {
-	pi->s++;
+unicode_to_chars(Saj saj, Buf buf, uint32_t code) {
+    if (0x0000007F >= code) {
+	buf_append(buf, (char)code);
+    } else if (0x000007FF >= code) {
+	buf_append(buf, 0xC0 | (code >> 6));
+	buf_append(buf, 0x80 | (0x3F & code));
+    } else if (0x0000FFFF >= code) {
+	buf_append(buf, 0xE0 | (code >> 12));
+	buf_append(buf, 0x80 | ((code >> 6) & 0x3F));
+	buf_append(buf, 0x80 | (0x3F & code));
+    } else if (0x001FFFFF >= code) {
+	buf_append(buf, 0xF0 | (code >> 18));
+	buf_append(buf, 0x80 | ((code >> 12) & 0x3F));
+	buf_append(buf, 0x80 | ((code >> 6) & 0x3F));
+	buf_append(buf, 0x80 | (0x3F & code));
+    } else if (0x03FFFFFF >= code) {
+	buf_append(buf, 0xF8 | (code >> 24));
+	buf_append(buf, 0x80 | ((code >> 18) & 0x3F));
+	buf_append(buf, 0x80 | ((code >> 12) & 0x3F));
+	buf_append(buf, 0x80 | ((code >> 6) & 0x3F));
+	buf_append(buf, 0x80 | (0x3F & code));
+    } else if (0x7FFFFFFF >= code) {
+	buf_append(buf, 0xFC | (code >> 30));
+	buf_append(buf, 0x80 | ((code >> 24) & 0x3F));
+	buf_append(buf, 0x80 | ((code >> 18) & 0x3F));
+	buf_append(buf, 0x80 | ((code >> 12) & 0x3F));
+	buf_append(buf, 0x80 | ((code >> 6) & 0x3F));
+	buf_append(buf, 0x80 | (0x3F & code));
     } else {
-	while (1) {
-	    read_next(pi, 0);
-	    next_non_white(pi);
-	    if (',' == *pi->s) {
-		pi->s++;
-	    } else if (']' == *pi->s) {
-		pi->s++;
-		break;
-	    } else {
-		if (pi->has_error) {
-		    call_error("invalid format, expected , or ] while in an array", pi, __FILE__, __LINE__);
-		}
-		raise_error("invalid format, expected , or ] while in an array", pi->str, pi->s);
-	    }
-	}
-    }
-    if (pi->has_array_end) {
-	call_no_value(pi->handler, oj_array_end_id, key);
+	saj_error(saj, "invalid Unicode");
     }
 }
 
+// Reads a string after the opening quote into saj->buf.
 static void
-read_str(ParseInfo pi, const char *key) {
-    char	*text;
+read_quoted_value(Saj saj) {
+    Buf		buf = &saj->buf;
+    char	c;
+    uint32_t	code;
 
-    text = read_quoted_value(pi);
-    if (pi->has_add_value) {
-	VALUE	s = rb_str_new2(text);
+    buf->tail = buf->head;
+    while (true) {
+	Reader		rd = &saj->rd;
+	const char	*start = rd->tail;
+	const char	*s = start;
+
+	// Runs without escapes are copied from the reader buffer in one step.
+	s = oj_scan_string(s, rd->read_end);
+	if (start < s) {
+	    buf_append_string(buf, start, s - start);
+	    rd->tail = (char*)s;
+	}
+	if ('"' == (c = reader_get(rd))) {
+	    break;
+	}
+	if ('\0' == c) {
+	    saj_error(saj, "quoted string not terminated");
+	} else if ('\\' == c) {
+	    c = reader_get(&saj->rd);
+	    switch (c) {
+	    case 'n':	buf_append(buf, '\n');	break;
+	    case 'r':	buf_append(buf, '\r');	break;
+	    case 't':	buf_append(buf, '\t');	break;
+	    case 'f':	buf_append(buf, '\f');	break;
+	    case 'b':	buf_append(buf, '\b');	break;
+	    case '"':	buf_append(buf, '"');	break;
+	    case '/':	buf_append(buf, '/');	break;
+	    case '\\':	buf_append(buf, '\\');	break;
+	    case 'u':
+		code = read_hex(saj);
+		if (0x0000D800 <= code && code <= 0x0000DFFF) {
+		    uint32_t	c1 = (code - 0x0000D800) & 0x000003FF;
+		    uint32_t	c2;
 
-	s = oj_encode(s);
-	call_add_value(pi->handler, s, key);
+		    if ('\\' != reader_get(&saj->rd) || 'u' != reader_get(&saj->rd)) {
+			saj_error(saj, "invalid escaped character");
+		    }
+		    c2 = read_hex(saj);
+		    c2 = (c2 - 0x0000DC00) & 0x000003FF;
+		    code = ((c1 << 10) | c2) + 0x00010000;
+		}
+		unicode_to_chars(saj, buf, code);
+		break;
+	    default:
+		saj_error(saj, "invalid escaped character");
+		break;
+	    }
+	} else {
+	    buf_append(buf, c);
+	}
+    }
+    if (buf->no_mem) {
+	rb_raise(rb_eNoMemError, "not enough memory");
     }
 }
 
-#ifdef RUBINIUS_RUBY
-#define NUM_MAX 0x07FFFFFF
-#else
-#define NUM_MAX (FIXNUM_MAX >> 8)
-#endif
-
-static void
-read_num(ParseInfo pi, const char *key) {
-    char	*start = pi->s;
+// Converts the number text in saj->buf. The conversion is the same as the
+// one the Saj parser has always made.
+static VALUE
+num_value(Saj saj) {
+    const char	*start = saj->buf.head;
+    const char	*s = start;
     int64_t	n = 0;
     long	a = 0;
     long	div = 1;
@@ -312,340 +267,335 @@ read_num(ParseInfo pi, const char *key) {
     int		eneg = 0;
     int		big = 0;
 
-    if ('-' == *pi->s) {
-	pi->s++;
+    if ('-' == *s) {
+	s++;
 	neg = 1;
-    } else if ('+' == *pi->s) {
-	pi->s++;
+    } else if ('+' == *s) {
+	s++;
     }
-    if ('I' == *pi->s) {
-	if (0 != strncmp("Infinity", pi->s, 8)) {
-	    if (pi->has_error) {
-		call_error("number or other value", pi, __FILE__, __LINE__);
-	    }
-	    raise_error("number or other value", pi->str, pi->s);
+    if ('I' == *s) {
+	if (0 != strcmp("Infinity", s)) {
+	    saj_error(saj, "number or other value");
 	}
-	pi->s += 8;
-	if (neg) {
-	    if (pi->has_add_value) {
-		call_add_value(pi->handler, rb_float_new(-OJ_INFINITY), key);
-	    }
-	} else {
-	    if (pi->has_add_value) {
-		call_add_value(pi->handler, rb_float_new(OJ_INFINITY), key);
-	    }
-	}
-	return;
+	return rb_float_new(neg ? -OJ_INFINITY : OJ_INFINITY);
     }
-    for (; '0' <= *pi->s && *pi->s <= '9'; pi->s++) {
+    for (; '0' <= *s && *s <= '9'; s++) {
 	if (big) {
 	    big++;
 	} else {
-	    n = n * 10 + (*pi->s - '0');
+	    n = n * 10 + (*s - '0');
 	    if (NUM_MAX <= n) {
 		big = 1;
 	    }
 	}
     }
-    if ('.' == *pi->s) {
-	pi->s++;
-	for (; '0' <= *pi->s && *pi->s <= '9'; pi->s++) {
-	    a = a * 10 + (*pi->s - '0');
+    if ('.' == *s) {
+	s++;
+	for (; '0' <= *s && *s <= '9'; s++) {
+	    a = a * 10 + (*s - '0');
 	    div *= 10;
 	    if (NUM_MAX <= div) {
 		big = 1;
 	    }
 	}
     }
-    if ('e' == *pi->s || 'E' == *pi->s) {
-	pi->s++;
-	if ('-' == *pi->s) {
-	    pi->s++;
+    if ('e' == *s || 'E' == *s) {
+	s++;
+	if ('-' == *s) {
+	    s++;
 	    eneg = 1;
-	} else if ('+' == *pi->s) {
-	    pi->s++;
+	} else if ('+' == *s) {
+	    s++;
 	}
-	for (; '0' <= *pi->s && *pi->s <= '9'; pi->s++) {
-	    e = e * 10 + (*pi->s - '0');
+	for (; '0' <= *s && *s <= '9'; s++) {
+	    e = e * 10 + (*s - '0');
 	    if (NUM_MAX <= e) {
 		big = 1;
 	    }
 	}
     }
+    if ('\0' != *s) {
+	saj_error(saj, "number or other value");
+    }
+    if (big) {
+	return rb_funcall(rb_cObject, oj_bigdecimal_id, 1, rb_str_new2(start));
+    }
     if (0 == e && 0 == a && 1 == div) {
-	if (big) {
-	    char	c = *pi->s;
-
-	    *pi->s = '\0';
-	    if (pi->has_add_value) {
-		call_add_value(pi->handler, rb_funcall(rb_cObject, oj_bigdecimal_id, 1, rb_str_new2(start)), key);
-	    }
-	    *pi->s = c;
-	} else {
-	    if (neg) {
-		n = -n;
-	    }
-	    if (pi->has_add_value) {
-		call_add_value(pi->handler, LONG2NUM(n), key);
-	    }
+	if (neg) {
+	    n = -n;
 	}
-	return;
-    } else { /* decimal */
-	if (big) {
-	    char	c = *pi->s;
-
-	    *pi->s = '\0';
-	    if (pi->has_add_value) {
-		call_add_value(pi->handler, rb_funcall(rb_cObject, oj_bigdecimal_id, 1, rb_str_new2(start)), key);
-	    }
-	    *pi->s = c;
-	} else {
-	    double	d = (double)n + (double)a / (double)div;
+	return LONG2NUM(n);
+    } else {
+	double	d = (double)n + (double)a / (double)div;
 
-	    if (neg) {
-		d = -d;
-	    }
-	    if (1 < big) {
-		e += big - 1;
-	    }
-	    if (0 != e) {
-		if (eneg) {
-		    e = -e;
-		}
-		d *= pow(10.0, e);
-	    }
-	    if (pi->has_add_value) {
-		call_add_value(pi->handler, rb_float_new(d), key);
+	if (neg) {
+	    d = -d;
+	}
+	if (0 != e) {
+	    if (eneg) {
+		e = -e;
 	    }
+	    d *= pow(10.0, e);
 	}
+	return rb_float_new(d);
     }
 }
 
+// Reads the text of a number, or of Infinity, into saj->buf.
 static void
-read_true(ParseInfo pi, const char *key) {
-    pi->s++;
-    if ('r' != *pi->s || 'u' != *(pi->s + 1) || 'e' != *(pi->s + 2)) {
-	if (pi->has_error) {
-	    call_error("invalid format, expected 'true'", pi, __FILE__, __LINE__);
+read_num(Saj saj, char c) {
+    Reader	rd = &saj->rd;
+    Buf		buf = &saj->buf;
+
+    buf->tail = buf->head;
+    buf_append(buf, c);
+    while (true) {
+	char	*s = rd->tail;
+	char	*end = rd->read_end;
+
+	for (; s < end; s++) {
+	    switch (*s) {
+	    case '0': case '1': case '2': case '3': case '4':
+	    case '5': case '6': case '7': case '8': case '9':
+	    case '.': case '+': case '-': case 'e': case 'E':
+	    case 'I': case 'n': case 'f': case 'i': case 't': case 'y':
+		continue;
+	    default:
+		break;
+	    }
+	    break;
+	}
+	if (rd->tail < s) {
+	    buf_append_string(buf, rd->tail, s - rd->tail);
+	    rd->tail = s;
+	}
+	if (s < end || 0 != oj_reader_read(rd)) {
+	    break;
 	}
-	raise_error("invalid format, expected 'true'", pi->str, pi->s);
     }
-    pi->s += 3;
-    if (pi->has_add_value) {
-	call_add_value(pi->handler, Qtrue, key);
+    buf_append(buf, '\0');
+    if (buf->no_mem) {
+	rb_raise(rb_eNoMemError, "not enough memory");
     }
 }
 
 static void
-read_false(ParseInfo pi, const char *key) {
-    pi->s++;
-    if ('a' != *pi->s || 'l' != *(pi->s + 1) || 's' != *(pi->s + 2) || 'e' != *(pi->s + 3)) {
-	if (pi->has_error) {
-	    call_error("invalid format, expected 'false'", pi, __FILE__, __LINE__);
-	}
-	raise_error("invalid format, expected 'false'", pi->str, pi->s);
-    }
-    pi->s += 4;
-    if (pi->has_add_value) {
-	call_add_value(pi->handler, Qfalse, key);
-    }
+call_key(Saj saj, ID method, size_t koff, long klen) {
+    rb_funcall(saj->handler, method, 1, key_value(saj, koff, klen));
 }
 
 static void
-read_nil(ParseInfo pi, const char *key) {
-    pi->s++;
-    if ('u' != *pi->s || 'l' != *(pi->s + 1) || 'l' != *(pi->s + 2)) {
-	if (pi->has_error) {
-	    call_error("invalid format, expected 'null'", pi, __FILE__, __LINE__);
-	}
-	raise_error("invalid format, expected 'null'", pi->str, pi->s);
+add_value(Saj saj, VALUE value, size_t koff, long klen) {
+    if (saj->has_add_value) {
+	rb_funcall(saj->handler, oj_add_value_id, 2, value, key_value(saj, koff, klen));
     }
-    pi->s += 3;
-    if (pi->has_add_value) {
-	call_add_value(pi->handler, Qnil, key);
+    if (0 <= klen) {
+	saj->keys.tail = saj->keys.head + koff;
     }
 }
 
-static uint32_t
-read_hex(ParseInfo pi, char *h) {
-    uint32_t	b = 0;
-    int		i;
-
-    /* TBD this can be made faster with a table */
-    for (i = 0; i < 4; i++, h++) {
-	b = b << 4;
-	if ('0' <= *h && *h <= '9') {
-	    b += *h - '0';
-	} else if ('A' <= *h && *h <= 'F') {
-	    b += *h - 'A' + 10;
-	} else if ('a' <= *h && *h <= 'f') {
-	    b += *h - 'a' + 10;
+static void
+read_scalar(Saj saj, char c, size_t koff, long klen) {
+    switch (c) {
+    case '"':
+	read_quoted_value(saj);
+	if (saj->has_add_value) {
+	    add_value(saj, oj_encode(rb_str_new(saj->buf.head, buf_len(&saj->buf))), koff, klen);
 	} else {
-	    pi->s = h;
-	    if (pi->has_error) {
-		call_error("invalid hex character", pi, __FILE__, __LINE__);
-	    }
-	    raise_error("invalid hex character", pi->str, pi->s);
+	    add_value(saj, Qnil, koff, klen);
+	}
+	break;
+    case '+':
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+    case 'I':
+	read_num(saj, c);
+	add_value(saj, saj->has_add_value ? num_value(saj) : Qnil, koff, klen);
+	break;
+    case 't':
+	if (0 != reader_expect(&saj->rd, "rue")) {
+	    saj_error(saj, "invalid format, expected 'true'");
 	}
+	add_value(saj, Qtrue, koff, klen);
+	break;
+    case 'f':
+	if (0 != reader_expect(&saj->rd, "alse")) {
+	    saj_error(saj, "invalid format, expected 'false'");
+	}
+	add_value(saj, Qfalse, koff, klen);
+	break;
+    case 'n':
+	if (0 != reader_expect(&saj->rd, "ull")) {
+	    saj_error(saj, "invalid format, expected 'null'");
+	}
+	add_value(saj, Qnil, koff, klen);
+	break;
+    default:
+	saj_error(saj, "invalid format, expected a value");
+	break;
     }
-    return b;
 }
 
-static char*
-unicode_to_chars(ParseInfo pi, char *t, uint32_t code) {
-    if (0x0000007F >= code) {
-	*t = (char)code;
-    } else if (0x000007FF >= code) {
-	*t++ = 0xC0 | (code >> 6);
-	*t = 0x80 | (0x3F & code);
-    } else if (0x0000FFFF >= code) {
-	*t++ = 0xE0 | (code >> 12);
-	*t++ = 0x80 | ((code >> 6) & 0x3F);
-	*t = 0x80 | (0x3F & code);
-    } else if (0x001FFFFF >= code) {
-	*t++ = 0xF0 | (code >> 18);
-	*t++ = 0x80 | ((code >> 12) & 0x3F);
-	*t++ = 0x80 | ((code >> 6) & 0x3F);
-	*t = 0x80 | (0x3F & code);
-    } else if (0x03FFFFFF >= code) {
-	*t++ = 0xF8 | (code >> 24);
-	*t++ = 0x80 | ((code >> 18) & 0x3F);
-	*t++ = 0x80 | ((code >> 12) & 0x3F);
-	*t++ = 0x80 | ((code >> 6) & 0x3F);
-	*t = 0x80 | (0x3F & code);
-    } else if (0x7FFFFFFF >= code) {
-	*t++ = 0xFC | (code >> 30);
-	*t++ = 0x80 | ((code >> 24) & 0x3F);
-	*t++ = 0x80 | ((code >> 18) & 0x3F);
-	*t++ = 0x80 | ((code >> 12) & 0x3F);
-	*t++ = 0x80 | ((code >> 6) & 0x3F);
-	*t = 0x80 | (0x3F & code);
-    } else {
-	if (pi->has_error) {
-	    call_error("invalid Unicode", pi, __FILE__, __LINE__);
+static void
+start_container(Saj saj, bool hash, size_t koff, long klen) {
+    if (saj->end <= saj->tail) {
+	size_t	cnt = saj->end - saj->head;
+
+	REALLOC_N(saj->head, struct _sajFrame, cnt * 2);
+	saj->tail = saj->head + cnt;
+	saj->end = saj->head + cnt * 2;
+    }
+    saj->tail->koff = koff;
+    saj->tail->klen = klen;
+    saj->tail->hash = hash;
+    saj->tail++;
+    if (hash) {
+	if (saj->has_hash_start) {
+	    call_key(saj, oj_hash_start_id, koff, klen);
 	}
-	raise_error("invalid Unicode", pi->str, pi->s);
+    } else if (saj->has_array_start) {
+	call_key(saj, oj_array_start_id, koff, klen);
     }
-    return t;
 }
 
-/* Assume the value starts immediately and goes until the quote character is
- * reached again. Do not read the character after the terminating quote.
- */
-static char*
-read_quoted_value(ParseInfo pi) {
-    char	*value = 0;
-    char	*h = pi->s; /* head */
-    char	*t = h;	    /* tail */
-    uint32_t	code;
-
-    h++;	/* skip quote character */
-    t++;
-    value = h;
-    for (; '"' != *h; h++, t++) {
-	if ('\0' == *h) {
-	    pi->s = h;
-	    raise_error("quoted string not terminated", pi->str, pi->s);
-	} else if ('\\' == *h) {
-	    h++;
-	    switch (*h) {
-	    case 'n':	*t = '\n';	break;
-	    case 'r':	*t = '\r';	break;
-	    case 't':	*t = '\t';	break;
-	    case 'f':	*t = '\f';	break;
-	    case 'b':	*t = '\b';	break;
-	    case '"':	*t = '"';	break;
-	    case '/':	*t = '/';	break;
-	    case '\\':	*t = '\\';	break;
-	    case 'u':
-		h++;
-		code = read_hex(pi, h);
-		h += 3;
-		if (0x0000D800 <= code && code <= 0x0000DFFF) {
-		    uint32_t	c1 = (code - 0x0000D800) & 0x000003FF;
-		    uint32_t	c2;
+static void
+end_container(Saj saj) {
+    SajFrame	frame = --saj->tail;
 
-		    h++;
-		    if ('\\' != *h || 'u' != *(h + 1)) {
-			pi->s = h;
-			if (pi->has_error) {
-			    call_error("invalid escaped character", pi, __FILE__, __LINE__);
-			}
-			raise_error("invalid escaped character", pi->str, pi->s);
-		    }
-		    h += 2;
-		    c2 = read_hex(pi, h);
-		    h += 3;
-		    c2 = (c2 - 0x0000DC00) & 0x000003FF;
-		    code = ((c1 << 10) | c2) + 0x00010000;
-		}
-		t = unicode_to_chars(pi, t, code);
-		break;
-	    default:
-		pi->s = h;
-		if (pi->has_error) {
-		    call_error("invalid escaped character", pi, __FILE__, __LINE__);
-		}
-		raise_error("invalid escaped character", pi->str, pi->s);
-		break;
-	    }
-	} else if (t != h) {
-	    *t = *h;
+    if (frame->hash) {
+	if (saj->has_hash_end) {
+	    call_key(saj, oj_hash_end_id, frame->koff, frame->klen);
 	}
+    } else if (saj->has_array_end) {
+	call_key(saj, oj_array_end_id, frame->koff, frame->klen);
     }
-    *t = '\0'; /* terminate value */
-    pi->s = h + 1;
+    if (0 <= frame->klen) {
+	saj->keys.tail = saj->keys.head + frame->koff;
+    }
+}
 
-    return value;
+// Reads a key and the colon after it onto the key store. Returns the first
+// character of the value.
+static char
+read_key(Saj saj, char c, size_t *koff, long *klen) {
+    if ('"' != c) {
+	saj_error(saj, "invalid format, expected a string key");
+    }
+    read_quoted_value(saj);
+    *koff = buf_len(&saj->keys);
+    *klen = buf_len(&saj->buf);
+    buf_append_string(&saj->keys, saj->buf.head, *klen);
+    if (saj->keys.no_mem) {
+	rb_raise(rb_eNoMemError, "not enough memory");
+    }
+    if (':' != next_non_white(saj)) {
+	saj_error(saj, "invalid format, expected :");
+    }
+    return next_non_white(saj);
 }
 
-static void
-saj_parse(VALUE handler, char *json) {
-    volatile VALUE	obj = Qnil;
-    struct _parseInfo	pi;
+// Reads the commas and closes that follow a value. Returns the first
+// character of the next value or '\0' once the document is complete.
+static char
+read_after_value(Saj saj, size_t *koff, long *klen) {
+    char	c;
+
+    while (saj->head < saj->tail) {
+	SajFrame	frame = saj->tail - 1;
 
-    if (0 == json) {
-	if (pi.has_error) {
-	    call_error("Invalid arg, xml string can not be null", &pi, __FILE__, __LINE__);
+	c = next_non_white(saj);
+	if (',' == c) {
+	    c = next_non_white(saj);
+	    if (frame->hash) {
+		return read_key(saj, c, koff, klen);
+	    }
+	    *klen = -1;
+	    return c;
 	}
-	raise_error("Invalid arg, xml string can not be null", json, 0);
-    }
-    /* skip UTF-8 BOM if present */
-    if (0xEF == (uint8_t)*json && 0xBB == (uint8_t)json[1] && 0xBF == (uint8_t)json[2]) {
-	json += 3;
+	if (frame->hash) {
+	    if ('}' != c) {
+		saj_error(saj, "invalid format, expected , or } while in an object");
+	    }
+	} else if (']' != c) {
+	    saj_error(saj, "invalid format, expected , or ] while in an array");
+	}
+	end_container(saj);
     }
-    /* initialize parse info */
-    pi.str = json;
-    pi.s = json;
-#if IS_WINDOWS
-    pi.stack_min = (void*)((char*)&obj - (512 * 1024)); /* assume a 1M stack and give half to ruby */
-#else
-    {
-	struct rlimit	lim;
+    return '\0';
+}
 
-	if (0 == getrlimit(RLIMIT_STACK, &lim) && RLIM_INFINITY != lim.rlim_cur) {
-	    pi.stack_min = (void*)((char*)&obj - (lim.rlim_cur / 4 * 3)); /* let 3/4ths of the stack be used only */
+static VALUE
+saj_parse(VALUE x) {
+    Saj		saj = (Saj)x;
+    size_t	koff = 0;
+    long	klen = -1;
+    char	c = reader_get(&saj->rd);
+
+    // skip UTF-8 BOM if present
+    if (0xEF == (uint8_t)c) {
+	if (0xBB == (uint8_t)reader_get(&saj->rd) && 0xBF == (uint8_t)reader_get(&saj->rd)) {
+	    c = next_non_white(saj);
 	} else {
-	    pi.stack_min = 0; /* indicates not to check stack limit */
+	    saj_error(saj, "invalid format, expected a value");
 	}
-    }
-#endif
-    pi.handler = handler;
-    pi.has_hash_start = rb_respond_to(handler, oj_hash_start_id);
-    pi.has_hash_end = rb_respond_to(handler, oj_hash_end_id);
-    pi.has_array_start = rb_respond_to(handler, oj_array_start_id);
-    pi.has_array_end = rb_respond_to(handler, oj_array_end_id);
-    pi.has_add_value = rb_respond_to(handler, oj_add_value_id);
-    pi.has_error = rb_respond_to(handler, oj_error_id);
-    read_next(&pi, 0);
-    next_non_white(&pi);
-    if ('\0' != *pi.s) {
-	if (pi.has_error) {
-	    call_error("invalid format, extra characters", &pi, __FILE__, __LINE__);
-	} else {
-	    raise_error("invalid format, extra characters", pi.str, pi.s);
+    } else if ('/' == c) {
+	skip_comment(saj);
+	c = next_non_white(saj);
+    } else if (is_white(c)) {
+	c = next_non_white(saj);
+    }
+    if ('\0' == c) {
+	return Qnil;
+    }
+    while ('\0' != c) {
+	switch (c) {
+	case '{':
+	    start_container(saj, true, koff, klen);
+	    if ('}' != (c = next_non_white(saj))) {
+		c = read_key(saj, c, &koff, &klen);
+		continue;
+	    }
+	    end_container(saj);
+	    break;
+	case '[':
+	    start_container(saj, false, koff, klen);
+	    if (']' != (c = next_non_white(saj))) {
+		klen = -1;
+		continue;
+	    }
+	    end_container(saj);
+	    break;
+	default:
+	    read_scalar(saj, c, koff, klen);
+	    break;
 	}
+	c = read_after_value(saj, &koff, &klen);
     }
+    if ('\0' != next_non_white(saj)) {
+	saj_err(saj, "invalid format, extra characters", __FILE__, __LINE__, false);
+    }
+    return Qnil;
+}
+
+static VALUE
+saj_cleanup(VALUE x) {
+    Saj	saj = (Saj)x;
+
+    xfree(saj->head);
+    buf_cleanup(&saj->buf);
+    buf_cleanup(&saj->keys);
+    reader_cleanup(&saj->rd);
+
+    return Qnil;
 }
 
 /* call-seq: saj_parse(handler, io)
@@ -655,57 +605,35 @@ saj_parse(VALUE handler, char *json) {
  * @param [Oj::Saj] handler Saj (responds to Oj::Saj methods) like handler
  * @param [IO|String] io IO Object to read from
  * @deprecated The sc_parse() method along with the ScHandler is the preferred
- * callback parser. It is slightly faster and handles streams while the
- * saj_parse() methos requires a complete read before parsing.
+ * callback parser. It is slightly faster and builds the values with the
+ * handler instead of passing each key.
  * @see sc_parse
  */
 VALUE
 oj_saj_parse(int argc, VALUE *argv, VALUE self) {
-    char	*json = 0;
-    size_t	len = 0;
-    VALUE	input = argv[1];
+    struct _saj	saj;
+    VALUE	handler = *argv;
 
     if (argc < 2) {
 	rb_raise(rb_eArgError, "Wrong number of arguments to saj_parse.\n");
     }
-    if (rb_type(input) == T_STRING) {
-	// the json string gets modified so make a copy of it
-	len = RSTRING_LEN(input) + 1;
-	json = ALLOC_N(char, len);
-	strcpy(json, StringValuePtr(input));
-    } else {
-	VALUE		clas = rb_obj_class(input);
-	volatile VALUE	s;
-
-	if (oj_stringio_class == clas) {
-	    s = rb_funcall2(input, oj_string_id, 0, 0);
-	    len = RSTRING_LEN(s) + 1;
-	    json = ALLOC_N(char, len);
-	    strcpy(json, rb_string_value_cstr((VALUE*)&s));
-#if !IS_WINDOWS
-	} else if (rb_cFile == clas && 0 == FIX2INT(rb_funcall(input, oj_pos_id, 0))) {
-	    int		fd = FIX2INT(rb_funcall(input, oj_fileno_id, 0));
-	    ssize_t	cnt;
-
-	    len = lseek(fd, 0, SEEK_END);
-	    lseek(fd, 0, SEEK_SET);
-	    json = ALLOC_N(char, len + 1);
-	    if (0 >= (cnt = read(fd, json, len)) || cnt != (ssize_t)len) {
-		rb_raise(rb_eIOError, "failed to read from IO Object.");
-	    }
-	    json[len] = '\0';
-#endif
-	} else if (rb_respond_to(input, oj_read_id)) {
-	    s = rb_funcall2(input, oj_read_id, 0, 0);
-	    len = RSTRING_LEN(s) + 1;
-	    json = ALLOC_N(char, len);
-	    strcpy(json, rb_string_value_cstr((VALUE*)&s));
-	} else {
-	    rb_raise(rb_eArgError, "saj_parse() expected a String or IO Object.");
-	}
-    }
-    saj_parse(*argv, json);
-    xfree(json);
+    if (T_STRING != rb_type(argv[1]) && oj_stringio_class != rb_obj_class(argv[1]) && !rb_respond_to(argv[1], oj_read_id)) {
+	rb_raise(rb_eArgError, "saj_parse() expected a String or IO Object.");
+    }
+    oj_reader_init(&saj.rd, argv[1], 0, false, 0);
+    buf_init(&saj.buf);
+    buf_init(&saj.keys);
+    saj.head = ALLOC_N(struct _sajFrame, 16);
+    saj.end = saj.head + 16;
+    saj.tail = saj.head;
+    saj.handler = handler;
+    saj.has_hash_start = rb_respond_to(handler, oj_hash_start_id);
+    saj.has_hash_end = rb_respond_to(handler, oj_hash_end_id);
+    saj.has_array_start = rb_respond_to(handler, oj_array_start_id);
+    saj.has_array_end = rb_respond_to(handler, oj_array_end_id);
+    saj.has_add_value = rb_respond_to(handler, oj_add_value_id);
+    saj.has_error = rb_respond_to(handler, oj_error_id);
+    rb_ensure(saj_parse, (VALUE)&saj, saj_cleanup, (VALUE)&saj);
 
     return Qnil;
 }
@@ -10,6 +10,7 @@
 #include "oj.h"
 #include "parse.h"
 #include "encode.h"
+#include "hash.h"
 
 static VALUE
 noop_start(ParseInfo pi) {
@@ -104,11 +105,11 @@ calc_hash_key(ParseInfo pi, Val kval) {
     volatile VALUE	rkey = kval->key_val;
 
     if (Qundef == rkey) {
-	rkey = rb_str_new(kval->key, kval->klen);
-	rkey = oj_encode(rkey);
 	if (Yes == pi->options.sym_key) {
-	    rkey = rb_str_intern(rkey);
+	    return oj_sym_new(kval->key, kval->klen);
 	}
+	rkey = rb_str_new(kval->key, kval->klen);
+	rkey = oj_encode(rkey);
     }
     return rkey;
 }
@@ -165,6 +166,7 @@ oj_sc_parse(int argc, VALUE *argv, VALUE self) {
     pi.options = oj_default_options;
     if (3 == argc) {
 	oj_parse_options(argv[2], &pi.options);
+	pi.compression = oj_compression(argv[2]);
     }
     if (rb_block_given_p()) {
 	pi.proc = Qnil;
@@ -213,7 +215,7 @@ oj_sc_parse(int argc, VALUE *argv, VALUE self) {
     }
     pi.has_callbacks = true;
 
-    if (T_STRING == rb_type(input)) {
+    if (T_STRING == rb_type(input) && NO_COMPRESS == pi.compression) {
 	return oj_pi_parse(argc - 1, argv + 1, &pi, 0, 0, 1);
     } else {
 	return oj_pi_sparse(argc - 1, argv + 1, &pi, 0);
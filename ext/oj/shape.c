@@ -0,0 +1,416 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "oj.h"
+#include "err.h"
+#include "parse.h"
+#include "encode.h"
+#include "shape.h"
+
+// Shapes are never freed since other shapes may refer to them.
+static Shape	*shapes = NULL;
+static int	shape_cnt = 0;
+static int	shape_size = 0;
+
+// The strict mode callbacks used for containers that are not shapes.
+static struct _parseInfo	plain;
+
+Shape
+oj_shape_get(VALUE clas) {
+    int	i;
+
+    for (i = shape_cnt - 1; 0 <= i; i--) {
+	if (clas == shapes[i]->clas) {
+	    return shapes[i];
+	}
+    }
+    return NULL;
+}
+
+static ShapeType
+shape_type(VALUE clas, VALUE type, Shape *nested) {
+    *nested = NULL;
+    if (Qnil == type) {
+	return SHAPE_ANY;
+    }
+    if (rb_cInteger == type) {
+	return SHAPE_INTEGER;
+    }
+    if (rb_cFloat == type) {
+	return SHAPE_FLOAT;
+    }
+    if (rb_cString == type) {
+	return SHAPE_STRING;
+    }
+    if (rb_cSymbol == type) {
+	return SHAPE_SYMBOL;
+    }
+    if (T_CLASS == rb_type(type)) {
+	if (clas != type && NULL == (*nested = oj_shape_get(type))) {
+	    rb_raise(rb_eArgError, "%s must be registered as a shape first.", rb_class2name(type));
+	}
+	return SHAPE_OBJECT;
+    }
+    if (T_ARRAY == rb_type(type) && 1 == RARRAY_LEN(type)) {
+	if (SHAPE_OBJECT == shape_type(clas, rb_ary_entry(type, 0), nested)) {
+	    return SHAPE_ARRAY;
+	}
+    }
+    rb_raise(rb_eArgError, "field types must be Integer, Float, String, Symbol, a shape class, or an Array of a shape class.");
+
+    return SHAPE_ANY;
+}
+
+static void
+set_nested(OnlyNode node, Shape shape) {
+    node->children = shape->node.children;
+    node->cnt = shape->cnt;
+    node->keep = false;
+}
+
+void
+oj_shape_register(VALUE clas, VALUE fields, VALUE types) {
+    Shape	shape;
+    VALUE	members = Qnil;
+    long	cnt;
+    long	i;
+
+    Check_Type(clas, T_CLASS);
+    shape = ALLOC(struct _shape);
+    memset(shape, 0, sizeof(struct _shape));
+    shape->clas = clas;
+    shape->is_struct = (Qtrue == rb_class_inherited_p(clas, rb_cStruct));
+    if (shape->is_struct) {
+	members = rb_funcall(clas, rb_intern("members"), 0);
+	if (Qnil == fields) {
+	    fields = members;
+	}
+    }
+    Check_Type(fields, T_ARRAY);
+    if (Qnil != types) {
+	Check_Type(types, T_HASH);
+    }
+    cnt = RARRAY_LEN(fields);
+    shape->cnt = (int)cnt;
+    shape->node.children = ALLOC_N(struct _onlyNode, cnt);
+    shape->node.cnt = (int)cnt;
+    shape->fields = ALLOC_N(struct _shapeField, cnt);
+    memset(shape->node.children, 0, sizeof(struct _onlyNode) * cnt);
+    memset(shape->fields, 0, sizeof(struct _shapeField) * cnt);
+    for (i = 0; i < cnt; i++) {
+	VALUE		name = rb_ary_entry(fields, i);
+	VALUE		sym;
+	VALUE		type = Qnil;
+	OnlyNode	node = shape->node.children + i;
+	ShapeField	f = shape->fields + i;
+	const char	*key;
+	char		*ivar;
+
+	switch (rb_type(name)) {
+	case T_SYMBOL:
+	    sym = name;
+	    name = rb_sym2str(name);
+	    break;
+	case T_STRING:
+	    sym = rb_str_intern(name);
+	    break;
+	default:
+	    rb_raise(rb_eArgError, "shape fields must be Strings or Symbols.");
+	    break;
+	}
+	key = rb_id2name(SYM2ID(sym));
+	node->key = key;
+	node->klen = strlen(key);
+	node->keep = true;
+	ivar = ALLOCA_N(char, node->klen + 2);
+	*ivar = '@';
+	strcpy(ivar + 1, key);
+	f->ivar = rb_intern(ivar);
+	f->index = -1;
+	if (shape->is_struct) {
+	    long	mcnt = RARRAY_LEN(members);
+	    long	m;
+
+	    for (m = 0; m < mcnt; m++) {
+		if (sym == rb_ary_entry(members, m)) {
+		    f->index = (int)m;
+		    break;
+		}
+	    }
+	    if (0 > f->index) {
+		rb_raise(rb_eArgError, "%s is not a member of %s.", key, rb_class2name(clas));
+	    }
+	}
+	if (Qnil != types && Qnil == (type = rb_hash_lookup(types, sym))) {
+	    type = rb_hash_lookup(types, name);
+	}
+	f->type = shape_type(clas, type, &f->shape);
+	if (SHAPE_OBJECT == f->type || SHAPE_ARRAY == f->type) {
+	    if (NULL == f->shape) {
+		f->shape = shape;
+	    }
+	}
+    }
+    // Nested filters refer to the children of the nested shape so they are
+    // set once every field has a node.
+    for (i = 0; i < cnt; i++) {
+	OnlyNode	node = shape->node.children + i;
+	ShapeField	f = shape->fields + i;
+
+	if (SHAPE_OBJECT == f->type) {
+	    set_nested(node, f->shape);
+	} else if (SHAPE_ARRAY == f->type) {
+	    f->star.key = "*";
+	    f->star.klen = 1;
+	    set_nested(&f->star, f->shape);
+	    node->children = &f->star;
+	    node->cnt = 1;
+	    node->keep = false;
+	}
+    }
+    shape->list.children = &shape->list_star;
+    shape->list.cnt = 1;
+    shape->list_star.key = "*";
+    shape->list_star.klen = 1;
+    set_nested(&shape->list_star, shape);
+    rb_gc_register_address(&shape->clas);
+
+    for (i = shape_cnt - 1; 0 <= i; i--) {
+	if (clas == shapes[i]->clas) {
+	    shapes[i] = shape;
+	    return;
+	}
+    }
+    if (shape_size <= shape_cnt) {
+	shape_size = (0 == shape_size) ? 16 : shape_size * 2;
+	REALLOC_N(shapes, Shape, shape_size);
+    }
+    shapes[shape_cnt++] = shape;
+}
+
+// Returns the shape of the container on the stack. A new container takes
+// the shape noted by start_hash() or start_array() on first use.
+inline static Shape
+val_shape(ParseInfo pi, Val v) {
+    if (NULL == v->shape && v->val == pi->shape_obj) {
+	v->shape = pi->shape_next;
+	pi->shape_obj = Qnil;
+    }
+    return v->shape;
+}
+
+// Returns the shape expected for a Hash or for the elements of an Array
+// about to be started.
+static Shape
+expected_shape(ParseInfo pi, bool array) {
+    Val		parent = stack_peek(&pi->stack);
+    Shape	ps;
+    ShapeField	f;
+
+    if (NULL == parent) {
+	return pi->shape;
+    }
+    if (NULL == (ps = val_shape(pi, parent))) {
+	return NULL;
+    }
+    // A replayed tape leaves an Array at NEXT_ARRAY_COMMA between elements.
+    if (NEXT_ARRAY_NEW == parent->next || NEXT_ARRAY_ELEMENT == parent->next || NEXT_ARRAY_COMMA == parent->next) {
+	return array ? NULL : ps;
+    }
+    if (!FIXNUM_P(parent->key_val)) {
+	return NULL;
+    }
+    f = ps->fields + FIX2INT(parent->key_val);
+    if (array) {
+	return (SHAPE_ARRAY == f->type) ? f->shape : NULL;
+    }
+    return (SHAPE_OBJECT == f->type) ? f->shape : NULL;
+}
+
+static VALUE
+start_hash(ParseInfo pi) {
+    Shape		shape = expected_shape(pi, false);
+    volatile VALUE	obj;
+
+    if (NULL == shape) {
+	return plain.start_hash(pi);
+    }
+    if (shape->is_struct) {
+	obj = rb_class_new_instance(0, NULL, shape->clas);
+    } else {
+	obj = rb_obj_alloc(shape->clas);
+    }
+    pi->shape_next = shape;
+    pi->shape_obj = obj;
+
+    return obj;
+}
+
+static VALUE
+start_array(ParseInfo pi) {
+    Shape		shape = expected_shape(pi, true);
+    volatile VALUE	a = plain.start_array(pi);
+
+    if (NULL != shape) {
+	pi->shape_next = shape;
+	pi->shape_obj = a;
+    }
+    return a;
+}
+
+// Returns the field index for a key in a shape, nil for keys not in the
+// shape, or Qundef if the Hash is not a shape.
+static VALUE
+hash_key(ParseInfo pi, const char *key, size_t klen) {
+    Val		parent = stack_peek(&pi->stack);
+    Shape	shape = val_shape(pi, parent);
+    OnlyNode	node;
+    OnlyNode	end;
+
+    if (NULL == shape) {
+	return Qundef;
+    }
+    // The parser already matched the key against the shape filter.
+    if (NULL != parent->only && parent->only->children == shape->node.children && NULL != parent->only_child) {
+	return INT2FIX(parent->only_child - shape->node.children);
+    }
+    for (node = shape->node.children, end = node + shape->cnt; node < end; node++) {
+	if (klen == node->klen && 0 == memcmp(key, node->key, klen)) {
+	    return INT2FIX(node - shape->node.children);
+	}
+    }
+    return Qnil;
+}
+
+static VALUE
+coerce(ShapeType type, VALUE v) {
+    if (Qnil == v) {
+	return v;
+    }
+    switch (type) {
+    case SHAPE_INTEGER:
+	return rb_Integer(v);
+    case SHAPE_FLOAT:
+	return rb_Float(v);
+    case SHAPE_STRING:
+	return (T_STRING == rb_type(v)) ? v : rb_obj_as_string(v);
+    case SHAPE_SYMBOL:
+	if (T_STRING != rb_type(v)) {
+	    rb_raise(rb_eTypeError, "expected a String for a Symbol field.");
+	}
+	return rb_str_intern(v);
+    case SHAPE_OBJECT:
+    case SHAPE_ARRAY:
+    case SHAPE_ANY:
+    default:
+	break;
+    }
+    return v;
+}
+
+static void
+shape_set(ParseInfo pi, Val parent, VALUE value) {
+    ShapeField	f;
+
+    if (!FIXNUM_P(parent->key_val)) {
+	return;
+    }
+    f = parent->shape->fields + FIX2INT(parent->key_val);
+    value = coerce(f->type, value);
+    if (parent->shape->is_struct) {
+	rb_struct_aset(parent->val, INT2FIX(f->index), value);
+    } else {
+	rb_ivar_set(parent->val, f->ivar, value);
+    }
+}
+
+static void
+hash_set_cstr(ParseInfo pi, Val parent, const char *str, size_t len, const char *orig) {
+    if (NULL == parent->shape) {
+	plain.hash_set_cstr(pi, parent, str, len, orig);
+    } else if (FIXNUM_P(parent->key_val)) {
+	volatile VALUE	rstr = rb_str_new(str, len);
+
+	shape_set(pi, parent, oj_encode(rstr));
+    }
+}
+
+static void
+hash_set_num(ParseInfo pi, Val parent, NumInfo ni) {
+    if (NULL == parent->shape) {
+	plain.hash_set_num(pi, parent, ni);
+    } else if (FIXNUM_P(parent->key_val)) {
+	if (ni->infinity || ni->nan) {
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
+	    return;
+	}
+	if (SHAPE_STRING == parent->shape->fields[FIX2INT(parent->key_val)].type) {
+	    shape_set(pi, parent, rb_str_new(ni->str, ni->len));
+	} else {
+	    shape_set(pi, parent, oj_num_as_value(ni));
+	}
+    }
+}
+
+static void
+hash_set_value(ParseInfo pi, Val parent, VALUE value) {
+    if (NULL == parent->shape) {
+	plain.hash_set_value(pi, parent, value);
+    } else {
+	shape_set(pi, parent, value);
+    }
+}
+
+static void
+set_shape_callbacks(ParseInfo pi) {
+    if (NULL == plain.start_hash) {
+	oj_set_strict_callbacks(&plain);
+    }
+    oj_set_strict_callbacks(pi);
+    pi->start_hash = start_hash;
+    pi->hash_key = hash_key;
+    pi->hash_set_cstr = hash_set_cstr;
+    pi->hash_set_num = hash_set_num;
+    pi->hash_set_value = hash_set_value;
+    pi->start_array = start_array;
+}
+
+VALUE
+oj_shape_parse(int argc, VALUE *argv, VALUE self) {
+    struct _parseInfo	pi;
+    Shape		shape;
+    VALUE		args[2];
+
+    if (2 > argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to load_shape().");
+    }
+    Check_Type(argv[1], T_CLASS);
+    if (NULL == (shape = oj_shape_get(argv[1]))) {
+	rb_raise(rb_eArgError, "%s is not a registered shape.", rb_class2name(argv[1]));
+    }
+    parse_info_init(&pi);
+    pi.options = oj_default_options;
+    pi.options.mode = StrictMode;
+    pi.handler = Qnil;
+    pi.err_class = Qnil;
+    pi.shape = shape;
+    pi.shape_obj = Qnil;
+    set_shape_callbacks(&pi);
+    args[0] = argv[0];
+    args[1] = (3 <= argc) ? argv[2] : Qnil;
+    if (T_STRING == rb_type(*argv)) {
+	const char	*s = RSTRING_PTR(*argv);
+
+	// The root filter depends on whether one or a list of the shape is
+	// expected.
+	while (' ' == *s || '\t' == *s || '\n' == *s || '\r' == *s) {
+	    s++;
+	}
+	pi.only = ('[' == *s) ? &shape->list : &shape->node;
+
+	return oj_pi_parse((3 <= argc) ? 2 : 1, args, &pi, 0, 0, false);
+    }
+    return oj_pi_sparse((3 <= argc) ? 2 : 1, args, &pi, 0);
+}
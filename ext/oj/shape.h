@@ -0,0 +1,48 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_SHAPE_H
+#define OJ_SHAPE_H
+
+#include <stdbool.h>
+
+#include "ruby.h"
+#include "only.h"
+
+// A shape is a registered class with the fields to fill when loading with
+// Oj.load_shape(). The field names also form an :only filter tree so keys
+// not in the shape are skipped by the parser and a matched key maps
+// directly to its field.
+
+typedef enum {
+    SHAPE_ANY		= 'a',
+    SHAPE_INTEGER	= 'i',
+    SHAPE_FLOAT		= 'f',
+    SHAPE_STRING	= 's',
+    SHAPE_SYMBOL	= 'y',
+    SHAPE_OBJECT	= 'o', // a nested shape
+    SHAPE_ARRAY		= 'A', // an Array of a nested shape
+} ShapeType;
+
+typedef struct _shapeField {
+    struct _shape	*shape;	// nested shape for SHAPE_OBJECT and SHAPE_ARRAY
+    struct _onlyNode	star;	// element filter for SHAPE_ARRAY
+    ID			ivar;	// attribute for a class
+    int			index;	// member index for a Struct
+    char		type;	// ShapeType
+} *ShapeField;
+
+typedef struct _shape {
+    VALUE		clas;
+    bool		is_struct;
+    int			cnt;
+    struct _onlyNode	node;	   // node.children are parallel to fields
+    struct _onlyNode	list;	   // root filter for an Array of the shape
+    struct _onlyNode	list_star; // the one child of list
+    ShapeField		fields;
+} *Shape;
+
+extern Shape	oj_shape_get(VALUE clas);
+extern void	oj_shape_register(VALUE clas, VALUE fields, VALUE types);
+extern VALUE	oj_shape_parse(int argc, VALUE *argv, VALUE self);
+
+#endif /* OJ_SHAPE_H */
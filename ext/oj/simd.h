@@ -0,0 +1,22 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_SIMD_H
+#define OJ_SIMD_H
+
+// Picks the vector instructions available at compile time. Building with
+// OJ_NO_SIMD defined uses only the scalar code.
+#if !defined(OJ_NO_SIMD)
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define OJ_USE_NEON	1
+#elif defined(__SSE2__) || defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OJ_USE_SSE2	1
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define OJ_USE_AVX2	1
+#endif
+#endif
+#endif
+
+#endif /* OJ_SIMD_H */
@@ -11,7 +11,10 @@
 #include "parse.h"
 #include "buf.h"
 #include "hash.h" // for oj_strndup()
+#include "probes.h"
+#include "stats.h"
 #include "val_stack.h"
+#include "only.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
 #define OJ_INFINITY	(1.0/0.0)
@@ -24,6 +27,37 @@
 #define EXP_MAX		100000
 #define DEC_MAX		15
 
+// Returns the next character that is not white space or '\0' at the end of
+// the input. Runs of white space are scanned in the reader buffer directly
+// instead of a character at a time.
+static char
+next_non_white(Reader rd) {
+    while (true) {
+	rd->tail = (char*)oj_scan_white(rd->tail, rd->read_end);
+	if (rd->tail < rd->read_end) {
+	    return *rd->tail++;
+	}
+	if (0 != oj_reader_read(rd)) {
+	    return '\0';
+	}
+    }
+}
+
+// Moves the tail past a run of string characters that need no decoding and
+// returns the character that ended the run or '\0' at the end of the input.
+static char
+next_str_stop(Reader rd) {
+    while (true) {
+	rd->tail = (char*)oj_scan_string(rd->tail, rd->read_end);
+	if (rd->tail < rd->read_end) {
+	    return *rd->tail++;
+	}
+	if (0 != oj_reader_read(rd)) {
+	    return '\0';
+	}
+    }
+}
+
 static void
 skip_comment(ParseInfo pi) {
     char	c = reader_get(&pi->rd);
@@ -209,7 +243,18 @@ read_escaped_str(ParseInfo pi) {
     if (pi->rd.str < pi->rd.tail) {
 	buf_append_string(&buf, pi->rd.str, pi->rd.tail - pi->rd.str);
     }
-    while ('\"' != (c = reader_get(&pi->rd))) {
+    while (true) {
+	Reader		rd = &pi->rd;
+	const char	*start = rd->tail;
+
+	// Runs without escapes are copied from the reader buffer in one step.
+	rd->tail = (char*)oj_scan_string(start, rd->read_end);
+	if (start < rd->tail) {
+	    buf_append_string(&buf, start, rd->tail - start);
+	}
+	if ('\"' == (c = reader_get(rd))) {
+	    break;
+	}
 	if ('\0' == c) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
 	    buf_cleanup(&buf);
@@ -276,6 +321,11 @@ read_escaped_str(ParseInfo pi) {
 	    buf_append(&buf, c);
 	}
     }
+    if (buf.no_mem) {
+	oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	buf_cleanup(&buf);
+	return;
+    }
     if (0 == parent) {
 	pi->add_cstr(pi, buf.head, buf_len(&buf), pi->rd.str);
     } else {
@@ -287,7 +337,10 @@ read_escaped_str(ParseInfo pi) {
 	    break;
 	case NEXT_HASH_NEW:
 	case NEXT_HASH_KEY:
-	    if (Qundef == (parent->key_val = pi->hash_key(pi, buf.head, buf_len(&buf)))) {
+	    if (NULL != parent->only && NULL == (parent->only_child = oj_only_child(parent->only, buf.head, buf_len(&buf)))) {
+		parent->key = "";
+		parent->klen = 0;
+	    } else if (Qundef == (parent->key_val = pi->hash_key(pi, buf.head, buf_len(&buf)))) {
 		parent->klen = buf_len(&buf);
 		parent->key = malloc(parent->klen + 1);
 		memcpy((char*)parent->key, buf.head, parent->klen);
@@ -326,7 +379,7 @@ read_str(ParseInfo pi) {
     char	c;
 
     reader_protect(&pi->rd);
-    while ('\"' != (c = reader_get(&pi->rd))) {
+    while ('\"' != (c = next_str_stop(&pi->rd))) {
 	if ('\0' == c) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
 	    return;
@@ -349,13 +402,24 @@ read_str(ParseInfo pi) {
 	case NEXT_HASH_NEW:
 	case NEXT_HASH_KEY:
 	    parent->klen = pi->rd.tail - pi->rd.str - 1;
-	    if (sizeof(parent->karray) <= parent->klen) {
+	    if (NULL != parent->only && NULL == (parent->only_child = oj_only_child(parent->only, pi->rd.str, parent->klen))) {
+		// The value will be skipped so the key is not needed.
+		parent->key = "";
+		parent->klen = 0;
+		parent->kalloc = 0;
+		parent->k1 = *pi->rd.str;
+		parent->next = NEXT_HASH_COLON;
+		break;
+	    }
+	    if (sizeof(((ValCold)0)->karray) <= parent->klen) {
 		parent->key = oj_strndup(pi->rd.str, parent->klen);
 		parent->kalloc = 1;
 	    } else {
-		memcpy(parent->karray, pi->rd.str, parent->klen);
-		parent->karray[parent->klen] = '\0';
-		parent->key = parent->karray;
+		char	*karray = stack_cold(&pi->stack, parent)->karray;
+
+		memcpy(karray, pi->rd.str, parent->klen);
+		karray[parent->klen] = '\0';
+		parent->key = karray;
 		parent->kalloc = 0;
 	    }
 	    parent->key_val = pi->hash_key(pi, parent->key, parent->klen);
@@ -400,6 +464,7 @@ read_num(ParseInfo pi) {
     ni.nan = 0;
     ni.neg = 0;
     ni.has_exp = 0;
+    ni.truncated = 0;
     if (CompatMode == pi->options.mode) {
 	ni.no_big = !pi->options.compat_bigdec;
 	ni.bigdec_load = pi->options.compat_bigdec;
@@ -468,8 +533,10 @@ read_num(ParseInfo pi) {
 		if (0 < ni.num || 0 < ni.i) {
 		    dec_cnt++;
 		}
-		if (INT64_MAX <= ni.div) {
-		    if (!ni.no_big) {
+		// Stop collecting digits before num or div overflow.
+		if (INT64_MAX / 10 <= ni.div || (INT64_MAX - 9) / 10 < ni.num) {
+		    ni.truncated = 1;
+		    if (DEC_MAX < dec_cnt && !ni.no_big) {
 			ni.big = true;
 		    }
 		} else {
@@ -495,6 +562,10 @@ read_num(ParseInfo pi) {
 	    } else if ('+' == c) {
 		c = reader_get(&pi->rd);
 	    }
+	    if (c < '0' || '9' < c) {
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Invalid float");
+		return;
+	    }
 	    for (; '0' <= c && c <= '9'; c = reader_get(&pi->rd)) {
 		ni.exp = ni.exp * 10 + (c - '0');
 		if (EXP_MAX <= ni.exp) {
@@ -573,11 +644,121 @@ read_nan(ParseInfo pi) {
     add_num_value(pi, &ni);
 }
 
+// Skips the rest of a string that is not on an :only path.
+static bool
+skip_str(ParseInfo pi) {
+    char	c;
+
+    while ('"' != (c = next_str_stop(&pi->rd))) {
+	if ('\0' == c) {
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
+	    return false;
+	}
+	if ('\\' == c) {
+	    reader_get(&pi->rd);
+	}
+    }
+    return true;
+}
+
+// Skips a value that is not on an :only path. Only quotes and brackets are
+// checked to find where it ends. Nothing is protected so the reader buffer
+// keeps sliding and a large skipped value is never held in memory.
+static void
+skip_value(ParseInfo pi) {
+    char	start = next_non_white(&pi->rd);
+    char	c;
+    int		depth = 1;
+
+    switch (start) {
+    case '"':
+	skip_str(pi);
+	break;
+    case '{':
+    case '[':
+	while (0 < depth && '\0' != (c = reader_get(&pi->rd))) {
+	    switch (c) {
+	    case '"':
+		if (!skip_str(pi)) {
+		    return;
+		}
+		break;
+	    case '{':
+	    case '[':
+		depth++;
+		break;
+	    case '}':
+	    case ']':
+		depth--;
+		break;
+	    default:
+		break;
+	    }
+	}
+	if (0 < depth) {
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "%s not terminated", ('{' == start) ? "hash" : "array");
+	}
+	break;
+    case '\0':
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected character");
+	break;
+    default:
+	// The character that ends a scalar is left for the main loop.
+	while ('\0' != (c = reader_get(&pi->rd))) {
+	    if (',' == c || '}' == c || ']' == c || '/' == c || is_white(c)) {
+		reader_backup(&pi->rd);
+		break;
+	    }
+	}
+	break;
+    }
+}
+
+// Returns the :only filter for a container about to be started.
+static OnlyNode
+only_for_new(ParseInfo pi) {
+    Val	parent = stack_peek(&pi->stack);
+
+    if (NULL == parent) {
+	return oj_only_root(pi->options.only);
+    }
+    if (NULL == parent->only) {
+	return NULL;
+    }
+    return oj_only_filter(parent->only_child);
+}
+
 static void
 array_start(ParseInfo pi) {
+    OnlyNode	only = (Qnil == pi->options.only) ? NULL : only_for_new(pi);
     VALUE	v = pi->start_array(pi);
 
-    stack_push(&pi->stack, v, NEXT_ARRAY_NEW);
+    if (!stack_push(&pi->stack, v, NEXT_ARRAY_NEW)) {
+	oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	return;
+    }
+    if (NULL != only) {
+	Val	array = stack_peek(&pi->stack);
+
+	array->only = only;
+	array->only_child = oj_only_child(only, "*", 1);
+	if (NULL == array->only_child) {
+	    // No element can match so skip them all and leave the close.
+	    char	c = next_non_white(&pi->rd);
+
+	    while (']' != c && !err_has(&pi->err)) {
+		reader_backup(&pi->rd);
+		skip_value(pi);
+		c = next_non_white(&pi->rd);
+		if (',' == c) {
+		    c = next_non_white(&pi->rd);
+		} else if (']' != c) {
+		    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "expected comma or array close");
+		}
+	    }
+	    reader_backup(&pi->rd);
+	}
+    }
 }
 
 static void
@@ -596,9 +777,16 @@ array_end(ParseInfo pi) {
 
 static void
 hash_start(ParseInfo pi) {
+    OnlyNode		only = (Qnil == pi->options.only) ? NULL : only_for_new(pi);
     volatile VALUE	v = pi->start_hash(pi);
 
-    stack_push(&pi->stack, v, NEXT_HASH_NEW);
+    if (!stack_push(&pi->stack, v, NEXT_HASH_NEW)) {
+	oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	return;
+    }
+    if (NULL != only) {
+	stack_peek(&pi->stack)->only = only;
+    }
 }
 
 static void
@@ -638,6 +826,10 @@ colon(ParseInfo pi) {
 
     if (0 != parent && NEXT_HASH_COLON == parent->next) {
 	parent->next = NEXT_HASH_VALUE;
+	if (NULL != parent->only && NULL == parent->only_child) {
+	    skip_value(pi);
+	    parent->next = NEXT_HASH_COMMA;
+	}
     } else {
 	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected colon");
     }
@@ -658,7 +850,7 @@ oj_sparse2(ParseInfo pi) {
 	    pi->err_class = err_clas;
 	    return;
 	}
-	c = reader_next_non_white(&pi->rd);
+	c = next_non_white(&pi->rd);
 	if (!first && '\0' != c) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected characters after the JSON document");
 	}
@@ -787,7 +979,7 @@ oj_sparse2(ParseInfo pi) {
 	if (stack_empty(&pi->stack)) {
 	    if (Qundef != pi->proc) {
 		VALUE	args[3];
-		long	len = pi->rd.pos - start;
+		long	len = reader_pos(&pi->rd) - start;
 
 		*args = stack_head_val(&pi->stack);
 		args[1] = LONG2NUM(start);
@@ -801,7 +993,7 @@ oj_sparse2(ParseInfo pi) {
 	    } else if (!pi->has_callbacks) {
 		first = 0;
 	    }
-	    start = pi->rd.pos;
+	    start = reader_pos(&pi->rd);
 	    // TBD break if option set to allow that
 	}
     }
@@ -820,6 +1012,7 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     volatile VALUE	wrapped_stack;
     VALUE		result = Qnil;
     int			line = 0;
+    size_t		alloc_start;
 
     if (argc < 1) {
 	rb_raise(rb_eArgError, "Wrong number of arguments to parse.");
@@ -828,6 +1021,8 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     if (2 <= argc) {
 	if (T_HASH == rb_type(argv[1])) {
 	    oj_parse_options(argv[1], &pi->options);
+	} else if (oj_options_class == rb_obj_class(argv[1])) {
+	    pi->options = *oj_options_load(argv[1]);
 	} else if (3 <= argc && T_HASH == rb_type(argv[2])) {
 	    oj_parse_options(argv[2], &pi->options);
 	}
@@ -846,7 +1041,8 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     } else {
 	pi->proc = Qundef;
     }
-    oj_reader_init(&pi->rd, input, fd, CompatMode == pi->options.mode);
+    oj_reader_init(&pi->rd, input, fd, CompatMode == pi->options.mode, pi->options.buffer_size);
+    oj_reader_inflate(&pi->rd, pi->compression);
     pi->json = 0; // indicates reader is in use
 
     if (Yes == pi->options.circular) {
@@ -861,6 +1057,8 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     // freed. We protect against this by wrapping the value stack in a ruby
     // data object and providing a mark function for ruby objects on the
     // value stack (while it is in scope).
+    alloc_start = oj_stats_allocated();
+    OJ_PROBE2(load__start, (size_t)0, (int)pi->options.mode);
     wrapped_stack = oj_stack_init(&pi->stack);
     rb_protect(protect_parse, (VALUE)pi, &line);
     if (Qundef == pi->stack.head->val && !empty_ok(&pi->options)) {
@@ -868,6 +1066,9 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     }
     result = stack_head_val(&pi->stack);
     DATA_PTR(wrapped_stack) = 0;
+    oj_stats.loads++;
+    oj_stats.bytes_parsed += reader_pos(&pi->rd);
+    oj_stats.objects_created += oj_stats_allocated() - alloc_start;
     if (No == pi->options.allow_gc) {
 	rb_gc_enable();
     }
@@ -908,10 +1109,12 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     }
 CLEANUP:
     // proceed with cleanup
+    OJ_PROBE3(load__done, (size_t)reader_pos(&pi->rd), (int)pi->options.mode, 0 != line || err_has(&pi->err));
     if (0 != pi->circ_array) {
 	oj_circ_array_free(pi->circ_array);
     }
     stack_cleanup(&pi->stack);
+    reader_cleanup(&pi->rd);
     if (0 != fd) {
 	close(fd);
     }
@@ -0,0 +1,60 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <string.h>
+
+#include "oj.h"
+#include "hash.h"
+#include "local.h"
+#include "stats.h"
+
+struct _ojStats	oj_stats;
+
+static VALUE	total_allocated_sym = Qundef;
+
+void
+oj_stats_init() {
+    total_allocated_sym = ID2SYM(rb_intern("total_allocated_objects"));
+    rb_gc_register_address(&total_allocated_sym);
+}
+
+// Returns the number of objects Ruby has allocated so far. Loads record the
+// difference over the parse as the objects they created.
+size_t
+oj_stats_allocated() {
+    return rb_gc_stat(total_allocated_sym);
+}
+
+static void
+set_stat(VALUE h, const char *key, uint64_t val) {
+    rb_hash_aset(h, ID2SYM(rb_intern(key)), ULL2NUM(val));
+}
+
+VALUE
+oj_stats_hash(bool reset) {
+    volatile VALUE	h = rb_hash_new();
+    uint64_t		lookups;
+    uint64_t		hits;
+
+    oj_hash_counts(oj_local()->caches, &lookups, &hits);
+    set_stat(h, "loads", oj_stats.loads);
+    set_stat(h, "bytes_parsed", oj_stats.bytes_parsed);
+    set_stat(h, "objects_created", oj_stats.objects_created);
+    set_stat(h, "dumps", oj_stats.dumps);
+    set_stat(h, "bytes_dumped", oj_stats.bytes_dumped);
+    set_stat(h, "out_grows", oj_stats.out_grows);
+    set_stat(h, "out_grow_bytes", oj_stats.out_grow_bytes);
+    set_stat(h, "reader_grows", oj_stats.reader_grows);
+    set_stat(h, "reader_grow_bytes", oj_stats.reader_grow_bytes);
+    set_stat(h, "cache_hits", hits);
+    set_stat(h, "cache_misses", lookups - hits);
+    set_stat(h, "circular_inserts", oj_stats.circ_inserts);
+    set_stat(h, "as_json_calls", oj_stats.as_json_calls);
+    set_stat(h, "to_json_calls", oj_stats.to_json_calls);
+    set_stat(h, "to_s_calls", oj_stats.to_s_calls);
+
+    if (reset) {
+	memset(&oj_stats, 0, sizeof(oj_stats));
+	oj_hash_counts_reset(oj_local()->caches);
+    }
+    return h;
+}
@@ -0,0 +1,37 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_STATS_H
+#define OJ_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ruby.h"
+
+// Counters that are always kept. Each is a plain increment made while the GVL
+// is held so they cost next to nothing and can be left on in production.
+// Ractors share the counters without a lock so counts made while several
+// Ractors are busy are approximate.
+typedef struct _ojStats {
+    uint64_t	loads;
+    uint64_t	bytes_parsed;
+    uint64_t	objects_created;
+    uint64_t	dumps;
+    uint64_t	bytes_dumped;
+    uint64_t	out_grows;
+    uint64_t	out_grow_bytes;
+    uint64_t	reader_grows;
+    uint64_t	reader_grow_bytes;
+    uint64_t	circ_inserts;
+    uint64_t	as_json_calls;
+    uint64_t	to_json_calls;
+    uint64_t	to_s_calls;
+} *OjStats;
+
+extern struct _ojStats	oj_stats;
+
+extern void	oj_stats_init(void);
+extern size_t	oj_stats_allocated(void);
+extern VALUE	oj_stats_hash(bool reset);
+
+#endif /* OJ_STATS_H */
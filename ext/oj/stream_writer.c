@@ -1,13 +1,270 @@
 // Copyright (c) 2012, 2017 Peter Ohler. All rights reserved.
 
 #include <errno.h>
+#include <unistd.h>
 
 #include <ruby.h>
 
+#include "dump.h"
 #include "encode.h"
+#include "probes.h"
+
+#if defined(HAVE_PTHREAD_MUTEX_INIT) && defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL) && !IS_WINDOWS
+#include <pthread.h>
+#include <ruby/thread.h>
+#define OJ_ASYNC_WRITES 1
+#endif
 
 extern VALUE	Oj;
 
+#ifdef OJ_ASYNC_WRITES
+// With the :async option writes to an fd are made on a writer thread
+// without the GVL while the next buffer fills. A filled buffer is swapped
+// for the drained one so there are never more than two. If the writer is
+// still busy when the next buffer needs to be flushed the pushing thread
+// waits, which keeps memory bounded by the flush limit.
+typedef struct _asyncWriter {
+    pthread_t		thread;
+    pthread_mutex_t	mutex;
+    pthread_cond_t	cond;
+    char		*buf;  // being drained or free for the next swap
+    size_t		size;  // usable size of buf, end - buf of the Out it came from
+    size_t		len;   // bytes of buf left to write
+    Deflater		deflater; // compresses on the writer thread if not NULL
+    DeflateMode		mode;
+    int			fd;    // dup of the StreamWriter fd for buf or -1 when idle
+    int			err;   // errno of the first failed write
+    pid_t		pid;   // the writer thread is not in a forked child
+    bool		pending; // buf has not been handled yet
+    bool		done;
+    bool		exited; // the writer thread will not touch the state again
+    bool		wake;  // returns from a wait so interrupts can be checked
+    struct _asyncWriter	*next; // next on the orphans list
+} *AsyncWriter;
+
+// A writer freed by the GC is not joined since a slow write would block the
+// GC. The thread is told to finish what it has and the state is put on this
+// list, which is only changed while holding the GVL, until the thread has
+// exited.
+static AsyncWriter	orphans = NULL;
+
+static void*
+async_run(void *ctx) {
+    AsyncWriter	aw = (AsyncWriter)ctx;
+    int		err;
+
+    pthread_mutex_lock(&aw->mutex);
+    while (true) {
+	while (!aw->pending && !aw->done) {
+	    pthread_cond_wait(&aw->cond, &aw->mutex);
+	}
+	if (!aw->pending) {
+	    break;
+	}
+	pthread_mutex_unlock(&aw->mutex);
+	if (NULL != aw->deflater) {
+	    err = oj_deflate(aw->deflater, aw->buf, aw->len, aw->mode);
+	} else {
+	    err = oj_write_all(aw->fd, aw->buf, aw->len);
+	}
+	// Each buffer is written to its own dup of the fd so the IO can be
+	// closed, and the fd reused, while an orphan is still writing. It is
+	// closed once written so closing the IO still ends the output.
+	close(aw->fd);
+	pthread_mutex_lock(&aw->mutex);
+	aw->fd = -1;
+	if (0 == aw->err) {
+	    aw->err = err;
+	}
+	aw->len = 0;
+	aw->pending = false;
+	pthread_cond_broadcast(&aw->cond);
+    }
+    aw->exited = true;
+    pthread_mutex_unlock(&aw->mutex);
+
+    return NULL;
+}
+
+static void*
+async_wait(void *ctx) {
+    AsyncWriter	aw = (AsyncWriter)ctx;
+
+    pthread_mutex_lock(&aw->mutex);
+    while (aw->pending && !aw->wake) {
+	pthread_cond_wait(&aw->cond, &aw->mutex);
+    }
+    aw->wake = false;
+    pthread_mutex_unlock(&aw->mutex);
+
+    return NULL;
+}
+
+static void
+async_unblock(void *ctx) {
+    AsyncWriter	aw = (AsyncWriter)ctx;
+
+    pthread_mutex_lock(&aw->mutex);
+    aw->wake = true;
+    pthread_cond_broadcast(&aw->cond);
+    pthread_mutex_unlock(&aw->mutex);
+}
+
+static bool
+async_busy(AsyncWriter aw) {
+    bool	busy;
+
+    pthread_mutex_lock(&aw->mutex);
+    busy = aw->pending;
+    pthread_mutex_unlock(&aw->mutex);
+
+    return busy;
+}
+
+// Waits without the GVL until the writer thread has drained its buffer and
+// raises if any write failed.
+static void
+async_idle(AsyncWriter aw) {
+    while (async_busy(aw)) {
+	rb_thread_call_without_gvl(async_wait, aw, async_unblock, aw);
+	rb_thread_check_ints();
+    }
+    if (0 != aw->err) {
+	rb_raise(rb_eIOError, "Write failed. [_%d_:%s]\n", aw->err, strerror(aw->err));
+    }
+}
+
+static void
+async_write(StreamWriter sw, DeflateMode mode) {
+    AsyncWriter	aw = sw->async;
+    Out		out = &sw->sw.out;
+    char	*buf;
+    size_t	size;
+    int		fd;
+
+    async_idle(aw);
+    if (0 > (fd = dup(sw->fd))) {
+	rb_raise(rb_eIOError, "Write failed. [_%d_:%s]\n", errno, strerror(errno));
+    }
+    if (NULL != aw->deflater) {
+	aw->deflater->ctx = (void*)(intptr_t)fd;
+    }
+    buf = aw->buf;
+    size = aw->size;
+    pthread_mutex_lock(&aw->mutex);
+    aw->fd = fd;
+    aw->buf = out->buf;
+    aw->size = out->end - out->buf;
+    aw->len = out->cur - out->buf;
+    aw->mode = mode;
+    aw->pending = true;
+    pthread_cond_broadcast(&aw->cond);
+    pthread_mutex_unlock(&aw->mutex);
+    out->buf = buf;
+    out->end = buf + size;
+}
+
+// Frees the state. The deflater is only set on orphans as it otherwise
+// belongs to the StreamWriter. A forked child closes its copy of an fd not
+// yet written.
+static void
+async_free(AsyncWriter aw) {
+    if (0 <= aw->fd) {
+	close(aw->fd);
+    }
+    if (NULL != aw->deflater) {
+	oj_deflater_cleanup(aw->deflater);
+	xfree(aw->deflater);
+    }
+    xfree(aw->buf);
+    xfree(aw);
+}
+
+// Frees the orphans whose threads have exited. A forked child has no writer
+// threads so its copies are just freed.
+static void
+async_reap() {
+    AsyncWriter	*ap = &orphans;
+    AsyncWriter	aw;
+    bool	exited;
+
+    while (NULL != (aw = *ap)) {
+	if (getpid() != aw->pid) {
+	    exited = true;
+	} else {
+	    pthread_mutex_lock(&aw->mutex);
+	    exited = aw->exited;
+	    pthread_mutex_unlock(&aw->mutex);
+	    if (exited) {
+		pthread_mutex_destroy(&aw->mutex);
+		pthread_cond_destroy(&aw->cond);
+	    }
+	}
+	if (exited) {
+	    *ap = aw->next;
+	    async_free(aw);
+	} else {
+	    ap = &aw->next;
+	}
+    }
+}
+
+static void
+async_start(StreamWriter sw) {
+    AsyncWriter	aw;
+    size_t	size = sw->sw.out.end - sw->sw.out.buf;
+
+    async_reap();
+    aw = ALLOC(struct _asyncWriter);
+    memset(aw, 0, sizeof(struct _asyncWriter));
+    aw->buf = ALLOC_N(char, size + 10);
+    aw->size = size;
+    aw->fd = -1;
+    aw->deflater = sw->deflater;
+    aw->pid = getpid();
+    pthread_mutex_init(&aw->mutex, 0);
+    pthread_cond_init(&aw->cond, 0);
+    if (0 != pthread_create(&aw->thread, NULL, async_run, aw)) {
+	// Fall back to writing on the calling thread.
+	pthread_mutex_destroy(&aw->mutex);
+	pthread_cond_destroy(&aw->cond);
+	xfree(aw->buf);
+	xfree(aw);
+	return;
+    }
+    sw->async = aw;
+}
+
+// Tells the writer thread to finish what it has and exit without waiting
+// for it. The orphan then owns the deflater.
+static void
+async_orphan(AsyncWriter aw) {
+    pthread_mutex_lock(&aw->mutex);
+    aw->done = true;
+    pthread_cond_broadcast(&aw->cond);
+    pthread_mutex_unlock(&aw->mutex);
+    pthread_detach(aw->thread);
+    aw->next = orphans;
+    orphans = aw;
+    async_reap();
+}
+
+// Returns the AsyncWriter or NULL if there is none in this process. After a
+// fork the child writes on the calling thread.
+static AsyncWriter
+async_get(StreamWriter sw) {
+    if (NULL != sw->async && getpid() != sw->async->pid) {
+	if (NULL != sw->deflater) {
+	    sw->deflater->ctx = (void*)(intptr_t)sw->fd;
+	}
+	sw->async->deflater = NULL;
+	async_free(sw->async);
+	sw->async = NULL;
+    }
+    return sw->async;
+}
+#endif
+
 static void
 stream_writer_free(void *ptr) {
     StreamWriter	sw;
@@ -16,25 +273,59 @@ stream_writer_free(void *ptr) {
 	return;
     }
     sw = (StreamWriter)ptr;
+#ifdef OJ_ASYNC_WRITES
+    if (NULL != async_get(sw)) {
+	async_orphan(sw->async);
+	sw->deflater = NULL;
+    }
+#endif
+    if (NULL != sw->deflater) {
+	oj_deflater_cleanup(sw->deflater);
+	xfree(sw->deflater);
+    }
     xfree(sw->sw.out.buf);
     xfree(sw->sw.types);
     xfree(ptr);
 }
 
+static void
+stream_writer_mark(void *ptr) {
+    if (NULL != ptr) {
+	rb_gc_mark(((StreamWriter)ptr)->stream);
+    }
+}
+
 static void
 stream_writer_reset_buf(StreamWriter sw) {
     sw->sw.out.cur = sw->sw.out.buf;
     *sw->sw.out.cur = '\0';
 }
 
+static void
+stream_writer_deflate(StreamWriter sw, const char *buf, size_t len, DeflateMode mode) {
+    int	err = oj_deflate(sw->deflater, buf, len, mode);
+
+    if (0 != err) {
+	rb_raise(rb_eIOError, "Write failed. [_%d_:%s]\n", err, strerror(err));
+    }
+}
+
 static void
 stream_writer_write(StreamWriter sw) {
     ssize_t	size = sw->sw.out.cur - sw->sw.out.buf;
+    int		err;
 
+    OJ_PROBE1(stream__flush, (size_t)size);
     switch (sw->type) {
     case STRING_IO:
     case STREAM_IO: {
-	volatile VALUE	rs = rb_str_new(sw->sw.out.buf, size);
+	volatile VALUE	rs;
+
+	if (NULL != sw->deflater) {
+	    stream_writer_deflate(sw, sw->sw.out.buf, size, DEFLATE_MORE);
+	    break;
+	}
+	rs = rb_str_new(sw->sw.out.buf, size);
 
 	// Oddly enough, when pushing ASCII characters with UTF-8 encoding or
 	// even ASCII-8BIT does not change the output encoding. Pushing any
@@ -45,8 +336,18 @@ stream_writer_write(StreamWriter sw) {
 	break;
     }
     case FILE_IO:
-	if (size != write(sw->fd, sw->sw.out.buf, size)) {
-	    rb_raise(rb_eIOError, "Write failed. [_%d_:%s]\n", errno, strerror(errno));
+#ifdef OJ_ASYNC_WRITES
+	if (NULL != async_get(sw)) {
+	    if (0 < size) {
+		async_write(sw, DEFLATE_MORE);
+	    }
+	    break;
+	}
+#endif
+	if (NULL != sw->deflater) {
+	    stream_writer_deflate(sw, sw->sw.out.buf, size, DEFLATE_MORE);
+	} else if (0 != (err = oj_write_all(sw->fd, sw->sw.out.buf, size))) {
+	    rb_raise(rb_eIOError, "Write failed. [_%d_:%s]\n", err, strerror(err));
 	}
 	break;
     default:
@@ -55,7 +356,34 @@ stream_writer_write(StreamWriter sw) {
     stream_writer_reset_buf(sw);
 }
 
+// Writes what has been buffered and, with the :async option, waits for the
+// writer thread to finish writing it. Compressed output is flushed too and
+// the gzip member is ended once the document is complete.
+static void
+stream_writer_drain(StreamWriter sw) {
+    stream_writer_write(sw);
+    if (NULL != sw->deflater) {
+	DeflateMode	mode = (0 == sw->sw.depth) ? DEFLATE_FINISH : DEFLATE_SYNC;
+
+#ifdef OJ_ASYNC_WRITES
+	if (NULL != async_get(sw)) {
+	    async_write(sw, mode);
+	    stream_writer_reset_buf(sw);
+	    async_idle(sw->async);
+	    return;
+	}
+#endif
+	stream_writer_deflate(sw, NULL, 0, mode);
+    }
+#ifdef OJ_ASYNC_WRITES
+    if (NULL != async_get(sw)) {
+	async_idle(sw->async);
+    }
+#endif
+}
+
 static VALUE	buffer_size_sym = Qundef;
+static VALUE	async_sym = Qundef;
 
 /* Document-method: new
  * call-seq: new(io, options)
@@ -70,6 +398,17 @@ static VALUE	buffer_size_sym = Qundef;
  * integer. It is considered a hint of how large the initial internal buffer
  * should be and also a hint on when to flush.
  *
+ * If the _:async_ option is true and the io is a File or socket then the
+ * buffer is written by a background thread while the next one fills. A push
+ * that needs to flush while the previous buffer is still being written
+ * waits for it. Errors are raised on the next flush. Call flush or pop_all
+ * before closing the io.
+ *
+ * With the _:compression_ option set to _:gzip_ the output is gzip
+ * compressed as it is written. A flush or pop_all after the document is
+ * complete ends the gzip member. Pushes after that start a new member. With
+ * _:async_ the compression is done on the writer thread.
+ *
  * - *io* [_IO_] stream to write to
  * - *options* [_Hash_] formating options
  */
@@ -98,14 +437,13 @@ stream_writer_new(int argc, VALUE *argv, VALUE self) {
 	rb_raise(rb_eArgError, "expected an IO Object.");
     }
     sw = ALLOC(struct _streamWriter);
+    sw->async = NULL;
+    sw->deflater = NULL;
     if (2 == argc && T_HASH == rb_type(argv[1])) {
 	volatile VALUE	v;
 	int		buf_size = 0;
+	Compression	compression;
 
-	if (Qundef == buffer_size_sym) {
-	    buffer_size_sym = ID2SYM(rb_intern("buffer_size"));	rb_gc_register_address(&buffer_size_sym);
-
-	}
 	if (Qnil != (v = rb_hash_lookup(argv[1], buffer_size_sym))) {
 #ifdef RUBY_INTEGER_UNIFICATION
 	    if (rb_cInteger != rb_obj_class(v)) {
@@ -121,16 +459,31 @@ stream_writer_new(int argc, VALUE *argv, VALUE self) {
 	oj_str_writer_init(&sw->sw, buf_size);
 	oj_parse_options(argv[1], &sw->sw.opts);
 	sw->flush_limit = buf_size;
+	sw->fd = fd;
+	if (NO_COMPRESS != (compression = oj_compression(argv[1]))) {
+	    sw->deflater = ALLOC(struct _deflater);
+	    if (FILE_IO == type) {
+		oj_deflater_init(sw->deflater, compression, oj_deflate_to_fd, (void*)(intptr_t)fd);
+	    } else {
+		oj_deflater_init(sw->deflater, compression, oj_deflate_to_io, (void*)stream);
+	    }
+	}
+#ifdef OJ_ASYNC_WRITES
+	if (FILE_IO == type && Qtrue == rb_hash_lookup(argv[1], async_sym)) {
+	    async_start(sw);
+	}
+#endif
     } else {
 	oj_str_writer_init(&sw->sw, 4096);
 	sw->flush_limit = 0;
     }
     sw->sw.out.indent = sw->sw.opts.indent;
+    sw->sw.out.omit_nil = sw->sw.opts.dump_opts.omit_nil;
     sw->stream = stream;
     sw->type = type;
     sw->fd = fd;
 
-    return Data_Wrap_Struct(oj_stream_writer_class, 0, stream_writer_free, sw);
+    return Data_Wrap_Struct(oj_stream_writer_class, stream_writer_mark, stream_writer_free, sw);
 }
 
 /* Document-method: push_key
@@ -291,6 +644,47 @@ stream_writer_push_json(int argc, VALUE *argv, VALUE self) {
     return Qnil;
 }
 
+static void
+stream_writer_maybe_flush(StrWriter sw) {
+    StreamWriter	ssw = (StreamWriter)sw;
+
+    if (ssw->flush_limit < sw->out.cur - sw->out.buf) {
+	stream_writer_write(ssw);
+    }
+}
+
+/* Document-method: push_values
+ * call-seq: push_values(values)
+ *
+ * Pushes each of the values onto the JSON document, flushing as needed.
+ * - *values* [_Array_] values to add to the JSON array
+ */
+static VALUE
+stream_writer_push_values(VALUE self, VALUE values) {
+    StreamWriter	sw = (StreamWriter)DATA_PTR(self);
+
+    oj_str_writer_push_values(&sw->sw, values, stream_writer_maybe_flush);
+
+    return Qnil;
+}
+
+/* Document-method: push_rows
+ * call-seq: push_rows(keys, rows)
+ *
+ * Pushes a JSON object for each row onto the JSON document, flushing as
+ * needed. The values of each row are paired with the keys in order.
+ * - *keys* [_Array_] String or Symbol keys
+ * - *rows* [_Array_] Arrays of values, one value for each key
+ */
+static VALUE
+stream_writer_push_rows(VALUE self, VALUE keys, VALUE rows) {
+    StreamWriter	sw = (StreamWriter)DATA_PTR(self);
+
+    oj_str_writer_push_rows(&sw->sw, keys, rows, stream_writer_maybe_flush);
+
+    return Qnil;
+}
+
 /* Document-method: pop
  * call-seq: pop()
  *
@@ -319,7 +713,7 @@ stream_writer_pop_all(VALUE self) {
     StreamWriter	sw = (StreamWriter)DATA_PTR(self);
 
     oj_str_writer_pop_all(&sw->sw);
-    stream_writer_write(sw);
+    stream_writer_drain(sw);
 
     return Qnil;
 }
@@ -327,11 +721,12 @@ stream_writer_pop_all(VALUE self) {
 /* Document-method: flush
  * call-seq: flush()
  *
- * Flush any remaining characters in the buffer.
+ * Flush any remaining characters in the buffer. With the _:async_ option this
+ * waits until the background thread has written them.
  */
 static VALUE
 stream_writer_flush(VALUE self) {
-    stream_writer_write((StreamWriter)DATA_PTR(self));
+    stream_writer_drain((StreamWriter)DATA_PTR(self));
 
     return Qnil;
 }
@@ -345,6 +740,9 @@ stream_writer_flush(VALUE self) {
  */
 void
 oj_stream_writer_init() {
+    buffer_size_sym = ID2SYM(rb_intern("buffer_size"));	rb_gc_register_address(&buffer_size_sym);
+    async_sym = ID2SYM(rb_intern("async"));		rb_gc_register_address(&async_sym);
+
     oj_stream_writer_class = rb_define_class_under(Oj, "StreamWriter", rb_cObject);
     rb_define_module_function(oj_stream_writer_class, "new", stream_writer_new, -1);
     rb_define_method(oj_stream_writer_class, "push_key", stream_writer_push_key, 1);
@@ -352,6 +750,8 @@ oj_stream_writer_init() {
     rb_define_method(oj_stream_writer_class, "push_array", stream_writer_push_array, -1);
     rb_define_method(oj_stream_writer_class, "push_value", stream_writer_push_value, -1);
     rb_define_method(oj_stream_writer_class, "push_json", stream_writer_push_json, -1);
+    rb_define_method(oj_stream_writer_class, "push_values", stream_writer_push_values, 1);
+    rb_define_method(oj_stream_writer_class, "push_rows", stream_writer_push_rows, 2);
     rb_define_method(oj_stream_writer_class, "pop", stream_writer_pop, 0);
     rb_define_method(oj_stream_writer_class, "pop_all", stream_writer_pop_all, 0);
     rb_define_method(oj_stream_writer_class, "flush", stream_writer_flush, 0);
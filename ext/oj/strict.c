@@ -40,9 +40,8 @@ add_value(ParseInfo pi, VALUE val) {
 
 static void
 add_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
+    volatile VALUE	rstr = oj_cstr_to_value(pi, str, len);
 
-    rstr = oj_encode(rstr);
     pi->stack.head->val = rstr;
     if (Yes == pi->options.trace) {
 	oj_trace_parse_call("add_string", pi, __FILE__, __LINE__, rstr);
@@ -71,26 +70,11 @@ start_hash(ParseInfo pi) {
     return rb_hash_new();
 }
 
-static VALUE
-calc_hash_key(ParseInfo pi, Val parent) {
-    volatile VALUE	rkey = parent->key_val;
-
-    if (Qundef == rkey) {
-	rkey = rb_str_new(parent->key, parent->klen);
-    }
-    rkey = oj_encode(rkey);
-    if (Yes == pi->options.sym_key) {
-	rkey = rb_str_intern(rkey);
-    }
-    return rkey;
-}
-
 static void
 hash_set_cstr(ParseInfo pi, Val parent, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
+    volatile VALUE	rstr = oj_cstr_to_value(pi, str, len);
 
-    rstr = oj_encode(rstr);
-    rb_hash_aset(stack_peek(&pi->stack)->val, calc_hash_key(pi, parent), rstr);
+    rb_hash_aset(stack_peek(&pi->stack)->val, oj_calc_hash_key(pi, parent), rstr);
     if (Yes == pi->options.trace) {
 	oj_trace_parse_call("set_string", pi, __FILE__, __LINE__, rstr);
     }
@@ -104,7 +88,7 @@ hash_set_num(ParseInfo pi, Val parent, NumInfo ni) {
 	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
     }
     v = oj_num_as_value(ni);
-    rb_hash_aset(stack_peek(&pi->stack)->val, calc_hash_key(pi, parent), v);
+    rb_hash_aset(stack_peek(&pi->stack)->val, oj_calc_hash_key(pi, parent), v);
     if (Yes == pi->options.trace) {
 	oj_trace_parse_call("set_number", pi, __FILE__, __LINE__, v);
     }
@@ -112,7 +96,7 @@ hash_set_num(ParseInfo pi, Val parent, NumInfo ni) {
 
 static void
 hash_set_value(ParseInfo pi, Val parent, VALUE value) {
-    rb_hash_aset(stack_peek(&pi->stack)->val, calc_hash_key(pi, parent), value);
+    rb_hash_aset(stack_peek(&pi->stack)->val, oj_calc_hash_key(pi, parent), value);
     if (Yes == pi->options.trace) {
 	oj_trace_parse_call("set_value", pi, __FILE__, __LINE__, value);
     }
@@ -128,9 +112,8 @@ start_array(ParseInfo pi) {
 
 static void
 array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
+    volatile VALUE	rstr = oj_cstr_to_value(pi, str, len);
 
-    rstr = oj_encode(rstr);
     rb_ary_push(stack_peek(&pi->stack)->val, rstr);
     if (Yes == pi->options.trace) {
 	oj_trace_parse_call("append_string", pi, __FILE__, __LINE__, rstr);
@@ -159,6 +142,123 @@ array_append_value(ParseInfo pi, VALUE value) {
     }
 }
 
+// The bulk callbacks collect the children of a container on the value stack
+// and add them all when the container closes. An Array then grows once and a
+// Hash is sized for all of its members before they are inserted.
+static VALUE
+bulk_hash_key(ParseInfo pi, Val parent) {
+    volatile VALUE	rkey = oj_calc_hash_key(pi, parent);
+
+    // rb_hash_bulk_insert() does not freeze a String key as rb_hash_aset()
+    // does. The key is not referenced by anything else so it is frozen here.
+    if (T_STRING == rb_type(rkey) && !OBJ_FROZEN(rkey)) {
+	OBJ_FREEZE(rkey);
+    }
+    return rkey;
+}
+
+static void
+bulk_hash_end(ParseInfo pi) {
+    Val		parent = stack_peek(&pi->stack);
+    size_t	cnt = pi->stack.vlen - parent->vstart;
+
+    if (0 < cnt) {
+#ifdef HAVE_RB_HASH_BULK_INSERT
+	rb_hash_bulk_insert((long)cnt, pi->stack.vals + parent->vstart, parent->val);
+#else
+	VALUE	*vp = pi->stack.vals + parent->vstart;
+	VALUE	*end = vp + cnt;
+
+	for (; vp < end; vp += 2) {
+	    rb_hash_aset(parent->val, *vp, vp[1]);
+	}
+#endif
+	pi->stack.vlen = parent->vstart;
+    }
+    hash_end(pi);
+}
+
+static void
+bulk_hash_set_cstr(ParseInfo pi, Val parent, const char *str, size_t len, const char *orig) {
+    volatile VALUE	rstr;
+
+    stack_vals_push(&pi->stack, bulk_hash_key(pi, parent));
+    rstr = oj_cstr_to_value(pi, str, len);
+    stack_vals_push(&pi->stack, rstr);
+    if (Yes == pi->options.trace) {
+	oj_trace_parse_call("set_string", pi, __FILE__, __LINE__, rstr);
+    }
+}
+
+static void
+bulk_hash_set_num(ParseInfo pi, Val parent, NumInfo ni) {
+    volatile VALUE	v;
+
+    if (ni->infinity || ni->nan) {
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
+    }
+    stack_vals_push(&pi->stack, bulk_hash_key(pi, parent));
+    v = oj_num_as_value(ni);
+    stack_vals_push(&pi->stack, v);
+    if (Yes == pi->options.trace) {
+	oj_trace_parse_call("set_number", pi, __FILE__, __LINE__, v);
+    }
+}
+
+static void
+bulk_hash_set_value(ParseInfo pi, Val parent, VALUE value) {
+    stack_vals_push(&pi->stack, bulk_hash_key(pi, parent));
+    stack_vals_push(&pi->stack, value);
+    if (Yes == pi->options.trace) {
+	oj_trace_parse_call("set_value", pi, __FILE__, __LINE__, value);
+    }
+}
+
+// Called after the array has been popped so it is just past the stack tail.
+static void
+bulk_array_end(ParseInfo pi) {
+    Val		array = stack_prev(&pi->stack);
+    size_t	cnt = pi->stack.vlen - array->vstart;
+
+    if (0 < cnt) {
+	rb_ary_cat(array->val, pi->stack.vals + array->vstart, (long)cnt);
+	pi->stack.vlen = array->vstart;
+    }
+    array_end(pi);
+}
+
+static void
+bulk_array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
+    volatile VALUE	rstr = oj_cstr_to_value(pi, str, len);
+
+    stack_vals_push(&pi->stack, rstr);
+    if (Yes == pi->options.trace) {
+	oj_trace_parse_call("append_string", pi, __FILE__, __LINE__, rstr);
+    }
+}
+
+static void
+bulk_array_append_num(ParseInfo pi, NumInfo ni) {
+    volatile VALUE	v;
+
+    if (ni->infinity || ni->nan) {
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
+    }
+    v = oj_num_as_value(ni);
+    stack_vals_push(&pi->stack, v);
+    if (Yes == pi->options.trace) {
+	oj_trace_parse_call("append_number", pi, __FILE__, __LINE__, v);
+    }
+}
+
+static void
+bulk_array_append_value(ParseInfo pi, VALUE value) {
+    stack_vals_push(&pi->stack, value);
+    if (Yes == pi->options.trace) {
+	oj_trace_parse_call("append_value", pi, __FILE__, __LINE__, value);
+    }
+}
+
 void
 oj_set_strict_callbacks(ParseInfo pi) {
     pi->start_hash = start_hash;
@@ -178,6 +278,22 @@ oj_set_strict_callbacks(ParseInfo pi) {
     pi->expect_value = 1;
 }
 
+// Sets the strict callbacks that build each container when it closes. Only
+// for strict and null mode loads since the other modes replace some of the
+// strict callbacks and every child of a container must go the same way.
+void
+oj_set_strict_bulk_callbacks(ParseInfo pi) {
+    oj_set_strict_callbacks(pi);
+    pi->end_hash = bulk_hash_end;
+    pi->hash_set_cstr = bulk_hash_set_cstr;
+    pi->hash_set_num = bulk_hash_set_num;
+    pi->hash_set_value = bulk_hash_set_value;
+    pi->end_array = bulk_array_end;
+    pi->array_append_cstr = bulk_array_append_cstr;
+    pi->array_append_num = bulk_array_append_num;
+    pi->array_append_value = bulk_array_append_value;
+}
+
 VALUE
 oj_strict_parse(int argc, VALUE *argv, VALUE self) {
     struct _parseInfo	pi;
@@ -186,7 +302,7 @@ oj_strict_parse(int argc, VALUE *argv, VALUE self) {
     pi.options = oj_default_options;
     pi.handler = Qnil;
     pi.err_class = Qnil;
-    oj_set_strict_callbacks(&pi);
+    oj_set_strict_bulk_callbacks(&pi);
 
     if (T_STRING == rb_type(*argv)) {
 	return oj_pi_parse(argc, argv, &pi, 0, 0, true);
@@ -203,7 +319,7 @@ oj_strict_parse_cstr(int argc, VALUE *argv, char *json, size_t len) {
     pi.options = oj_default_options;
     pi.handler = Qnil;
     pi.err_class = Qnil;
-    oj_set_strict_callbacks(&pi);
+    oj_set_strict_bulk_callbacks(&pi);
 
     return oj_pi_parse(argc, argv, &pi, json, len, true);
 }
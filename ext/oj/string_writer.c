@@ -63,9 +63,15 @@ oj_str_writer_init(StrWriter sw, int buf_size) {
     sw->out.buf = ALLOC_N(char, buf_size);
     sw->out.end = sw->out.buf + buf_size - 10;
     sw->out.allocated = true;
+    sw->out.str = Qnil;
+    sw->out.flush = NULL;
     sw->out.cur = sw->out.buf;
     *sw->out.cur = '\0';
-    sw->out.circ_cache = NULL;
+    sw->out.circ_slots = NULL;
+    sw->out.circ_mask = 0;
+    sw->out.key_used = 0;
+    sw->out.ropt_used = 0;
+    sw->out.tj_used = 0;
     sw->out.circ_cnt = 0;
     sw->out.hash_cnt = 0;
     sw->out.opts = &sw->opts;
@@ -148,6 +154,21 @@ oj_str_writer_push_array(StrWriter sw, const char *key) {
     push_type(sw, ArrayNew);
 }
 
+static void
+dump_val(StrWriter sw, VALUE val, int depth) {
+    Out	out = &sw->out;
+
+    switch (out->opts->mode) {
+    case StrictMode:	oj_dump_strict_val(val, depth, out);				break;
+    case NullMode:	oj_dump_null_val(val, depth, out);				break;
+    case ObjectMode:	oj_dump_obj_val(val, depth, out);				break;
+    case CompatMode:	oj_dump_compat_val(val, depth, out, Yes == out->opts->to_json);	break;
+    case RailsMode:	oj_dump_rails_val(val, depth, out);				break;
+    case CustomMode:	oj_dump_custom_val(val, depth, out, true);			break;
+    default:		oj_dump_custom_val(val, depth, out, true);			break;
+    }
+}
+
 void
 oj_str_writer_push_value(StrWriter sw, VALUE val, const char *key) {
     Out	out = &sw->out;
@@ -169,15 +190,145 @@ oj_str_writer_push_value(StrWriter sw, VALUE val, const char *key) {
 	    *out->cur++ = ':';
 	}
     }
-    switch (out->opts->mode) {
-    case StrictMode:	oj_dump_strict_val(val, sw->depth, out);				break;
-    case NullMode:	oj_dump_null_val(val, sw->depth, out);					break;
-    case ObjectMode:	oj_dump_obj_val(val, sw->depth, out);					break;
-    case CompatMode:	oj_dump_compat_val(val, sw->depth, out, Yes == out->opts->to_json);	break;
-    case RailsMode:	oj_dump_rails_val(val, sw->depth, out);					break;
-    case CustomMode:	oj_dump_custom_val(val, sw->depth, out, true);				break;
-    default:		oj_dump_custom_val(val, sw->depth, out, true);				break;
+    dump_val(sw, val, sw->depth);
+}
+
+// Pushes each element of ary as a value without a key. The flush function,
+// if not NULL, is called after each element.
+void
+oj_str_writer_push_values(StrWriter sw, VALUE ary, void (*flush)(StrWriter sw)) {
+    Out		out = &sw->out;
+    long	cnt;
+    long	i;
+
+    rb_check_type(ary, T_ARRAY);
+    if (sw->keyWritten) {
+	rb_raise(rb_eStandardError, "Can not push values after a key.");
+    }
+    key_check(sw, 0);
+    cnt = RARRAY_LEN(ary);
+    for (i = 0; i < cnt; i++) {
+	assure_size(out, sw->depth * out->indent + 3);
+	maybe_comma(sw);
+	if (0 < sw->depth) {
+	    fill_indent(out, sw->depth);
+	}
+	dump_val(sw, RARRAY_AREF(ary, i), sw->depth);
+	if (NULL != flush) {
+	    flush(sw);
+	}
+    }
+}
+
+// Encodes each key followed by a colon into a String once so that the rows
+// only copy the bytes. The start of each key is put in offs with one more
+// for the end.
+static VALUE
+encode_keys(StrWriter sw, VALUE keys, long *offs) {
+    struct _out		out;
+    volatile VALUE	kstr = rb_str_buf_new(256);
+    long		cnt = RARRAY_LEN(keys);
+    long		i;
+
+    memset(&out, 0, sizeof(out));
+    out.str = kstr;
+    out.buf = RSTRING_PTR(kstr);
+    out.end = out.buf + rb_str_capacity(kstr) - BUFFER_EXTRA;
+    out.cur = out.buf;
+    out.opts = sw->out.opts;
+    for (i = 0; i < cnt; i++) {
+	volatile VALUE	key = RARRAY_AREF(keys, i);
+
+	offs[i] = out.cur - out.buf;
+	switch (rb_type(key)) {
+	case T_STRING:
+	    oj_dump_str(key, 0, &out, false);
+	    break;
+	case T_SYMBOL:
+	    oj_dump_sym(key, 0, &out, false);
+	    break;
+	default:
+	    oj_dump_str(rb_funcall(key, oj_to_s_id, 0), 0, &out, false);
+	    break;
+	}
+	assure_size(&out, 1);
+	*out.cur++ = ':';
+    }
+    offs[cnt] = out.cur - out.buf;
+    rb_str_set_len(kstr, out.cur - out.buf);
+
+    return kstr;
+}
+
+// Pushes an Object for each row. The row values are paired with the keys
+// in order and, like a Hash, nil values are left out when the :omit_nil
+// option is set. The flush function, if not NULL, is called after each row.
+void
+oj_str_writer_push_rows(StrWriter sw, VALUE keys, VALUE rows, void (*flush)(StrWriter sw)) {
+    Out			out = &sw->out;
+    volatile VALUE	kstr;
+    volatile VALUE	offs_v = 0;
+    long		*offs;
+    long		kcnt;
+    long		cnt;
+    long		i;
+    long		k;
+    int			d2 = sw->depth + 1;
+
+    rb_check_type(keys, T_ARRAY);
+    rb_check_type(rows, T_ARRAY);
+    if (sw->keyWritten) {
+	rb_raise(rb_eStandardError, "Can not push rows after a key.");
     }
+    key_check(sw, 0);
+    kcnt = RARRAY_LEN(keys);
+    offs = ALLOCV_N(long, offs_v, kcnt + 1);
+    kstr = encode_keys(sw, keys, offs);
+    cnt = RARRAY_LEN(rows);
+    for (i = 0; i < cnt; i++) {
+	volatile VALUE	row = RARRAY_AREF(rows, i);
+	bool		first = true;
+
+	if (T_ARRAY != rb_type(row)) {
+	    rb_raise(rb_eTypeError, "rows must be Arrays, not %s.", rb_class2name(rb_obj_class(row)));
+	}
+	if (kcnt != RARRAY_LEN(row)) {
+	    rb_raise(rb_eArgError, "row %ld has %ld values but there are %ld keys.", i, RARRAY_LEN(row), kcnt);
+	}
+	assure_size(out, sw->depth * out->indent + 3);
+	maybe_comma(sw);
+	if (0 < sw->depth) {
+	    fill_indent(out, sw->depth);
+	}
+	*out->cur++ = '{';
+	for (k = 0; k < kcnt; k++) {
+	    VALUE	v = RARRAY_AREF(row, k);
+	    long	klen = offs[k + 1] - offs[k];
+
+	    if (out->omit_nil && Qnil == v) {
+		continue;
+	    }
+	    assure_size(out, d2 * out->indent + klen + 2);
+	    if (!first) {
+		*out->cur++ = ',';
+	    }
+	    first = false;
+	    fill_indent(out, d2);
+	    memcpy(out->cur, RSTRING_PTR(kstr) + offs[k], klen);
+	    out->cur += klen;
+	    dump_val(sw, v, d2);
+	}
+	assure_size(out, sw->depth * out->indent + 3);
+	fill_indent(out, sw->depth);
+	*out->cur++ = '}';
+	if (0 == sw->depth && 0 <= out->indent) {
+	    *out->cur++ = '\n';
+	}
+	if (NULL != flush) {
+	    flush(sw);
+	}
+    }
+    ALLOCV_END(offs_v);
 }
 
 void
@@ -250,6 +401,7 @@ str_writer_free(void *ptr) {
     sw = (StrWriter)ptr;
     xfree(sw->out.buf);
     xfree(sw->types);
+    oj_circ_cleanup(&sw->out);
     xfree(ptr);
 }
 
@@ -280,6 +432,7 @@ str_writer_new(int argc, VALUE *argv, VALUE self) {
     sw->out.argc = argc - 1;
     sw->out.argv = argv + 1;
     sw->out.indent = sw->opts.indent;
+    sw->out.omit_nil = sw->opts.dump_opts.omit_nil;
 
     return Data_Wrap_Struct(oj_string_writer_class, 0, str_writer_free, sw);
 }
@@ -398,6 +551,36 @@ str_writer_push_value(int argc, VALUE *argv, VALUE self) {
     return Qnil;
 }
 
+/* Document-method: push_values
+ * call-seq: push_values(values)
+ *
+ * Pushes each of the values onto the JSON document. This is the same as
+ * calling push_value for each one but with a single call.
+ * - *values* [_Array_] values to add to the JSON array
+ */
+static VALUE
+str_writer_push_values(VALUE self, VALUE values) {
+    oj_str_writer_push_values((StrWriter)DATA_PTR(self), values, NULL);
+
+    return Qnil;
+}
+
+/* Document-method: push_rows
+ * call-seq: push_rows(keys, rows)
+ *
+ * Pushes a JSON object for each row onto the JSON document. The values of
+ * each row are paired with the keys in order. The keys are encoded once for
+ * all the rows.
+ * - *keys* [_Array_] String or Symbol keys
+ * - *rows* [_Array_] Arrays of values, one value for each key
+ */
+static VALUE
+str_writer_push_rows(VALUE self, VALUE keys, VALUE rows) {
+    oj_str_writer_push_rows((StrWriter)DATA_PTR(self), keys, rows, NULL);
+
+    return Qnil;
+}
+
 /* Document-method: push_json
  * call-seq: push_json(value, key=nil)
  *
@@ -522,6 +705,8 @@ oj_string_writer_init() {
     rb_define_method(oj_string_writer_class, "push_array", str_writer_push_array, -1);
     rb_define_method(oj_string_writer_class, "push_value", str_writer_push_value, -1);
     rb_define_method(oj_string_writer_class, "push_json", str_writer_push_json, -1);
+    rb_define_method(oj_string_writer_class, "push_values", str_writer_push_values, 1);
+    rb_define_method(oj_string_writer_class, "push_rows", str_writer_push_rows, 2);
     rb_define_method(oj_string_writer_class, "pop", str_writer_pop, 0);
     rb_define_method(oj_string_writer_class, "pop_all", str_writer_pop_all, 0);
     rb_define_method(oj_string_writer_class, "reset", str_writer_reset, 0);
@@ -0,0 +1,490 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tape.h"
+#include "err.h"
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+#include <ruby/thread.h>
+#endif
+
+#define BLOCK_SIZE	16384
+
+void
+oj_tape_init(Tape tape, const char *src, const char *src_end) {
+    memset(tape, 0, sizeof(struct _tape));
+    tape->src = src;
+    tape->src_end = src_end;
+}
+
+void
+oj_tape_cleanup(Tape tape) {
+    TapeBlock	b;
+
+    free(tape->events);
+    free(tape->nums);
+    while (NULL != (b = tape->blocks)) {
+	tape->blocks = b->next;
+	free(b);
+    }
+    tape->events = NULL;
+    tape->nums = NULL;
+    tape->ecnt = 0;
+    tape->ncnt = 0;
+    tape->esize = 0;
+    tape->nsize = 0;
+}
+
+// Drops the events after ecnt. Copied strings are left in the blocks unless
+// all the events are dropped.
+void
+oj_tape_reset(Tape tape, size_t ecnt) {
+    if (ecnt < tape->ecnt) {
+	tape->ecnt = ecnt;
+    }
+    if (0 == ecnt) {
+	TapeBlock	b;
+
+	tape->ncnt = 0;
+	while (NULL != (b = tape->blocks)) {
+	    tape->blocks = b->next;
+	    free(b);
+	}
+    }
+}
+
+static TapeEvent
+tape_push(ParseInfo pi, char op, char where) {
+    Tape	tape = pi->tape;
+    TapeEvent	ev;
+
+    if (tape->esize <= tape->ecnt) {
+	size_t	size = (0 == tape->esize) ? 256 : tape->esize * 2;
+
+	if (NULL == (ev = realloc(tape->events, sizeof(struct _tapeEvent) * size))) {
+	    tape->no_mem = true;
+	    oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	    return NULL;
+	}
+	tape->events = ev;
+	tape->esize = size;
+    }
+    ev = tape->events + tape->ecnt++;
+    ev->op = op;
+    ev->where = where;
+    ev->str = NULL;
+    ev->orig = NULL;
+    ev->len = 0;
+    ev->value = Qundef;
+    ev->num = 0;
+    ev->k1 = '\0';
+
+    return ev;
+}
+
+// Strings that are in the source are used as is. Others, such as strings
+// with escape sequences, are in a buffer that does not outlive the callback so
+// they are copied to the tape.
+static const char*
+tape_str(ParseInfo pi, const char *str, size_t len) {
+    Tape	tape = pi->tape;
+    TapeBlock	b = tape->blocks;
+    char	*s;
+
+    if (tape->src <= str && str + len <= tape->src_end) {
+	return str;
+    }
+    if (NULL == b || b->size < b->len + len + 1) {
+	size_t	size = (BLOCK_SIZE < len + 1) ? len + 1 : BLOCK_SIZE;
+
+	if (NULL == (b = malloc(sizeof(struct _tapeBlock) + size))) {
+	    tape->no_mem = true;
+	    oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	    return NULL;
+	}
+	b->len = 0;
+	b->size = size;
+	b->next = tape->blocks;
+	tape->blocks = b;
+    }
+    s = b->data + b->len;
+    memcpy(s, str, len);
+    s[len] = '\0';
+    b->len += len + 1;
+
+    return s;
+}
+
+static void
+tape_str_event(ParseInfo pi, char where, char k1, const char *str, size_t len, const char *orig) {
+    TapeEvent	ev = tape_push(pi, TAPE_CSTR, where);
+
+    if (NULL != ev) {
+	ev->str = tape_str(pi, str, len);
+	ev->len = len;
+	ev->orig = orig;
+	ev->k1 = k1;
+    }
+}
+
+static void
+tape_num_event(ParseInfo pi, char where, char k1, NumInfo ni) {
+    Tape	tape = pi->tape;
+    TapeEvent	ev;
+
+    if (tape->nsize <= tape->ncnt) {
+	size_t		size = (0 == tape->nsize) ? 64 : tape->nsize * 2;
+	NumInfo		nums;
+
+	if (NULL == (nums = realloc(tape->nums, sizeof(struct _numInfo) * size))) {
+	    tape->no_mem = true;
+	    oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	    return;
+	}
+	tape->nums = nums;
+	tape->nsize = size;
+    }
+    if (NULL != (ev = tape_push(pi, TAPE_NUM, where))) {
+	ev->num = (long)tape->ncnt;
+	ev->k1 = k1;
+	tape->nums[tape->ncnt++] = *ni;
+    }
+}
+
+static void
+tape_value_event(ParseInfo pi, char where, char k1, VALUE value) {
+    TapeEvent	ev = tape_push(pi, TAPE_VALUE, where);
+
+    if (NULL != ev) {
+	ev->value = value;
+	ev->k1 = k1;
+    }
+}
+
+static VALUE
+start_hash(ParseInfo pi) {
+    tape_push(pi, TAPE_START_HASH, TAPE_ADD);
+
+    return Qundef;
+}
+
+static void
+end_hash(ParseInfo pi) {
+    tape_push(pi, TAPE_END_HASH, TAPE_ADD);
+}
+
+static VALUE
+hash_key(ParseInfo pi, const char *key, size_t klen) {
+    TapeEvent	ev = tape_push(pi, TAPE_KEY, TAPE_SET);
+
+    if (NULL != ev) {
+	ev->str = tape_str(pi, key, klen);
+	ev->len = klen;
+    }
+    return Qundef;
+}
+
+static void
+hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *orig) {
+    tape_str_event(pi, TAPE_SET, kval->k1, str, len, orig);
+}
+
+static void
+hash_set_num(ParseInfo pi, Val kval, NumInfo ni) {
+    tape_num_event(pi, TAPE_SET, kval->k1, ni);
+}
+
+static void
+hash_set_value(ParseInfo pi, Val kval, VALUE value) {
+    tape_value_event(pi, TAPE_SET, kval->k1, value);
+}
+
+static VALUE
+start_array(ParseInfo pi) {
+    tape_push(pi, TAPE_START_ARRAY, TAPE_ADD);
+
+    return Qundef;
+}
+
+static void
+end_array(ParseInfo pi) {
+    tape_push(pi, TAPE_END_ARRAY, TAPE_ADD);
+}
+
+static void
+array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
+    tape_str_event(pi, TAPE_APPEND, '\0', str, len, orig);
+}
+
+static void
+array_append_num(ParseInfo pi, NumInfo ni) {
+    tape_num_event(pi, TAPE_APPEND, '\0', ni);
+}
+
+static void
+array_append_value(ParseInfo pi, VALUE value) {
+    tape_value_event(pi, TAPE_APPEND, '\0', value);
+}
+
+static void
+add_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
+    tape_str_event(pi, TAPE_ADD, '\0', str, len, orig);
+}
+
+static void
+add_num(ParseInfo pi, NumInfo ni) {
+    tape_num_event(pi, TAPE_ADD, '\0', ni);
+}
+
+static void
+add_value(ParseInfo pi, VALUE val) {
+    tape_value_event(pi, TAPE_ADD, '\0', val);
+}
+
+void
+oj_tape_set_callbacks(ParseInfo pi, Tape tape) {
+    pi->tape = tape;
+    pi->start_hash = start_hash;
+    pi->end_hash = end_hash;
+    pi->hash_key = hash_key;
+    pi->hash_set_cstr = hash_set_cstr;
+    pi->hash_set_num = hash_set_num;
+    pi->hash_set_value = hash_set_value;
+    pi->start_array = start_array;
+    pi->end_array = end_array;
+    pi->array_append_cstr = array_append_cstr;
+    pi->array_append_num = array_append_num;
+    pi->array_append_value = array_append_value;
+    pi->add_cstr = add_cstr;
+    pi->add_num = add_num;
+    pi->add_value = add_value;
+    pi->proc = Qundef;
+    pi->max_depth = 0;
+    pi->has_callbacks = false;
+}
+
+// Records one document from pi->json which must be terminated with a '\0'.
+// With the tape callbacks nothing here calls into Ruby so the GVL does not
+// need to be held. With the mode callbacks the document is loaded directly.
+// Errors are left in pi->err.
+void
+oj_tape_record(ParseInfo pi) {
+    Val	v;
+
+    pi->stack.tail = pi->stack.head;
+    pi->stack.head->val = Qundef;
+    oj_parse2(pi);
+    if (!err_has(&pi->err) && NULL != (v = stack_peek(&pi->stack))) {
+	switch (v->next) {
+	case NEXT_ARRAY_NEW:
+	case NEXT_ARRAY_ELEMENT:
+	case NEXT_ARRAY_COMMA:
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Array not terminated");
+	    break;
+	case NEXT_HASH_NEW:
+	case NEXT_HASH_KEY:
+	case NEXT_HASH_COLON:
+	case NEXT_HASH_VALUE:
+	case NEXT_HASH_COMMA:
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Hash/Object not terminated");
+	    break;
+	default:
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
+	}
+    }
+}
+
+// Replays the events for one document starting at the start event on the
+// callbacks of pi. The stack of pi is used the same way the string parser
+// uses it so the callbacks see the same state. Returns the index of the
+// event after the document. Errors are left in pi->err.
+size_t
+oj_tape_replay(ParseInfo pi, Tape tape, size_t start) {
+    TapeEvent		ev = tape->events + start;
+    TapeEvent		end = tape->events + tape->ecnt;
+    volatile VALUE	last = Qundef;
+    volatile VALUE	v;
+    Val			parent;
+    bool		done = false;
+
+    for (; ev < end && !done; ev++) {
+	switch (ev->op) {
+	case TAPE_START_HASH:
+	    v = pi->start_hash(pi);
+	    if (!stack_push(&pi->stack, v, NEXT_HASH_NEW)) {
+		oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	    }
+	    break;
+	case TAPE_END_HASH:
+	    // The hash stays on the stack until just after the callback.
+	    pi->end_hash(pi);
+	    last = stack_pop(&pi->stack)->val;
+	    break;
+	case TAPE_START_ARRAY:
+	    v = pi->start_array(pi);
+	    if (!stack_push(&pi->stack, v, NEXT_ARRAY_NEW)) {
+		oj_set_error_at(pi, rb_eNoMemError, __FILE__, __LINE__, "not enough memory");
+	    }
+	    break;
+	case TAPE_END_ARRAY:
+	    last = stack_pop(&pi->stack)->val;
+	    pi->end_array(pi);
+	    break;
+	case TAPE_KEY:
+	    parent = stack_peek(&pi->stack);
+	    if (Qundef == (parent->key_val = pi->hash_key(pi, ev->str, ev->len))) {
+		parent->key = ev->str;
+		parent->klen = ev->len;
+	    } else {
+		parent->key = "";
+		parent->klen = 0;
+	    }
+	    parent->next = NEXT_HASH_COLON;
+	    break;
+	case TAPE_CSTR:
+	    switch (ev->where) {
+	    case TAPE_SET:
+		parent = stack_peek(&pi->stack);
+		parent->k1 = ev->k1;
+		pi->hash_set_cstr(pi, parent, ev->str, ev->len, ev->orig);
+		parent->next = NEXT_HASH_COMMA;
+		break;
+	    case TAPE_APPEND:
+		pi->array_append_cstr(pi, ev->str, ev->len, ev->orig);
+		stack_peek(&pi->stack)->next = NEXT_ARRAY_COMMA;
+		break;
+	    default:
+		pi->add_cstr(pi, ev->str, ev->len, ev->orig);
+		done = true;
+		break;
+	    }
+	    break;
+	case TAPE_NUM:
+	    switch (ev->where) {
+	    case TAPE_SET:
+		parent = stack_peek(&pi->stack);
+		parent->k1 = ev->k1;
+		pi->hash_set_num(pi, parent, tape->nums + ev->num);
+		parent->next = NEXT_HASH_COMMA;
+		break;
+	    case TAPE_APPEND:
+		pi->array_append_num(pi, tape->nums + ev->num);
+		stack_peek(&pi->stack)->next = NEXT_ARRAY_COMMA;
+		break;
+	    default:
+		pi->add_num(pi, tape->nums + ev->num);
+		done = true;
+		break;
+	    }
+	    break;
+	case TAPE_VALUE:
+	    v = (Qundef == ev->value) ? last : ev->value;
+	    switch (ev->where) {
+	    case TAPE_SET:
+		parent = stack_peek(&pi->stack);
+		parent->k1 = ev->k1;
+		pi->hash_set_value(pi, parent, v);
+		parent->next = NEXT_HASH_COMMA;
+		break;
+	    case TAPE_APPEND:
+		pi->array_append_value(pi, v);
+		stack_peek(&pi->stack)->next = NEXT_ARRAY_COMMA;
+		break;
+	    default:
+		pi->add_value(pi, v);
+		done = true;
+		break;
+	    }
+	    break;
+	default:
+	    break;
+	}
+	if (err_has(&pi->err)) {
+	    break;
+	}
+	if (0 < pi->max_depth && pi->max_depth <= (int)stack_size(&pi->stack) - 1) {
+	    VALUE	err_clas = oj_get_json_err_class("NestingError");
+
+	    oj_set_error_at(pi, err_clas, __FILE__, __LINE__, "Too deeply nested.");
+	    pi->err_class = err_clas;
+	    break;
+	}
+    }
+    return ev - tape->events;
+}
+
+typedef struct _tapeParse {
+    ParseInfo		pi;
+    struct _parseInfo	rpi;
+    struct _tape	tape;
+    volatile VALUE	input;
+} *TapeParse;
+
+static void*
+record_nogvl(void *arg) {
+    oj_tape_record((ParseInfo)arg);
+
+    return NULL;
+}
+
+static VALUE
+tape_parse_run(VALUE arg) {
+    TapeParse	tp = (TapeParse)arg;
+    ParseInfo	pi = tp->pi;
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    rb_thread_call_without_gvl(record_nogvl, &tp->rpi, NULL, NULL);
+#else
+    record_nogvl(&tp->rpi);
+#endif
+    pi->cur = tp->rpi.cur;
+    if (err_has(&tp->rpi.err)) {
+	pi->err = tp->rpi.err;
+    } else if (0 < tp->tape.ecnt) {
+	oj_tape_replay(pi, &tp->tape, 0);
+    }
+    return Qnil;
+}
+
+static VALUE
+tape_parse_cleanup(VALUE arg) {
+    TapeParse	tp = (TapeParse)arg;
+
+    if (Qnil != tp->input) {
+	rb_str_unlocktmp(tp->input);
+    }
+    oj_tape_cleanup(&tp->tape);
+    stack_cleanup(&tp->rpi.stack);
+
+    return Qnil;
+}
+
+// Parses the single document in pi->json in two stages. The first records a
+// tape without the GVL and the second replays it on the callbacks of pi with
+// the GVL. The input String, if not nil, is locked so it can not be changed
+// by another thread while the GVL is released.
+void
+oj_tape_parse(ParseInfo pi, VALUE input) {
+    struct _tapeParse	tp;
+
+    tp.pi = pi;
+    tp.input = Qnil;
+    err_init(&pi->err);
+    parse_info_init(&tp.rpi);
+    oj_stack_reset(&tp.rpi.stack);
+    tp.rpi.options = pi->options;
+    tp.rpi.only = pi->only;
+    tp.rpi.handler = Qnil;
+    tp.rpi.err_class = Qnil;
+    tp.rpi.json = pi->json;
+    tp.rpi.end = pi->end;
+    oj_tape_init(&tp.tape, pi->json, pi->end + 1);
+    oj_tape_set_callbacks(&tp.rpi, &tp.tape);
+    if (Qnil != input) {
+	rb_str_locktmp(input);
+	tp.input = input;
+    }
+    rb_ensure(tape_parse_run, (VALUE)&tp, tape_parse_cleanup, (VALUE)&tp);
+}
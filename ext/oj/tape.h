@@ -0,0 +1,73 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_TAPE_H
+#define OJ_TAPE_H
+
+#include <stdbool.h>
+
+#include "parse.h"
+
+// A tape is a record of the callbacks the string parser makes. Recording
+// does not call into Ruby so it can run without the GVL. Replaying the tape
+// makes the same calls on the mode callbacks of another ParseInfo to build
+// the Ruby objects.
+
+typedef enum {
+    TAPE_START_HASH	= 'h',
+    TAPE_END_HASH	= 'H',
+    TAPE_START_ARRAY	= 'a',
+    TAPE_END_ARRAY	= 'A',
+    TAPE_KEY		= 'k',
+    TAPE_CSTR		= 's',
+    TAPE_NUM		= 'n',
+    TAPE_VALUE		= 'v',
+} TapeOp;
+
+typedef enum {
+    TAPE_ADD		= 'd',
+    TAPE_APPEND		= 'p',
+    TAPE_SET		= 't',
+} TapeWhere;
+
+typedef struct _tapeEvent {
+    const char	*str;
+    const char	*orig;
+    size_t	len;
+    VALUE	value; // Qundef for the last container closed
+    long	num;   // index into the nums
+    char	op;    // TapeOp
+    char	where; // TapeWhere
+    char	k1;
+} *TapeEvent;
+
+typedef struct _tapeBlock {
+    struct _tapeBlock	*next;
+    size_t		len;
+    size_t		size;
+    char		data[];
+} *TapeBlock;
+
+typedef struct _tape {
+    TapeEvent		events;
+    size_t		ecnt;
+    size_t		esize;
+    struct _numInfo	*nums;
+    size_t		ncnt;
+    size_t		nsize;
+    TapeBlock		blocks;
+    const char		*src;     // strings in src..src_end are not copied
+    const char		*src_end;
+    bool		no_mem;
+} *Tape;
+
+extern void	oj_tape_init(Tape tape, const char *src, const char *src_end);
+extern void	oj_tape_cleanup(Tape tape);
+extern void	oj_tape_reset(Tape tape, size_t ecnt);
+
+extern void	oj_tape_set_callbacks(ParseInfo pi, Tape tape);
+extern void	oj_tape_record(ParseInfo pi);
+
+extern size_t	oj_tape_replay(ParseInfo pi, Tape tape, size_t start);
+extern void	oj_tape_parse(ParseInfo pi, VALUE input);
+
+#endif /* OJ_TAPE_H */
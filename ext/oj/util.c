@@ -1,6 +1,7 @@
 // Copyright (c) 2019 Peter Ohler. All rights reserved.
 
 #include "util.h"
+#include "simd.h"
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -134,3 +135,222 @@ sec_as_time(int64_t secs, TimeInfo ti) {
     secs = secs - (int64_t)ti->min * 60LL;
     ti->sec = (int)secs;
 }
+
+static const char*
+read_digits(const char *s, const char *end, int cnt, int *vp) {
+    int	v = 0;
+
+    if (end - s < cnt) {
+	return NULL;
+    }
+    for (; 0 < cnt; cnt--, s++) {
+	if (*s < '0' || '9' < *s) {
+	    return NULL;
+	}
+	v = v * 10 + *s - '0';
+    }
+    *vp = v;
+
+    return s;
+}
+
+// Days from 1970-01-01 to the proleptic Gregorian date.
+static int64_t
+days_from_civil(int64_t y, int m, int d) {
+    int64_t	era;
+    int64_t	yoe;
+    int64_t	doy;
+
+    if (m <= 2) {
+	y--;
+    }
+    era = (0 <= y ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (2 < m ? -3 : 9)) + 2) / 5 + d - 1;
+
+    return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+static int
+days_in_month(int64_t y, int m) {
+    static const int	days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    if (2 == m && 0 == y % 4 && (0 != y % 100 || 0 == y % 400)) {
+	return 29;
+    }
+    return days[m - 1];
+}
+
+// Reads YYYY-MM-DD optionally followed by T, t, or a space and hh:mm:ss, a
+// fraction of any length of which nanoseconds are kept, and a Z or a
+// +hh:mm, +hhmm, or +hh offset. The whole string must match. Returns false
+// if it does not. A day up to 31 in any month and a second of 60 are read
+// but clear exact.
+bool
+oj_parse_iso8601(const char *str, size_t len, IsoTime it) {
+    const char	*end = str + len;
+    const char	*s = str;
+    bool	neg = false;
+    int		hour = 0;
+    int		min = 0;
+    int		sec = 0;
+    int		oh = 0;
+    int		om = 0;
+
+    memset(it, 0, sizeof(*it));
+    if (s < end && '-' == *s) {
+	neg = true;
+	s++;
+    }
+    if (NULL == (s = read_digits(s, end, 4, &it->year)) || end <= s || '-' != *s++ ||
+	NULL == (s = read_digits(s, end, 2, &it->mon)) || end <= s || '-' != *s++ ||
+	NULL == (s = read_digits(s, end, 2, &it->day))) {
+	return false;
+    }
+    if (neg) {
+	it->year = -it->year;
+    }
+    if (it->mon < 1 || 12 < it->mon || it->day < 1 || 31 < it->day) {
+	return false;
+    }
+    it->exact = (it->day <= days_in_month(it->year, it->mon));
+    if (s < end) {
+	if ('T' != *s && 't' != *s && ' ' != *s) {
+	    return false;
+	}
+	s++;
+	if (NULL == (s = read_digits(s, end, 2, &hour)) || end <= s || ':' != *s++ ||
+	    NULL == (s = read_digits(s, end, 2, &min)) || end <= s || ':' != *s++ ||
+	    NULL == (s = read_digits(s, end, 2, &sec))) {
+	    return false;
+	}
+	if (23 < hour || 59 < min || 60 < sec) {
+	    return false;
+	}
+	if (60 == sec) {
+	    it->exact = false;
+	}
+	it->has_time = true;
+	if (s < end && '.' == *s) {
+	    long	scale = 100000000;
+
+	    s++;
+	    if (end <= s || *s < '0' || '9' < *s) {
+		return false;
+	    }
+	    for (; s < end && '0' <= *s && *s <= '9'; s++) {
+		it->nsecs += (*s - '0') * scale;
+		scale /= 10;
+	    }
+	}
+	if (s < end) {
+	    char	z = *s++;
+
+	    it->zoned = true;
+	    switch (z) {
+	    case 'Z':
+	    case 'z':
+		it->utc = true;
+		break;
+	    case '+':
+	    case '-':
+		if (NULL == (s = read_digits(s, end, 2, &oh))) {
+		    return false;
+		}
+		if (s < end && ':' == *s) {
+		    s++;
+		}
+		if (s < end && NULL == (s = read_digits(s, end, 2, &om))) {
+		    return false;
+		}
+		if (23 < oh || 59 < om) {
+		    return false;
+		}
+		it->offset = oh * 3600 + om * 60;
+		if ('-' == z) {
+		    it->offset = -it->offset;
+		}
+		break;
+	    default:
+		return false;
+	    }
+	    if (s != end) {
+		return false;
+	    }
+	}
+    }
+    it->secs = days_from_civil(it->year, it->mon, it->day) * SECS_PER_DAY + hour * 3600 + min * 60 + sec - it->offset;
+
+    return true;
+}
+
+// Returns the first byte in str..end that does not start or continue a well
+// formed UTF-8 sequence or NULL if there is none. Overlong forms, surrogates,
+// and code points above U+10FFFF are not well formed. Runs of ASCII are
+// skipped a block at a time.
+const char*
+oj_utf8_invalid(const char *str, const char *end) {
+    const uint8_t	*s = (const uint8_t*)str;
+    const uint8_t	*e = (const uint8_t*)end;
+    uint8_t		c;
+    uint8_t		lo;
+    uint8_t		hi;
+    int			cnt;
+
+    while (s < e) {
+#if defined(OJ_USE_SSE2)
+	while (s + 16 <= e && 0 == _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)s))) {
+	    s += 16;
+	}
+#elif defined(OJ_USE_NEON)
+	while (s + 16 <= e && vmaxvq_u8(vld1q_u8(s)) < 0x80) {
+	    s += 16;
+	}
+#else
+	for (; s + 8 <= e; s += 8) {
+	    uint64_t	w;
+
+	    memcpy(&w, s, sizeof(w));
+	    if (0 != (w & 0x8080808080808080ULL)) {
+		break;
+	    }
+	}
+#endif
+	for (; s < e && *s < 0x80; s++) {
+	}
+	if (e <= s) {
+	    break;
+	}
+	c = *s;
+	lo = 0x80;
+	hi = 0xBF;
+	if (c < 0xC2) {
+	    return (const char*)s;
+	} else if (c < 0xE0) {
+	    cnt = 1;
+	} else if (c < 0xF0) {
+	    cnt = 2;
+	    if (0xE0 == c) {
+		lo = 0xA0;
+	    } else if (0xED == c) {
+		hi = 0x9F;
+	    }
+	} else if (c < 0xF5) {
+	    cnt = 3;
+	    if (0xF0 == c) {
+		lo = 0x90;
+	    } else if (0xF4 == c) {
+		hi = 0x8F;
+	    }
+	} else {
+	    return (const char*)s;
+	}
+	if (e - s <= cnt || s[1] < lo || hi < s[1] ||
+	    (1 < cnt && 0x80 != (s[2] & 0xC0)) ||
+	    (2 < cnt && 0x80 != (s[3] & 0xC0))) {
+	    return (const char*)s;
+	}
+	s += cnt + 1;
+    }
+    return NULL;
+}
@@ -3,6 +3,8 @@
 #ifndef OJ_UTIL_H
 #define OJ_UTIL_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct _timeInfo {
@@ -14,6 +16,23 @@ typedef struct _timeInfo {
     int year;
 } *TimeInfo;
 
+// An RFC 3339 or ISO 8601 date and time as read by oj_parse_iso8601().
+typedef struct _isoTime {
+    int64_t	secs;	// seconds since 1970-01-01T00:00:00Z
+    long	nsecs;
+    int		offset;	// seconds east of UTC
+    bool	utc;	// a Z zone rather than an offset
+    bool	zoned;	// false if neither a Z nor an offset was given
+    bool	has_time; // false for a date alone
+    bool	exact;	// false if the day is past the end of the month or the
+			// second is 60, secs then rolls over as a Time does
+    int		year;
+    int		mon;
+    int		day;
+} *IsoTime;
+
 extern void	sec_as_time(int64_t secs, TimeInfo ti);
+extern bool	oj_parse_iso8601(const char *str, size_t len, IsoTime it);
+extern const char*	oj_utf8_invalid(const char *str, const char *end);
 
 #endif /* OJ_UTIL_H */
@@ -14,12 +14,6 @@ mark(void *ptr) {
     if (0 == ptr) {
 	return;
     }
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-    pthread_mutex_lock(&stack->mutex);
-#else
-    rb_mutex_lock(stack->mutex);
-    rb_gc_mark(stack->mutex);
-#endif
     for (v = stack->head; v < stack->tail; v++) {
 	if (Qnil != v->val && Qundef != v->val) {
 	    rb_gc_mark(v->val);
@@ -27,51 +21,124 @@ mark(void *ptr) {
 	if (Qnil != v->key_val && Qundef != v->key_val) {
 	    rb_gc_mark(v->key_val);
 	}
-	if (NULL != v->odd_args) {
-	    VALUE	*a;
-	    int		i;
+	if (v->cold) {
+	    ValCold	c = stack_cold_peek(stack, v);
 
-	    for (i = v->odd_args->odd->attr_cnt, a = v->odd_args->args; 0 < i; i--, a++) {
-		if (Qnil != *a) {
-		    rb_gc_mark(*a);
+	    if (NULL != c->odd_args) {
+		VALUE	*a;
+		int	i;
+
+		for (i = c->odd_args->odd->attr_cnt, a = c->odd_args->args; 0 < i; i--, a++) {
+		    if (Qnil != *a) {
+			rb_gc_mark(*a);
+		    }
 		}
 	    }
 	}
     }
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-    pthread_mutex_unlock(&stack->mutex);
-#else
-    rb_mutex_unlock(stack->mutex);
-#endif
-}
-
-VALUE
-oj_stack_init(ValStack stack) {
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-    int	err;
+    if (NULL != stack->vals) {
+	VALUE	*a;
+	VALUE	*end = stack->vals + stack->vlen;
 
-    if (0 != (err = pthread_mutex_init(&stack->mutex, 0))) {
-	rb_raise(rb_eException, "failed to initialize a mutex. %s", strerror(err));
+	for (a = stack->vals; a < end; a++) {
+	    rb_gc_mark(*a);
+	}
     }
-#else
-    stack->mutex = rb_mutex_new();
-#endif
+}
+
+void
+oj_stack_reset(ValStack stack) {
     stack->head = stack->base;
     stack->end = stack->base + sizeof(stack->base) / sizeof(struct _val);
     stack->tail = stack->head;
+    stack->vals = NULL;
+    stack->vlen = 0;
+    stack->vcap = 0;
+    stack->colds = NULL;
+    stack->ccnt = 0;
     stack->head->val = Qundef;
     stack->head->key = NULL;
     stack->head->key_val = Qundef;
-    stack->head->classname = NULL;
-    stack->head->odd_args = NULL;
-    stack->head->clas = Qundef;
     stack->head->klen = 0;
-    stack->head->clen = 0;
     stack->head->next = NEXT_NONE;
+    stack->head->cold = 0;
+}
+
+VALUE
+oj_stack_init(ValStack stack) {
+    oj_stack_reset(stack);
 
     return Data_Wrap_Struct(oj_cstack_class, mark, 0, stack);
 }
 
+// Doubles the stack. Plain malloc and realloc are used since the tape
+// recorder pushes without the GVL. Returns false, leaving the stack as it
+// was, if there is not enough memory.
+bool
+oj_stack_grow(ValStack stack) {
+    size_t	len = stack->end - stack->head;
+    size_t	toff = stack->tail - stack->head;
+    Val		head;
+
+    if (stack->base == stack->head) {
+	if (NULL == (head = malloc(sizeof(struct _val) * len * 2))) {
+	    return false;
+	}
+	memcpy(head, stack->base, sizeof(struct _val) * len);
+    } else if (NULL == (head = realloc(stack->head, sizeof(struct _val) * len * 2))) {
+	return false;
+    }
+    stack->head = head;
+    stack->tail = head + toff;
+    stack->end = head + len * 2;
+
+    return true;
+}
+
+// The vals hold Ruby objects so they are only grown while holding the GVL.
+// A GC started by the realloc still marks the old block.
+void
+oj_stack_vals_grow(ValStack stack) {
+    size_t	cap = (0 == stack->vcap) ? STACK_INC * 4 : stack->vcap * 2;
+
+    REALLOC_N(stack->vals, VALUE, cap);
+    stack->vcap = cap;
+}
+
+// Allocates the block of cold fields for depth, and the list of blocks if
+// needed, and returns the start of the block. The blocks are never moved.
+ValCold
+oj_stack_cold_block(ValStack stack, size_t depth) {
+    size_t	bi = depth / STACK_INC;
+
+    if (stack->ccnt <= bi) {
+	size_t	cnt = (0 == stack->ccnt) ? 4 : stack->ccnt * 2;
+
+	if (cnt <= bi) {
+	    cnt = bi + 1;
+	}
+	REALLOC_N(stack->colds, ValCold, cnt);
+	memset(stack->colds + stack->ccnt, 0, sizeof(ValCold) * (cnt - stack->ccnt));
+	stack->ccnt = cnt;
+    }
+    if (NULL == stack->colds[bi]) {
+	stack->colds[bi] = ALLOC_N(struct _valCold, STACK_INC);
+    }
+    return stack->colds[bi];
+}
+
+void
+oj_stack_colds_free(ValStack stack) {
+    size_t	i;
+
+    for (i = 0; i < stack->ccnt; i++) {
+	xfree(stack->colds[i]);
+    }
+    xfree(stack->colds);
+    stack->colds = NULL;
+    stack->ccnt = 0;
+}
+
 const char*
 oj_stack_next_string(ValNext n) {
     switch (n) {
@@ -5,10 +5,8 @@
 
 #include "ruby.h"
 #include "odd.h"
+#include <stdbool.h>
 #include <stdint.h>
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-#include <pthread.h>
-#endif
 
 #define STACK_INC	64
 
@@ -24,89 +22,155 @@ typedef enum {
     NEXT_HASH_COMMA	= 'n',
 } ValNext;
 
+// The fields used by every mode. A push resets all of them so they are kept
+// to one cache line.
 typedef struct _val {
     volatile VALUE	val;
-    const char		*key;
-    char		karray[32];
     volatile VALUE	key_val;
-    const char		*classname;
-    VALUE		clas;
-    OddArgs		odd_args;
+    const char		*key;
+    struct _onlyNode	*only;	     // :only filter for the members, NULL keeps all
+    struct _onlyNode	*only_child; // :only match for the current member
+    struct _shape	*shape;	     // shape being filled by Oj.load_shape()
+    size_t		vstart;	     // first of the buffered children in the stack vals
     uint16_t		klen;
-    uint16_t		clen;
     char		next; // ValNext
     char		k1;   // first original character in the key
     char		kalloc;
+    char		cold; // the ValCold at the same depth was reset after the push
 } *Val;
 
+// The fields only used by the object, custom, and compat create_id paths,
+// by the stream parser for short keys, and with :raw. They are kept apart
+// from the Val at the same depth in blocks of STACK_INC that do not move,
+// so a key in karray stays put when the stack grows, and are only reset
+// when first used after a push.
+typedef struct _valCold {
+    OddArgs		odd_args;
+    const char		*classname;
+    VALUE		clas;
+    struct _onlyNode	*raw;	    // :raw paths for the members, set only with :raw
+    struct _onlyNode	*raw_child; // :raw match for the current member
+    uint16_t		clen;
+    char		karray[32];
+} *ValCold;
+
+// Stacks that are wrapped for the GC are only pushed while holding the GVL
+// and a recording stack never holds Ruby objects so growing the stack does
+// not need a lock.
 typedef struct _valStack {
     struct _val		base[STACK_INC];
     Val			head;	// current stack
     Val			end;	// stack end
     Val			tail;	// pointer to one past last element name on stack
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-    pthread_mutex_t	mutex;
-#else
-    VALUE		mutex;
-#endif
-
+    // Children of open containers, keys and values alternating for a Hash,
+    // collected by the bulk strict callbacks until the container closes.
+    VALUE		*vals;
+    size_t		vlen;
+    size_t		vcap;
+    ValCold		*colds; // blocks of STACK_INC, NULL until used
+    size_t		ccnt;
 } *ValStack;
 
 extern VALUE	oj_stack_init(ValStack stack);
+extern void	oj_stack_reset(ValStack stack);
 
 inline static int
 stack_empty(ValStack stack) {
     return (stack->head == stack->tail);
 }
 
+extern void	oj_stack_colds_free(ValStack stack);
+
 inline static void
 stack_cleanup(ValStack stack) {
     if (stack->base != stack->head) {
-        xfree(stack->head);
+        free(stack->head);
 	stack->head = NULL;
     }
+    if (NULL != stack->vals) {
+	xfree(stack->vals);
+	stack->vals = NULL;
+	stack->vlen = 0;
+	stack->vcap = 0;
+    }
+    if (NULL != stack->colds) {
+	oj_stack_colds_free(stack);
+    }
 }
 
-inline static void
+extern bool	oj_stack_grow(ValStack stack);
+extern void	oj_stack_vals_grow(ValStack stack);
+extern ValCold	oj_stack_cold_block(ValStack stack, size_t depth);
+
+// Returns false if the stack could not grow, nothing is pushed then.
+inline static bool
 stack_push(ValStack stack, VALUE val, ValNext next) {
-    if (stack->end <= stack->tail) {
-	size_t	len = stack->end - stack->head;
-	size_t	toff = stack->tail - stack->head;
-	Val	head = stack->head;
-
-	// A realloc can trigger a GC so make sure it happens outside the lock
-	// but lock before changing pointers.
-	if (stack->base == stack->head) {
-	    head = ALLOC_N(struct _val, len + STACK_INC);
-	    memcpy(head, stack->base, sizeof(struct _val) * len);
-	} else {
-	    REALLOC_N(head, struct _val, len + STACK_INC);
-	}
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-	pthread_mutex_lock(&stack->mutex);
-#else
-	rb_mutex_lock(stack->mutex);
-#endif
-	stack->head = head;
-	stack->tail = stack->head + toff;
-	stack->end = stack->head + len + STACK_INC;
-#ifdef HAVE_PTHREAD_MUTEX_INIT
-	pthread_mutex_unlock(&stack->mutex);
-#else
-	rb_mutex_unlock(stack->mutex);
-#endif
+    Val	v;
+
+    if (stack->end <= stack->tail && !oj_stack_grow(stack)) {
+	return false;
+    }
+    v = stack->tail++;
+    v->val = val;
+    v->key_val = Qundef;
+    v->key = 0;
+    v->only = NULL;
+    v->only_child = NULL;
+    v->shape = NULL;
+    v->vstart = stack->vlen;
+    v->klen = 0;
+    v->next = next;
+    v->kalloc = 0;
+    v->cold = 0;
+
+    return true;
+}
+
+// Returns the cold fields of v, resetting them if this is their first use
+// since v was pushed. Only called with the GVL held.
+inline static ValCold
+stack_cold(ValStack stack, Val v) {
+    size_t	depth = v - stack->head;
+    ValCold	c;
+
+    if (depth / STACK_INC < stack->ccnt && NULL != stack->colds[depth / STACK_INC]) {
+	c = stack->colds[depth / STACK_INC] + depth % STACK_INC;
+    } else {
+	c = oj_stack_cold_block(stack, depth) + depth % STACK_INC;
+    }
+    if (!v->cold) {
+	c->odd_args = NULL;
+	c->classname = NULL;
+	c->clas = Qundef;
+	c->raw = NULL;
+	c->raw_child = NULL;
+	c->clen = 0;
+	v->cold = 1;
+    }
+    return c;
+}
+
+// Returns the cold fields of v or NULL if they have not been used since v
+// was pushed, in which case they all have their reset values.
+inline static ValCold
+stack_cold_peek(ValStack stack, Val v) {
+    size_t	depth;
+
+    if (!v->cold) {
+	return NULL;
+    }
+    depth = v - stack->head;
+
+    return stack->colds[depth / STACK_INC] + depth % STACK_INC;
+}
+
+// Only called with the GVL held.
+inline static void
+stack_vals_push(ValStack stack, VALUE v) {
+    if (stack->vcap <= stack->vlen) {
+	oj_stack_vals_grow(stack);
     }
-    stack->tail->val = val;
-    stack->tail->next = next;
-    stack->tail->classname = NULL;
-    stack->tail->clas = Qundef;
-    stack->tail->odd_args = NULL;
-    stack->tail->key = 0;
-    stack->tail->key_val = Qundef;
-    stack->tail->clen = 0;
-    stack->tail->klen = 0;
-    stack->tail->kalloc = 0;
-    stack->tail++;
+    stack->vals[stack->vlen++] = v;
 }
 
 inline static size_t
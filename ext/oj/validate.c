@@ -0,0 +1,333 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#include <string.h>
+
+#include "oj.h"
+#include "parse.h"
+#include "encode.h"
+#include "util.h"
+#include "err.h"
+#include "validate.h"
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+#include <ruby/thread.h>
+#endif
+
+// Inputs of at least this many bytes are validated without the GVL when the
+// :release_gvl option is not set.
+#define VALIDATE_NOGVL_MIN	65536
+
+// The validator runs the string parser with callbacks that build nothing so
+// a document can be checked without allocating any Ruby objects. The only
+// state kept is the head of the stack which is set to nil to note that a
+// value was seen. Since nothing is built, classes named in the document are
+// not looked up so the check is of the syntax and encoding only.
+
+// The strict, null, and wab callbacks reject NaN and Infinity even when the
+// parser reads them. The other modes keep them if :allow_nan lets the parser
+// read them.
+static void
+check_num(ParseInfo pi, NumInfo ni) {
+    if (ni->infinity || ni->nan) {
+	switch (pi->options.mode) {
+	case StrictMode:
+	case NullMode:
+	case WabMode:
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
+	    break;
+	default:
+	    break;
+	}
+    }
+}
+
+static VALUE
+noop_start(ParseInfo pi) {
+    return Qnil;
+}
+
+static void
+noop_end(ParseInfo pi) {
+}
+
+static VALUE
+noop_hash_key(ParseInfo pi, const char *key, size_t klen) {
+    return Qundef;
+}
+
+static void
+noop_hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *orig) {
+}
+
+static void
+noop_hash_set_num(ParseInfo pi, Val kval, NumInfo ni) {
+    check_num(pi, ni);
+}
+
+static void
+noop_hash_set_value(ParseInfo pi, Val kval, VALUE value) {
+}
+
+static void
+noop_array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
+}
+
+static void
+noop_array_append_num(ParseInfo pi, NumInfo ni) {
+    check_num(pi, ni);
+}
+
+static void
+noop_array_append_value(ParseInfo pi, VALUE value) {
+}
+
+static void
+seen_value(ParseInfo pi, VALUE val) {
+    pi->stack.head->val = Qnil;
+}
+
+static void
+seen_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
+    pi->stack.head->val = Qnil;
+}
+
+static void
+seen_num(ParseInfo pi, NumInfo ni) {
+    check_num(pi, ni);
+    pi->stack.head->val = Qnil;
+}
+
+static void
+set_validate_callbacks(ParseInfo pi) {
+    pi->start_hash = noop_start;
+    pi->end_hash = noop_end;
+    pi->hash_key = noop_hash_key;
+    pi->hash_set_cstr = noop_hash_set_cstr;
+    pi->hash_set_num = noop_hash_set_num;
+    pi->hash_set_value = noop_hash_set_value;
+    pi->start_array = noop_start;
+    pi->end_array = noop_end;
+    pi->array_append_cstr = noop_array_append_cstr;
+    pi->array_append_num = noop_array_append_num;
+    pi->array_append_value = noop_array_append_value;
+    pi->add_cstr = seen_cstr;
+    pi->add_num = seen_num;
+    pi->add_value = seen_value;
+    pi->add_doc = NULL;
+    pi->has_callbacks = false;
+}
+
+// Called with or without the GVL. Nothing here may call into Ruby.
+static void*
+validate_nogvl(void *arg) {
+    ParseInfo	pi = &((Validation)arg)->pi;
+    const char	*end;
+    const char	*bad;
+    Val		v;
+
+    oj_parse2(pi);
+    if (!err_has(&pi->err) && NULL != (v = stack_peek(&pi->stack))) {
+	switch (v->next) {
+	case NEXT_ARRAY_NEW:
+	case NEXT_ARRAY_ELEMENT:
+	case NEXT_ARRAY_COMMA:
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Array not terminated");
+	    break;
+	case NEXT_HASH_NEW:
+	case NEXT_HASH_KEY:
+	case NEXT_HASH_COLON:
+	case NEXT_HASH_VALUE:
+	case NEXT_HASH_COMMA:
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Hash/Object not terminated");
+	    break;
+	default:
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
+	}
+    }
+    if (!err_has(&pi->err) && Qundef == pi->stack.head->val && !empty_ok(&pi->options)) {
+	if (No == pi->options.nilnil || (CompatMode == pi->options.mode && 0 < pi->cur - pi->json)) {
+	    oj_set_error_at(pi, oj_json_parser_error_class, __FILE__, __LINE__, "Empty input");
+	}
+    }
+    if (!err_has(&pi->err) && No == pi->options.quirks_mode) {
+	const char	*s = pi->json;
+
+	for (; s < pi->end && (' ' == *s || '\t' == *s || '\n' == *s || '\r' == *s); s++) {
+	}
+	if (s < pi->end && '{' != *s && '[' != *s) {
+	    pi->cur = s + 1;
+	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "unexpected non-document value");
+	}
+    }
+    // Bytes past an error were never looked at so only the ones before it
+    // are checked. An invalid sequence there is the first error.
+    end = err_has(&pi->err) ? pi->cur - 1 : pi->end;
+    if (end < pi->json) {
+	end = pi->json;
+    }
+    if (NULL != (bad = oj_utf8_invalid(pi->json, end))) {
+	pi->cur = bad + 1;
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "invalid UTF-8");
+    }
+    return NULL;
+}
+
+static VALUE
+validate_run(VALUE arg) {
+    Validation	val = (Validation)arg;
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if (val->nogvl) {
+	rb_thread_call_without_gvl(validate_nogvl, val, NULL, NULL);
+	return Qnil;
+    }
+#endif
+    validate_nogvl(val);
+
+    return Qnil;
+}
+
+static VALUE
+validate_cleanup(VALUE arg) {
+    Validation	val = (Validation)arg;
+
+    if (val->nogvl) {
+	rb_str_unlocktmp(val->input);
+    }
+    stack_cleanup(&val->pi.stack);
+
+    return Qnil;
+}
+
+// Validates the document in argv[0] and returns true if it is valid. On
+// failure val->pi.err holds the error and val->pi.cur is just past where it
+// was found.
+bool
+oj_validate_doc(int argc, VALUE *argv, Validation val) {
+    ParseInfo		pi = &val->pi;
+    volatile VALUE	input;
+    rb_encoding		*enc;
+    size_t		min;
+
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to validate.");
+    }
+    parse_info_init(pi);
+    pi->options = oj_default_options;
+    pi->handler = Qnil;
+    pi->err_class = Qnil;
+    pi->proc = Qundef;
+    pi->max_depth = 0;
+    if (2 == argc && oj_options_class == rb_obj_class(argv[1])) {
+	pi->options = *oj_options_load(argv[1]);
+    } else {
+	VALUE	ropts = (2 == argc) ? argv[1] : Qnil;
+
+	if (Qnil != ropts) {
+	    Check_Type(ropts, T_HASH);
+	}
+	oj_set_mode_callbacks(pi, ropts);
+	if (Qnil != ropts) {
+	    oj_parse_options(ropts, &pi->options);
+	}
+    }
+    set_validate_callbacks(pi);
+    // Raw values are checked like any others.
+    pi->options.raw = Qnil;
+
+    input = *argv;
+    if (Qnil == input) {
+	if (Yes == pi->options.nilnil) {
+	    return true;
+	}
+	rb_raise(rb_eTypeError, "Nil is not a valid JSON source.");
+    }
+    if (T_STRING != rb_type(input)) {
+	if (oj_stringio_class == rb_obj_class(input)) {
+	    input = rb_funcall2(input, oj_string_id, 0, 0);
+	} else if (rb_respond_to(input, oj_read_id)) {
+	    input = rb_funcall2(input, oj_read_id, 0, 0);
+	} else {
+	    rb_raise(rb_eArgError, "validate() expected a String or IO Object.");
+	}
+	Check_Type(input, T_STRING);
+    }
+    enc = rb_enc_get(input);
+    if (rb_utf8_encoding() != enc && rb_usascii_encoding() != enc && rb_ascii8bit_encoding() != enc) {
+	input = rb_str_conv_enc(input, enc, rb_utf8_encoding());
+    }
+    val->input = input;
+    val->start = RSTRING_PTR(input);
+    pi->json = val->start;
+    pi->end = pi->json + RSTRING_LEN(input);
+    // skip UTF-8 BOM if present
+    if (3 <= pi->end - pi->json && 0xEF == (uint8_t)*pi->json && 0xBB == (uint8_t)pi->json[1] && 0xBF == (uint8_t)pi->json[2]) {
+	pi->json += 3;
+    }
+    if (CompatMode == pi->options.mode && No == pi->options.nilnil && pi->json == pi->end) {
+	oj_err_set(&pi->err, oj_json_parser_error_class, "An empty string is not a valid JSON string.");
+	pi->cur = pi->json;
+	return false;
+    }
+    min = (0 < pi->options.release_gvl) ? pi->options.release_gvl : VALIDATE_NOGVL_MIN;
+    val->nogvl = (min <= (size_t)(pi->end - pi->json));
+    oj_stack_reset(&pi->stack);
+    if (val->nogvl) {
+	rb_str_locktmp(input);
+    }
+    rb_ensure(validate_run, (VALUE)val, validate_cleanup, (VALUE)val);
+
+    return !err_has(&pi->err);
+}
+
+VALUE
+oj_valid_p(int argc, VALUE *argv, VALUE self) {
+    struct _validation	val;
+
+    return oj_validate_doc(argc, argv, &val) ? Qtrue : Qfalse;
+}
+
+VALUE
+oj_validate(int argc, VALUE *argv, VALUE self) {
+    struct _validation	val;
+    volatile VALUE	h;
+    const char		*cur;
+    const char		*s;
+    char		*m;
+    long		line = 1;
+    long		col = 1;
+
+    if (oj_validate_doc(argc, argv, &val)) {
+	return Qnil;
+    }
+    cur = val.pi.cur - 1;
+    if (cur < val.pi.json) {
+	cur = val.pi.json;
+    }
+    if (val.pi.end < cur) {
+	cur = val.pi.end;
+    }
+    for (s = cur; val.start < s && '\n' != s[-1]; s--) {
+	col++;
+    }
+    for (; val.start < s; s--) {
+	if ('\n' == s[-1]) {
+	    line++;
+	}
+    }
+    // Drop the location the message ends with as it is in the other fields
+    // and the path when it is empty.
+    if (NULL != (m = strstr(val.pi.err.msg, " at line "))) {
+	*m = '\0';
+    }
+    if (NULL != (m = strstr(val.pi.err.msg, " (after )"))) {
+	*m = '\0';
+    }
+    h = rb_hash_new();
+    rb_hash_aset(h, ID2SYM(rb_intern("message")), oj_encode(rb_str_new2(val.pi.err.msg)));
+    rb_hash_aset(h, ID2SYM(rb_intern("offset")), LONG2NUM(cur - val.start));
+    rb_hash_aset(h, ID2SYM(rb_intern("line")), LONG2NUM(line));
+    rb_hash_aset(h, ID2SYM(rb_intern("column")), LONG2NUM(col));
+
+    return h;
+}
@@ -0,0 +1,22 @@
+// Copyright (c) 2021 Peter Ohler. All rights reserved.
+
+#ifndef OJ_VALIDATE_H
+#define OJ_VALIDATE_H
+
+#include <stdbool.h>
+
+#include "parse.h"
+
+typedef struct _validation {
+    struct _parseInfo	pi;
+    volatile VALUE	input;
+    const char		*start; // start of the input including a BOM
+    bool		nogvl;
+} *Validation;
+
+// Checks the document in argv[0] with the options in argv[1] without
+// creating any Ruby objects. On success val->pi.json to val->pi.cur is the
+// document. On failure val->pi.err holds the error.
+extern bool	oj_validate_doc(int argc, VALUE *argv, Validation val);
+
+#endif /* OJ_VALIDATE_H */
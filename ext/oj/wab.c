@@ -10,6 +10,7 @@
 #include "err.h"
 #include "parse.h"
 #include "encode.h"
+#include "hash.h"
 #include "dump.h"
 #include "trace.h"
 #include "util.h"
@@ -17,6 +18,8 @@
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
 #define OJ_INFINITY (1.0/0.0)
 
+extern VALUE	oj_parse_xml_time(const char *str, int len); // from object.c
+
 static char	hex_chars[256] = "\
 ................................\
 ................xxxxxxxxxx......\
@@ -27,9 +30,23 @@ static char	hex_chars[256] = "\
 ................................\
 ................................";
 
+// Characters that may be in a URI. A 'r' may be in a host name and a 'p'
+// only in a path, query, or fragment. The '%', '/', '?', '#', '[', and ']'
+// characters are checked on their own.
+static char	uri_chars[256] = "\
+................................\
+.r..r.rrrrrrrrr.rrrrrrrrrrpr.r..\
+prrrrrrrrrrrrrrrrrrrrrrrrrr....r\
+.rrrrrrrrrrrrrrrrrrrrrrrrrr...r.\
+................................\
+................................\
+................................\
+................................";
+
 static VALUE	wab_uuid_clas = Qundef;
 static VALUE	uri_clas = Qundef;
 static VALUE	uri_http_clas = Qundef;
+static VALUE	uri_parser = Qundef;
 
 ///// dump functions /////
 
@@ -77,6 +94,20 @@ resolve_uri_http_class() {
     return uri_http_clas;
 }
 
+// The parser URI.parse() uses or nil if it is not the RFC 3986 parser.
+static VALUE
+resolve_uri_parser() {
+    if (Qundef == uri_parser) {
+	volatile VALUE	uri_module = resolve_uri_class();
+
+	uri_parser = Qnil;
+	if (Qnil != uri_module && rb_const_defined_at(uri_module, rb_intern("RFC3986_PARSER"))) {
+	    uri_parser = rb_const_get_at(uri_module, rb_intern("RFC3986_PARSER"));
+	}
+    }
+    return uri_parser;
+}
+
 static void
 raise_wab(VALUE obj) {
     rb_raise(rb_eTypeError, "Failed to dump %s Object to JSON in wab mode.\n", rb_class2name(rb_obj_class(obj)));
@@ -100,6 +131,8 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
     } else {
 	if (OJ_INFINITY == d || -OJ_INFINITY == d || isnan(d)) {
 	    raise_wab(obj);
+	} else if (ShortestFloat == out->opts->float_engine) {
+	    cnt = oj_dump_float_shortest(d, buf);
 	} else if (d == (double)(long long int)d) {
 	    cnt = snprintf(buf, sizeof(buf), "%.1f", d);
 	} else {
@@ -157,7 +190,7 @@ hash_cb(VALUE key, VALUE value, VALUE ov) {
     size = depth * out->indent + 1;
     assure_size(out, size);
     fill_indent(out, depth);
-    oj_dump_sym(key, 0, out, false);
+    oj_dump_key(key, out);
     *out->cur++ = ':';
     oj_dump_wab_val(value, depth, out);
     out->depth = depth;
@@ -193,7 +226,6 @@ dump_hash(VALUE obj, int depth, Out out, bool as_ok) {
 static void
 dump_time(VALUE obj, Out out) {
     char		buf[64];
-    struct _timeInfo	ti;
     int			len;
     time_t		sec;
     long long		nsec;
@@ -215,9 +247,7 @@ dump_time(VALUE obj, Out out) {
 
     assure_size(out, 36);
     // 2012-01-05T23:58:07.123456000Z
-    sec_as_time(sec, &ti);
-
-    len = sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02d.%09ldZ", ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec, (long)nsec);
+    len = oj_xml_time_str(buf, (int64_t)sec, (long)nsec, 9, 0, true);
     oj_dump_cstr(buf, len, 0, 0, out);
 }
 
@@ -227,6 +257,8 @@ dump_obj(VALUE obj, int depth, Out out, bool as_ok) {
 
     if (rb_cTime == clas) {
 	dump_time(obj, out);
+    } else if (oj_raw_json_class == clas) {
+	oj_dump_raw_json(obj, depth, out);
     } else if (oj_bigdecimal_class == clas) {
 	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
 
@@ -355,117 +387,208 @@ uuid_check(const char *str, int len) {
     return true;
 }
 
-static const char*
-read_num(const char *s, int len, int *vp) {
-    uint32_t	v = 0;
+static VALUE
+protect_uri(VALUE rstr) {
+    return rb_funcall(resolve_uri_class(), oj_parse_id, 1, rstr);
+}
 
-    for (; 0 < len; len--, s++) {
-	if ('0' <= *s && *s <= '9') {
-	    v = v * 10 + *s - '0';
-	} else {
-	    return NULL;
+typedef enum {
+    URI_INVALID	= 'i',
+    URI_VALID	= 'v',
+    URI_UNKNOWN	= 'u',
+} UriCheck;
+
+typedef struct _uriPart {
+    const char	*str;
+    const char	*end; // NULL if the part is not present
+} *UriPart;
+
+typedef struct _uriParts {
+    struct _uriPart	userinfo;
+    struct _uriPart	host;
+    struct _uriPart	port;
+    struct _uriPart	path;
+    struct _uriPart	query;
+    struct _uriPart	fragment;
+} *UriParts;
+
+// Returns the end of the run of characters starting at s that are 'r'
+// characters, 'p' characters if pchar is true, percent encodings, or in also.
+static const char*
+uri_run(const char *s, const char *end, bool pchar, const char *also) {
+    for (; s < end; s++) {
+	switch (uri_chars[*(uint8_t*)s]) {
+	case 'r':
+	    continue;
+	case 'p':
+	    if (pchar) {
+		continue;
+	    }
+	    break;
+	default:
+	    break;
+	}
+	if ('%' == *s) {
+	    if (end - s < 3 || 'x' != hex_chars[(uint8_t)s[1]] || 'x' != hex_chars[(uint8_t)s[2]]) {
+		return s;
+	    }
+	    s += 2;
+	} else if ('\0' == *s || NULL == strchr(also, *s)) {
+	    return s;
 	}
     }
-    *vp = (int)v;
-
-    return s;
+    return end;
 }
 
-static VALUE
-time_parse(const char *s, int len) {
-    struct tm	tm;
-    bool	neg = false;
-    long	nsecs = 0;
-    int		i;
-    time_t	secs;
+// Splits a string that starts with http:// into the parts URI.parse() finds
+// with the same rules for what is a valid URI. A host in brackets is left to
+// URI.parse().
+static UriCheck
+uri_split(const char *str, size_t len, UriParts parts) {
+    const char	*end = str + len;
+    const char	*s = str + 7;
+    const char	*auth_end;
+    const char	*e;
 
-    memset(&tm, 0, sizeof(tm));
-    if ('-' == *s) {
-	s++;
-	neg = true;
-    }
-    if (NULL == (s = read_num(s, 4, &tm.tm_year))) {
-	return Qnil;
-    }
-    if (neg) {
-	tm.tm_year = -tm.tm_year;
-	neg = false;
+    memset(parts, 0, sizeof(struct _uriParts));
+    for (auth_end = s; auth_end < end && '/' != *auth_end && '?' != *auth_end && '#' != *auth_end; auth_end++) {
     }
-    tm.tm_year -= 1900;
-    s++;
-    if (NULL == (s = read_num(s, 2, &tm.tm_mon))) {
-	return Qnil;
-    }
-    tm.tm_mon--;
-    s++;
-    if (NULL == (s = read_num(s, 2, &tm.tm_mday))) {
-	return Qnil;
-    }
-    s++;
-    if (NULL == (s = read_num(s, 2, &tm.tm_hour))) {
-	return Qnil;
+    if (s < auth_end && '[' == *s) {
+	return URI_UNKNOWN;
     }
-    s++;
-    if (NULL == (s = read_num(s, 2, &tm.tm_min))) {
-	return Qnil;
+    if (NULL != (e = memchr(s, '@', auth_end - s))) {
+	if (e != uri_run(s, e, false, ":")) {
+	    return URI_INVALID;
+	}
+	parts->userinfo.str = s;
+	parts->userinfo.end = e;
+	s = e + 1;
+    }
+    e = uri_run(s, auth_end, false, "");
+    parts->host.str = s;
+    parts->host.end = e;
+    if (e < auth_end) {
+	if (':' != *e) {
+	    return '[' == *e ? URI_UNKNOWN : URI_INVALID;
+	}
+	for (s = ++e; e < auth_end && '0' <= *e && *e <= '9'; e++) {
+	}
+	if (e < auth_end) {
+	    return URI_INVALID;
+	}
+	parts->port.str = s;
+	parts->port.end = e;
+    }
+    s = auth_end;
+    e = uri_run(s, end, true, "/");
+    parts->path.str = s;
+    parts->path.end = e;
+    if (e < end && '?' == *e) {
+	// Any ASCII but a '#' is accepted in a query and escaped by URI::HTTP
+	// but only some bad percent encodings are rejected so those are left
+	// to URI.parse().
+	for (s = ++e; e < end && '#' != *e && 0 == (0x80 & *e); e++) {
+	    if ('%' == *e && (end - e < 3 || 'x' != hex_chars[(uint8_t)e[1]] || 'x' != hex_chars[(uint8_t)e[2]])) {
+		return URI_UNKNOWN;
+	    }
+	}
+	parts->query.str = s;
+	parts->query.end = e;
     }
-    s++;
-    if (NULL == (s = read_num(s, 2, &tm.tm_sec))) {
-	return Qnil;
+    if (e < end && '#' == *e) {
+	s = e + 1;
+	e = uri_run(s, end, true, "/?");
+	parts->fragment.str = s;
+	parts->fragment.end = e;
     }
-    s++;
+    return (e == end) ? URI_VALID : URI_INVALID;
+}
 
-    for (i = 9; 0 < i; i--, s++) {
-	if ('0' <= *s && *s <= '9') {
-	    nsecs = nsecs * 10 + *s - '0';
-	} else {
-	    return Qnil;
-	}
+static VALUE
+uri_part_value(UriPart part) {
+    if (NULL == part->end) {
+	return Qnil;
     }
-#if IS_WINDOWS
-    secs = (time_t)mktime(&tm);
-    memset(&tm, 0, sizeof(tm));
-    tm.tm_year = 70;
-    tm.tm_mday = 1;
-    secs -= (time_t)mktime(&tm);
-#else
-    secs = (time_t)timegm(&tm);
-#endif
-    return rb_funcall(rb_time_nano_new(secs, nsecs), oj_utc_id, 0);
+    return oj_encode(rb_str_new(part->str, part->end - part->str));
 }
 
+// Returns a URI::HTTP for an http:// string, Qnil if URI.parse() would
+// reject it, or Qundef if it is not known.
 static VALUE
-protect_uri(VALUE rstr) {
-    return rb_funcall(resolve_uri_class(), oj_parse_id, 1, rstr);
-}
+cstr_to_uri(const char *str, size_t len) {
+    struct _uriParts	parts;
+    VALUE		args[10];
 
+    if (Qnil == resolve_uri_http_class() || Qnil == resolve_uri_parser()) {
+	return Qundef;
+    }
+    switch (uri_split(str, len, &parts)) {
+    case URI_INVALID:
+	return Qnil;
+    case URI_UNKNOWN:
+	return Qundef;
+    default:
+	break;
+    }
+    // The same arguments URI.parse() gives URI::HTTP.new().
+    args[0] = oj_encode(rb_str_new(str, 4));
+    args[1] = uri_part_value(&parts.userinfo);
+    args[2] = uri_part_value(&parts.host);
+    args[3] = uri_part_value(&parts.port);
+    args[4] = Qnil; // registry
+    args[5] = uri_part_value(&parts.path);
+    args[6] = Qnil; // opaque
+    args[7] = uri_part_value(&parts.query);
+    args[8] = uri_part_value(&parts.fragment);
+    args[9] = uri_parser;
+
+    return rb_class_new_instance(10, args, uri_http_clas);
+}
+
+// Strings are classified by their length and first characters so most are
+// turned into a String with no further checks.
 static VALUE
-cstr_to_rstr(const char *str, size_t len) {
+cstr_to_rstr(ParseInfo pi, const char *str, size_t len) {
     volatile VALUE	v = Qnil;
 
-    if (30 == len && '-' == str[4] && '-' == str[7] && 'T' == str[10] && ':' == str[13] && ':' == str[16]  && '.' == str[19] && 'Z' == str[29]) {
-	if (Qnil != (v = time_parse(str, (int)len))) {
-	    return v;
+    switch (len) {
+    case 30:
+	if ('-' == str[4] && '-' == str[7] && 'T' == str[10] && ':' == str[13] && ':' == str[16]  && '.' == str[19] && 'Z' == str[29]) {
+	    if (Qnil != (v = oj_parse_xml_time(str, (int)len))) {
+		return v;
+	    }
 	}
+	break;
+    case 36:
+	if ('-' == str[8] && '-' == str[13] && '-' == str[18] && '-' == str[23] && uuid_check(str, (int)len) && Qnil != resolve_wab_uuid_class()) {
+	    return rb_funcall(wab_uuid_clas, oj_new_id, 1, rb_str_new(str, len));
+	}
+	break;
+    default:
+	break;
     }
-    if (36 == len && '-' == str[8] && '-' == str[13] && '-' == str[18] && '-' == str[23] && uuid_check(str, (int)len) && Qnil != resolve_wab_uuid_class()) {
-	return rb_funcall(wab_uuid_clas, oj_new_id, 1, rb_str_new(str, len));
-    }
-    v = rb_str_new(str, len);
-    if (7 < len && 0 == strncasecmp("http://", str, 7)) {
-	int		err = 0;
-	volatile VALUE	uri = rb_protect(protect_uri, v, &err);
+    if (7 < len && ('h' == *str || 'H' == *str) && 0 == strncasecmp("http://", str, 7) && Qnil != resolve_uri_class()) {
+	int	err = 0;
+
+	volatile VALUE	uri;
 
+	if (Qundef != (v = cstr_to_uri(str, len))) {
+	    return (Qnil == v) ? oj_cstr_to_value(pi, str, len) : v;
+	}
+	v = oj_cstr_to_value(pi, str, len);
+	uri = rb_protect(protect_uri, v, &err);
 	if (0 == err) {
 	    return uri;
 	}
+	rb_set_errinfo(Qnil);
+	return v;
     }
-    return oj_encode(v);
+    return oj_cstr_to_value(pi, str, len);
 }
 
 static void
 add_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    pi->stack.head->val = cstr_to_rstr(str, len);
+    pi->stack.head->val = cstr_to_rstr(pi, str, len);
     if (Yes == pi->options.trace) {
 	oj_trace_parse_call("add_string", pi, __FILE__, __LINE__, pi->stack.head->val);
     }
@@ -498,7 +621,7 @@ calc_hash_key(ParseInfo pi, Val parent) {
     volatile VALUE	rkey = parent->key_val;
 
     if (Qundef == rkey) {
-	rkey = rb_str_new(parent->key, parent->klen);
+	return oj_sym_new(parent->key, parent->klen);
     }
     rkey = oj_encode(rkey);
     rkey = rb_str_intern(rkey);
@@ -508,7 +631,7 @@ calc_hash_key(ParseInfo pi, Val parent) {
 
 static void
 hash_set_cstr(ParseInfo pi, Val parent, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rval = cstr_to_rstr(str, len);
+    volatile VALUE	rval = cstr_to_rstr(pi, str, len);
 
     rb_hash_aset(stack_peek(&pi->stack)->val, calc_hash_key(pi, parent), rval);
     if (Yes == pi->options.trace) {
@@ -548,7 +671,7 @@ start_array(ParseInfo pi) {
 
 static void
 array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rval = cstr_to_rstr(str, len);
+    volatile VALUE	rval = cstr_to_rstr(pi, str, len);
 
     rb_ary_push(stack_peek(&pi->stack)->val, rval);
     if (Yes == pi->options.trace) {
@@ -7,6 +7,7 @@ require 'oj/bag'
 require 'oj/easy_hash'
 require 'oj/error'
 require 'oj/mimic'
+require 'oj/raw_json'
 require 'oj/saj'
 require 'oj/schandler'
 
@@ -0,0 +1,49 @@
+module Oj
+
+  # Holds a value as the JSON it was read from. Loads with the :raw option
+  # return one in place of each value on a raw path so the value is not built
+  # unless it is asked for. Oj.dump writes the JSON back out unchanged in
+  # every mode.
+  class RawJSON
+
+    # The JSON of the value.
+    attr_reader :json
+
+    # @param [String] json JSON of the value
+    def initialize(json)
+      @json = json.to_str
+    end
+
+    # Returns the value loaded from the JSON. The first call loads it with the
+    # options given or the default options and later calls return the same
+    # value.
+    # @param [Hash] opts load options
+    def value(opts = {})
+      @value = Oj.load(@json, opts) unless instance_variable_defined?(:@value)
+      @value
+    end
+
+    # Called by Oj.dump with the :use_raw_json option and by the json gem.
+    def raw_json(depth = 0, indent = 0)
+      @json
+    end
+
+    def to_json(*)
+      @json
+    end
+
+    def to_s
+      @json
+    end
+
+    def eql?(o)
+      self.class == o.class && @json == o.json
+    end
+    alias == eql?
+
+    def hash
+      @json.hash
+    end
+
+  end # RawJSON
+end # Oj
@@ -0,0 +1,77 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$: << File.dirname(File.dirname(__FILE__))
+
+require 'helper'
+
+# Rails is not loaded. The stand-ins only have what the rails mode record
+# dump uses, the @attributes ivar and an attribute set that responds to keys
+# and fetch_value.
+module ActiveRecord
+  class Base
+    def initialize(attributes)
+      @attributes = attributes
+    end
+
+    def as_json(options = nil)
+      { 'as_json' => true }
+    end
+  end
+end
+
+class StandInAttributeSet
+  def initialize(values)
+    @values = values
+  end
+
+  def keys
+    @values.keys
+  end
+
+  def fetch_value(name)
+    @values[name]
+  end
+end
+
+class StandInRecord < ActiveRecord::Base
+end
+
+Oj::Rails.optimize(StandInRecord)
+
+class ActiveRecordAttributeSetTest < Minitest::Test
+  def record
+    StandInRecord.new(StandInAttributeSet.new('id' => 1, 'name' => 'x', 'note' => nil))
+  end
+
+  def test_attributes
+    assert_equal('{"id":1,"name":"x","note":null}', Oj.dump(record, mode: :rails))
+    assert_equal('{"id":1,"name":"x"}', Oj.dump(record, mode: :rails, omit_nil: true))
+    assert_equal(%|{\n  "id":1,\n  "name":"x",\n  "note":null\n}\n|, Oj.dump(record, mode: :rails, indent: 2))
+    assert_equal('[{"id":1,"name":"x","note":null}]', Oj::Rails.encode([record]))
+  end
+
+  def test_only
+    assert_equal('{"id":1,"name":"x"}', Oj::Rails.encode(record, only: [:id, 'name']))
+    assert_equal('{"id":1}', Oj::Rails.encode(record, only: :id))
+    assert_equal('{}', Oj::Rails.encode(record, only: :missing))
+    # :except is ignored when :only is given, as with serializable_hash.
+    assert_equal('{"id":1}', Oj::Rails.encode(record, only: :id, except: :id))
+  end
+
+  def test_except
+    assert_equal('{"id":1,"name":"x"}', Oj::Rails.encode(record, except: :note))
+    assert_equal('{"note":null}', Oj::Rails.encode(record, except: ['id', :name]))
+  end
+
+  def test_as_json_options
+    # :include and :methods need the model so as_json is called.
+    assert_equal('{"as_json":true}', Oj::Rails.encode(record, include: :x))
+    assert_equal('{"as_json":true}', Oj::Rails.encode(record, methods: :x))
+  end
+
+  def test_hash_attributes
+    # Before Rails 4.2 the attributes were a Hash.
+    assert_equal('{"a":1}', Oj.dump(StandInRecord.new('a' => 1), mode: :rails))
+  end
+end
@@ -24,4 +24,9 @@ class ActiveRecordResultTest < Minitest::Test
    
     assert_equal Oj.dump(result, mode: :rails), Oj.dump(result.to_hash)
   end
+
+  def test_symbol_columns
+    result = ActiveRecord::Result.new([:one, "two"], [[1, 2], [3, 4]])
+    assert_equal('[{"one":1,"two":2},{"one":3,"two":4}]', Oj.dump(result, mode: :rails))
+  end
 end
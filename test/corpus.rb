@@ -0,0 +1,213 @@
+# encoding: UTF-8
+
+# Generates documents with the shapes of the standard JSON benchmark corpora
+# (twitter.json, canada.json, citm_catalog.json) and an NDJSON log. The
+# content is made from a seeded Random so every run with the same seed and
+# scale produces the same bytes and results can be compared over time. Real
+# copies of the corpora can be used instead by putting them in a directory
+# and passing it to Corpus.load.
+module Corpus
+
+  NAMES = %w(twitter canada citm_catalog logs).freeze
+
+  WORDS = %w(
+    the quick brown fox jumps over lazy dog json parse dump value string
+    number array object ruby oj fast stream buffer cache key test data
+    café naïve résumé über straße 東京 日本語 текст данные 🙂 🚀
+  ).freeze
+
+  # Returns a Hash of corpus name to JSON String. Files named <name>.json
+  # (or <name>.ndjson for logs) in dir are used in place of the generated
+  # documents.
+  def self.load(dir=nil, seed=1, scale=1)
+    corpora = {}
+    NAMES.each do |name|
+      path = dir && [File.join(dir, "#{name}.json"), File.join(dir, "#{name}.ndjson")].find { |p| File.exist?(p) }
+      corpora[name] = path ? File.read(path) : generate(name, seed, scale)
+    end
+    corpora
+  end
+
+  # Writes the generated corpora to dir so other tools can use the same
+  # documents.
+  def self.write(dir, seed=1, scale=1)
+    NAMES.each do |name|
+      ext = 'logs' == name ? 'ndjson' : 'json'
+      File.write(File.join(dir, "#{name}.#{ext}"), generate(name, seed, scale))
+    end
+  end
+
+  def self.generate(name, seed=1, scale=1)
+    rand = Random.new(seed)
+    case name
+    when 'twitter'
+      Oj.dump(twitter(rand, 400 * scale), mode: :strict)
+    when 'canada'
+      Oj.dump(canada(rand, 260 * scale), mode: :strict, float_precision: 17)
+    when 'citm_catalog'
+      Oj.dump(citm(rand, 240 * scale), mode: :strict, indent: 1)
+    when 'logs'
+      logs(rand, 5000 * scale).map { |h| Oj.dump(h, mode: :strict) }.join("\n") << "\n"
+    else
+      raise ArgumentError, "unknown corpus #{name}"
+    end
+  end
+
+  def self.text(rand, cnt)
+    Array.new(cnt) { WORDS[rand.rand(WORDS.size)] }.join(' ')
+  end
+
+  def self.twitter(rand, cnt)
+    statuses = Array.new(cnt) do |i|
+      id = 505874924095815681 - i * 7919
+      {
+        'metadata' => { 'result_type' => 'recent', 'iso_language_code' => 'ja' },
+        'created_at' => "Sun Aug 31 00:%02d:%02d +0000 2014" % [rand.rand(60), rand.rand(60)],
+        'id' => id,
+        'id_str' => id.to_s,
+        'text' => text(rand, 8 + rand.rand(12)),
+        'source' => '<a href="http://twitter.com/download/iphone" rel="nofollow">Twitter for iPhone</a>',
+        'truncated' => false,
+        'in_reply_to_status_id' => nil,
+        'in_reply_to_user_id' => 0 == rand.rand(3) ? rand.rand(2**31) : nil,
+        'user' => {
+          'id' => rand.rand(2**40),
+          'name' => text(rand, 2),
+          'screen_name' => "user_#{rand.rand(100000)}",
+          'location' => text(rand, 1),
+          'description' => text(rand, 10),
+          'url' => nil,
+          'entities' => { 'description' => { 'urls' => [] } },
+          'protected' => false,
+          'followers_count' => rand.rand(10000),
+          'friends_count' => rand.rand(10000),
+          'listed_count' => rand.rand(100),
+          'created_at' => 'Sun Jul 20 03:54:00 +0000 2014',
+          'favourites_count' => rand.rand(1000),
+          'utc_offset' => nil,
+          'geo_enabled' => 0 == rand.rand(2),
+          'verified' => false,
+          'statuses_count' => rand.rand(100000),
+          'lang' => 'ja',
+          'profile_background_color' => 'C0DEED',
+          'profile_image_url' => "http://pbs.twimg.com/profile_images/#{rand.rand(2**32)}/normal.jpeg",
+          'default_profile' => true,
+        },
+        'geo' => nil,
+        'coordinates' => nil,
+        'retweet_count' => rand.rand(100),
+        'favorite_count' => rand.rand(100),
+        'entities' => {
+          'hashtags' => Array.new(rand.rand(3)) { { 'text' => text(rand, 1), 'indices' => [rand.rand(100), rand.rand(140)] } },
+          'symbols' => [],
+          'urls' => [],
+          'user_mentions' => Array.new(rand.rand(3)) { { 'screen_name' => "user_#{rand.rand(100000)}", 'id' => rand.rand(2**31), 'indices' => [0, 12] } },
+        },
+        'favorited' => false,
+        'retweeted' => false,
+        'lang' => 'ja',
+      }
+    end
+    {
+      'statuses' => statuses,
+      'search_metadata' => {
+        'completed_in' => 0.087,
+        'max_id' => 505874924095815681,
+        'query' => '%E4%B8%80',
+        'count' => cnt,
+        'since_id' => 0,
+      }
+    }
+  end
+
+  def self.canada(rand, rings)
+    coords = Array.new(rings) do
+      lon = -65.0 - rand.rand * 75.0
+      lat = 44.0 + rand.rand * 35.0
+      Array.new(100 + rand.rand(200)) do
+        lon += rand.rand * 0.02 - 0.01
+        lat += rand.rand * 0.02 - 0.01
+        [lon, lat]
+      end
+    end
+    {
+      'type' => 'FeatureCollection',
+      'features' => [
+        {
+          'type' => 'Feature',
+          'properties' => { 'name' => 'Canada' },
+          'geometry' => { 'type' => 'Polygon', 'coordinates' => coords },
+        }
+      ]
+    }
+  end
+
+  def self.citm(rand, cnt)
+    areas = {}
+    60.times { |i| areas[(205705993 + i).to_s] = text(rand, 2) }
+    events = {}
+    ids = Array.new(cnt) { |i| 138586341 + i * 3 }
+    ids.each do |id|
+      events[id.to_s] = {
+        'description' => nil,
+        'id' => id,
+        'logo' => 0 == rand.rand(2) ? "/images/UE0AAAAACEKo6QAAAAVDSVRN" : nil,
+        'name' => text(rand, 3),
+        'subTopicIds' => Array.new(1 + rand.rand(4)) { 337184262 + rand.rand(100) },
+        'subjectCode' => nil,
+        'subtitle' => nil,
+        'topicIds' => Array.new(1 + rand.rand(3)) { 324846099 + rand.rand(100) },
+      }
+    end
+    performances = ids.map do |id|
+      {
+        'eventId' => id,
+        'id' => id + 1,
+        'logo' => nil,
+        'name' => nil,
+        'prices' => Array.new(1 + rand.rand(4)) { { 'amount' => 10000 + rand.rand(200) * 500, 'audienceSubCategoryId' => 337100890, 'seatCategoryId' => 338937295 + rand.rand(10) } },
+        'seatCategories' => Array.new(1 + rand.rand(3)) {
+          { 'areas' => Array.new(1 + rand.rand(6)) { { 'areaId' => 205705993 + rand.rand(60), 'blockIds' => [] } }, 'seatCategoryId' => 338937295 + rand.rand(10) }
+        },
+        'seatMapImage' => nil,
+        'start' => 1372701600000 + rand.rand(10000) * 86400000,
+        'venueCode' => 'PLEYEL_PLEYEL',
+      }
+    end
+    {
+      'areaNames' => areas,
+      'audienceSubCategoryNames' => { '337100890' => 'Abonné' },
+      'blockNames' => {},
+      'events' => events,
+      'performances' => performances,
+      'seatCategoryNames' => Hash[Array.new(10) { |i| [(338937295 + i).to_s, text(rand, 2)] }],
+      'subTopicNames' => Hash[Array.new(100) { |i| [(337184262 + i).to_s, text(rand, 1)] }],
+      'subjectNames' => {},
+      'topicNames' => Hash[Array.new(100) { |i| [(324846099 + i).to_s, text(rand, 1)] }],
+      'topicSubTopics' => {},
+      'venueNames' => { 'PLEYEL_PLEYEL' => 'Salle Pleyel' },
+    }
+  end
+
+  def self.logs(rand, cnt)
+    levels = %w(debug info info info warn error)
+    paths = %w(/ /api/v1/users /api/v1/orders /health /login /search)
+    t = 1609459200
+    Array.new(cnt) do
+      t += rand.rand(5)
+      {
+        'ts' => Time.at(t).utc.strftime('%Y-%m-%dT%H:%M:%SZ'),
+        'level' => levels[rand.rand(levels.size)],
+        'msg' => text(rand, 6),
+        'req_id' => '%016x' % rand.rand(2**64),
+        'method' => 0 == rand.rand(4) ? 'POST' : 'GET',
+        'path' => paths[rand.rand(paths.size)],
+        'status' => [200, 200, 200, 201, 304, 404, 500][rand.rand(7)],
+        'latency_ms' => (rand.rand * 250).round(3),
+        'bytes' => rand.rand(100000),
+        'cached' => 0 == rand.rand(3),
+      }
+    end
+  end
+
+end
@@ -284,6 +284,36 @@ class SharedMimicTest < Minitest::Test
     {'a' => 1}.to_json()
     Object.new().to_json()
   end
+
+  class Plain
+    def to_s
+      'plain'
+    end
+  end
+
+  class Custom < Plain
+    def to_json(*)
+      '{"custom":true}'
+    end
+  end
+
+  # Objects that use the mimic Object#to_json are dumped without calling it
+  # but the output must be the same as if it had been called.
+  def test_mimic_object_to_json_not_called
+    plain = Plain.new
+    single = Plain.new
+    def single.to_json(*)
+      '"single"'
+    end
+    assert_equal('"plain"', plain.to_json)
+    assert_equal(%{["plain",{"custom":true},"single",{"p":"plain"}]},
+                 JSON.generate([plain, Custom.new, single, {'p' => plain}]))
+
+    later = Class.new(Plain)
+    assert_equal('["plain"]', JSON.generate([later.new]))
+    later.class_eval { def to_json(*) '"later"' end }
+    assert_equal('["later"]', JSON.generate([later.new]))
+  end
 end # SharedMimicTest
 
 if defined?(ActiveSupport)
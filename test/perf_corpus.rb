@@ -0,0 +1,168 @@
+#!/usr/bin/env ruby
+# encoding: UTF-8
+
+# Times Oj.load and Oj.dump on the standard corpora for each mode and option
+# set. Reports MB/s, ns per value, objects allocated per call, and GC runs per
+# call. The -j option writes the results as JSON so runs can be tracked and
+# compared over time.
+
+$: << File.dirname(__FILE__)
+$: << File.join(File.dirname(__FILE__), "../lib")
+$: << File.join(File.dirname(__FILE__), "../ext")
+
+require 'optparse'
+require 'oj'
+require 'corpus'
+
+$verbose = false
+$iter = 10
+$seed = 1
+$scale = 1
+$dir = nil
+$json_path = nil
+$write_dir = nil
+$corpora = Corpus::NAMES
+$modes = [:strict, :null, :compat, :object, :custom, :wab]
+$ops = %w(load dump)
+
+opts = OptionParser.new
+opts.on("-v", "verbose")                                           { $verbose = true }
+opts.on("-c", "--count [Int]", Integer, "iterations per case")     { |i| $iter = i }
+opts.on("-s", "--seed [Int]", Integer, "seed for generated corpora") { |i| $seed = i }
+opts.on("-x", "--scale [Int]", Integer, "size multiplier")         { |i| $scale = i }
+opts.on("-d", "--dir [String]", String, "directory with real corpora") { |s| $dir = s }
+opts.on("-w", "--write [String]", String, "write the generated corpora to a directory and exit") { |s| $write_dir = s }
+opts.on("-j", "--json [String]", String, "write results as JSON") { |s| $json_path = s }
+opts.on("--corpus [String]", String, "comma separated corpora")   { |s| $corpora = s.split(',') }
+opts.on("--mode [String]", String, "comma separated modes")       { |s| $modes = s.split(',').map(&:to_sym) }
+opts.on("--op [String]", String, "load, dump, or load,dump")      { |s| $ops = s.split(',') }
+opts.on("-h", "--help", "Show this display")                      { puts opts; Process.exit!(0) }
+opts.parse(ARGV)
+
+unless $write_dir.nil?
+  Corpus.write($write_dir, $seed, $scale)
+  Process.exit!(0)
+end
+
+LOAD_OPTS = {
+  'default' => {},
+  'symbol_keys' => { symbol_keys: true },
+  'no_cache_keys' => { cache_keys: false },
+  'bigdecimal' => { bigdecimal_load: :bigdecimal },
+}
+
+DUMP_OPTS = {
+  'default' => {},
+  'indent' => { indent: 2 },
+}
+
+# Counts every scalar and container in a loaded document.
+def count_values(obj)
+  case obj
+  when Hash
+    obj.inject(1) { |cnt, (_, v)| cnt + 1 + count_values(v) }
+  when Array
+    obj.inject(1) { |cnt, v| cnt + count_values(v) }
+  else
+    1
+  end
+end
+
+# Runs the block $iter times after a warm up call and returns the best and
+# median seconds, the objects the block allocates, and the GC runs per call.
+def measure
+  yield
+  before = GC.stat(:total_allocated_objects)
+  yield
+  allocs = GC.stat(:total_allocated_objects) - before
+  gc_start = GC.count
+  times = Array.new($iter) do
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    yield
+    Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+  end.sort
+  { best: times[0], median: times[times.size / 2], allocs: allocs, gc: (GC.count - gc_start).to_f / $iter }
+end
+
+def ndjson?(name)
+  'logs' == name
+end
+
+def load_doc(name, json, opts)
+  if ndjson?(name)
+    json.each_line.map { |line| Oj.load(line, opts) }
+  else
+    Oj.load(json, opts)
+  end
+end
+
+def dump_doc(name, obj, opts)
+  if ndjson?(name)
+    obj.each { |d| Oj.dump(d, opts) }
+  else
+    Oj.dump(obj, opts)
+  end
+end
+
+corpora = Corpus.load($dir, $seed, $scale)
+results = []
+
+$corpora.each do |name|
+  json = corpora[name]
+  raise ArgumentError, "unknown corpus #{name}" if json.nil?
+  values = count_values(load_doc(name, json, mode: :strict))
+  $modes.each do |mode|
+    if $ops.include?('load')
+      LOAD_OPTS.each do |label, o|
+        o = o.merge(mode: mode)
+        begin
+          m = measure { load_doc(name, json, o) }
+        rescue Exception => e
+          puts "***** #{name} load #{mode} #{label} failed! #{e.class}: #{e.message[0, 200]}" if $verbose
+          next
+        end
+        results << { corpus: name, op: 'load', mode: mode.to_s, options: label, bytes: json.bytesize, values: values }.merge(m)
+      end
+    end
+    next unless $ops.include?('dump')
+    obj = load_doc(name, json, mode: :wab == mode ? :wab : :strict)
+    size = dump_doc(name, obj, mode: mode).to_s.bytesize
+    size = json.bytesize if ndjson?(name)
+    DUMP_OPTS.each do |label, o|
+      o = o.merge(mode: mode)
+      begin
+        m = measure { dump_doc(name, obj, o) }
+      rescue Exception => e
+        puts "***** #{name} dump #{mode} #{label} failed! #{e.class}: #{e.message[0, 200]}" if $verbose
+        next
+      end
+      results << { corpus: name, op: 'dump', mode: mode.to_s, options: label, bytes: size, values: values }.merge(m)
+    end
+  end
+end
+
+results.each do |r|
+  r[:mb_per_sec] = r[:bytes] / r[:best] / 1_000_000.0
+  r[:ns_per_value] = r[:best] * 1_000_000_000.0 / r[:values]
+end
+
+puts "%-13s %-4s %-7s %-13s %9s %9s %11s %7s" % %w(corpus op mode options MB/s ns/value allocs/call gc/call)
+puts '-' * 80
+results.each do |r|
+  puts "%-13s %-4s %-7s %-13s %9.1f %9.1f %11d %7.2f" %
+    [r[:corpus], r[:op], r[:mode], r[:options], r[:mb_per_sec], r[:ns_per_value], r[:allocs], r[:gc]]
+end
+
+unless $json_path.nil?
+  report = {
+    oj: Oj::VERSION,
+    ruby: RUBY_DESCRIPTION,
+    time: Time.now.utc.strftime('%Y-%m-%dT%H:%M:%SZ'),
+    seed: $seed,
+    scale: $scale,
+    dir: $dir,
+    iterations: $iter,
+    results: results,
+  }
+  File.write($json_path, Oj.dump(report, mode: :compat, indent: 2))
+end
@@ -56,6 +56,18 @@ class CompatJuice < Minitest::Test
     end
   end # Stringy
 
+  class Tagged
+    attr_reader :s
+
+    def initialize(s)
+      @s = s
+    end
+
+    def self.json_create(s)
+      new(s)
+    end
+  end # Tagged
+
   module One
     module Two
       module Three
@@ -466,6 +478,38 @@ class CompatJuice < Minitest::Test
     assert_equal('"1..7"', json)
   end
 
+  def test_add_remove_to_json
+    json = Oj.dump(1..7, mode: :compat)
+    assert_equal('"1..7"', json)
+    Oj.add_to_json(Range)
+    json = Oj.dump(1..7, mode: :compat)
+    assert_equal('{"json_class":"Range","a":[1,7,false]}', json)
+  ensure
+    Oj.remove_to_json(Range)
+    assert_equal('"1..7"', Oj.dump(1..7, mode: :compat))
+  end
+
+  def test_match_string
+    json = %|["id-12","xid-12","id-","line\nid-3"]|
+    [/^id-\d+/, /\Aid-\d+/, '^id-[0-9][0-9]*'].each { |rx|
+      obj = Oj.compat_load(json, :create_additions => true, :match_string => { rx => Tagged })
+      assert_equal(Tagged, obj[0].class, "#{rx.inspect}")
+      assert_equal('id-12', obj[0].s)
+      assert_equal(['xid-12', 'id-'], obj[1..2], "#{rx.inspect}")
+      # Only a Regexp ^ matches after a newline.
+      assert_equal(rx.is_a?(Regexp) && rx.source.start_with?('^') ? Tagged : String, obj[3].class, "#{rx.inspect}")
+    }
+  end
+
+  def test_match_string_multibyte_repeat
+    json = %|["a","aé","aéé","b"]|
+    [/^aé?$/, /^aé*$/, /^aé{0,1}$/].each { |rx|
+      obj = Oj.compat_load(json, :create_additions => true, :match_string => { rx => Tagged })
+      assert_equal([Tagged, Tagged], obj[0..1].map(&:class), "#{rx.inspect}")
+      assert_equal('b', obj[3], "#{rx.inspect}")
+    }
+  end
+
   def test_arg_passing
     json = Oj.to_json(Argy.new(), :max_nesting=> 40)
     assert_equal(%|{"args":"[{:max_nesting=>40}]"}|, json)
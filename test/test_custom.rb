@@ -424,6 +424,14 @@ class CustomJuice < Minitest::Test
     assert_equal('1483574400.000000000', json)
   end
 
+  def test_date_unix_early
+    assert_equal('-86400.000000000', Oj.dump(Date.new(1969, 12, 31), time_format: :unix))
+    # A Julian date is converted by Date#to_time.
+    d = Date.new(1000, 1, 1)
+    json = Oj.dump(d, time_format: :unix)
+    assert_equal(d.to_time.to_i + d.to_time.utc_offset, json.to_i)
+  end
+
   def test_date_ruby
     obj = Date.new(2017, 1, 5)
     json = Oj.dump(obj, :indent => 2, time_format: :ruby)
@@ -468,6 +476,17 @@ class CustomJuice < Minitest::Test
     assert_equal('"2017-01-05T10:20:30-05:00"', json)
   end
 
+  def test_datetime_load_range
+    opts = { mode: :custom, create_id: '^o', create_additions: true }
+    assert_raises(ArgumentError) { Oj.load(%|{"^o":"DateTime","s":"2021-02-30T00:00:00Z"}|, opts) }
+    assert_raises(ArgumentError) { Oj.load(%|{"^o":"DateTime","s":"2021-04-31T00:00:00+01:00"}|, opts) }
+    assert_raises(ArgumentError) { Oj.load(%|{"^o":"Date","s":"2021-02-29"}|, opts) }
+    assert_raises(ArgumentError) { Oj.load(%|{"^o":"Date","s":"2100-02-29"}|, opts) }
+    assert_equal(Date.new(2000, 2, 29), Oj.load(%|{"^o":"Date","s":"2000-02-29"}|, opts))
+    assert_equal(DateTime.new(2020, 2, 29, 1, 2, 3), Oj.load(%|{"^o":"DateTime","s":"2020-02-29T01:02:03Z"}|, opts))
+    assert_equal(DateTime.parse('2021-12-31T23:59:60Z'), Oj.load(%|{"^o":"DateTime","s":"2021-12-31T23:59:60Z"}|, opts))
+  end
+
   def test_regexp
     # this notation must be used to get an == match later
     obj = /(?ix-m:^yes$)/
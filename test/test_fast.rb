@@ -450,6 +450,67 @@ class DocTest < Minitest::Test
     assert_equal({'/a/x' => 2, '/b/y' => 4}, results)
   end
 
+  def test_large_array
+    json = Oj.dump((1..1000).to_a, mode: :strict)
+    Oj::Doc.open(json) do |doc|
+      assert_equal(1, doc.fetch('/0'))
+      assert_equal(1, doc.fetch('/1'))
+      assert_equal(500, doc.fetch('/500'))
+      assert_equal(1000, doc.fetch('/1000'))
+      assert_nil(doc.fetch('/1001'))
+      doc.move('/750')
+      assert_equal('/750', doc.where?)
+      assert_equal(750, doc.fetch())
+      assert_raises(ArgumentError) { doc.move('/1001') }
+    end
+  end
+
+  def test_large_hash
+    h = {}
+    100.times { |i| h["k#{i}"] = i }
+    h['a/b'] = 'slash'
+    json = Oj.dump(h, mode: :strict).sub('{', '{"k7":"dup",')
+    Oj::Doc.open(json) do |doc|
+      assert_equal(0, doc.fetch('/k0'))
+      assert_equal(99, doc.fetch('/k99'))
+      assert_equal('dup', doc.fetch('/k7'))
+      assert_equal('slash', doc.fetch('/a\\/b'))
+      assert_nil(doc.fetch('/k100'))
+      doc.move('/k42')
+      assert_equal(42, doc.fetch())
+      assert_equal(99, doc.fetch('../k99'))
+    end
+  end
+
+  def test_path
+    doc_path = Oj::Doc::Path.new('/array/1/hash/h2/a/2')
+    up_path = Oj::Doc::Path.new('../../..')
+    assert_equal('/array/1/hash/h2/a/2', doc_path.to_s)
+    Oj::Doc.open(@json1) do |doc|
+      assert_equal(2, doc.fetch(doc_path))
+      assert_equal(Integer, doc.type(doc_path))
+      assert_nil(doc.fetch(Oj::Doc::Path.new('/array/1/missing')))
+      assert_equal(true, doc.fetch(Oj::Doc::Path.new('boolean')))
+      doc.move(doc_path)
+      assert_equal('/array/1/hash/h2/a/2', doc.where?)
+      assert_equal(3, doc.fetch(Oj::Doc::Path.new('../3')))
+      doc.move(up_path)
+      assert_equal('/array/1/hash', doc.where?)
+      assert_raises(ArgumentError) { doc.move(Oj::Doc::Path.new('nothing')) }
+      assert_equal('/array/1/hash', doc.where?)
+      values = []
+      doc.each_value(Oj::Doc::Path.new('/array/1/hash/h2/a')) { |v| values << v }
+      assert_equal([1, 2, 3], values)
+      children = []
+      doc.each_child(Oj::Doc::Path.new('/array/1')) { |d| children << d.where? }
+      assert_equal(['/array/1/num', '/array/1/string', '/array/1/hash'], children)
+      assert_equal('[1,2,3]', doc.dump(Oj::Doc::Path.new('/array/1/hash/h2/a')))
+    end
+    Oj::Doc.open('{"a/b":{"c":5}}') do |doc|
+      assert_equal(5, doc.fetch(Oj::Doc::Path.new('/a\\/b/c')))
+    end
+  end
+
   def test_comment
     json = %{{
   "x"/*one*/:/*two*/true,//three
@@ -4,6 +4,7 @@
 $: << File.dirname(__FILE__)
 
 require 'helper'
+require 'zlib'
 
 class FileJuice < Minitest::Test
   class Jam
@@ -212,6 +213,56 @@ class FileJuice < Minitest::Test
     dump_and_load(DateTime.new(2012, 6, 19), false)
   end
 
+  def test_load_file_mmap
+    filename = File.join(File.dirname(__FILE__), 'file_test.json')
+    # Sizes on either side of a page boundary check the terminating '\0'.
+    [4095, 4096, 4097, 8192].each { |size|
+      json = '[' + '"' + 'x' * (size - 4) + '"' + ']'
+      File.write(filename, json)
+      assert_equal(size, File.size(filename))
+      assert_equal(['x' * (size - 4)], Oj.load_file(filename, mode: :strict, mmap: true))
+    }
+    File.write(filename, "\xEF\xBB\xBF{\"a\":1}")
+    assert_equal({'a' => 1}, Oj.load_file(filename, mode: :strict, mmap: true))
+
+    File.write(filename, "[1]\n[2]\n")
+    docs = []
+    Oj.load_file(filename, mode: :strict, mmap: true) { |doc| docs << doc }
+    assert_equal([[1], [2]], docs)
+
+    File.write(filename, '{"a":')
+    assert_raises(Oj::ParseError) { Oj.load_file(filename, mode: :strict, mmap: true) }
+  end
+
+  def test_load_file_error_location
+    filename = File.join(File.dirname(__FILE__), 'file_test.json')
+    # The bad value is well past the first buffer so the line and column are
+    # found after the buffer has been shifted.
+    File.write(filename, "[\n" + (["  {\"a\": 1,\n   \"b\": \"xyz\"}"] * 3000).join(",\n") + ",\n  bad]")
+    err = assert_raises(Oj::ParseError) { Oj.load_file(filename, mode: :strict) }
+    assert_match(/at line 6002, column 4/, err.message)
+  end
+
+  def test_gzip_file
+    filename = File.join(File.dirname(__FILE__), 'file_test.json.gz')
+    obj = { 'a' => (1..2000).map { |i| { 'id' => i, 'name' => "n#{i}" } } }
+    Oj.to_file(filename, obj, mode: :strict, compression: :gzip)
+    assert_equal(obj, Oj.load(Zlib::GzipReader.open(filename) { |z| z.read }, mode: :strict))
+    assert_equal(obj, Oj.load_file(filename, mode: :strict, compression: :gzip))
+    assert_equal(obj, Oj.load_file(filename, mode: :strict, compression: :gzip, mmap: true))
+    assert_equal({ 'a' => obj['a'] }, Oj.load_file(filename, mode: :strict, compression: :gzip, only: ['a']))
+
+    # Concatenated gzip members are read as one stream.
+    File.binwrite(filename, Zlib.gzip('[1]') + Zlib.gzip('[2]'))
+    docs = []
+    Oj.load_file(filename, mode: :strict, compression: :gzip) { |doc| docs << doc }
+    assert_equal([[1], [2]], docs)
+
+    File.binwrite(filename, "\x1f\x8bnot gzip")
+    assert_raises(IOError) { Oj.load_file(filename, mode: :strict, compression: :gzip) }
+    assert_raises(ArgumentError) { Oj.load_file(filename, mode: :strict, compression: :lzma) }
+  end
+
   def dump_and_load(obj, trace=false)
     filename = File.join(File.dirname(__FILE__), 'file_test.json')
     File.open(filename, "w") { |f|
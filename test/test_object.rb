@@ -133,6 +133,18 @@ class ObjectJuice < Minitest::Test
     end
   end
 
+  class Dotted
+    attr_reader :inner
+
+    def initialize(x)
+      @inner = Jeez.new(x, nil)
+    end
+
+    def self.create(x)
+      new(x)
+    end
+  end
+
   class AutoStrung < String
     attr_accessor :safe
 
@@ -493,6 +505,22 @@ class ObjectJuice < Minitest::Test
     assert_equal(t.utc_offset, loaded.utc_offset)
   end
 
+  def test_xml_time_parse
+    t = Oj.object_load(%|{"^t":"2015-01-05T21:37:07.123456789+09:30"}|)
+    assert_equal(Time.utc(2015, 1, 5, 12, 7, 7).tv_sec, t.tv_sec)
+    assert_equal(123456789, t.tv_nsec)
+    assert_equal(34200, t.utc_offset)
+    assert_equal(false, t.utc?)
+    t = Oj.object_load(%|{"^t":"1969-12-31T23:59:59.5Z"}|)
+    assert_equal(-1, t.tv_sec)
+    assert_equal(500000000, t.tv_nsec)
+    assert_equal(true, t.utc?)
+    refute_kind_of(Time, Oj.object_load(%|{"^t":"2015-13-05T21:37:07Z"}|))
+    # Out of range days and seconds roll over as they do with Time.utc.
+    assert_equal(Time.utc(2021, 2, 30), Oj.object_load(%|{"^t":"2021-02-30T00:00:00Z"}|))
+    assert_equal(Time.utc(2021, 12, 31, 23, 59, 60), Oj.object_load(%|{"^t":"2021-12-31T23:59:60Z"}|))
+  end
+
   def test_ruby_time
     t = Time.new(2015, 1, 5, 21, 37, 7.123456789, -8 * 3600)
     # The fractional seconds are not always recreated exactly which causes a
@@ -877,6 +905,18 @@ class ObjectJuice < Minitest::Test
     assert_equal(a, a2)
   end
 
+  def test_circular_array_shared
+    # Enough containers to grow the set of dumped objects several times.
+    shared = [1]
+    a = (0...500).map { |i| [i, shared] }
+    a << a
+    json = Oj.dump(a, mode: :object, circular: true)
+    a2 = Oj.load(json, mode: :object, circular: true)
+    assert_equal(501, a2.size)
+    assert_equal(a2[0][1].__id__, a2[499][1].__id__)
+    assert_equal(a2.__id__, a2[500].__id__)
+  end
+
   def test_circular_hash2
     h = { 'a' => 7 }
     h['b'] = h
@@ -995,6 +1035,15 @@ class ObjectJuice < Minitest::Test
     assert_equal({'a' => 1}, h)
   end
 
+  def test_odd_dotted
+    Oj.register_odd(Dotted, Dotted, :create, 'inner.x')
+    json = Oj.dump(Dotted.new(3), :mode => :object)
+    assert_equal(%|{"^O":"ObjectJuice::Dotted","inner.x":3}|, json)
+    obj = Oj.load(json, :mode => :object)
+    assert_equal(Dotted, obj.class)
+    assert_equal(3, obj.inner.x)
+  end
+
   def test_auto_string
     s = AutoStrung.new("Pete", true)
     dump_and_load(s, false)
@@ -0,0 +1,97 @@
+#!/usr/bin/env ruby
+# encoding: UTF-8
+
+$: << File.dirname(__FILE__)
+
+require 'helper'
+
+class ParserTest < Minitest::Test
+
+  def test_feed_split
+    json = %|{"name":"a long name longer than thirty-two bytes","list":[1,2.5,true,null,"x\\"y"]} [123] "end"|
+    expect = [{'name' => 'a long name longer than thirty-two bytes', 'list' => [1, 2.5, true, nil, 'x"y']}, [123], 'end']
+    # Every split point gets tried, including inside strings, numbers, and keys.
+    (1...json.size).each { |i|
+      parser = Oj::Parser.new(mode: :strict)
+      results = []
+      parser.feed(json[0, i]) { |obj| results << obj }
+      parser.feed(json[i..-1]) { |obj| results << obj }
+      parser.finish { |obj| results << obj }
+      assert_equal(expect, results, "split at #{i}")
+    }
+  end
+
+  def test_feed_split_only
+    json = %|{"b":[1,2,{"c":"x"},3],"a":{"d":[4]},"e":"f"} {"a":5}|
+    expect = [{'a' => {'d' => [4]}}, {'a' => 5}]
+    (1...json.size).each { |i|
+      parser = Oj::Parser.new(mode: :strict, only: ['a'])
+      results = []
+      parser.feed(json[0, i]) { |obj| results << obj }
+      parser.feed(json[i..-1]) { |obj| results << obj }
+      parser.finish { |obj| results << obj }
+      assert_equal(expect, results, "split at #{i}")
+    }
+  end
+
+  def test_feed_split_raw
+    json = %|{"a":{"p":[1,"x]"]},"b":2} [3]|
+    (1...json.size).each { |i|
+      parser = Oj::Parser.new(mode: :strict, raw: ['a'])
+      results = []
+      parser.feed(json[0, i]) { |obj| results << obj }
+      parser.feed(json[i..-1]) { |obj| results << obj }
+      parser.finish { |obj| results << obj }
+      assert_equal([{'a' => Oj::RawJSON.new('{"p":[1,"x]"]}'), 'b' => 2}, [3]], results, "split at #{i}")
+    }
+  end
+
+  def test_feed_bytes
+    parser = Oj::Parser.new(mode: :compat, symbol_keys: true)
+    results = []
+    %|/* c */{"a":[12,\n34]}\n{"b":{}}|.each_char { |c| results.concat(parser.feed(c)) }
+    assert_equal([{a: [12, 34]}, {b: {}}], results)
+  end
+
+  def test_number_at_end
+    parser = Oj::Parser.new(mode: :strict)
+    assert_equal([], parser.feed('12'))
+    assert_equal([], parser.feed('34'))
+    assert_equal([1234], parser.finish)
+  end
+
+  def test_not_terminated
+    parser = Oj::Parser.new(mode: :strict)
+    parser.feed('{"a":[1')
+    assert_raises(Oj::ParseError) { parser.finish }
+    assert_equal([[2]], parser.feed('[2]'))
+  end
+
+  def test_error_resets
+    parser = Oj::Parser.new(mode: :strict)
+    assert_raises(Oj::ParseError) { parser.feed('{"a":}') }
+    assert_equal([{'b' => 1}], parser.feed('{"b":1}'))
+  end
+
+  def test_object_mode
+    parser = Oj::Parser.new(mode: :object)
+    json = Oj.dump(Jam.new(1, 'two'), mode: :object)
+    results = []
+    json.each_char { |c| parser.feed(c) { |obj| results << obj } }
+    assert_equal([Jam.new(1, 'two')], results)
+  end
+
+  class Jam
+    attr_accessor :x, :y
+
+    def initialize(x, y)
+      @x = x
+      @y = y
+    end
+
+    def ==(o)
+      self.class == o.class && @x == o.x && @y == o.y
+    end
+  end
+
+end
@@ -183,4 +183,24 @@ class SajTest < Minitest::Test
     assert_match(%r{invalid format, extra characters at line 1, column 6 \[(?:[a-z\.]+/)*saj\.c:\d+\]}, message)
   end
 
+  def test_io
+    handler = AllSaj.new()
+    Oj.saj_parse(handler, StringIO.new(%{{"a":[1,"two"],\n"b":null}}))
+    assert_equal([[:hash_start, nil],
+                  [:array_start, 'a'],
+                  [:add_value, 1, nil],
+                  [:add_value, 'two', nil],
+                  [:array_end, 'a'],
+                  [:add_value, nil, 'b'],
+                  [:hash_end, nil]], handler.calls)
+  end
+
+  def test_deep_nesting
+    handler = AllSaj.new()
+    depth = 100_000
+    Oj.saj_parse(handler, '[' * depth + ']' * depth)
+    assert_equal(depth * 2, handler.calls.size)
+    assert_equal([:array_end, nil], handler.calls.last)
+  end
+
 end
@@ -258,6 +258,44 @@ class ScpTest < Minitest::Test
                   [:add_value, {}]], handler.calls)
   end
 
+  def test_only_io
+    expect = [[:hash_start],
+              [:hash_key, 'array'],
+              [:array_start],
+              [:hash_start],
+              [:hash_key, 'hash'],
+              [:hash_start],
+              [:hash_key, 'h2'],
+              [:hash_start],
+              [:hash_key, 'a'],
+              [:array_start],
+              [:array_append, 1],
+              [:array_append, 2],
+              [:array_append, 3],
+              [:array_end],
+              [:hash_set, "a", []],
+              [:hash_end],
+              [:hash_set, "h2", {}],
+              [:hash_end],
+              [:hash_set, "hash", {}],
+              [:hash_end],
+              [:array_append, {}],
+              [:array_end],
+              [:hash_set, "array", []],
+              [:hash_end],
+              [:add_value, {}]]
+    [$json, StringIO.new($json)].each { |input|
+      handler = AllHandler.new()
+      Oj.sc_parse(handler, input, only: ['array/*/hash/h2'])
+      assert_equal(expect, handler.calls)
+    }
+    # Skipped values larger than the read buffer are not held in memory.
+    json = %|{"skip":[#{(['{"s":"x\\"]}","n":[1,-2.5e3,true,null]}'] * 2000).join(',')}],"keep":7}|
+    handler = AllHandler.new()
+    Oj.sc_parse(handler, StringIO.new(json), only: ['keep'])
+    assert_equal([[:hash_start], [:hash_key, 'keep'], [:hash_set, 'keep', 7], [:hash_end], [:add_value, {}]], handler.calls)
+  end
+
   def test_double
     handler = AllHandler.new()
     json = %{{"one":true,"two":false}{"three":true,"four":false}}
@@ -143,6 +143,25 @@ class StrictJuice < Minitest::Test
     assert_equal(json, json2)
   end
 
+  def test_string_long
+    # Exercise the block scanners with special characters at every offset.
+    (0..70).each { |i|
+      str = ('a' * i) + "\"\\\n" + ('b' * (70 - i))
+      dump_and_load(str, false)
+      json = %{"#{'x' * i}\\u3074#{'y' * 40}"}
+      assert_equal(('x' * i) + "ぴ" + ('y' * 40), Oj.strict_load(json))
+      assert_raises(Oj::ParseError) { Oj.strict_load("\"#{'x' * i}\u0000#{'y' * 40}\"") }
+      assert_raises(Oj::ParseError) { Oj.strict_load("\"#{'x' * i}") }
+    }
+  end
+
+  def test_whitespace_long
+    (0..70).each { |i|
+      json = "#{' ' * i}{#{"\n\t" * i}\"a\"#{"\r " * i}:\f[#{' ' * i}1 ]}#{' ' * i}"
+      assert_equal({'a' => [1]}, Oj.strict_load(json))
+    }
+  end
+
   def test_array
     dump_and_load([], false)
     dump_and_load([true, false], false)
@@ -228,6 +247,26 @@ class StrictJuice < Minitest::Test
     assert_equal(orig, bg)
   end
 
+  def test_rational_load
+    a = Oj.load('[80.51,-0.125,12.00,1.5e3,123456789012345678901234567890.5,1e-40]', :mode => :strict, :bigdecimal_load => :rational)
+    assert_equal([Rational(8051, 100), Rational(-1, 8), 12, 1500, Rational(246913578024691357802469135781, 2)], a[0..4])
+    assert_equal([Rational, Rational, Integer, Integer, Rational], a[0..4].map(&:class))
+    # Too small for 128 bits so a BigDecimal.
+    assert_equal(BigDecimal('1e-40'), a[5])
+    assert_equal(BigDecimal, a[5].class)
+  end
+
+  def test_cache_strings
+    a = Oj.load('[{"c":"USD"},{"c":"USD"},"USD","not cached"]', :mode => :strict, :cache_strings => 5)
+    assert_equal([{'c' => 'USD'}, {'c' => 'USD'}, 'USD', 'not cached'], a)
+    assert(a[0]['c'].frozen?)
+    assert(a[0]['c'].equal?(a[1]['c']))
+    assert(a[0]['c'].equal?(a[2]))
+    assert_equal(Encoding::UTF_8, a[2].encoding)
+    refute(a[3].frozen?)
+    refute(Oj.load('["USD"]', :mode => :strict)[0].frozen?)
+  end
+
   def test_json_object
     obj = Jeez.new(true, 58)
     begin
@@ -276,6 +315,37 @@ class StrictJuice < Minitest::Test
     assert_equal({ 'x' => true, 'y' => 58, 'z' => [1, 2, 3]}, obj)
   end
 
+  def test_io_pipe
+    data = { 'a' => ['x' * 10000, 1, 2.5], 'b' => Array.new(2000) { |i| { 'i' => i } } }
+    json = Oj.dump(data, mode: :strict)
+    [nil, 4096, 100_000].each { |size|
+      r, w = IO.pipe
+      writer = Thread.new { w.write(json); w.close }
+      opts = size.nil? ? {} : { buffer_size: size }
+      assert_equal(data, Oj.strict_load(r, opts))
+      writer.join
+      r.close
+    }
+  end
+
+  class ChunkReader
+    def initialize(str)
+      @str = str
+    end
+
+    def read(len)
+      return nil if @str.empty?
+      chunk = @str[0, [len, 100].min]
+      @str = @str[chunk.size..-1]
+      chunk
+    end
+  end
+
+  def test_io_read_only
+    json = Oj.dump({ 'a' => ['x' * 10000, 1, 2.5] }, mode: :strict)
+    assert_equal({ 'a' => ['x' * 10000, 1, 2.5] }, Oj.strict_load(ChunkReader.new(json)))
+  end
+
   def test_symbol
     json = Oj.dump(:abc)
     assert_equal('"abc"', json)
@@ -324,6 +394,44 @@ class StrictJuice < Minitest::Test
     assert_equal({ :x => true, :y => 58, :z => [1, 2, 3]}, obj)
   end
 
+  def test_cache_keys
+    json = %{[{"aaa":1,"bbb":2},{"aaa":3,"bbb":4},{"#{'k' * 40}":5}]}
+    [true, false].each { |cache|
+      [true, false].each { |sym|
+        obj = Oj.strict_load(json, :cache_keys => cache, :symbol_keys => sym)
+        k = sym ? :aaa : 'aaa'
+        assert_equal([{k => 1, (sym ? :bbb : 'bbb') => 2}, {k => 3, (sym ? :bbb : 'bbb') => 4}, {(sym ? ('k' * 40).to_sym : 'k' * 40) => 5}], obj)
+        assert_equal(Encoding::UTF_8, obj[0].keys[0].encoding) unless sym
+      }
+    }
+    a = Oj.strict_load(json, :cache_keys => true)
+    b = Oj.strict_load(json, :cache_keys => true)
+    assert(a[0].keys[0].frozen?)
+    assert(a[0].keys[0].equal?(b[1].keys[0]))
+  end
+
+  def test_bulk_containers
+    h = {}
+    100.times { |i| h["k#{i}"] = [i, "v#{i}", {'n' => [[], {}]}] }
+    json = Oj.dump([h, (1..1000).to_a, {}], :mode => :strict)
+    assert_equal([h, (1..1000).to_a, {}], Oj.load(json, :mode => :strict))
+    assert_equal([h, (1..1000).to_a, {}], Oj.load(json, :mode => :null))
+    assert_equal({'a' => 2, 'b' => 1}, Oj.load('{"a":1,"b":1,"a":2}', :mode => :strict))
+    assert(Oj.load('{"abc":1}', :mode => :strict, :cache_keys => false).keys[0].frozen?)
+    e = assert_raises(Oj::ParseError) { Oj.load('{"a":[1,2,{"b":x}]}', :mode => :strict) }
+    assert_match(/after a\[2\]\.b/, e.message)
+  end
+
+  def test_symbol_keys_direct
+    fresh = "fresh_#{rand(1 << 30)}_#{'q' * 30}"
+    json = %{{"#{fresh}":1,"caf\\u00e9":2,"tab\\tkey":3,"héllo":4}}
+    [true, false].each { |cache|
+      obj = Oj.strict_load(json, :cache_keys => cache, :symbol_keys => true)
+      assert_equal({fresh.to_sym => 1, :"café" => 2, :"tab\tkey" => 3, :"héllo" => 4}, obj)
+      assert_equal(Encoding::UTF_8, obj.keys[3].to_s.encoding)
+    }
+  end
+
   def test_symbol_keys_safe
     json = %{{
   "x":true,
@@ -88,6 +88,12 @@ class Juice < Minitest::Test
     end
   end # Jazz
 
+  Spot = Struct.new(:city, :zip)
+
+  class Person
+    attr_reader :name, :age, :spots, :tag, :home, :boss
+  end # Person
+
   def setup
     @default_options = Oj.default_options
   end
@@ -101,6 +107,8 @@ class Juice < Minitest::Test
     alt ={
       indent: " - ",
       second_precision: 5,
+      buffer_size: 8192,
+      release_gvl: 65536,
       circular: true,
       class_cache: false,
       auto_define: true,
@@ -116,6 +124,7 @@ class Juice < Minitest::Test
       quirks_mode: false,
       allow_invalid_unicode: true,
       float_precision: 13,
+      float_engine: :shortest,
       mode: :strict,
       escape_mode: :ascii,
       time_format: :unix_zone,
@@ -133,8 +142,14 @@ class Juice < Minitest::Test
       allow_nan: true,
       integer_range: nil,
       array_class: Array,
+      only: ["id", "user/name"],
+      raw: ["payload"],
       ignore: nil,
       ignore_under: true,
+      cache_keys: false,
+      mmap: true,
+      cache_strings: 16,
+      string_buffer: true,
       trace: true,
       safe: true,
     }
@@ -188,6 +203,432 @@ class Juice < Minitest::Test
     assert_equal('-0.12345678901234567E-4', n.to_s.upcase)
   end
 
+  def test_float_parse_bad_exponent
+    ['1e', '1e+', '1E', '[1.5e-]', '[1E+,2]'].each { |json|
+      [:strict, :null, :compat, :object, :custom].each { |mode|
+        assert_raises(Oj::ParseError, EncodingError, "#{mode} #{json}") { Oj.load(json, mode: mode) }
+      }
+      assert_raises(Oj::ParseError, json) { Oj.load(StringIO.new(json), mode: :strict) }
+      assert_equal(false, Oj.valid?(json, mode: :strict, quirks_mode: true), json)
+    }
+  end
+
+  def test_float_dump_shortest
+    r = Random.new(42)
+    samples = [0.1, -0.5, 1.0e-5, 0.0001, 123.456, 1.0e+15, 1.5e+15, 5.0e-324, 2.2250738585072014e-308,
+               1.7976931348623157e+308, 0.30000000000000004, -122.41941550000001, 1.0e+23, 100.0]
+    2000.times {
+      samples << [r.rand(0x7FEFFFFFFFFFFFFF)].pack('Q').unpack1('d')
+      samples << r.rand * 10**r.rand(-10..20)
+    }
+    samples.each { |f|
+      json = Oj.dump(f, mode: :strict, float_engine: :shortest)
+      assert_equal(f.to_s, json) unless f == f.to_i && f.abs < 1.0e+15
+      assert_equal(f, Oj.load(json, mode: :strict, bigdecimal_load: :float))
+    }
+    [:compat, :custom, :null, :rails, :wab, :object].each { |mode|
+      assert_equal('[0.1,2.0,1.0e+20]', Oj.dump([0.1, 2.0, 1.0e20], mode: mode, float_engine: :shortest))
+    }
+  end
+
+  def test_float_parse_rounding
+    r = Random.new(42)
+    samples = ['-0.0', '1e-330', '2.2250738585072014e-308', '4.9e-324', '1.7976931348623157e308',
+               '9007199254740993', '0.30000000000000004', '-122.41941550000001', '37.774929000000004']
+    2000.times {
+      m = r.rand(10**r.rand(1..17)).to_s
+      pos = r.rand(1..m.size)
+      samples << "#{m[0...pos]}.#{m[pos..-1]}5e#{r.rand(-320..300)}"
+    }
+    [:float, :auto, :fast].each { |mode|
+      samples.each { |s|
+        n = Oj.load(s, mode: :strict, bigdecimal_load: mode)
+        assert_equal(Float(s), n.to_f, "#{mode} #{s}")
+      }
+    }
+  end
+
+  def test_load_ndjson
+    lines = []
+    20000.times { |i|
+      lines << %|{"a":#{i},"b":"x\\u00e9\\n#{i}","c":[1,2.5,{"d":null,"e":true}],"f\\tk":12345678901234567890}|
+      lines << '' if 0 == i % 1000
+    }
+    lines << '  [1,2 ,3]  '
+    json = lines.join("\n")
+    [:strict, :null, :compat, :custom, :object, :rails].each { |mode|
+      expect = lines.reject { |line| line.strip.empty? }.map { |line| Oj.load(line, mode: mode) }
+      assert_equal(expect, Oj.load_ndjson(json, mode: mode, threads: 4), mode)
+      assert_equal(expect, Oj.load_ndjson(json, mode: mode, threads: 1), mode)
+    }
+    objs = []
+    Oj.load_ndjson(StringIO.new(json + "\n"), mode: :strict, threads: 3) { |obj| objs << obj }
+    assert_equal(20001, objs.size)
+    assert_equal([1, 2, 3], objs[-1])
+    sizes = []
+    Oj.load_ndjson(json, mode: :strict, batch_size: 7) { |batch| sizes << batch.size }
+    assert_equal([7], sizes[0..-2].uniq)
+    assert_equal(20001, sizes.sum)
+  end
+
+  def test_load_ndjson_raw
+    lines = (0...50000).map { |i| %|{"a":{"x":[#{i},"y"]},"b":#{i}}| }
+    json = lines.join("\n")
+    docs = Oj.load_ndjson(json, mode: :strict, raw: ['a'], threads: 8)
+    assert_equal(50000, docs.size)
+    GC.start
+    docs.each_with_index { |doc, i|
+      assert_equal(%|{"x":[#{i},"y"]}|, doc['a'].to_s)
+      assert_equal(i, doc['b'])
+    }
+    err = assert_raises(Oj::ParseError) { Oj.load_ndjson(%|{"a":1}\n\n{"a":}\n|, mode: :strict, raw: ['a'], threads: 8) }
+    assert_match(/at line 3, column/, err.message)
+  end
+
+  def test_load_ndjson_error
+    objs = []
+    err = assert_raises(Oj::ParseError) {
+      Oj.load_ndjson(%|{"a":1}\n\n{"a":2}\n[1,}\n{"a":3}\n|, mode: :strict) { |obj| objs << obj }
+    }
+    assert_equal([{'a' => 1}, {'a' => 2}], objs)
+    assert_match(/at line 4, column/, err.message)
+    assert_raises(Oj::ParseError) { Oj.load_ndjson(%|{"a":1} {"b":2}\n|, mode: :strict) }
+  end
+
+  def test_release_gvl
+    docs = ['{"a":[1,2.5,"xé\\n",{"b":null}],"c\\tk":true,"d":12345678901234567890}', '[]', '{}', '12', '"abc"', '[1,[2,[3]]]']
+    [:strict, :null, :compat, :custom, :object, :rails, :wab].each { |mode|
+      docs.each { |json|
+        assert_equal(Oj.load(json, mode: mode), Oj.load(json, mode: mode, release_gvl: 1), "#{mode} #{json}")
+      }
+    }
+    err = assert_raises(Oj::ParseError) { Oj.load('{"a":[1,}', mode: :strict, release_gvl: 1) }
+    assert_match(/at line 1, column 9/, err.message)
+    assert_raises(Oj::ParseError) { Oj.load('[1] [2]', mode: :strict, release_gvl: 1) }
+  end
+
+  def test_load_only
+    json = '{"id":7,"skip":{"a":[1,{"b":"}]"}],"c":"x\\"y"},"user":{"name":"Ann","age":3},"items":[{"sku":"a","n":1},{"sku":"b"}],"tail":1.5e3}'
+    only = ['id', 'user/name', 'items/*/sku']
+    expect = {'id' => 7, 'user' => {'name' => 'Ann'}, 'items' => [{'sku' => 'a'}, {'sku' => 'b'}]}
+    [:strict, :compat, :custom, :null].each { |mode|
+      assert_equal(expect, Oj.load(json, mode: mode, only: only), mode.to_s)
+      assert_equal(expect, Oj.load(StringIO.new(json), mode: mode, only: only), mode.to_s)
+      assert_equal(expect, Oj.load(json, mode: mode, only: only, release_gvl: 1), mode.to_s)
+    }
+    assert_equal(expect, Oj.strict_load(json, only: only))
+    assert_equal(expect, Oj.compat_load(json, only: only))
+    assert_equal({'user' => {'name' => 'Ann', 'age' => 3}}, Oj.load(json, mode: :strict, only: ['user', 'user/name']))
+    assert_equal({'items' => []}, Oj.load(json, mode: :strict, only: ['items/sku']))
+    assert_equal([{'id' => 1}, {}], Oj.load('[{"id":1,"x":2},{"y":3}]', mode: :strict, only: ['*/id']))
+    assert_raises(Oj::ParseError) { Oj.load('{"skip":[1,2', mode: :strict, only: only) }
+    assert_raises(ArgumentError) { Oj.load(json, mode: :strict, only: 'id') }
+  end
+
+  # Reference for the :only rules. Paths are Arrays of steps.
+  def only_filter(value, paths)
+    return value if paths.any?(&:empty?)
+    case value
+    when Hash
+      value.each_with_object({}) { |(k, v), h|
+        sub = paths.select { |p| '*' == p[0] || k == p[0] }.map { |p| p[1..-1] }
+        h[k] = only_filter(v, sub) unless sub.empty?
+      }
+    when Array
+      sub = paths.select { |p| '*' == p[0] }.map { |p| p[1..-1] }
+      sub.empty? ? [] : value.map { |v| only_filter(v, sub) }
+    else
+      value
+    end
+  end
+
+  def test_load_only_overlap
+    json = '{"a":"x","b":[{"b":true}]}'
+    assert_equal({'a' => 'x', 'b' => [{'b' => true}]}, Oj.load(json, mode: :strict, only: ['b/c/*', '*']))
+    json = '{"a":{"a":1,"b":2},"c":{"a":3,"b":{"b":4,"c":5}}}'
+    assert_equal({'a' => {'a' => 1}, 'c' => {'a' => 3, 'b' => {'b' => 4}}}, Oj.load(json, mode: :strict, only: ['*/a', 'c/b/b']))
+    raw = Oj.load('{"a":{"b":1,"c":2},"d":3}', mode: :strict, raw: ['*', 'a/b'])
+    assert_equal('{"b":1,"c":2}', raw['a'].to_s)
+
+    r = Random.new(7)
+    keys = %w(a b c)
+    gen = lambda { |depth|
+      case 2 < depth ? 3 : r.rand(4)
+      when 0 then keys.sample(r.rand(0..3), random: r).each_with_object({}) { |k, h| h[k] = gen.call(depth + 1) }
+      when 1 then Array.new(r.rand(3)) { gen.call(depth + 1) }
+      when 2 then 'x'
+      else r.rand(10)
+      end
+    }
+    500.times {
+      doc = gen.call(0)
+      paths = Array.new(r.rand(1..3)) { Array.new(r.rand(1..3)) { (keys + ['*']).sample(random: r) } }
+      only = paths.map { |p| p.join('/') }
+      expect = only_filter(doc, paths)
+      json = Oj.dump(doc, mode: :strict)
+      assert_equal(expect, Oj.load(json, mode: :strict, only: only), "#{json} #{only}")
+      assert_equal(expect, Oj.load(StringIO.new(json), mode: :strict, only: only), "#{json} #{only}")
+    }
+  end
+
+  def test_options_handle
+    opts = Oj::Options.new(mode: :strict, symbol_keys: true, indent: 1)
+    assert_equal({mode: :strict, symbol_keys: true, indent: 1}, opts.to_h)
+    assert_equal({a: [1, 2.5]}, Oj.load('{"a":[1,2.5]}', opts))
+    assert_equal({b: 1}, Oj.strict_load('{"b":1}', opts))
+    assert_equal({c: 1}, Oj.load(StringIO.new('{"c":1}'), opts))
+    assert_equal(Oj.dump({'a' => [1]}, mode: :strict, indent: 1), Oj.dump({'a' => [1]}, opts))
+
+    # Later changes to the defaults do not change the handle.
+    Oj.default_options = {symbol_keys: false}
+    assert_equal({a: 1}, Oj.load('{"a":1}', opts))
+
+    compat = Oj::Options.new(mode: :compat)
+    assert_equal(Oj.dump([1.5, nil], mode: :compat), Oj.dump([1.5, nil], compat))
+    assert_raises(EncodingError) { Oj.load('', mode: :compat) }
+    assert_raises(EncodingError) { Oj.load('', compat) }
+    assert_raises(TypeError) { Oj::Options.new(7) }
+  end
+
+  def test_options_handle_owns_defaults
+    obj = { 'a' => Jam.new(1, 2), 'b' => 1..2 }
+    Oj.default_options = {ignore: [Jam]}
+    expect = Oj.dump(obj, mode: :custom)
+    opts = Oj::Options.new(mode: :custom)
+    Oj.default_options = {ignore: [Range]}
+    GC.start
+    assert_equal(expect, Oj.dump(obj, opts))
+    refute_equal(expect, Oj.dump(obj, mode: :custom))
+  end
+
+  def test_cache_stats
+    json = Oj.dump(Jam.new(1, 2), mode: :object)
+    before = Oj.cache_stats
+    assert_equal([:class, :attr, :string, :symbol, :value], before.keys)
+    4.times { Oj.load(json, mode: :object) }
+    after = Oj.cache_stats
+    assert(after[:class][:hits] >= before[:class][:hits] + 3)
+    assert(after[:attr][:hits] >= before[:attr][:hits] + 6)
+    after.each_value { |stats|
+      assert(stats[:size] * 2 <= stats[:capacity])
+      assert(stats[:hits] <= stats[:lookups])
+    }
+  end
+
+  def test_stats
+    Oj.stats(true)
+    json = '{"a":[1,2,"x"],"b":{"c":true}}'
+    Oj.load(json, mode: :strict)
+    Oj.load(StringIO.new(json), mode: :strict)
+    Oj.dump([1.25, 'x' * 5000], mode: :strict, float_precision: 0)
+    stats = Oj.stats(true)
+    assert_equal(2, stats[:loads])
+    assert_equal(json.size * 2, stats[:bytes_parsed])
+    assert(0 < stats[:objects_created])
+    assert_equal(1, stats[:dumps])
+    assert(5000 < stats[:bytes_dumped])
+    assert(stats.key?(:out_grows))
+    assert_equal(1, stats[:to_s_calls])
+    assert_equal(0, Oj.stats[:loads])
+  end
+
+  def test_ractor
+    skip "Ractor not available" unless defined?(Ractor)
+    verbose = $VERBOSE
+    $VERBOSE = nil
+    json = Oj.dump({'a' => [1, 2.5, 'x', nil], 'b' => {'c' => true}, 't' => Time.at(0).utc}, mode: :compat)
+    workers = Array.new(3) { |i|
+      Ractor.new(json, i) { |j, k|
+        obj = nil
+        200.times { obj = Oj.load(j, mode: :strict, cache_keys: true) }
+        [obj, Oj.dump(obj, mode: :compat), Oj.dump(Time.at(k * 86400).utc, mode: :custom, time_format: :xmlschema, second_precision: 0)]
+      }
+    }
+    workers.each_with_index { |r, i|
+      obj, dumped, time = r.take
+      assert_equal(Oj.load(json, mode: :strict), obj)
+      assert_equal(Oj.dump(obj, mode: :compat), dumped)
+      assert_equal(%|"1970-01-0#{i + 1}T00:00:00Z"|, time)
+    }
+    err = Ractor.new { begin; Oj.default_options = { mode: :strict }; rescue Exception => e; e.class.name; end }.take
+    assert_equal('Ractor::UnsafeError', err)
+  ensure
+    $VERBOSE = verbose
+  end
+
+  def test_valid
+    assert(Oj.valid?('{"a":[1,2.5,"x\\u00e9",null]}'))
+    assert(Oj.valid?(StringIO.new('[true]')))
+    refute(Oj.valid?('{"a":[1,2}'))
+    refute(Oj.valid?('[1] x'))
+    refute(Oj.valid?('1', quirks_mode: false))
+    refute(Oj.valid?('NaN', mode: :strict, allow_nan: false))
+    assert(Oj.valid?(%|["caf\xC3\xA9"]|.b))
+    refute(Oj.valid?(%|["caf\xC3"]|.b))
+    refute(Oj.valid?(%|["\xED\xA0\x80"]|.b))
+    refute(Oj.valid?(%|["\xF4\x90\x80\x80"]|.b))
+    # Only the syntax is checked, not the classes named.
+    assert(Oj.valid?('{"^o":"NoSuchClass","a":1}', mode: :object))
+    big = Oj.dump(Array.new(5000) { |i| { "k#{i}" => "v\u00e9#{i}" } }, mode: :strict)
+    assert(Oj.valid?(big))
+    assert(Oj.valid?(big, release_gvl: 1))
+    refute(Oj.valid?(big.b.sub('v'.b, "\xFF".b)))
+    Oj.valid?(big)
+    before = GC.stat(:total_allocated_objects)
+    10.times { Oj.valid?(big) }
+    assert(GC.stat(:total_allocated_objects) - before < 10)
+  end
+
+  def test_valid_nan
+    ['[NaN]', '[Infinity]', '[-Infinity]', '{"a":NaN}', 'NaN'].each { |json|
+      [:strict, :null, :wab, :compat, :object, :custom, :rails].each { |mode|
+        [true, false].each { |allow_nan|
+          opts = { mode: mode, quirks_mode: true, allow_nan: allow_nan }
+          loads = begin; Oj.load(json, opts); true; rescue Oj::ParseError, EncodingError; false; end
+          assert_equal(loads, Oj.valid?(json, opts), "#{json} #{opts}")
+          assert_equal(loads, Oj.validate(json, opts).nil?, "#{json} #{opts}")
+        }
+      }
+    }
+    assert_equal('not a number or other value', Oj.validate('[NaN]', mode: :strict)[:message][0, 27])
+  end
+
+  def test_validate
+    assert_nil(Oj.validate('{"a":1}'))
+    assert_equal({ message: 'expected array element, not an array close', offset: 3, line: 1, column: 4 }, Oj.validate('[1,]'))
+    report = Oj.validate(%|{\n "a": tru}|)
+    assert_equal([11, 2, 10], [report[:offset], report[:line], report[:column]])
+    report = Oj.validate(%|["ab\xFFc", x]|.b)
+    assert_equal('invalid UTF-8', report[:message])
+    assert_equal(4, report[:offset])
+    assert_equal(4, Oj.validate(%|\xEF\xBB\xBF[}|.b)[:offset])
+  end
+
+  def test_msgpack
+    obj = { 'a' => [1, -33, 70000, -(2**40), 2**63, 2**70, 1.5, 0.1, nil, true, false, 'x' * 40, ''], 'b' => { 'c' => {} }, 'e' => [] }
+    bin = Oj.to_msgpack(obj, mode: :strict)
+    assert_equal(Encoding::ASCII_8BIT, bin.encoding)
+    assert(bin.bytesize < Oj.dump(obj, mode: :strict).bytesize)
+    expect = obj.merge('a' => obj['a'].map { |v| v == 2**70 ? (2**70).to_s : v })
+    assert_equal(expect, Oj.load_msgpack(bin, mode: :strict))
+    assert_equal([0x81, 0xa1, 0x31, 0x02], Oj.to_msgpack({ 1 => 2 }, mode: :compat).bytes)
+    assert_equal([0x82, 0xa1, 0x61, 0xa1, 0x62, 0xa1, 0x63, 0xc0], Oj.to_msgpack({ a: :b, c: nil }, mode: :strict).bytes)
+    assert_equal([0x81, 0xa1, 0x79, 0x01], Oj.to_msgpack({ 'x' => nil, 'y' => 1 }, mode: :compat, omit_nil: true).bytes)
+    assert_equal({ a: 0.1 }, Oj.load_msgpack(Oj.to_msgpack({ 'a' => 0.1 }), mode: :strict, symbol_keys: true))
+    assert_equal([1], Oj.load_msgpack(StringIO.new(Oj.to_msgpack([1]))))
+    assert_raises(TypeError) { Oj.to_msgpack(Object.new, mode: :strict) }
+    assert_raises(Oj::ParseError) { Oj.load_msgpack("\x92\x01".b) }
+    assert_raises(Oj::ParseError) { Oj.load_msgpack("\x01\x02".b) }
+  end
+
+  def test_binary_deep_scalar_keys
+    # Integer keys whose values are maps, deep enough to grow the level stack.
+    expect = (0...40).reverse_each.inject({}) { |h, i| { i.to_s => h } }
+    msgpack = (0...40).map { |i| [0x81, i].pack('C*') }.join + "\x80".b
+    cbor = (0...40).map { |i| [0xa1, 0x18, i].pack('C*') }.join + "\xa0".b
+    assert_equal(expect, Oj.load_msgpack(msgpack.b, mode: :strict))
+    assert_equal(expect, Oj.load_cbor(cbor.b, mode: :strict))
+  end
+
+  def test_msgpack_modes
+    jam = Jam.new(true, 58)
+    back = Oj.load_msgpack(Oj.to_msgpack(jam, mode: :object), mode: :object)
+    assert_equal(Jam, back.class)
+    assert_equal(58, back.y)
+    assert_equal({ '^o' => 'Juice::Jam', 'x' => true, 'y' => 58 }, Oj.load_msgpack(Oj.to_msgpack(jam, mode: :object), mode: :strict))
+    t = Time.at(0).utc
+    bin = Oj.to_msgpack({ 't' => t }, mode: :custom, time_format: :xmlschema, second_precision: 0)
+    assert_equal({ 't' => '1970-01-01T00:00:00Z' }, Oj.load_msgpack(bin, mode: :strict))
+  end
+
+  def test_cbor
+    obj = { 'a' => [1, -33, 70000, -(2**40), 2**63, -(2**64), 2**100, 1.5, 0.1, nil, true, false, 'x' * 40, ''], 'b' => { 'c' => {} }, 'e' => [] }
+    bin = Oj.to_cbor(obj, mode: :strict)
+    assert(bin.bytesize < Oj.dump(obj, mode: :strict).bytesize)
+    assert_equal(obj, Oj.load_cbor(bin, mode: :strict))
+    assert_equal([0xa1, 0x61, 0x31, 0x02], Oj.to_cbor({ 1 => 2 }, mode: :compat).bytes)
+    assert_equal({ '1' => 2 }, Oj.load_cbor("\xa1\x01\x02".b, mode: :strict))
+    assert_equal([1, { 'a' => 2 }], Oj.load_cbor("\x9f\x01\xbf\x61a\x02\xff\xff".b, mode: :strict))
+    assert_equal(1.5, Oj.load_cbor("\xf9\x3e\x00".b))
+    assert_raises(Oj::ParseError) { Oj.load_cbor("\x9f\x01".b) }
+  end
+
+  def test_cbor_tags
+    assert_equal(2**64, Oj.load_cbor("\xc2\x49\x01\x00\x00\x00\x00\x00\x00\x00\x00".b))
+    assert_equal([1], Oj.load_cbor("\xd9\xd9\xf7\x81\x01".b))
+    # An epoch time, a date string, and a bignum tag on a non byte string.
+    ["\xc1\x1a\x51\x4b\x67\xb0", "\x81\xc0\x61x", "\xc2\x01", "\xa1\x61a\xd8\x20\x61u"].each { |bin|
+      e = assert_raises(Oj::ParseError) { Oj.load_cbor(bin.b) }
+      assert_match(/CBOR/, e.message)
+    }
+  end
+
+  def test_reformat
+    json = %|{ "a" : [1, 2.50, 1e3, 123456789012345678901234567890, "x\\"y\\u00e9"], /* c */ "b":{ }, "c":[ ] , "d" : {"e":null}}|
+    assert_equal(%|{"a":[1,2.50,1e3,123456789012345678901234567890,"x\\"y\\u00e9"],"b":{},"c":[],"d":{"e":null}}|, Oj.minify(json))
+    assert_equal(%|{\n  "a":[\n    1,\n    2.50,\n    1e3,\n    123456789012345678901234567890,\n    "x\\"y\\u00e9"\n  ],\n  "b":{},\n  "c":[],\n  "d":{\n    "e":null\n  }\n}\n|,
+                 Oj.reformat(json, indent: 2))
+    obj = { 'a' => [1, 2.5, { 'b' => nil, 'c' => [] }], 'd' => {}, 'e' => "f\u00e9" }
+    assert_equal(Oj.dump(obj, mode: :strict, indent: 3), Oj.reformat(Oj.dump(obj, mode: :strict), indent: 3))
+    assert_equal(Oj.dump(obj, mode: :strict), Oj.minify(Oj.dump(obj, mode: :strict, indent: 2)))
+    [{ indent: "\t" }, { indent: '  ', space: ' ', object_nl: "\n", array_nl: "\n" }, { indent: 0, space_before: ' ' }].each { |opts|
+      assert_equal(Oj.dump(obj, { mode: :strict }.merge(opts)), Oj.reformat(Oj.dump(obj, mode: :strict), opts), opts)
+    }
+    deep = (1..200).inject([1]) { |a, i| { "k#{i}" => [a] } }
+    assert_equal(Oj.dump(deep, mode: :strict, indent: "\t"), Oj.reformat(Oj.dump(deep, mode: :strict), indent: "\t"))
+    assert_equal(Oj.dump(obj, mode: :strict), Oj.minify(Oj.dump(obj, mode: :strict), indent: "\t"))
+    assert_equal('"abc"', Oj.minify(' "abc" '))
+    ['"s"', '1.5', 'null', '[]', '{}'].each { |j|
+      assert_equal(Oj.dump(Oj.load(j, mode: :strict), mode: :strict, indent: 2), Oj.reformat(" #{j} ", indent: 2), j)
+    }
+    assert_equal(%|[NaN,-Infinity]|, Oj.minify('[ NaN, -Infinity ]', mode: :object))
+    assert_equal('[1]', Oj.minify(StringIO.new('[ 1 ]')))
+    assert_nil(Oj.minify('  ', mode: :strict))
+    assert_raises(Oj::ParseError) { Oj.minify('[1,') }
+    assert_raises(Oj::ParseError) { Oj.reformat('[1] x', indent: 2) }
+  end
+
+  def test_load_raw
+    json = %|{"id":1,"payload":{"a":[1, 2.50],"b":"x"},"list":[{"p":[1 ,2]},{"q":3}]}|
+    h = Oj.load(json, mode: :strict, raw: ['payload', 'list/*/p'])
+    assert_equal(Oj::RawJSON, h['payload'].class)
+    assert_equal('{"a":[1, 2.50],"b":"x"}', h['payload'].json)
+    assert_equal({ 'a' => [1, 2.5], 'b' => 'x' }, h['payload'].value)
+    assert_equal('[1 ,2]', h['list'][0]['p'].json)
+    assert_equal({ 'q' => 3 }, h['list'][1])
+    [:strict, :null, :compat, :object, :custom, :rails].each do |mode|
+      assert_equal(json, Oj.dump(h, mode: mode), mode)
+    end
+    assert_equal([Oj::RawJSON.new('1'), Oj::RawJSON.new('[2, 3]')], Oj.load('[1, [2, 3] ]', mode: :strict, raw: ['*']))
+    assert_equal({ payload: Oj::RawJSON.new('{"a":[1, 2.50],"b":"x"}') }, Oj.load(json, mode: :compat, raw: ['payload'], only: ['payload'], symbol_keys: true))
+    assert_equal(Oj.load(json, mode: :strict), Oj.load(json, mode: :strict, raw: ['other']))
+    assert_raises(Oj::ParseError) { Oj.load('{"payload":[1,2', mode: :strict, raw: ['payload']) }
+  end
+
+  def test_load_shape
+    Oj.register_shape(Spot, nil, zip: String)
+    Oj.register_shape(Person, [:name, :age, :spots, :tag, :home, :boss],
+                      age: Integer, spots: [Spot], tag: Symbol, home: Spot, boss: Person)
+    json = '{"name":"Ann","age":"42","skip":{"x":[1,2]},"spots":[{"city":"A","zip":123,"q":1},{"city":"B"}],"tag":"t","home":{"city":"H"},"boss":{"name":"Bob"}}'
+    [json, StringIO.new(json)].each { |input|
+      p = Oj.load_shape(input, Person)
+      assert_equal(Person, p.class)
+      assert_equal('Ann', p.name)
+      assert_equal(42, p.age)
+      assert_equal([Spot.new('A', '123'), Spot.new('B')], p.spots)
+      assert_equal(:t, p.tag)
+      assert_equal(Spot.new('H'), p.home)
+      assert_equal('Bob', p.boss.name)
+      refute(p.instance_variable_defined?(:@skip))
+    }
+    p = Oj.load_shape(json, Person, release_gvl: 1)
+    assert_equal([Spot.new('A', '123'), Spot.new('B')], p.spots)
+    assert_equal([Spot.new('x', '1'), Spot.new('y')], Oj.load_shape(' [{"city":"x","zip":1},{"city":"y"}]', Spot))
+    assert_raises(ArgumentError) { Oj.load_shape('{"age":"x"}', Person) }
+    assert_raises(ArgumentError) { Oj.load_shape('{}', String) }
+    assert_raises(ArgumentError) { Oj.register_shape(Spot, [:street]) }
+  end
+
 =begin
 # TBD move to custom
   def test_float_dump
@@ -372,6 +813,29 @@ class Juice < Minitest::Test
     out = Oj.dump(x)
     assert_equal(json, out)
   end
+  def test_escape_long_clean_runs
+    clean = 'abcdefghijklmnopqrstuvwxyz0123456789' * 3
+    str = "#{clean}\"#{clean}\\#{clean}\t<é>/\x7f#{clean}"
+    assert_equal(%{"#{clean}\\"#{clean}\\\\#{clean}\\t<é>/\x7f#{clean}"}, Oj.dump(str, mode: :strict, escape_mode: :json))
+    assert_equal(%{"#{clean}\\"#{clean}\\\\#{clean}\\t<\\u00e9>/\\u007f#{clean}"}, Oj.dump(str, mode: :strict, escape_mode: :ascii))
+    assert_equal(%{"#{clean}\\"#{clean}\\\\#{clean}\\t\\u003c\\u00e9\\u003e\\/\\u007f#{clean}"}, Oj.dump(str, mode: :strict, escape_mode: :xss_safe))
+  end
+  def test_dump_repeated_keys
+    dyn = "dyn_#{rand(1000)}".to_sym
+    row = { id: 1, dyn => 2, 'a"b' => 3, 'str' => 4, 'é'.encode('ISO-8859-1') => 5 }
+    json = %{{"id":1,"#{dyn}":2,"a\\"b":3,"str":4,"é":5}}
+    assert_equal("[#{json},#{json},#{json}]", Oj.dump([row, row.dup, row.dup], mode: :compat))
+    assert_equal(%{[{"id":1},{"id":2}]}, Oj.dump([{id: 1}, {'id' => 2}], mode: :strict))
+  end
+  def test_dump_compact_containers
+    obj = { 'a' => [1, [], {}, nil, [2, { 'b' => nil }]], 'c' => nil, 'd' => {} }
+    json = %{{"a":[1,[],{},null,[2,{"b":null}]],"c":null,"d":{}}}
+    [:strict, :null, :compat].each { |mode|
+      assert_equal(json, Oj.dump(obj, mode: mode))
+      assert_equal(%{{"a":[1,[],{},null,[2,{}]],"d":{}}}, Oj.dump(obj, mode: mode, omit_nil: true))
+      assert_equal(%{{\n  "a":[\n    1,\n    [],\n    {},\n    null,\n    [\n      2,\n      {\n        "b":null\n      }\n    ]\n  ],\n  "c":null,\n  "d":{}\n}\n}, Oj.dump(obj, mode: mode, indent: 2))
+    }
+  end
   def test_dump_invalid_utf8
     Oj.default_options = { :escape_mode => :ascii }
     assert_raises(EncodingError) {
@@ -409,6 +873,12 @@ class Juice < Minitest::Test
     }
   end
 
+  def test_time_across_days
+    t = Time.utc(1969, 12, 31, 23, 59, 59, 500000)
+    json = Oj.dump([t, t + 1, (t + 3601).getlocal('-05:30'), t - 86400 * 366], mode: :custom, time_format: :xmlschema, second_precision: 6)
+    assert_equal(%{["1969-12-31T23:59:59.500000Z","1970-01-01T00:00:00.500000Z","1969-12-31T19:30:00.500000-05:30","1968-12-30T23:59:59.500000Z"]}, json)
+  end
+
   # Class
   def test_class_null
     json = Oj.dump(Juice, :mode => :null)
@@ -526,6 +996,17 @@ class Juice < Minitest::Test
     assert_equal(58, obj.y)
   end
 
+  def test_dump_string_buffer
+    obj = (0...2000).map { |i| { 'id' => i, 'name' => "name #{i}", 'tags' => ['a', 'b'] } }
+    json = Oj.dump(obj, mode: :compat)
+    assert_equal(json, Oj.dump(obj, mode: :compat, string_buffer: true))
+    assert_equal(Encoding::UTF_8, Oj.dump(obj, mode: :compat, string_buffer: true).encoding)
+    # A dump that raises must release the reused buffer.
+    assert_raises(TypeError) { Oj.dump([obj, Object.new], mode: :strict) }
+    assert_equal(json, Oj.dump(obj, mode: :compat))
+    assert_equal('[1]', Oj.dump([1], mode: :compat, string_buffer: true))
+  end
+
 # Stream Deeply Nested
   def test_deep_nest_dump
     begin
@@ -550,6 +1031,30 @@ class Juice < Minitest::Test
     assert_equal(src, obj)
   end
 
+  class WriteRecorder
+    attr_reader :writes
+    def initialize
+      @writes = []
+    end
+    def write(s)
+      @writes << s
+      s.size
+    end
+  end
+
+  def test_io_stream_flushes
+    src = (1..20000).map { |i| { 'id' => i, 'list' => [i, 'x' * (i % 10)], 'h' => {} } }
+    out = WriteRecorder.new
+    Oj.to_stream(out, src, :mode => :compat, :indent => 1)
+    assert(1 < out.writes.size)
+    assert(out.writes.all? { |s| s.size <= 64 * 1024 })
+    assert_equal(Oj.dump(src, :mode => :compat, :indent => 1), out.writes.join)
+
+    filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
+    Oj.to_file(filename, src, :mode => :compat)
+    assert_equal(Oj.dump(src, :mode => :compat), File.read(filename))
+  end
+
   def test_io_file
     src = { 'x' => true, 'y' => 58, 'z' => [1, 2, 3]}
     filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
@@ -228,6 +228,19 @@ class WabJuice < Minitest::Test
     dump_and_load(u, false)
   end
 
+  def test_uri_load
+    ['http://opo.technology/sample', 'HTTP://u:p@Opo.technology:8080/a%20b;c?x=1&y=[2]#f', 'http://a.com:/', 'http:///x',
+     'http://[::1]/x', 'http://a.com?q=1 2', 'http://a.com?%4z'].each do |s|
+      uri = Oj.wab_load(Oj.dump([s], mode: :strict))[0]
+      assert_equal(URI::HTTP, uri.class, s)
+      assert_equal(URI.parse(s), uri, s)
+      assert_equal(URI.parse(s).to_s, uri.to_s, s)
+    end
+    ['http://a b', "http://a.com/\u00e9", 'http://a@b@c', 'http://a.com/%zz', 'http://a.com?%zz', 'http://a.com:8x/', 'http://a.com#x#y', 'https://a.com', 'http://'].each do |s|
+      assert_equal([s], Oj.wab_load(Oj.dump([s], mode: :strict)), s)
+    end
+  end
+
   def test_class
     assert_raises() { Oj.dump(WabJuice, mode: :wab) }
   end
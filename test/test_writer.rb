@@ -4,6 +4,7 @@
 $: << File.dirname(__FILE__)
 
 require 'helper'
+require 'zlib'
 
 class OjWriter < Minitest::Test
 
@@ -293,6 +294,126 @@ class OjWriter < Minitest::Test
     assert_equal(%|{"a1":{},"a2":{"b":[7,true,"string"]},"a3":{}}\n|, content)
   end
 
+  def test_string_writer_push_rows
+    w = Oj::StringWriter.new(:indent => 0, :mode => :compat)
+    w.push_array()
+    w.push_rows(['id', :name], [[1, 'one'], [2, nil]])
+    w.push_values([3, [4]])
+    w.pop()
+    assert_equal(%|[{"id":1,"name":"one"},{"id":2,"name":null},3,[4]]\n|, w.to_s)
+
+    w = Oj::StringWriter.new(:indent => 2, :mode => :compat, :omit_nil => true)
+    w.push_array()
+    w.push_rows(['id', 'name'], [[1, nil]])
+    w.pop()
+    assert_equal(%|[\n  {\n    "id":1\n  }\n]\n|, w.to_s)
+
+    assert_raises(ArgumentError) { w.push_rows(['id'], [[1, 2]]) }
+    w = Oj::StringWriter.new(:indent => 0)
+    w.push_object()
+    assert_raises(StandardError) { w.push_values([1]) }
+  end
+
+  def test_stream_writer_push_rows
+    output = StringIO.open("", "w+")
+    w = Oj::StreamWriter.new(output, :indent => 0, :buffer_size => 20)
+    w.push_array()
+    w.push_rows(['a', 'b'], (1..100).map { |i| [i, i.to_s] })
+    w.pop_all()
+    content = Oj.load(output.string)
+    assert_equal(100, content.size)
+    assert_equal({'a' => 100, 'b' => '100'}, content[-1])
+  end
+
+  def test_stream_writer_async_file
+    filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
+    File.open(filename, "w") do |f|
+      w = Oj::StreamWriter.new(f, :indent => 0, :buffer_size => 64, :async => true)
+      w.push_array()
+      1000.times { |i| w.push_value({'i' => i}) }
+      w.pop_all()
+    end
+    content = Oj.load(File.read(filename))
+    assert_equal(1000, content.size)
+    assert_equal({'i' => 999}, content[-1])
+  end
+
+  def test_stream_writer_async_pipe
+    r, wio = IO.pipe
+    reader = Thread.new { r.read }
+    w = Oj::StreamWriter.new(wio, :indent => 0, :buffer_size => 1024, :async => true)
+    w.push_array()
+    20000.times { |i| w.push_value([i, 'x' * (i % 20)]) }
+    w.pop_all()
+    wio.close
+    content = Oj.load(reader.value)
+    r.close
+    assert_equal(20000, content.size)
+    assert_equal([19999, 'x' * 19], content[-1])
+  end
+
+  def async_writer_blocked(wio)
+    w = Oj::StreamWriter.new(wio, :indent => 0, :buffer_size => 1024, :async => true)
+    w.push_array()
+    # More than a pipe holds so the writer thread blocks until it is read.
+    w.push_value('x' * 200_000)
+    nil
+  end
+
+  def test_stream_writer_async_dropped
+    r, wio = IO.pipe
+    4.times { async_writer_blocked(wio) }
+    # Freeing a writer must not wait on its thread.
+    gc = Thread.new { 3.times { GC.start } }
+    assert(gc.join(10), 'GC blocked on an async writer')
+    # The writer threads finish their writes once the pipe is read.
+    reader = Thread.new { r.read(200_000) }
+    assert(reader.join(10), 'async writer did not write')
+    assert_equal(200_000, reader.value.size)
+    wio.close
+    r.close
+  end
+
+  def test_stream_writer_async_closed_io
+    r, wio = IO.pipe
+    async_writer_blocked(wio)
+    gc = Thread.new { 3.times { GC.start } }
+    assert(gc.join(10), 'GC blocked on an async writer')
+    # The writer thread keeps writing to the pipe after the IO is closed and
+    # not to whatever reuses its fd.
+    wio.close
+    r2, w2 = IO.pipe
+    reader = Thread.new { r.read(200_000) }
+    assert(reader.join(10), 'async writer did not write')
+    assert_equal(200_000, reader.value.size)
+    w2.close
+    assert_equal('', r2.read)
+    r.close
+    r2.close
+  end
+
+  def test_stream_writer_gzip
+    filename = File.join(File.dirname(__FILE__), 'open_file_test.json.gz')
+    [false, true].each do |async|
+      File.open(filename, "w") do |f|
+        w = Oj::StreamWriter.new(f, :indent => 0, :buffer_size => 64, :async => async, :compression => :gzip)
+        w.push_array()
+        500.times { |i| w.push_value({'i' => i}) }
+        w.flush()
+        500.times { |i| w.push_value({'i' => i + 500}) }
+        w.pop_all()
+      end
+      content = Oj.load(Zlib::GzipReader.open(filename) { |z| z.read })
+      assert_equal(1000, content.size)
+      assert_equal({'i' => 999}, content[-1])
+    end
+    output = StringIO.new(String.new(encoding: Encoding::BINARY))
+    w = Oj::StreamWriter.new(output, :indent => 0, :compression => :gzip)
+    w.push_value([1, 2])
+    w.flush()
+    assert_equal([1, 2], Oj.load(Zlib.gunzip(output.string), mode: :strict))
+  end
+
   def test_stream_writer_nested_key_object
     output = StringIO.open("", "w+")
     w = Oj::StreamWriter.new(output, :indent => 0)
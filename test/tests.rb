@@ -15,6 +15,7 @@ require 'test_gc'
 require 'test_hash'
 require 'test_null'
 require 'test_object'
+require 'test_parser'
 require 'test_saj'
 require 'test_scp'
 require 'test_strict'